@@ -18,10 +18,19 @@
 #include <getopt.h>
 #include <wchar.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "xine-server-api.h" 
+#include "xine-server-ext.h" 
 
 /*==========================================================================
 
@@ -32,8 +41,37 @@ struct _XSPlaylist
   {
   int nentries;
   char **entries;
+  long long version;
+  char *text; // Response that entries may point into, or NULL
+  size_t text_size;
   };
 
+struct _XSClient
+  {
+  char *host;
+  int port;
+  int connect_msec;
+  int read_msec;
+  pthread_mutex_t mutex; // Protects everything below, and the timeouts
+  struct addrinfo *addrs; // NULL until looked up
+  int last_good; // Index in addrs of the last address that connected
+  int idle[XSCLIENT_MAX_IDLE];
+  int nidle;
+  BOOL no_keep_alive; // Server does not support keep-alive
+  BOOL single_use; // Set by xsclient_set_keep_alive(): don't reuse
+  char *token; // Sent with 'auth' on each new connection, if not NULL
+  };
+
+struct _XSShm
+  {
+  const XSShmHeader *header;
+  size_t size;
+  };
+
+// How many times a reader of shared memory retries while the server
+//  is writing, before concluding that the server died while doing so
+#define XSSHM_MAX_TRIES 1000000
+
 struct _XSStatus
   {
   char *stream;
@@ -42,6 +80,8 @@ struct _XSStatus
   int playlist_index;
   int playlist_length;
   XSTransportStatus transport_status;
+  BOOL shuffle;
+  XSRepeatMode repeat;
   };
 
 struct _XSMetaInfo
@@ -73,6 +113,11 @@ struct _XSMetaInfo
   well as certain types of comments, but these are not used in the
   protocol at present.
 
+  The tokens are made in place, in a single pass over s, and the array
+  points into s; so s must outlive the tokens, and only the array is
+  freed afterwards. A response of tens of thousands of playlist
+  entries is parsed with a handful of allocations.
+
 ==========================================================================*/
 // Dunno state -- usually start of line where nothing has been read
 #define STATE_DUNNO 0
@@ -97,26 +142,34 @@ struct _XSMetaInfo
 // Hash comment
 #define CHAR_HASH 4
 
-// Helper to maintain a variable-length string. This really ought to
-//  be optimized to allocate memory in blocks.
-static char *buff_append (char *buff, char c)
-  {
-  int l = strlen (buff);
-  char *buff2 = realloc (buff, l + 2);
-  buff2[l] = c;
-  buff2[l+1] = 0;
-  return buff2;
-  }
-
-static void xineserver_tokenize_response (const char *s, 
+// Finish the token being written at s[w], if it is not empty, and start
+//  the next one after it. The nul never overwrites a character that has
+//  not been read yet, because each character read writes at most one
+#define END_TOKEN \
+  if (w > start) \
+    { \
+    if (ntokens == size) \
+      { \
+      size *= 2; \
+      tokens = realloc (tokens, size * sizeof (char *)); \
+      } \
+    s[w] = 0; \
+    tokens[ntokens++] = s + start; \
+    w++; \
+    } \
+  start = w;
+
+static void xineserver_tokenize_response (char *s, 
          int *_ntokens, char ***_tokens)
   {
   int ntokens = 0;
-  char **tokens = malloc (ntokens * sizeof (char *)); 
+  int size = 16;
+  char **tokens = malloc (size * sizeof (char *)); 
   int i, l = strlen (s);
 
-  char *buff = malloc (1);
-  buff[0] = 0; 
+  // Tokens are written back into s, from the start: w is where the 
+  //  next character goes, and start where the current token started
+  int w = 0, start = 0;
 
   int state = STATE_DUNNO;
   int last_state = STATE_DUNNO;
@@ -154,7 +207,7 @@ static void xineserver_tokenize_response (const char *s,
       {
       // --- Dunno states ---
       case 1000 * STATE_DUNNO + CHAR_GENERAL:
-        buff = buff_append (buff, c);
+        s[w++] = c;
         state = STATE_GENERAL;
         break;
 
@@ -181,7 +234,7 @@ static void xineserver_tokenize_response (const char *s,
       // --- White states ---
       case 1000 * STATE_WHITE + CHAR_GENERAL:
         // Got a char while in ws
-        buff = buff_append (buff, c); 
+        s[w++] = c;
         state = STATE_GENERAL;
         break;
 
@@ -207,19 +260,12 @@ static void xineserver_tokenize_response (const char *s,
       // --- General states ---
       case 1000 * STATE_GENERAL + CHAR_GENERAL:
         // Eat normal char 
-        buff = buff_append (buff, c);
+        s[w++] = c;
         break;
 
       case 1000 * STATE_GENERAL + CHAR_WHITE:
         //Hit ws while eating characters -- this is a token
-        if (strlen (buff) > 0)
-          {
-          tokens = realloc (tokens, (ntokens + 1) * sizeof (char *));     
-          tokens[ntokens] = buff;
-          ntokens++;
-          }
-        buff = malloc (1);
-        buff[0] = 0;
+        END_TOKEN
         state = STATE_WHITE;
         break;
 
@@ -235,38 +281,24 @@ static void xineserver_tokenize_response (const char *s,
 
       case 1000 * STATE_GENERAL + CHAR_HASH:
         //Hit hash while eating characters -- this is a token
-        if (strlen (buff) > 0)
-          {
-          tokens = realloc (tokens, (ntokens + 1) * sizeof (char *));     
-          tokens[ntokens] = buff;
-          ntokens++;
-          }
-        buff = malloc (1);
-        buff[0] = 0;
+        END_TOKEN
         state = STATE_COMMENT;
         break;
 
       // --- Dquote states ---
       case 1000 * STATE_DQUOTE + CHAR_GENERAL:
         // Store the char, but remain in dquote mode
-        buff = buff_append (buff, c);
+        s[w++] = c;
         break;
 
       case 1000 * STATE_DQUOTE + CHAR_WHITE:
         // Store the ws, and remain in dquote mode
-        buff = buff_append (buff, c);
+        s[w++] = c;
         break;
 
       case 1000 * STATE_DQUOTE + CHAR_DQUOTE:
         // Leave dquote mode and store token (which might be empty) 
-        if (strlen (buff) > 0)
-          {
-          tokens = realloc (tokens, (ntokens + 1) * sizeof (char *));     
-          tokens[ntokens] = buff;
-          ntokens++;
-          }
-        buff = malloc (1);
-        buff[0] = 0;
+        END_TOKEN
         state = STATE_DUNNO;
         break;
 
@@ -278,32 +310,32 @@ static void xineserver_tokenize_response (const char *s,
 
       case 1000 * STATE_DQUOTE + CHAR_HASH:
         // Keep this hash char -- it is quoted 
-        buff = buff_append (buff, c);
+        s[w++] = c;
         break;
 
       // --- Esc states ---
       case 1000 * STATE_ESC + CHAR_GENERAL:
-        buff = buff_append (buff, c);
+        s[w++] = c;
         state = last_state; 
         break;
 
       case 1000 * STATE_ESC + CHAR_WHITE:
-        buff = buff_append (buff, c);
+        s[w++] = c;
         state = last_state; 
         break;
 
       case 1000 * STATE_ESC + CHAR_DQUOTE:
-        buff = buff_append (buff, '"');
+        s[w++] = '"';
         state = last_state; 
         break;
 
       case 1000 * STATE_ESC + CHAR_ESC:
-        buff = buff_append (buff, '\\');
+        s[w++] = '\\';
         state = last_state; 
         break;
 
       case 1000 * STATE_ESC + CHAR_HASH:
-        buff = buff_append (buff, '#');
+        s[w++] = '#';
         state = last_state; 
         break;
 
@@ -330,106 +362,601 @@ static void xineserver_tokenize_response (const char *s,
       }
     }
 
-  if (strlen (buff) > 0)
+  END_TOKEN
+
+  *_ntokens = ntokens;
+  *_tokens = tokens;
+  }
+
+
+
+/*==========================================================================
+
+  xsclient_create
+
+==========================================================================*/
+XSClient *xsclient_create (const char *host, int port)
+  {
+  XSClient *self = malloc (sizeof (XSClient));
+  memset (self, 0, sizeof (XSClient));
+  self->host = strdup (host);
+  self->port = port;
+  self->connect_msec = XSCLIENT_DEF_CONNECT_MSEC;
+  self->read_msec = XSCLIENT_DEF_READ_MSEC;
+  const char *token = getenv (XSCLIENT_TOKEN_ENV);
+  if (token && token[0]) self->token = strdup (token);
+  pthread_mutex_init (&self->mutex, NULL);
+  return self;
+  }
+
+
+/*==========================================================================
+
+  xsclient_destroy
+
+==========================================================================*/
+void xsclient_destroy (XSClient *self)
+  {
+  if (self)
     {
-    tokens = realloc (tokens, (ntokens + 1) * sizeof (char *));     
-    tokens[ntokens] = buff;
-    ntokens++;
+    for (int i = 0; i < self->nidle; i++)
+      close (self->idle[i]);
+    if (self->addrs) freeaddrinfo (self->addrs);
+    pthread_mutex_destroy (&self->mutex);
+    if (self->token) free (self->token);
+    free (self->host);
+    free (self);
     }
-  else
+  }
+
+
+/*==========================================================================
+
+  xsclient_set_timeouts
+
+==========================================================================*/
+void xsclient_set_timeouts (XSClient *self, int connect_msec, int read_msec)
+  {
+  pthread_mutex_lock (&self->mutex);
+  self->connect_msec = connect_msec > 0 ? connect_msec : 0;
+  self->read_msec = read_msec > 0 ? read_msec : 0;
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  xsclient_set_token
+
+==========================================================================*/
+void xsclient_set_token (XSClient *self, const char *token)
+  {
+  pthread_mutex_lock (&self->mutex);
+  if (self->token) free (self->token);
+  self->token = token && token[0] ? strdup (token) : NULL;
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  xsclient_set_keep_alive
+
+==========================================================================*/
+void xsclient_set_keep_alive (XSClient *self, BOOL keep_alive)
+  {
+  pthread_mutex_lock (&self->mutex);
+  self->single_use = !keep_alive;
+  if (self->single_use)
     {
-    if (buff) free (buff); 
+    for (int i = 0; i < self->nidle; i++)
+      close (self->idle[i]);
+    self->nidle = 0;
     }
+  pthread_mutex_unlock (&self->mutex);
+  }
 
-  *_ntokens = ntokens;
-  *_tokens = tokens;
+
+/*==========================================================================
+
+  xsclient_connect_addr
+
+  Connect to one address, giving up after msec (if not zero)
+
+==========================================================================*/
+static int xsclient_connect_addr (const struct addrinfo *ai, int msec)
+  {
+  int sock = socket (ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, 
+    ai->ai_protocol);
+  if (sock < 0) return -1;
+  int flags = fcntl (sock, F_GETFL);
+  fcntl (sock, F_SETFL, flags | O_NONBLOCK);
+  int ret = connect (sock, ai->ai_addr, ai->ai_addrlen);
+  if (ret != 0 && errno == EINPROGRESS)
+    {
+    struct pollfd pfd = { sock, POLLOUT, 0 };
+    int n;
+    do
+      n = poll (&pfd, 1, msec > 0 ? msec : -1);
+    while (n < 0 && errno == EINTR);
+    if (n == 0)
+      errno = ETIMEDOUT;
+    else if (n > 0)
+      {
+      int err = 0;
+      socklen_t len = sizeof (err);
+      getsockopt (sock, SOL_SOCKET, SO_ERROR, &err, &len);
+      errno = err;
+      if (err == 0) ret = 0;
+      }
+    }
+  if (ret != 0)
+    {
+    int e = errno;
+    close (sock);
+    errno = e;
+    return -1;
+    }
+  fcntl (sock, F_SETFL, flags);
+  int nodelay = 1;
+  setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof (nodelay));
+  return sock;
   }
 
 
+/*==========================================================================
+
+  xsclient_connect_unix
+
+  Connect to a server's Unix socket, whose path is given as the host
+
+==========================================================================*/
+static int xsclient_connect_unix (XSClient *self, char **error)
+  {
+  struct sockaddr_un addr;
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  snprintf (addr.sun_path, sizeof (addr.sun_path), "%s", self->host);
+  int sock = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock >= 0 && connect (sock, (struct sockaddr *)&addr, sizeof (addr)))
+    {
+    int e = errno;
+    close (sock);
+    errno = e;
+    sock = -1;
+    }
+  if (sock < 0)
+    asprintf (error, "Can't connect to xine-server at %s: %s", 
+      self->host, strerror (errno));
+  return sock;
+  }
+
 
 /*==========================================================================
 
-  xineserver_send_and_receive
+  xsclient_connect
+
+  Open a new connection, looking up the host if it has not been looked
+  up already, or if none of the addresses it had worked last time. The
+  address that worked is tried first next time -- a name like
+  'localhost' often has an IPv6 address that the server is not 
+  listening on
 
 ==========================================================================*/
-BOOL xineserver_send_and_receive (const char *host, 
-       int port, const char *command, char **response, char **error)
+static int xsclient_connect (XSClient *self, char **error)
   {
-  BOOL ret = FALSE;
+  int sock = -1;
+  if (self->host[0] == '/')
+    return xsclient_connect_unix (self, error);
+  pthread_mutex_lock (&self->mutex);
+  int msec = self->connect_msec;
+  if (!self->addrs)
+    {
+    struct addrinfo hints;
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char service[16];
+    snprintf (service, sizeof (service), "%d", self->port);
+    int gai = getaddrinfo (self->host, service, &hints, &self->addrs);
+    if (gai != 0)
+      {
+      self->addrs = NULL;
+      pthread_mutex_unlock (&self->mutex);
+      asprintf (error, "Can't resolve hostname: %s", gai_strerror (gai));
+      return -1;
+      }
+    self->last_good = 0;
+    }
+  // Take a copy of the addresses, so that the lock is not held while
+  //  connecting
+  int naddrs = 0;
+  for (struct addrinfo *ai = self->addrs; ai; ai = ai->ai_next)
+    naddrs++;
+  struct addrinfo addrs[naddrs];
+  struct sockaddr_storage storage[naddrs];
+  int n = 0;
+  for (struct addrinfo *ai = self->addrs; ai; ai = ai->ai_next, n++)
+    {
+    int i = (n - self->last_good + naddrs) % naddrs;
+    addrs[i] = *ai;
+    memcpy (&storage[i], ai->ai_addr, ai->ai_addrlen);
+    addrs[i].ai_addr = (struct sockaddr *)&storage[i];
+    addrs[i].ai_next = NULL;
+    }
+  int first = self->last_good;
+  pthread_mutex_unlock (&self->mutex);
+
+  int e = 0;
+  for (int i = 0; i < naddrs && sock < 0; i++)
+    {
+    sock = xsclient_connect_addr (&addrs[i], msec);
+    if (sock >= 0)
+      {
+      pthread_mutex_lock (&self->mutex);
+      if (self->last_good == first) 
+        self->last_good = (first + i) % naddrs;
+      pthread_mutex_unlock (&self->mutex);
+      }
+    else if (e == 0 || errno != ECONNREFUSED)
+      e = errno;
+    }
+  if (sock < 0)
+    {
+    pthread_mutex_lock (&self->mutex);
+    if (self->addrs) freeaddrinfo (self->addrs);
+    self->addrs = NULL;
+    pthread_mutex_unlock (&self->mutex);
+    asprintf (error, "Can't connect to xine-server at %s:%d: %s", 
+      self->host, self->port, strerror (e));
+    }
+  return sock;
+  }
+
+
+/*==========================================================================
+
+  xsclient_send_line
+
+==========================================================================*/
+static BOOL xsclient_send_line (int sock, const char *line)
+  {
+  size_t len = strlen (line);
+  while (len > 0)
+    {
+    ssize_t n = send (sock, line, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FALSE;
+    line += n;
+    len -= n;
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  xsclient_receive_line
 
-  int sock = socket (AF_INET, SOCK_STREAM, 0);  
+  Read a response, up to the newline, which is not stored. Sets 'len' 
+  to the number of bytes read, including the newline, even on failure.
+  If the connection closes first, errno is set to zero.
+  The response is only ever one line, so there should be nothing after
+  the newline; if there is, 'extra' is set, and the connection should
+  not be used again
 
-  if (sock >= 0)
+==========================================================================*/
+static BOOL xsclient_receive_line (int sock, int msec, char **line, 
+       int *len, BOOL *extra)
+  {
+  BOOL got_line = FALSE;
+  int size = 256;
+  char *buff = malloc (size);
+  *len = 0;
+  *extra = FALSE;
+  while (!got_line)
     {
-    struct hostent *hostent = gethostbyname (host);
-    if (hostent)
+    if (msec > 0)
       {
-      struct sockaddr_in sin;
-      memcpy (&sin.sin_addr.s_addr, hostent->h_addr, hostent->h_length);
-      sin.sin_family = AF_INET;
-      sin.sin_port = htons (port);
-      if (connect (sock, (struct sockaddr *)&sin, sizeof (sin)) == 0)
-        {
-        static char *buff = "\r\n";
-        send (sock, command, strlen (command), 0);
-        send (sock, buff, 2, 0);
-        int n;
-        BOOL got_line = FALSE;
-        char *rbuff = malloc (1);
-        rbuff[0] = 0;
-        int i = 0;
-        do
-          {
-          char buf[1];
-          n = read (sock, &buf, 1);
-          if (buf[0] == '\n')
-            got_line = TRUE;
-          else
-            {
-            rbuff = realloc (rbuff, i + 2);
-            rbuff[i] = buf[0];
-            rbuff[i + 1] = 0;
-            //printf ("got %c\n", buf[0]); 
-            }
-          i++;
-          } while (n > 0 && !got_line); 
-
-        *response = strdup (rbuff);
-        free (rbuff);
-        ret = TRUE;
-        }
+      struct pollfd pfd = { sock, POLLIN, 0 };
+      int n = poll (&pfd, 1, msec);
+      if (n < 0 && errno == EINTR) continue;
+      if (n == 0) errno = ETIMEDOUT;
+      if (n <= 0) break;
+      }
+    if (size - *len < 256)
+      {
+      size *= 2;
+      buff = realloc (buff, size);
+      }
+    ssize_t n = recv (sock, buff + *len, size - *len - 1, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n == 0) errno = 0;
+    if (n <= 0) break;
+    char *nl = memchr (buff + *len, '\n', n);
+    *len += n;
+    if (nl)
+      {
+      got_line = TRUE;
+      *extra = (nl - buff) + 1 < *len;
+      *nl = 0;
+      }
+    }
+  if (!got_line) buff[*len] = 0;
+  *line = buff;
+  return got_line;
+  }
+
+
+/*==========================================================================
+
+  xsclient_get_idle
+
+  Take an idle connection from the pool, discarding any that the server
+  has closed in the meantime. Returns -1 if there are none
+
+==========================================================================*/
+static int xsclient_get_idle (XSClient *self)
+  {
+  int sock = -1;
+  pthread_mutex_lock (&self->mutex);
+  while (sock < 0 && self->nidle > 0)
+    {
+    sock = self->idle[--self->nidle];
+    char c;
+    ssize_t n = recv (sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      {
+      close (sock);
+      sock = -1;
+      }
+    }
+  pthread_mutex_unlock (&self->mutex);
+  return sock;
+  }
+
+
+/*==========================================================================
+
+  xsclient_put_idle
+
+==========================================================================*/
+static void xsclient_put_idle (XSClient *self, int sock)
+  {
+  pthread_mutex_lock (&self->mutex);
+  if (self->nidle < XSCLIENT_MAX_IDLE)
+    {
+    self->idle[self->nidle++] = sock;
+    sock = -1;
+    }
+  pthread_mutex_unlock (&self->mutex);
+  if (sock >= 0) close (sock);
+  }
+
+
+/*==========================================================================
+
+  xsclient_open
+
+  Open a new connection, and ask the server to keep it open after 
+  responding. A server too old to do that says that the command is
+  not known, and closes the connection; after that, each request gets
+  a connection of its own. Sets keep_alive if the connection can be
+  reused. Then, if there is a token, authenticate. A client that does 
+  not reuse connections need not ask, unless it has to authenticate, 
+  because the server closes a connection after its first command 
+  otherwise
+
+==========================================================================*/
+static int xsclient_open (XSClient *self, BOOL *keep_alive, char **error)
+  {
+  *keep_alive = FALSE;
+  pthread_mutex_lock (&self->mutex);
+  int msec = self->read_msec;
+  char *token = self->token ? strdup (self->token) : NULL;
+  BOOL no_keep_alive = self->no_keep_alive || (self->single_use && !token);
+  pthread_mutex_unlock (&self->mutex);
+  
+  int sock = xsclient_connect (self, error);
+  if (sock >= 0 && !no_keep_alive)
+    {
+    char *response = NULL;
+    int len = 0;
+    BOOL extra;
+    if (xsclient_send_line (sock, XINESERVER_CMD_KEEPALIVE "\r\n")
+        && xsclient_receive_line (sock, msec, &response, &len, &extra))
+      {
+      int code = -1;
+      sscanf (response, "%d", &code);
+      if (code == 0 && !extra)
+        *keep_alive = TRUE;
       else
         {
-        asprintf (error, "Can't connect to xine-server at %s:%d: %s", 
-	  host, port, strerror (errno));
-        ret = FALSE;
+        pthread_mutex_lock (&self->mutex);
+        self->no_keep_alive = TRUE;
+        pthread_mutex_unlock (&self->mutex);
         }
+      free (response);
       }
     else
       {
-      ret = FALSE;
-      asprintf (error, "Can't resolve hostname: %s", hstrerror (h_errno));
+      if (response) free (response);
+      asprintf (error, "Can't communicate with xine-server at %s:%d: %s", 
+        self->host, self->port, len > 0 ? "bad response" : strerror (errno));
+      close (sock);
+      if (token) free (token);
+      return -1;
+      }
+    // A server that did not know the command has closed the connection
+    if (!*keep_alive)
+      {
+      close (sock);
+      sock = xsclient_connect (self, error);
       }
-    close (sock);
     }
-  else
-   {
-   ret = FALSE;
-   asprintf (error, "Can't open socket");
-   }
 
+  // Authentication lasts as long as the connection, so it is only worth
+  //  doing on one that is kept open; a server too old for keep-alive
+  //  does not know 'auth' either
+  if (sock >= 0 && *keep_alive && token)
+    {
+    char *line;
+    char *response = NULL;
+    int len = 0;
+    BOOL extra;
+    int code = -1;
+    asprintf (&line, "%s %s\r\n", XINESERVER_CMD_AUTH, token);
+    BOOL ok = xsclient_send_line (sock, line)
+      && xsclient_receive_line (sock, msec, &response, &len, &extra);
+    free (line);
+    if (ok) sscanf (response, "%d", &code);
+    if (code != 0)
+      {
+      if (ok)
+        asprintf (error, "xine-server at %s:%d did not accept the token: %s",
+          self->host, self->port, response);
+      else
+        asprintf (error, "Can't communicate with xine-server at %s:%d: %s", 
+          self->host, self->port, 
+          len > 0 ? "bad response" : strerror (errno));
+      close (sock);
+      sock = -1;
+      }
+    if (response) free (response);
+    }
+  if (token) free (token);
+  return sock;
+  }
+
+
+/*==========================================================================
+
+  xsclient_send_and_receive
+
+  A pooled connection might have been closed by the server just after it
+  was checked. Then sending fails, or the connection is closed or reset 
+  before any of the response arrives, and the request is sent again on 
+  a new connection. Commands are not sent twice in any other case, 
+  because they might not be safe to repeat. In particular, a request
+  that times out might still be running
+
+==========================================================================*/
+BOOL xsclient_send_and_receive (XSClient *self, const char *command, 
+       char **response, char **error)
+  {
+  BOOL ret = FALSE;
+  char *line;
+  asprintf (&line, "%s\r\n", command);
+  pthread_mutex_lock (&self->mutex);
+  int msec = self->read_msec;
+  BOOL single_use = self->single_use;
+  pthread_mutex_unlock (&self->mutex);
+
+  BOOL done = FALSE;
+  while (!done)
+    {
+    BOOL keep_alive = TRUE;
+    int sock = xsclient_get_idle (self);
+    BOOL pooled = sock >= 0;
+    if (!pooled)
+      sock = xsclient_open (self, &keep_alive, error);
+    if (sock < 0) break;
+
+    int len = 0;
+    BOOL extra = FALSE;
+    char *rbuff = NULL;
+    BOOL sent = xsclient_send_line (sock, line);
+    if (sent)
+      ret = xsclient_receive_line (sock, msec, &rbuff, &len, &extra);
+    int e = errno;
+    if (ret)
+      {
+      *response = rbuff;
+      if (keep_alive && !extra && !single_use)
+        xsclient_put_idle (self, sock);
+      else
+        close (sock);
+      done = TRUE;
+      }
+    else
+      {
+      close (sock);
+      BOOL stale = pooled && (!sent 
+        || (len == 0 && (e == 0 || e == ECONNRESET)));
+      if (!stale)
+        {
+        // The server always ends its response with a newline but, as 
+        //  it always has, take what arrived before the connection 
+        //  closed as the response
+        if (len > 0 && e != ETIMEDOUT)
+          {
+          *response = rbuff;
+          rbuff = NULL;
+          ret = TRUE;
+          }
+        else
+          asprintf (error, "Can't communicate with xine-server at %s:%d: %s",
+            self->host, self->port, 
+            e == 0 ? "connection closed" : strerror (e));
+        done = TRUE;
+        }
+      if (rbuff) free (rbuff);
+      }
+    }
+  free (line);
   return ret;
   }
 
 
+/*==========================================================================
+
+  xineserver_get_client
+
+==========================================================================*/
+XSClient *xineserver_get_client (const char *host, int port)
+  {
+  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  static XSClient **clients = NULL;
+  static int nclients = 0;
+  XSClient *ret = NULL;
+  pthread_mutex_lock (&mutex);
+  for (int i = 0; i < nclients && !ret; i++)
+    {
+    if (clients[i]->port == port && strcmp (clients[i]->host, host) == 0)
+      ret = clients[i];
+    }
+  if (!ret)
+    {
+    ret = xsclient_create (host, port);
+    clients = realloc (clients, (nclients + 1) * sizeof (XSClient *));
+    clients[nclients++] = ret;
+    }
+  pthread_mutex_unlock (&mutex);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  xineserver_send_and_receive
+
+==========================================================================*/
+BOOL xineserver_send_and_receive (const char *host, 
+       int port, const char *command, char **response, char **error)
+  {
+  return xsclient_send_and_receive (xineserver_get_client (host, port), 
+    command, response, error);
+  }
+
+
 /*==========================================================================
 
   xineserver_get_text_response
 
 ==========================================================================*/
-static const char *xineserver_get_text_response (const char *response)
+static char *xineserver_get_text_response (char *response)
   {
-  const char *ret;
+  char *ret;
   char *sp = strchr (response, ' ');
   if (sp)
     ret = sp + 1;
@@ -516,7 +1043,8 @@ BOOL xineserver_status (const char *host, int port, XSStatus **status,
       xineserver_tokenize_response 
         (xineserver_get_text_response (response), &ntokens, &tokens); 
 
-      if (ntokens == 6)
+      // Older servers do not report shuffle and repeat
+      if (ntokens >= 6)
         { 
         XSStatus *_status = malloc (sizeof (XSStatus)); 
 
@@ -534,6 +1062,16 @@ BOOL xineserver_status (const char *host, int port, XSStatus **status,
         _status->stream = strdup (tokens[3]);
         _status->playlist_index = atoi (tokens[4]);
         _status->playlist_length = atoi (tokens[5]);
+        _status->shuffle = FALSE;
+        _status->repeat = XINESERVER_REPEAT_OFF;
+        if (ntokens >= 8)
+          {
+          _status->shuffle = strcmp (tokens[6], "on") == 0;
+          if (strcmp (tokens[7], "one") == 0)
+            _status->repeat = XINESERVER_REPEAT_ONE;
+          else if (strcmp (tokens[7], "all") == 0)
+            _status->repeat = XINESERVER_REPEAT_ALL;
+          }
 
         *status = _status;
         ret = TRUE;
@@ -542,7 +1080,6 @@ BOOL xineserver_status (const char *host, int port, XSStatus **status,
         {
         *error_code = XINESERVER_ERR_RESPONSE;
         }
-      for (int i = 0; i < ntokens; i++) free (tokens[i]);
       free (tokens);
       }
     free (response);
@@ -600,7 +1137,6 @@ BOOL xineserver_get_eq (const char *host, int port, int eq[10],
         *error = strdup ("Incorrect number of tokens in response from server");
         ret = FALSE;
         }
-      for (int i = 0; i < ntokens; i++) free (tokens[i]);
       free (tokens);
       }
     free (response);
@@ -613,6 +1149,74 @@ BOOL xineserver_get_eq (const char *host, int port, int eq[10],
   }
 
 
+/*==========================================================================
+
+  xineserver_get_levels
+
+==========================================================================*/
+BOOL xineserver_get_levels (const char *host, int port, XSLevels *levels,
+                            int *error_code, char **error)
+  {
+  BOOL ret = FALSE;
+  char *response = NULL;
+  ret = xineserver_send_and_receive (host, port, XINESERVER_CMD_LEVELS, 
+    &response, error);
+  if (ret)
+    {
+    int _error_code = xineserver_get_error_code_response (response);
+    if (_error_code != 0)
+      {
+      *error_code = _error_code;
+      if (error)
+        {
+        *error = strdup (xineserver_get_text_response (response));
+        }
+      ret = FALSE;
+      }
+    else
+      {
+      // Response is seq, channels, then the RMS and peak levels of
+      //  each channel, then the bands
+      char **tokens = NULL;
+      int ntokens = 0;
+
+      xineserver_tokenize_response 
+        (xineserver_get_text_response (response), &ntokens, &tokens); 
+
+      int channels = ntokens >= 2 ? atoi (tokens[1]) : -1;
+      if (channels >= 0 && channels <= XINESERVER_LEVELS_MAX_CHANNELS
+           && ntokens == 2 + 2 * channels + XINESERVER_LEVELS_BANDS)
+        { 
+        memset (levels, 0, sizeof (XSLevels));
+        levels->seq = strtoul (tokens[0], NULL, 10);
+        levels->channels = channels;
+        for (int i = 0; i < channels; i++)
+          {
+          levels->rms[i] = atof (tokens[2 + i]);
+          levels->peak[i] = atof (tokens[2 + channels + i]);
+          }
+        for (int i = 0; i < XINESERVER_LEVELS_BANDS; i++)
+          levels->bands[i] = atof (tokens[2 + 2 * channels + i]);
+        ret = TRUE;
+        }
+      else 
+        {
+        *error_code = XINESERVER_ERR_RESPONSE;
+        if (error)
+          *error = strdup 
+            ("Incorrect number of tokens in response from server");
+        ret = FALSE;
+        }
+      free (tokens);
+      }
+    free (response);
+    }
+  else
+    *error_code = XINESERVER_ERR_COMM;
+  return ret;
+  }
+
+
 /*==========================================================================
 
   xineserver_set_eq
@@ -652,16 +1256,244 @@ BOOL xineserver_set_eq (const char *host, int port, int eq[10],
 
 /*==========================================================================
 
-  xineserver_meta_info
+  xineserver_meta_info
+
+==========================================================================*/
+BOOL xineserver_meta_info (const char *host, int port, XSMetaInfo **mi, 
+                            int *error_code, char **error)
+  {
+  BOOL ret = FALSE;
+  char *command = NULL;
+  char *response = NULL;
+  asprintf (&command, "%s", XINESERVER_CMD_META_INFO);
+  ret = xineserver_send_and_receive (host, port, command, &response, error);
+  if (ret)
+    {
+    int _error_code = xineserver_get_error_code_response (response);
+    if (_error_code != 0)
+      {
+      *error_code = _error_code;
+      if (error)
+        {
+        *error = strdup (xineserver_get_text_response (response));
+        }
+      ret = FALSE;
+      }
+    else
+      {
+      // Parse status out of response 
+      //printf ("response = %s\n", response);
+      char **tokens = NULL;
+      int ntokens = 0;
+
+      xineserver_tokenize_response 
+        (xineserver_get_text_response (response), &ntokens, &tokens); 
+
+      if (ntokens == 7)
+        { 
+        XSMetaInfo *_mi = malloc (sizeof (XSMetaInfo)); 
+
+        _mi->bitrate = atoi (tokens[0]);
+        _mi->seekable = atoi (tokens[1]);
+        _mi->title = strdup (tokens[2]);
+        _mi->artist = strdup (tokens[3]);
+        _mi->genre = strdup (tokens[4]);
+        _mi->album = strdup (tokens[5]);
+        _mi->composer = strdup (tokens[6]);
+
+        *mi = _mi;
+        ret = TRUE;
+        }
+      else 
+        {
+        *error_code = XINESERVER_ERR_RESPONSE;
+        *error = strdup ("Incorrect number of tokens in response from server");
+        ret = FALSE;
+        }
+      free (tokens);
+      }
+    free (response);
+    }
+  else
+    *error_code = XINESERVER_ERR_COMM;
+  free (command);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  xsplaylist_free_entry
+
+  Entries from a full playlist response point into the response, which
+  the playlist keeps; only entries added since are allocated separately
+
+==========================================================================*/
+static void xsplaylist_free_entry (XSPlaylist *self, char *entry)
+  {
+  if (!self->text || entry < self->text 
+       || entry >= self->text + self->text_size)
+    free (entry);
+  }
+
+
+/*==========================================================================
+
+  xsplaylist_free_entries
+
+==========================================================================*/
+static void xsplaylist_free_entries (XSPlaylist *self)
+  {
+  if (self->entries)
+    {
+    for (int i = 0; i < self->nentries; i++)
+      xsplaylist_free_entry (self, self->entries[i]);
+    free (self->entries);
+    }
+  if (self->text) free (self->text);
+  self->entries = NULL;
+  self->nentries = 0;
+  self->text = NULL;
+  }
+
+
+/*==========================================================================
+
+  xineserver_playlist
+
+==========================================================================*/
+BOOL xineserver_playlist (const char *host, int port, XSPlaylist **playlist, 
+                            int *error_code, char **error)
+  {
+  BOOL ret = FALSE;
+  char *command = NULL;
+  char *response = NULL;
+  asprintf (&command, "%s", XINESERVER_CMD_PLAYLIST);
+  ret = xineserver_send_and_receive (host, port, command, &response, error);
+  if (ret)
+    {
+    int _error_code = xineserver_get_error_code_response (response);
+    if (_error_code != 0)
+      {
+      *error_code = _error_code;
+      if (error)
+        {
+        *error = strdup (xineserver_get_text_response (response));
+        }
+      ret = FALSE;
+      }
+    else
+      {
+      // Parse playlist out of response 
+      //printf ("response = %s\n", response);
+      char **tokens = NULL;
+      int ntokens = 0;
+      XSPlaylist *pl = malloc (sizeof (XSPlaylist)); 
+      pl->text = response;
+      pl->text_size = strlen (response) + 1;
+      xineserver_tokenize_response 
+        (xineserver_get_text_response (response), &ntokens, &tokens); 
+      pl->nentries = ntokens;
+      pl->entries = tokens;
+      pl->version = 0;
+      *playlist = pl;
+      response = NULL;
+      ret = TRUE;
+      }
+    free (response);
+    }
+  else
+    *error_code = XINESERVER_ERR_COMM;
+  free (command);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  xineserver_apply_changes
+
+  Apply the changes in a playlist-since response, starting at token 'i',
+  to a playlist. Returns FALSE if they do not fit the playlist, which 
+  means that it was not the version the changes were made to
+
+==========================================================================*/
+static BOOL xineserver_apply_changes (XSPlaylist *pl, char **tokens, 
+                            int ntokens, int i)
+  {
+  int nops = atoi (tokens[i++]);
+  for (int op = 0; op < nops; op++)
+    {
+    if (i >= ntokens) return FALSE;
+    const char *type = tokens[i++];
+    if (strcmp (type, "clear") == 0)
+      {
+      for (int j = 0; j < pl->nentries; j++) 
+        xsplaylist_free_entry (pl, pl->entries[j]);
+      pl->nentries = 0;
+      continue;
+      }
+    if (i + 2 > ntokens) return FALSE;
+    int first = atoi (tokens[i++]);
+    int count = atoi (tokens[i++]);
+    if (first < 0 || count < 0) return FALSE;
+    if (strcmp (type, "insert") == 0)
+      {
+      if (first > pl->nentries || i + count > ntokens) return FALSE;
+      pl->entries = realloc (pl->entries, 
+        (pl->nentries + count + 1) * sizeof (char *));
+      memmove (pl->entries + first + count, pl->entries + first,
+        (pl->nentries - first) * sizeof (char *));
+      for (int j = 0; j < count; j++)
+        pl->entries[first + j] = strdup (tokens[i++]);
+      pl->nentries += count;
+      }
+    else if (strcmp (type, "remove") == 0)
+      {
+      if (first + count > pl->nentries) return FALSE;
+      for (int j = 0; j < count; j++) 
+        xsplaylist_free_entry (pl, pl->entries[first + j]);
+      memmove (pl->entries + first, pl->entries + first + count,
+        (pl->nentries - first - count) * sizeof (char *));
+      pl->nentries -= count;
+      }
+    else if (strcmp (type, "move") == 0)
+      {
+      if (i >= ntokens) return FALSE;
+      int dest = atoi (tokens[i++]);
+      if (first + count > pl->nentries || dest < 0 
+           || dest + count > pl->nentries) return FALSE;
+      char **moved = malloc ((count + 1) * sizeof (char *));
+      memcpy (moved, pl->entries + first, count * sizeof (char *));
+      memmove (pl->entries + first, pl->entries + first + count,
+        (pl->nentries - first - count) * sizeof (char *));
+      memmove (pl->entries + dest + count, pl->entries + dest,
+        (pl->nentries - count - dest) * sizeof (char *));
+      memcpy (pl->entries + dest, moved, count * sizeof (char *));
+      free (moved);
+      }
+    else
+      return FALSE;
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  xineserver_playlist_update
 
 ==========================================================================*/
-BOOL xineserver_meta_info (const char *host, int port, XSMetaInfo **mi, 
-                            int *error_code, char **error)
+BOOL xineserver_playlist_update (const char *host, int port, 
+                            XSPlaylist **playlist, int *error_code, 
+                            char **error)
   {
   BOOL ret = FALSE;
   char *command = NULL;
   char *response = NULL;
-  asprintf (&command, "%s", XINESERVER_CMD_META_INFO);
+  XSPlaylist *pl = *playlist;
+  asprintf (&command, "%s %lld", XINESERVER_CMD_PLAYLIST_SINCE, 
+    pl ? pl->version : 0LL);
   ret = xineserver_send_and_receive (host, port, command, &response, error);
   if (ret)
     {
@@ -677,36 +1509,44 @@ BOOL xineserver_meta_info (const char *host, int port, XSMetaInfo **mi,
       }
     else
       {
-      // Parse status out of response 
-      //printf ("response = %s\n", response);
       char **tokens = NULL;
       int ntokens = 0;
-
+      size_t size = strlen (response) + 1;
       xineserver_tokenize_response 
         (xineserver_get_text_response (response), &ntokens, &tokens); 
 
-      if (ntokens == 7)
-        { 
-        XSMetaInfo *_mi = malloc (sizeof (XSMetaInfo)); 
-
-        _mi->bitrate = atoi (tokens[0]);
-        _mi->seekable = atoi (tokens[1]);
-        _mi->title = strdup (tokens[2]);
-        _mi->artist = strdup (tokens[3]);
-        _mi->genre = strdup (tokens[4]);
-        _mi->album = strdup (tokens[5]);
-        _mi->composer = strdup (tokens[6]);
-
-        *mi = _mi;
-        ret = TRUE;
+      if (ntokens >= 3 && strcmp (tokens[1], "full") == 0)
+        {
+        int n = ntokens - 3;
+        if (pl) 
+          xsplaylist_free_entries (pl);
+        else
+          pl = malloc (sizeof (XSPlaylist)); 
+        pl->entries = malloc ((n + 1) * sizeof (char *));
+        memcpy (pl->entries, tokens + 3, n * sizeof (char *));
+        pl->nentries = n;
+        pl->version = atoll (tokens[0]);
+        pl->text = response;
+        pl->text_size = size;
+        response = NULL;
+        *playlist = pl;
+        }
+      else if (ntokens >= 3 && strcmp (tokens[1], "delta") == 0 && pl
+           && xineserver_apply_changes (pl, tokens, ntokens, 2))
+        {
+        pl->version = atoll (tokens[0]);
         }
       else 
         {
+        // Changes that do not apply mean that the playlist was not
+        //  the version it claimed to be. Make the next update a full one
+        if (pl) pl->version = 0;
         *error_code = XINESERVER_ERR_RESPONSE;
-        *error = strdup ("Incorrect number of tokens in response from server");
+        if (error)
+          *error = strdup 
+            ("Incorrect playlist changes in response from server");
         ret = FALSE;
         }
-      for (int i = 0; i < ntokens; i++) free (tokens[i]);
       free (tokens);
       }
     free (response);
@@ -720,51 +1560,63 @@ BOOL xineserver_meta_info (const char *host, int port, XSMetaInfo **mi,
 
 /*==========================================================================
 
-  xineserver_playlist
+  xineserver_insert
 
 ==========================================================================*/
-BOOL xineserver_playlist (const char *host, int port, XSPlaylist **playlist, 
+BOOL xineserver_insert (const char *host, int port, int pos, int nstreams, 
+                            const char *const *streams, 
                             int *error_code, char **error)
   {
   BOOL ret = FALSE;
   char *command = NULL;
-  char *response = NULL;
-  asprintf (&command, "%s", XINESERVER_CMD_PLAYLIST);
-  ret = xineserver_send_and_receive (host, port, command, &response, error);
-  if (ret)
+  asprintf (&command, "%s %d", XINESERVER_CMD_INSERT, pos);
+  for (int i = 0; i < nstreams; i++)
     {
-    int _error_code = xineserver_get_error_code_response (response);
-    if (_error_code != 0)
-      {
-      *error_code = _error_code;
-      if (error)
-        {
-        *error = strdup (xineserver_get_text_response (response));
-        }
-      ret = FALSE;
-      }
-    else
-      {
-      // Parse playlist out of response 
-      //printf ("response = %s\n", response);
-      char **tokens = NULL;
-      int ntokens = 0;
-      xineserver_tokenize_response 
-        (xineserver_get_text_response (response), &ntokens, &tokens); 
-      XSPlaylist *pl = malloc (sizeof (XSPlaylist)); 
-      pl->nentries = ntokens;
-      pl->entries = tokens;
-      *playlist = pl;
-      ret = TRUE;
-      }
-    free (response);
+    const char *stream = streams[i]; // TODO -- escape
+
+    command = realloc (command, strlen (command) + strlen(stream) + 10);   
+
+    strcat (command, " \"");
+    strcat (command, stream);
+    strcat (command, "\"");
     }
-  else
-    *error_code = XINESERVER_ERR_COMM;
+
+  ret = xineserver_gen_command (host, port, command, error_code, error);
+  free (command);
+  return ret;
+  }
+
+/*==========================================================================
+
+  xineserver_remove
+
+==========================================================================*/
+BOOL xineserver_remove (const char *host, int port, int from, int to,
+        int *error_code, char **error)
+  {
+  BOOL ret = FALSE;
+  char *command = NULL;
+  asprintf (&command, "%s %d %d", XINESERVER_CMD_REMOVE, from, to);
+  ret = xineserver_gen_command (host, port, command, error_code, error);
   free (command);
   return ret;
   }
 
+/*==========================================================================
+
+  xineserver_move
+
+==========================================================================*/
+BOOL xineserver_move (const char *host, int port, int from, int to,
+        int dest, int *error_code, char **error)
+  {
+  BOOL ret = FALSE;
+  char *command = NULL;
+  asprintf (&command, "%s %d %d %d", XINESERVER_CMD_MOVE, from, to, dest);
+  ret = xineserver_gen_command (host, port, command, error_code, error);
+  free (command);
+  return ret;
+  }
 
 /*==========================================================================
 
@@ -893,6 +1745,44 @@ BOOL xineserver_prev (const char *host, int port,
   }
 
 
+/*==========================================================================
+
+  xineserver_set_shuffle
+
+==========================================================================*/
+BOOL xineserver_set_shuffle (const char *host, int port, BOOL shuffle,
+        int *error_code, char **error)
+  {
+  BOOL ret = FALSE;
+  char *command = NULL;
+  asprintf (&command, "%s %s", XINESERVER_CMD_SHUFFLE, 
+    shuffle ? "on" : "off");
+  ret = xineserver_gen_command (host, port, command, error_code, error);
+  free (command);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  xineserver_set_repeat
+
+==========================================================================*/
+BOOL xineserver_set_repeat (const char *host, int port, XSRepeatMode mode,
+        int *error_code, char **error)
+  {
+  BOOL ret = FALSE;
+  char *command = NULL;
+  const char *s = "off";
+  if (mode == XINESERVER_REPEAT_ONE) s = "one";
+  else if (mode == XINESERVER_REPEAT_ALL) s = "all";
+  asprintf (&command, "%s %s", XINESERVER_CMD_REPEAT, s);
+  ret = xineserver_gen_command (host, port, command, error_code, error);
+  free (command);
+  return ret;
+  }
+
+
 /*==========================================================================
 
   xineserver_set_volume
@@ -1058,26 +1948,204 @@ BOOL xineserver_clear (const char *host, int port,
   xineserver_is_playable_ext
 
 ==========================================================================*/
-BOOL xineserver_is_playable_ext (const char *_ext)
+BOOL xineserver_is_playable_ext (const char *ext)
   {
-  BOOL ret = FALSE;
-  char *ext = strdup (_ext);
-  int l = strlen (ext);
-  for (int j = 0; j < l; j++)
-    ext[j] = tolower (ext[j]); // Better hope extensions are ASCII 
-  if (strcmp (ext, "mp3") == 0) ret = TRUE;
-  else if (strcmp (ext, "flac") == 0) ret = TRUE;
-  else if (strcmp (ext, "ogg") == 0) ret = TRUE;
-  else if (strcmp (ext, "ac3") == 0) ret = TRUE;
-  else if (strcmp (ext, "aac") == 0) ret = TRUE;
-  else if (strcmp (ext, "m4a") == 0) ret = TRUE;
-  else if (strcmp (ext, "m4b") == 0) ret = TRUE;
-  else if (strcmp (ext, "mp3") == 0) ret = TRUE;
-  free (ext);
+  return xineserver_ext_is_playable (ext) ? TRUE : FALSE;
+  }
+
+
+/*==========================================================================
+
+  xineserver_attach_shm
+
+==========================================================================*/
+XSShm *xineserver_attach_shm (const char *name, char **error)
+  {
+  XSShm *ret = NULL;
+  char *path = NULL;
+  asprintf (&path, "%s%s", name[0] == '/' ? "" : "/", name);
+  int fd = shm_open (path, O_RDONLY, 0);
+  if (fd >= 0)
+    {
+    struct stat sb;
+    fstat (fd, &sb);
+    void *p = MAP_FAILED;
+    if (sb.st_size >= sizeof (XSShmHeader))
+      p = mmap (NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED)
+      {
+      const XSShmHeader *h = p;
+      if (h->magic == XINESERVER_SHM_MAGIC 
+           && h->header_size >= sizeof (XSShmHeader)
+           && h->size <= sb.st_size)
+        {
+        ret = malloc (sizeof (XSShm));
+        ret->header = h;
+        ret->size = sb.st_size;
+        }
+      else
+        {
+        munmap (p, sb.st_size);
+        asprintf (error, "%s is not in use by xine-server", path);
+        }
+      }
+    else
+      asprintf (error, "Can't map %s", path);
+    close (fd);
+    }
+  else
+    asprintf (error, "Can't open %s: %s", path, strerror (errno));
+  free (path);
   return ret;
   }
 
 
+/*==========================================================================
+
+  xineserver_detach_shm
+
+==========================================================================*/
+void xineserver_detach_shm (XSShm *shm)
+  {
+  if (shm)
+    {
+    munmap ((void *)shm->header, shm->size);
+    free (shm);
+    }
+  }
+
+
+/*==========================================================================
+
+  xsshm_xxx functions 
+
+==========================================================================*/
+/*==========================================================================
+
+  xsshm_get_status
+
+==========================================================================*/
+BOOL xsshm_get_status (XSShm *shm, XSStatus **status)
+  {
+  const XSShmHeader *h = shm->header;
+  XSShmHeader copy;
+  BOOL ok = FALSE;
+  for (int tries = 0; !ok && tries < XSSHM_MAX_TRIES; tries++)
+    {
+    uint32_t seq = __atomic_load_n (&h->status_seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) continue;
+    memcpy (&copy, h, sizeof (XSShmHeader));
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    ok = __atomic_load_n (&h->status_seq, __ATOMIC_RELAXED) == seq;
+    }
+  if (ok && copy.magic == XINESERVER_SHM_MAGIC)
+    {
+    XSStatus *s = *status;
+    if (s)
+      free (s->stream);
+    else
+      s = malloc (sizeof (XSStatus));
+    copy.stream[XINESERVER_SHM_STREAM_MAX - 1] = 0;
+    s->stream = strdup (copy.stream);
+    s->position = copy.position;
+    s->length = copy.length;
+    s->playlist_index = copy.playlist_index;
+    s->playlist_length = copy.playlist_length;
+    s->transport_status = copy.transport_status;
+    s->shuffle = copy.shuffle;
+    s->repeat = copy.repeat;
+    *status = s;
+    return TRUE;
+    }
+  return FALSE;
+  }
+
+
+/*==========================================================================
+
+  xsshm_read_playlist
+
+  Copy the playlist table, which might be changing as we read it. 
+  Returns NULL if any part of it is out of bounds
+
+==========================================================================*/
+static char **xsshm_read_playlist (const XSShm *shm, uint64_t offset,
+                    uint64_t size, int count)
+  {
+  if (offset > shm->size || size > shm->size - offset 
+       || (uint64_t)count * sizeof (uint32_t) > size)
+    return NULL;
+  const char *table = (const char *)shm->header + offset;
+  const uint32_t *offsets = (const uint32_t *)table;
+  char **entries = malloc ((count + 1) * sizeof (char *));
+  for (int i = 0; i < count; i++)
+    {
+    uint32_t o = offsets[i];
+    size_t l = o < size ? strnlen (table + o, size - o) : size;
+    if (o + l >= size)
+      {
+      for (int j = 0; j < i; j++) free (entries[j]);
+      free (entries);
+      return NULL;
+      }
+    entries[i] = strndup (table + o, l);
+    }
+  return entries;
+  }
+
+
+/*==========================================================================
+
+  xsshm_get_playlist
+
+==========================================================================*/
+BOOL xsshm_get_playlist (XSShm *shm, XSPlaylist **playlist)
+  {
+  const XSShmHeader *h = shm->header;
+  for (int tries = 0; tries < XSSHM_MAX_TRIES; tries++)
+    {
+    uint32_t seq = __atomic_load_n (&h->playlist_seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) continue;
+    uint32_t magic = h->magic;
+    int count = h->playlist_count;
+    int64_t version = h->playlist_version;
+    uint64_t offset = h->playlist_offset;
+    uint64_t size = h->playlist_size;
+    XSPlaylist *pl = *playlist;
+    char **entries = NULL;
+    if (count >= 0 && !(pl && pl->version == version))
+      entries = xsshm_read_playlist (shm, offset, size, count);
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    if (__atomic_load_n (&h->playlist_seq, __ATOMIC_RELAXED) != seq
+         || (count >= 0 && !entries && !(pl && pl->version == version)))
+      {
+      if (entries)
+        {
+        for (int i = 0; i < count; i++) free (entries[i]);
+        free (entries);
+        }
+      continue;
+      }
+    if (magic != XINESERVER_SHM_MAGIC || count < 0) 
+      return FALSE;
+    if (entries)
+      {
+      if (pl)
+        xsplaylist_free_entries (pl);
+      else
+        pl = malloc (sizeof (XSPlaylist));
+      pl->text = NULL;
+      pl->entries = entries;
+      pl->nentries = count;
+      pl->version = version;
+      *playlist = pl;
+      }
+    return TRUE;
+    }
+  return FALSE;
+  }
+
+
 /*==========================================================================
 
   xsplaylist_xxx functions 
@@ -1092,12 +2160,7 @@ void xsplaylist_destroy  (XSPlaylist *self)
   {
   if (self)
     {
-    if (self->entries)
-      {
-      for (int i = 0; i < self->nentries; i++)
-        free (self->entries[i]);
-      free (self->entries);
-      }
+    xsplaylist_free_entries (self);
     free (self);
     }
   }
@@ -1125,6 +2188,17 @@ char** const xsplaylist_get_entries (const XSPlaylist *self)
   }
 
 
+/*==========================================================================
+
+  xsplaylist_get_version
+
+==========================================================================*/
+long long xsplaylist_get_version (const XSPlaylist *self)
+  {
+  return self->version;
+  }
+
+
 /*==========================================================================
 
   xsstatys_xxx functions 
@@ -1204,6 +2278,26 @@ XSTransportStatus xsstatus_get_transport_status (const XSStatus *self)
   return self->transport_status;
   }
 
+/*==========================================================================
+
+  xsstatus_get_shuffle
+
+==========================================================================*/
+BOOL xsstatus_get_shuffle (const XSStatus *self)
+  {
+  return self->shuffle;
+  }
+
+/*==========================================================================
+
+  xsstatus_get_repeat
+
+==========================================================================*/
+XSRepeatMode xsstatus_get_repeat (const XSStatus *self)
+  {
+  return self->repeat;
+  }
+
 /*==========================================================================
 
   xsstatus_get_position_hms
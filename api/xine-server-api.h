@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 // Boolean -- define these if nobody else has
 
 #ifndef TRUE
@@ -53,6 +55,18 @@ typedef int BOOL;
 #define XINESERVER_ERR_COMM           10 
 // Unexpected response from server 
 #define XINESERVER_ERR_RESPONSE       11 
+// Command addressed to a zone that does not exist 
+#define XINESERVER_ERR_NOZONE         12 
+// Library command when no media library is configured
+#define XINESERVER_ERR_NOLIBRARY      13 
+// Levels requested when the level meter is disabled or unavailable
+#define XINESERVER_ERR_NOLEVELS       14 
+// Client has sent more commands than the server's rate limit allows
+#define XINESERVER_ERR_RATELIMIT      15 
+// Token sent with 'auth' is not known to the server
+#define XINESERVER_ERR_AUTH           16 
+// Client's role does not allow the command
+#define XINESERVER_ERR_DENIED         17 
 
 // Limits
 
@@ -79,6 +93,36 @@ typedef int BOOL;
 #define XINESERVER_CMD_SEEK      "seek"
 #define XINESERVER_CMD_EQ        "eq"
 #define XINESERVER_CMD_VERSION   "version"
+#define XINESERVER_CMD_ZONE      "zone"
+#define XINESERVER_CMD_SYNC      "sync"
+#define XINESERVER_CMD_STATS     "stats"
+#define XINESERVER_CMD_OUTPUT    "output"
+#define XINESERVER_CMD_ADD_DIR   "add-dir"
+#define XINESERVER_CMD_ADD_M3U   "add-m3u"
+#define XINESERVER_CMD_ADD_PLS   "add-pls"
+#define XINESERVER_CMD_SEARCH    "search"
+#define XINESERVER_CMD_ADD_QUERY "add-query"
+#define XINESERVER_CMD_LIBRARY   "library"
+#define XINESERVER_CMD_PLAYLIST_META "playlist-meta"
+#define XINESERVER_CMD_SHUFFLE   "shuffle"
+#define XINESERVER_CMD_REPEAT    "repeat"
+#define XINESERVER_CMD_INSERT    "insert"
+#define XINESERVER_CMD_REMOVE    "remove"
+#define XINESERVER_CMD_MOVE      "move"
+#define XINESERVER_CMD_PLAYLIST_SINCE "playlist-since"
+#define XINESERVER_CMD_LEVELS    "levels"
+#define XINESERVER_CMD_KEEPALIVE "keep-alive"
+#define XINESERVER_CMD_AUTH      "auth"
+
+// Client connection defaults. A timeout of zero means no limit
+
+#define XSCLIENT_DEF_CONNECT_MSEC     5000
+#define XSCLIENT_DEF_READ_MSEC        0
+// Most idle connections an XSClient keeps open to its server
+#define XSCLIENT_MAX_IDLE             8
+// Environment variable holding the token a new XSClient sends to 
+//  servers that need authentication
+#define XSCLIENT_TOKEN_ENV            "XINE_SERVER_TOKEN"
 
 // XSPlaylist is an opaque structure, used with the
 //  xsplaylist_xxx funtions
@@ -90,6 +134,11 @@ typedef struct _XSPlaylist XSPlaylist;
 
 typedef struct _XSMetaInfo XSMetaInfo;
 
+// XSClient is an opaque structure, used with the
+//  xsclient_xxx functions
+
+typedef struct _XSClient XSClient;
+
 // XSStatus is an opaque structure, used with the
 //  xsstatus_xxx funtions
 
@@ -103,6 +152,13 @@ typedef enum _XSTransportStatus
   XINESERVER_TRANSPORT_BUFFERING = 3
   } XSTransportStatus;
 
+typedef enum _XSRepeatMode
+  {
+  XINESERVER_REPEAT_OFF = 0, // Stop at the end of the playlist
+  XINESERVER_REPEAT_ONE = 1, // Play the same item again when it finishes
+  XINESERVER_REPEAT_ALL = 2  // Go back to the start of the playlist 
+  } XSRepeatMode;
+
 typedef enum _XSNotifyClass
   {
   XSNOTIFY_CLASS_SERVER = 1, // Server events
@@ -128,11 +184,113 @@ typedef enum XSNotifyEvent
 
   } XSNotifyEvent;
 
+// Audio levels, as measured by the server's level meter. Levels are in
+//  dB relative to full scale, and never below XINESERVER_LEVELS_FLOOR.
+//  The spectrum is of the mix of all channels, in XINESERVER_LEVELS_BANDS
+//  bands spaced logarithmically from XINESERVER_LEVELS_MIN_FREQ to
+//  XINESERVER_LEVELS_MAX_FREQ Hz; a full-scale sine wave reads 0 dB in
+//  its band. seq increases with each new measurement, and is zero if
+//  there has not yet been one. Channels beyond the first 
+//  XINESERVER_LEVELS_MAX_CHANNELS are not reported separately
+
+#define XINESERVER_LEVELS_MAX_CHANNELS 8
+#define XINESERVER_LEVELS_BANDS        16
+#define XINESERVER_LEVELS_FLOOR        -120.0
+#define XINESERVER_LEVELS_MIN_FREQ     30
+#define XINESERVER_LEVELS_MAX_FREQ     16000
+
+typedef struct _XSLevels
+  {
+  uint32_t seq;
+  int channels;
+  double rms[XINESERVER_LEVELS_MAX_CHANNELS];
+  double peak[XINESERVER_LEVELS_MAX_CHANNELS];
+  double bands[XINESERVER_LEVELS_BANDS];
+  } XSLevels;
+
+// XSShm is an opaque structure, used with the xsshm_xxx functions
+
+typedef struct _XSShm XSShm;
+
+// Layout of the shared memory segment that the server keeps up to date
+//  when it is started with --shm. The segment starts with this header. 
+//  The status and the playlist are each protected by a sequence count,
+//  which is odd while the server is writing; a reader copies what it 
+//  wants, and then checks that the count is even and has not changed.
+//  The playlist table, at playlist_offset, is playlist_count 32-bit 
+//  offsets, relative to the start of the table, of nul-terminated MRLs 
+//  that follow them. Clients should use the xsshm_xxx functions rather
+//  than reading this directly
+
+#define XINESERVER_SHM_MAGIC      0x31534d58 
+#define XINESERVER_SHM_STREAM_MAX 4096
+
+typedef struct _XSShmHeader
+  {
+  uint32_t magic; // Zero once the server has stopped updating it
+  uint32_t header_size;
+  uint64_t size; 
+  uint32_t status_seq;
+  int32_t transport_status;
+  int32_t position;
+  int32_t length;
+  int32_t playlist_index;
+  int32_t playlist_length;
+  int32_t shuffle;
+  int32_t repeat;
+  int64_t updated; // Time of the last update, usec since the epoch
+  char stream[XINESERVER_SHM_STREAM_MAX];
+  uint32_t playlist_seq;
+  int32_t playlist_count; // -1 if the playlist does not fit
+  int64_t playlist_version;
+  uint64_t playlist_offset;
+  uint64_t playlist_size;
+  } XSShmHeader;
+
 
 #ifdef __cplusplus
 exetern "C" { 
 #endif
 
+// Client connections
+
+// Create a client for the server at host:port, or at the Unix socket
+//  whose path is given as the host. Nothing is looked up or
+//  connected until the first request. A client may be used from any 
+//  number of threads at once: it looks up the host once, and keeps 
+//  connections that it has finished with open for reuse, up to
+//  XSCLIENT_MAX_IDLE of them. Use xsclient_destroy() to close them
+XSClient *xsclient_create  (const char *host, int port);
+void      xsclient_destroy (XSClient *self);
+
+// Set the time allowed to connect to the server, and to wait for each
+//  part of a response, in msec; zero means no limit. A request that 
+//  times out fails with XINESERVER_ERR_COMM
+void      xsclient_set_timeouts (XSClient *self, int connect_msec, 
+                            int read_msec);
+
+// Set the token sent with 'auth' on each new connection, before any
+//  command, or NULL for none. It is taken from XSCLIENT_TOKEN_ENV by
+//  default. A connection whose token is not accepted is not used, and 
+//  the request fails
+void      xsclient_set_token (XSClient *self, const char *token);
+
+// Set whether connections are kept open to be reused, which they are 
+//  by default. If not, each request gets a connection of its own, 
+//  which is closed when the response arrives
+void      xsclient_set_keep_alive (XSClient *self, BOOL keep_alive);
+
+// Send one command line (without line ending) and wait for the 
+//  response line, which is returned without its line ending. If the
+//  method returns TRUE, the caller should free() the response
+BOOL      xsclient_send_and_receive (XSClient *self, const char *command, 
+                            char **response, char **error);
+
+// Get the client shared by all the xineserver_xxx functions that take
+//  this host and port. It is created the first time it is needed, and 
+//  must not be destroyed; but its timeouts can be changed
+XSClient *xineserver_get_client (const char *host, int port);
+
 // Basic API functions
 
 // Add the specific streams (or local files) to the playlist. They won't
@@ -150,6 +308,26 @@ BOOL   xineserver_add_single (const char *host, int port,
                             const char *stream, 
                             int *error_code, char **error);
 
+// Insert the specified streams (or local files) into the playlist, so
+//  that the first of them is at position 'pos'. A position equal to
+//  the playlist length adds them to the end. If the item being
+//  played moves, playback is not interrupted.
+BOOL   xineserver_insert   (const char *host, int port, int pos, 
+                            int nstreams, const char *const *streams, 
+                            int *error_code, char **error);
+
+// Remove the playlist items from position 'from' to position 'to',
+//  inclusive. If the item being played is removed, playback continues
+//  with the item that followed the removed ones
+BOOL   xineserver_remove   (const char *host, int port, int from, int to,
+                            int *error_code, char **error);
+
+// Move the playlist items from position 'from' to position 'to',
+//  inclusive, so that the first of them is at position 'dest' 
+//  afterwards
+BOOL   xineserver_move     (const char *host, int port, int from, int to,
+                            int dest, int *error_code, char **error);
+
 // Get the contents of the playlist, as a XSPlist opaque structure.
 // See the methods below for access the playlist. If the method
 //   returns TRUE a structure has been stored, and the caller should
@@ -157,6 +335,24 @@ BOOL   xineserver_add_single (const char *host, int port,
 BOOL   xineserver_playlist (const char *host, int port, XSPlaylist **playlist, 
                             int *error_code, char **error);
 
+// Bring a playlist up to date. If *playlist is NULL, or was got 
+//   from xineserver_playlist(), a new copy of the whole playlist is
+//   fetched and stored in it. Otherwise only the changes made since the
+//   playlist's version are fetched and applied, unless the server no
+//   longer has them, in which case the whole playlist is fetched again.
+//   If the method returns TRUE, *playlist is current, and the caller 
+//   should use xsplaylist_destroy() to free it after use
+BOOL   xineserver_playlist_update (const char *host, int port, 
+                            XSPlaylist **playlist, 
+                            int *error_code, char **error);
+
+// Map the shared memory segment that a server on the same machine was
+//   started with (--shm=name), for reading. Returns NULL, and allocates
+//   an error message, if it can't be mapped. Use xineserver_detach_shm()
+//   to unmap it after use
+XSShm *xineserver_attach_shm (const char *name, char **error);
+void   xineserver_detach_shm (XSShm *shm);
+
 // Stop playback, and set the playlist index to -1 (ie., nowhere).
 BOOL   xineserver_stop     (const char *host, int port, 
                             int *error_code, char **error);
@@ -198,6 +394,20 @@ BOOL   xineserver_next     (const char *host, int port,
 BOOL   xineserver_prev     (const char *host, int port,
                             int *error_code, char **error);
 
+// Turn shuffle on or off. When shuffle is on, next, prev, and the 
+//   end of each item move through the playlist in a random order,
+//   which is different each time shuffle is turned on. The playlist
+//   itself, and the indices of its items, are not changed
+BOOL   xineserver_set_shuffle (const char *host, int port, BOOL shuffle,
+                            int *error_code, char **error);
+
+// Set what happens at the end of an item: the next item is played,
+//   the same item is played again, or, at the end of the playlist,
+//   playback starts again from the beginning. With XINESERVER_REPEAT_ALL,
+//   next and prev also wrap around
+BOOL   xineserver_set_repeat (const char *host, int port, XSRepeatMode mode,
+                            int *error_code, char **error);
+
 // Set the volume (0..100). Note that xineserver sets the _system_ volume, not
 //  a local volume level for itsel, when using the 'alsa' driver. 
 //  Setting the volume here could potentially
@@ -214,6 +424,14 @@ BOOL   xineserver_set_eq (const char *host, int port, int eq[10],
 BOOL   xineserver_get_eq (const char *host, int port, int eq[10],
                             int *error_code, char **error);
 
+// Get the latest audio levels. The server measures levels only while 
+//  clients are asking for them, so the first call after a pause of 
+//  more than a few seconds returns seq zero, or an old measurement. 
+//  Call this at the rate the server was configured to measure at 
+//  (--levels-rate) to see every measurement
+BOOL   xineserver_get_levels (const char *host, int port, XSLevels *levels,
+                            int *error_code, char **error);
+
 // A convenience function for converting the time valumes in msec
 //   that Xine uses, to more manageable hour, minute, second values
 void   xineserver_msec_to_hms (int msec, int *h, int *m, int *s);
@@ -242,6 +460,10 @@ BOOL   xineserver_seek (const char *host, int port, int msec,
 BOOL   xineserver_version (const char *host, int port, int *major, 
                             int *minor, int *error_code, char **error);
 
+// Returns TRUE if the filename extension (without the dot, in any case)
+//   is one of the audio formats that xine-server is expected to play
+BOOL   xineserver_is_playable_ext (const char *ext);
+
 // Operations on opaque data structures 
 
 // Destroy the XSPlaylist structure allocated by xineserver__playlist()
@@ -250,6 +472,10 @@ void         xsplaylist_destroy  (XSPlaylist *self);
 int          xsplaylist_get_nentries (const XSPlaylist *self);
 // Get the playlist items as an array of const char * values
 char **const xsplaylist_get_entries (const XSPlaylist *self);
+// Get the version of the playlist on the server that this is a copy of,
+//   or zero if it is not known. Versions are opaque, except that a
+//   later version is a larger number
+long long    xsplaylist_get_version (const XSPlaylist *self);
 
 // Destroy the XSStatus structure alloation by xineserver_status()
 void         xsstatus_destroy (XSStatus *self);
@@ -276,6 +502,24 @@ void         xsstatus_get_length_hms (const XSStatus *self, char *buff,
 //  stream is "-" (that is, a dash).
 const char  *xsstatus_get_stream (const XSStatus *self);
 XSTransportStatus xsstatus_get_transport_status (const XSStatus *self);
+// Get the shuffle and repeat modes. Older servers do not report 
+//  these, and they are taken to be off
+BOOL         xsstatus_get_shuffle (const XSStatus *self);
+XSRepeatMode xsstatus_get_repeat (const XSStatus *self);
+
+// Read the status from a shared memory segment, without any system
+//   calls. If *status is NULL a new XSStatus is allocated; otherwise
+//   the one given is reused. Returns FALSE if the server is no longer
+//   updating the segment, which happens when it shuts down. Because the
+//   server only updates the segment a few times a second, the position
+//   can be that much behind
+BOOL         xsshm_get_status (XSShm *shm, XSStatus **status);
+// Bring a playlist up to date from a shared memory segment. If 
+//   *playlist is NULL a new one is allocated. A playlist whose version 
+//   is already current is not copied again. Returns FALSE if the server
+//   is no longer updating the segment, or the playlist is too large 
+//   for it; xineserver_playlist_update() can then be used instead
+BOOL         xsshm_get_playlist (XSShm *shm, XSPlaylist **playlist);
 
 // Destroy the XSMetaInfo structure alloation by xineserver_meta_info()
 void        xsmetainfo_destroy (XSMetaInfo *self);
@@ -0,0 +1,32 @@
+/*==========================================================================
+
+  xine-server-api
+  xine-server-ext.h
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  The filename extensions of the audio formats that xine-server is 
+  expected to play. This is shared by the API and the server itself, 
+  so the server's directory scanner and media library agree with 
+  clients about what is playable. It is header-only, so the server 
+  need not be built with the whole client API
+
+==========================================================================*/
+
+#pragma once
+
+#include <strings.h>
+
+static const char *const xineserver_playable_exts[] = 
+  {
+  "mp3", "flac", "ogg", "ac3", "aac", "m4a", "m4b", NULL
+  };
+
+// Returns nonzero if the filename extension (without the dot, in any 
+//   case) is one of the playable formats
+static inline int xineserver_ext_is_playable (const char *ext)
+  {
+  for (int i = 0; xineserver_playable_exts[i]; i++)
+    if (strcasecmp (ext, xineserver_playable_exts[i]) == 0) return 1;
+  return 0;
+  }
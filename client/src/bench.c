@@ -0,0 +1,608 @@
+/*==========================================================================
+
+  xine-client
+  bench.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Load test for a server. Each thread sends requests back to back,
+  each one chosen at random from the mix, and records how long each
+  took, from sending it until the whole response has arrived. Each 
+  thread has a client of its own, which either keeps one connection
+  open, as programs that use the API do, or connects for each request,
+  as the API did before it reused connections. Responses are not 
+  parsed. At the end, the latencies are sorted to find the percentiles.
+  Requests that fail count as errors, and are not included in the
+  latencies.
+
+  The host is looked up once, before the threads start, so that name
+  lookup is not part of what is measured. Its first address that 
+  accepts a connection is used, IPv4 or IPv6.
+
+  The parsing benchmark times playlist responses from a stand-in server
+  on the loopback interface, so that the server's own speed does not
+  come into it.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "bench.h"
+#include "../../api/xine-server-api.h"
+
+typedef enum
+  {
+  BENCH_STATUS = 0,
+  BENCH_META_INFO,
+  BENCH_PLAYLIST,
+  BENCH_ADD,
+  BENCH_NOPS
+  } BenchOp;
+
+static const char *bench_op_names[BENCH_NOPS] =
+  { "status", "meta-info", "playlist", "add" };
+
+static const char *bench_op_commands[BENCH_NOPS] =
+  { XINESERVER_CMD_STATUS, XINESERVER_CMD_META_INFO, 
+    XINESERVER_CMD_PLAYLIST, 
+    XINESERVER_CMD_ADD " \"" BENCH_ADD_STREAM "\"" };
+
+typedef struct _BenchSamples
+  {
+  int64_t *usec;
+  int count;
+  int size;
+  int errors;
+  } BenchSamples;
+
+typedef struct _BenchWorker
+  {
+  pthread_t thread;
+  XSClient *client;
+  const int *weights;
+  int total_weight;
+  int64_t end;
+  unsigned int seed;
+  BenchSamples samples[BENCH_NOPS];
+  char *first_error;
+  } BenchWorker;
+
+typedef struct _BenchParseServer
+  {
+  int sock;
+  int conn;
+  char *response;
+  } BenchParseServer;
+
+
+/*==========================================================================
+
+  bench_usec
+
+==========================================================================*/
+static int64_t bench_usec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+
+/*==========================================================================
+
+  bench_parse_mix
+
+  Parse "name=weight,..." into a weight for each kind of request
+
+==========================================================================*/
+static BOOL bench_parse_mix (const char *mix, int weights[BENCH_NOPS],
+       char **error)
+  {
+  BOOL ret = TRUE;
+  memset (weights, 0, BENCH_NOPS * sizeof (int));
+  char *s = strdup (mix);
+  char *saveptr = NULL;
+  int total = 0;
+  for (char *tok = strtok_r (s, ",", &saveptr); tok && ret;
+        tok = strtok_r (NULL, ",", &saveptr))
+    {
+    char *eq = strchr (tok, '=');
+    int weight = eq ? atoi (eq + 1) : 1;
+    if (eq) *eq = 0;
+    int op;
+    for (op = 0; op < BENCH_NOPS; op++)
+      if (strcmp (tok, bench_op_names[op]) == 0) break;
+    if (op == BENCH_NOPS)
+      {
+      asprintf (error, "Unknown request '%s' in mix", tok);
+      ret = FALSE;
+      }
+    else if (weight < 0)
+      {
+      asprintf (error, "Bad weight for '%s' in mix", tok);
+      ret = FALSE;
+      }
+    else
+      {
+      weights[op] = weight;
+      total += weight;
+      }
+    }
+  if (ret && total == 0)
+    {
+    asprintf (error, "Mix has no requests");
+    ret = FALSE;
+    }
+  free (s);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  bench_resolve
+
+  Look up the host, and find the first of its addresses that accepts
+  a connection, as the API would. The address is written numerically,
+  so that the clients need not look it up again. A Unix socket path is
+  copied as it is
+
+==========================================================================*/
+static BOOL bench_resolve (const char *host, int port, char *address,
+      size_t size, char **error)
+  {
+  if (host[0] == '/')
+    {
+    snprintf (address, size, "%s", host);
+    return TRUE;
+    }
+  struct addrinfo hints, *addrs;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  char service[16];
+  snprintf (service, sizeof (service), "%d", port);
+  int gai = getaddrinfo (host, service, &hints, &addrs);
+  if (gai != 0)
+    {
+    asprintf (error, "Can't resolve %s: %s", host, gai_strerror (gai));
+    return FALSE;
+    }
+  BOOL ret = FALSE;
+  int e = 0;
+  for (struct addrinfo *ai = addrs; ai && !ret; ai = ai->ai_next)
+    {
+    int sock = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sock >= 0 && connect (sock, ai->ai_addr, ai->ai_addrlen) == 0)
+      ret = getnameinfo (ai->ai_addr, ai->ai_addrlen, address, size, 
+        NULL, 0, NI_NUMERICHOST) == 0;
+    else
+      e = errno;
+    if (sock >= 0) close (sock);
+    }
+  freeaddrinfo (addrs);
+  if (!ret)
+    asprintf (error, "Can't connect to %s:%d: %s", host, port, 
+      strerror (e));
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  bench_request
+
+  Send a request and wait for the response, which counts as an error
+  if its code is not zero
+
+==========================================================================*/
+static BOOL bench_request (XSClient *client, BenchOp op,
+      int *error_code, char **error)
+  {
+  char *response = NULL;
+  BOOL ret = xsclient_send_and_receive (client, bench_op_commands[op], 
+    &response, error);
+  if (ret)
+    {
+    int code = -1;
+    sscanf (response, "%d", &code);
+    if (code != 0)
+      {
+      const char *sp = strchr (response, ' ');
+      *error_code = code;
+      *error = strdup (sp ? sp + 1 : response);
+      ret = FALSE;
+      }
+    free (response);
+    }
+  else
+    *error_code = XINESERVER_ERR_COMM;
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  bench_thread
+
+==========================================================================*/
+static void *bench_thread (void *arg)
+  {
+  BenchWorker *w = (BenchWorker *)arg;
+  int64_t now = bench_usec ();
+  while (now < w->end)
+    {
+    int r = rand_r (&w->seed) % w->total_weight;
+    BenchOp op = 0;
+    while (r >= w->weights[op])
+      {
+      r -= w->weights[op];
+      op++;
+      }
+    int error_code = 0;
+    char *error = NULL;
+    BOOL ok = bench_request (w->client, op, &error_code, &error);
+    int64_t t = bench_usec ();
+    BenchSamples *s = &w->samples[op];
+    if (ok)
+      {
+      if (s->count == s->size)
+        {
+        s->size = s->size ? s->size * 2 : 1024;
+        s->usec = realloc (s->usec, s->size * sizeof (int64_t));
+        }
+      s->usec[s->count++] = t - now;
+      }
+    else
+      {
+      s->errors++;
+      if (!w->first_error && error)
+        asprintf (&w->first_error, "%s: error %d: %s", bench_op_names[op],
+          error_code, error);
+      }
+    if (error) free (error);
+    now = t;
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  bench_compare
+
+==========================================================================*/
+static int bench_compare (const void *a, const void *b)
+  {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+  }
+
+
+/*==========================================================================
+
+  bench_percentile
+
+  In msec, from sorted latencies in usec
+
+==========================================================================*/
+static double bench_percentile (const int64_t *usec, int count, double p)
+  {
+  if (count == 0) return 0;
+  int i = (int)(p * count + 0.999999) - 1;
+  if (i < 0) i = 0;
+  if (i >= count) i = count - 1;
+  return usec[i] / 1000.0;
+  }
+
+
+/*==========================================================================
+
+  bench_print
+
+==========================================================================*/
+static void bench_print (FILE *out, const char *name, int64_t *usec,
+      int count, int errors, double seconds)
+  {
+  qsort (usec, count, sizeof (int64_t), bench_compare);
+  fprintf (out, "%-10s %9d %7d %9.1f %8.2f %8.2f %8.2f\n", name, count,
+    errors, count / seconds, bench_percentile (usec, count, 0.5),
+    bench_percentile (usec, count, 0.99),
+    bench_percentile (usec, count, 0.999));
+  }
+
+
+/*==========================================================================
+
+  bench_run
+
+==========================================================================*/
+BOOL bench_run (const char *host, int port, double seconds,
+       int concurrency, const char *mix, BOOL persistent, FILE *out, 
+       char **error)
+  {
+  LOG_IN
+  int weights[BENCH_NOPS];
+  if (seconds <= 0 || concurrency <= 0)
+    {
+    asprintf (error, "Duration and concurrency must be positive");
+    LOG_OUT
+    return FALSE;
+    }
+  if (!bench_parse_mix (mix, weights, error))
+    {
+    LOG_OUT
+    return FALSE;
+    }
+
+  char address[NI_MAXHOST];
+  if (!bench_resolve (host, port, address, sizeof (address), error))
+    {
+    LOG_OUT
+    return FALSE;
+    }
+
+  int total_weight = 0;
+  for (int op = 0; op < BENCH_NOPS; op++)
+    total_weight += weights[op];
+  BOOL ipv6 = strchr (address, ':') != NULL;
+  fprintf (out, "%d threads for %.1f sec against %s%s%s:%d, mix %s\n",
+    concurrency, seconds, ipv6 ? "[" : "", address, ipv6 ? "]" : "", 
+    port, mix);
+  fprintf (out, "One connection per %s\n", 
+    persistent ? "thread" : "request");
+
+  BenchWorker *workers = calloc (concurrency, sizeof (BenchWorker));
+  int64_t start = bench_usec ();
+  for (int i = 0; i < concurrency; i++)
+    {
+    BenchWorker *w = &workers[i];
+    w->client = xsclient_create (address, port);
+    xsclient_set_keep_alive (w->client, persistent);
+    w->weights = weights;
+    w->total_weight = total_weight;
+    w->end = start + (int64_t)(seconds * 1000000);
+    w->seed = (unsigned int)start + i;
+    pthread_create (&w->thread, NULL, bench_thread, w);
+    }
+  for (int i = 0; i < concurrency; i++)
+    pthread_join (workers[i].thread, NULL);
+  double elapsed = (bench_usec () - start) / 1000000.0;
+  for (int i = 0; i < concurrency; i++)
+    xsclient_destroy (workers[i].client);
+
+  fprintf (out, "\n%-10s %9s %7s %9s %8s %8s %8s\n", "request", "count",
+    "errors", "req/s", "p50 ms", "p99 ms", "p999 ms");
+  int64_t *all = NULL;
+  int all_count = 0, all_errors = 0;
+  const char *first_error = NULL;
+  for (int op = 0; op < BENCH_NOPS; op++)
+    {
+    if (weights[op] == 0) continue;
+    int count = 0, errors = 0;
+    for (int i = 0; i < concurrency; i++)
+      {
+      count += workers[i].samples[op].count;
+      errors += workers[i].samples[op].errors;
+      }
+    int64_t *usec = malloc ((count + 1) * sizeof (int64_t));
+    all = realloc (all, (all_count + count + 1) * sizeof (int64_t));
+    int n = 0;
+    for (int i = 0; i < concurrency; i++)
+      {
+      BenchSamples *s = &workers[i].samples[op];
+      memcpy (usec + n, s->usec, s->count * sizeof (int64_t));
+      n += s->count;
+      }
+    memcpy (all + all_count, usec, count * sizeof (int64_t));
+    all_count += count;
+    all_errors += errors;
+    bench_print (out, bench_op_names[op], usec, count, errors, elapsed);
+    free (usec);
+    }
+  bench_print (out, "all", all, all_count, all_errors, elapsed);
+  free (all);
+
+  for (int i = 0; i < concurrency; i++)
+    if (!first_error && workers[i].first_error)
+      first_error = workers[i].first_error;
+  if (first_error)
+    fprintf (out, "\nFirst error: %s\n", first_error);
+  if (weights[BENCH_ADD] > 0)
+    fprintf (out, "\n'add' requests added '%s' to the playlist\n",
+      BENCH_ADD_STREAM);
+
+  for (int i = 0; i < concurrency; i++)
+    {
+    for (int op = 0; op < BENCH_NOPS; op++)
+      if (workers[i].samples[op].usec) free (workers[i].samples[op].usec);
+    if (workers[i].first_error) free (workers[i].first_error);
+    }
+  free (workers);
+  LOG_OUT
+  return TRUE;
+  }
+
+/*==========================================================================
+
+  bench_parse_serve
+
+  Answer every request on every connection with the same response, 
+  until the listening socket is shut down
+
+==========================================================================*/
+static void *bench_parse_serve (void *arg)
+  {
+  BenchParseServer *s = (BenchParseServer *)arg;
+  int sock;
+  while ((sock = accept (s->sock, NULL, NULL)) >= 0)
+    {
+    s->conn = sock;
+    char buff[256];
+    int len = 0;
+    ssize_t n;
+    while ((n = recv (sock, buff + len, sizeof (buff) - len, 0)) > 0)
+      {
+      len += n;
+      char *cr;
+      while ((cr = memchr (buff, '\r', len)))
+        {
+        *cr = 0;
+        const char *response = strcmp (buff, XINESERVER_CMD_KEEPALIVE) == 0
+          ? "0 OK\n" : s->response;
+        size_t l = strlen (response);
+        while (l > 0 && (n = send (sock, response, l, MSG_NOSIGNAL)) > 0)
+          {
+          response += n;
+          l -= n;
+          }
+        // Skip the newline after the carriage return 
+        int used = cr - buff + 1;
+        if (used < len && buff[used] == '\n') used++;
+        memmove (buff, buff + used, len - used);
+        len -= used;
+        }
+      if (len == sizeof (buff)) len = 0;
+      }
+    close (sock);
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  bench_parse_response
+
+  Make a playlist response, with the kind of quoting that real names
+  need
+
+==========================================================================*/
+static char *bench_parse_response (int entries)
+  {
+  size_t size = 16 + (size_t)entries * 80;
+  char *response = malloc (size);
+  size_t len = snprintf (response, size, "0");
+  for (int i = 0; i < entries; i++)
+    len += snprintf (response + len, size - len, 
+      " \"/music/Artist %d/Album %d/%02d - Track \\\"%d\\\".flac\"",
+      i % 997, i % 89, i % 20 + 1, i);
+  snprintf (response + len, size - len, "\n");
+  return response;
+  }
+
+
+/*==========================================================================
+
+  bench_parse_run
+
+==========================================================================*/
+BOOL bench_parse_run (int entries, int times, FILE *out, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  if (entries <= 0 || times <= 0)
+    {
+    asprintf (error, "Entries and times must be positive");
+    LOG_OUT
+    return FALSE;
+    }
+
+  BenchParseServer s;
+  s.conn = -1;
+  s.response = bench_parse_response (entries);
+  s.sock = socket (AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sin;
+  socklen_t sinlen = sizeof (sin);
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (s.sock < 0 || bind (s.sock, (struct sockaddr *)&sin, sizeof (sin)) 
+       || listen (s.sock, 5) 
+       || getsockname (s.sock, (struct sockaddr *)&sin, &sinlen))
+    {
+    asprintf (error, "Can't listen on the loopback interface: %s",
+      strerror (errno));
+    if (s.sock >= 0) close (s.sock);
+    free (s.response);
+    LOG_OUT
+    return FALSE;
+    }
+  int port = ntohs (sin.sin_port);
+  const char *host = "127.0.0.1";
+  pthread_t thread;
+  pthread_create (&thread, NULL, bench_parse_serve, &s);
+
+  double mb = strlen (s.response) / 1000000.0;
+  fprintf (out, "Playlist of %d entries, %.2f MB response, %d times\n", 
+    entries, mb, times);
+
+  // First just fetch the response, then fetch it and make a playlist of 
+  //  it; the difference is the time taken to parse it
+  int64_t receive = 0, parse = 0;
+  XSClient *client = xineserver_get_client (host, port);
+  for (int i = 0; i < times && !*error; i++)
+    {
+    char *response = NULL;
+    int64_t t0 = bench_usec ();
+    if (xsclient_send_and_receive (client, XINESERVER_CMD_PLAYLIST, 
+         &response, error))
+      {
+      receive += bench_usec () - t0;
+      free (response);
+      }
+    }
+  for (int i = 0; i < times && !*error; i++)
+    {
+    XSPlaylist *playlist = NULL;
+    int error_code = 0;
+    int64_t t0 = bench_usec ();
+    if (xineserver_playlist (host, port, &playlist, &error_code, error))
+      {
+      parse += bench_usec () - t0;
+      if (xsplaylist_get_nentries (playlist) != entries)
+        asprintf (error, "Parsed %d entries, not %d", 
+          xsplaylist_get_nentries (playlist), entries);
+      xsplaylist_destroy (playlist);
+      }
+    }
+
+  if (!*error)
+    {
+    double r = receive / 1000.0 / times;
+    double p = parse / 1000.0 / times;
+    fprintf (out, "\n%-14s %9s %9s %12s\n", "", "ms each", "MB/s", 
+      "entries/s");
+    fprintf (out, "%-14s %9.2f %9.1f %12.0f\n", "receive", r, 
+      mb * 1000 / r, entries * 1000 / r);
+    fprintf (out, "%-14s %9.2f %9.1f %12.0f\n", "receive+parse", p, 
+      mb * 1000 / p, entries * 1000 / p);
+    if (p > r)
+      fprintf (out, "%-14s %9.2f %9.1f %12.0f\n", "parse", p - r, 
+        mb * 1000 / (p - r), entries * 1000 / (p - r));
+    ret = TRUE;
+    }
+
+  shutdown (s.sock, SHUT_RDWR);
+  if (s.conn >= 0) shutdown (s.conn, SHUT_RDWR);
+  pthread_join (thread, NULL);
+  close (s.sock);
+  free (s.response);
+  LOG_OUT
+  return ret;
+  }
+
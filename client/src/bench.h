@@ -0,0 +1,48 @@
+/*============================================================================
+
+  xine-client
+  bench.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdio.h>
+#include "defs.h"
+
+#define BENCH_DEF_SECONDS 10
+#define BENCH_DEF_CONCURRENCY 4
+#define BENCH_DEF_MIX "status=70,meta-info=20,playlist=10"
+
+// How each thread connects: one connection kept open, or a new one for
+//  each request
+#define BENCH_CONNS_PERSISTENT "persistent"
+#define BENCH_CONNS_REQUEST "per-request"
+
+// The stream that 'add' requests put in the playlist
+#define BENCH_ADD_STREAM "xine-client-bench"
+
+#define BENCH_PARSE_DEF_ENTRIES 50000
+#define BENCH_PARSE_DEF_TIMES 20
+
+BEGIN_DECLS
+
+// Send requests to the server from 'concurrency' threads for 'seconds',
+//  choosing each request at random, in the proportions given by 'mix'
+//  (e.g., "status=70,add=30"), and write the throughput and latency of
+//  each kind of request to 'out'. If 'persistent' is set, each thread 
+//  keeps one connection open; otherwise it connects for each request.
+//  Returns FALSE, with an error message, if the arguments are no good
+//  or the server can't be reached
+BOOL bench_run (const char *host, int port, double seconds,
+       int concurrency, const char *mix, BOOL persistent, FILE *out, 
+       char **error);
+
+// Time how long the API takes to receive and parse a playlist response
+//  of 'entries' items, 'times' times, and write the results to 'out'
+BOOL bench_parse_run (int entries, int times, FILE *out, char **error);
+
+END_DECLS
+
+
@@ -29,6 +29,7 @@
 #include "console.h" 
 #include "usage.h" 
 #include "numberformat.h" 
+#include "bench.h" 
 #include "../../api/xine-server-api.h" 
 
 /*==========================================================================
@@ -244,6 +245,148 @@ static int program_cmd_add (const ProgramContext *context, const char *host,
   return ret;
   }
 
+/*==========================================================================
+
+  program_read_positions
+
+  Read playlist positions from arguments, reporting the first that is
+  not a number
+
+==========================================================================*/
+static BOOL program_read_positions (const char *cmd, char **args, int n,
+      int *positions)
+  {
+  for (int i = 0; i < n; i++)
+    {
+    uint64_t v;
+    if (!numberformat_read_integer (args[i], &v, TRUE))
+      {
+      fprintf (stderr, NAME " %s: error: bad number '%s'\n", cmd, args[i]);
+      return FALSE;
+      }
+    positions[i] = v;
+    }
+  return TRUE;
+  }
+
+/*==========================================================================
+
+  program_cmd_insert
+
+==========================================================================*/
+static int program_cmd_insert (const ProgramContext *context, 
+      const char *host, int port, int argc, char **argv)
+  {
+  LOG_IN
+  int ret = 0;
+ 
+  int pos;
+  if (argc >= 3)
+    {
+    if (program_read_positions ("insert", argv + 1, 1, &pos))
+      {
+      int error_code = 0;
+      char *error = NULL;
+      if (!xineserver_insert (host, port, pos, argc - 2, 
+                (const char *const *)argv + 2, &error_code, &error))
+        {
+        fprintf (stderr, NAME " insert: error %d: %s\n", error_code, error);
+        ret = -1;
+        free (error);
+        }
+      }
+    else
+      ret = -1;
+    }
+  else
+    {
+    fprintf (stderr, "Usage: " NAME " insert {position} {streams}\n");
+    ret = -1;
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  program_cmd_remove
+
+==========================================================================*/
+static int program_cmd_remove (const ProgramContext *context, 
+      const char *host, int port, int argc, char **argv)
+  {
+  LOG_IN
+  int ret = 0;
+ 
+  int pos[2];
+  if (argc == 2 || argc == 3)
+    {
+    if (program_read_positions ("remove", argv + 1, argc - 1, pos))
+      {
+      if (argc == 2) pos[1] = pos[0];
+      int error_code = 0;
+      char *error = NULL;
+      if (!xineserver_remove (host, port, pos[0], pos[1], &error_code, 
+             &error))
+        {
+        fprintf (stderr, NAME " remove: error %d: %s\n", error_code, error);
+        ret = -1;
+        free (error);
+        }
+      }
+    else
+      ret = -1;
+    }
+  else
+    {
+    fprintf (stderr, "Usage: " NAME " remove {from} [to]\n");
+    ret = -1;
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  program_cmd_move
+
+==========================================================================*/
+static int program_cmd_move (const ProgramContext *context, 
+      const char *host, int port, int argc, char **argv)
+  {
+  LOG_IN
+  int ret = 0;
+ 
+  int pos[3];
+  if (argc == 4)
+    {
+    if (program_read_positions ("move", argv + 1, 3, pos))
+      {
+      int error_code = 0;
+      char *error = NULL;
+      if (!xineserver_move (host, port, pos[0], pos[1], pos[2], 
+             &error_code, &error))
+        {
+        fprintf (stderr, NAME " move: error %d: %s\n", error_code, error);
+        ret = -1;
+        free (error);
+        }
+      }
+    else
+      ret = -1;
+    }
+  else
+    {
+    fprintf (stderr, "Usage: " NAME " move {from} {to} {dest}\n");
+    ret = -1;
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
 /*==========================================================================
 
   program_cmd_seek
@@ -334,6 +477,120 @@ static int program_cmd_eq (const ProgramContext *context, const char *host,
   return ret;
   }
 
+/*==========================================================================
+
+  program_cmd_levels
+
+  Print each new measurement from the server's level meter, for the
+  given number of seconds; or, with no argument, print the first one.
+  The meter only starts when it is first asked for levels, so the
+  first few requests might not return a measurement
+
+==========================================================================*/
+static int program_cmd_levels (const ProgramContext *context, 
+      const char *host, int port, int argc, char **argv)
+  {
+  LOG_IN
+  int ret = 0;
+ 
+  if (argc <= 2)
+    {
+    // Give up after a second, with no argument, if the meter never 
+    //  produces anything, e.g., because nothing is playing
+    double seconds = argc == 2 ? atof (argv[1]) : 1;
+    struct timespec start, now;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    uint32_t last_seq = 0;
+    BOOL done = FALSE;
+    while (!done)
+      {
+      int error_code = 0;
+      char *error = NULL;
+      XSLevels levels;
+      if (xineserver_get_levels (host, port, &levels, &error_code, &error))
+        {
+        if (levels.seq != 0 && levels.seq != last_seq)
+          {
+          printf ("rms");
+          for (int i = 0; i < levels.channels; i++)
+            printf (" %.1f", levels.rms[i]);
+          printf (" peak");
+          for (int i = 0; i < levels.channels; i++)
+            printf (" %.1f", levels.peak[i]);
+          printf (" bands");
+          for (int i = 0; i < XINESERVER_LEVELS_BANDS; i++)
+            printf (" %.1f", levels.bands[i]);
+          printf ("\n");
+          fflush (stdout);
+          last_seq = levels.seq;
+          if (argc == 1) done = TRUE;
+          }
+        }
+      else
+        { 
+        fprintf (stderr, NAME " levels: error %d: %s\n", error_code, error);
+        ret = -1;
+        free (error);
+        done = TRUE;
+        }
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      double elapsed = (now.tv_sec - start.tv_sec) 
+        + (now.tv_nsec - start.tv_nsec) / 1e9;
+      if (elapsed >= seconds) done = TRUE;
+      if (!done) usleep (25000);
+      }
+    }
+  else
+    {
+    fprintf (stderr, "Usage: " NAME " levels [seconds]\n");
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  program_cmd_bench
+
+  Load test the server, and report throughput and latency
+
+==========================================================================*/
+static int program_cmd_bench (const ProgramContext *context, 
+      const char *host, int port, int argc, char **argv)
+  {
+  LOG_IN
+  int ret = 0;
+ 
+  const char *conns = argc >= 5 ? argv[4] : BENCH_CONNS_PERSISTENT;
+  BOOL persistent = strcmp (conns, BENCH_CONNS_PERSISTENT) == 0;
+  if (argc <= 5 && (persistent || strcmp (conns, BENCH_CONNS_REQUEST) == 0))
+    {
+    double seconds = argc >= 2 ? atof (argv[1]) : BENCH_DEF_SECONDS;
+    int concurrency = argc >= 3 ? atoi (argv[2]) : BENCH_DEF_CONCURRENCY;
+    const char *mix = argc >= 4 ? argv[3] : BENCH_DEF_MIX;
+    char *error = NULL;
+    if (!bench_run (host, port, seconds, concurrency, mix, persistent, 
+          stdout, &error))
+      {
+      fprintf (stderr, NAME " bench: %s\n", error);
+      free (error);
+      ret = -1;
+      }
+    }
+  else
+    {
+    fprintf (stderr, "Usage: " NAME " bench [seconds] [threads] [mix] "
+      "[" BENCH_CONNS_PERSISTENT "|" BENCH_CONNS_REQUEST "]\n");
+    ret = -1;
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
+
 /*==========================================================================
 
   program_cmd_volume
@@ -498,6 +755,133 @@ static int program_cmd_prev (const ProgramContext *context, const char *host,
   return ret;
   }
 
+/*==========================================================================
+
+  program_cmd_shuffle
+
+==========================================================================*/
+static int program_cmd_shuffle (const ProgramContext *context, 
+      const char *host, int port, int argc, char **argv)
+  {
+  LOG_IN
+  int ret = 0;
+ 
+  char *error = NULL;
+  int error_code = 0;
+  if (argc == 2)
+    {
+    const char *arg = argv[1];
+    if (strcmp (arg, "on") == 0 || strcmp (arg, "off") == 0)
+      {
+      if (!xineserver_set_shuffle (host, port, strcmp (arg, "on") == 0, 
+            &error_code, &error))
+        {
+        fprintf (stderr, NAME " shuffle: error %d: %s\n", error_code, error);
+        ret = -1;
+        free (error);
+        }
+      }
+    else
+      {
+      fprintf (stderr, NAME " shuffle: argument must be 'on' or 'off'\n");
+      ret = -1;
+      }
+    }
+  else
+    {
+    XSStatus *status;
+    if (xineserver_status (host, port, &status, &error_code, &error))
+      {
+      printf ("%s\n", xsstatus_get_shuffle (status) ? "on" : "off");
+      xsstatus_destroy (status); 
+      }
+    else
+      {
+      fprintf (stderr, NAME " shuffle: error %d: %s\n", error_code, error);
+      ret = -1;
+      free (error);
+      }
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
+/*==========================================================================
+
+  program_repeat_to_string
+
+==========================================================================*/
+static const char *program_repeat_to_string (XSRepeatMode mode)
+  {
+  switch (mode)
+    {
+    case XINESERVER_REPEAT_ONE: return "one";
+    case XINESERVER_REPEAT_ALL: return "all";
+    default: return "off";
+    }
+  }
+
+/*==========================================================================
+
+  program_cmd_repeat
+
+==========================================================================*/
+static int program_cmd_repeat (const ProgramContext *context, 
+      const char *host, int port, int argc, char **argv)
+  {
+  LOG_IN
+  int ret = 0;
+ 
+  char *error = NULL;
+  int error_code = 0;
+  if (argc == 2)
+    {
+    const char *arg = argv[1];
+    int mode = -1;
+    if (strcmp (arg, "off") == 0)
+      mode = XINESERVER_REPEAT_OFF;
+    else if (strcmp (arg, "one") == 0)
+      mode = XINESERVER_REPEAT_ONE;
+    else if (strcmp (arg, "all") == 0)
+      mode = XINESERVER_REPEAT_ALL;
+    if (mode >= 0)
+      {
+      if (!xineserver_set_repeat (host, port, mode, &error_code, &error))
+        {
+        fprintf (stderr, NAME " repeat: error %d: %s\n", error_code, error);
+        ret = -1;
+        free (error);
+        }
+      }
+    else
+      {
+      fprintf (stderr, 
+        NAME " repeat: argument must be 'off', 'one', or 'all'\n");
+      ret = -1;
+      }
+    }
+  else
+    {
+    XSStatus *status;
+    if (xineserver_status (host, port, &status, &error_code, &error))
+      {
+      printf ("%s\n", 
+        program_repeat_to_string (xsstatus_get_repeat (status)));
+      xsstatus_destroy (status); 
+      }
+    else
+      {
+      fprintf (stderr, NAME " repeat: error %d: %s\n", error_code, error);
+      ret = -1;
+      free (error);
+      }
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
 /*==========================================================================
 
   program_cmd_clear
@@ -555,6 +939,9 @@ static int program_cmd_status (const ProgramContext *context, const char *host,
       case XINESERVER_TRANSPORT_BUFFERING: ts = "buffering"; break;
       }
     printf ("transport: %s\n", ts); 
+    printf ("shuffle: %s\n", xsstatus_get_shuffle (status) ? "on" : "off");
+    printf ("repeat: %s\n", 
+      program_repeat_to_string (xsstatus_get_repeat (status)));
     xsstatus_destroy (status); 
     }
   else
@@ -636,6 +1023,42 @@ static int program_cmd_version (const ProgramContext *context,
   }
 
 
+/*==========================================================================
+
+  program_cmd_bench_parse
+
+  Time the API's handling of large playlist responses
+
+==========================================================================*/
+static int program_cmd_bench_parse (const ProgramContext *context, 
+      const char *host, int port, int argc, char **argv)
+  {
+  LOG_IN
+  int ret = 0;
+ 
+  if (argc <= 3)
+    {
+    int entries = argc >= 2 ? atoi (argv[1]) : BENCH_PARSE_DEF_ENTRIES;
+    int times = argc >= 3 ? atoi (argv[2]) : BENCH_PARSE_DEF_TIMES;
+    char *error = NULL;
+    if (!bench_parse_run (entries, times, stdout, &error))
+      {
+      fprintf (stderr, NAME " bench-parse: %s\n", error);
+      free (error);
+      ret = -1;
+      }
+    }
+  else
+    {
+    fprintf (stderr, "Usage: " NAME " bench-parse [entries] [times]\n");
+    ret = -1;
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
+
 /*==========================================================================
 
   program_do_cmd
@@ -650,6 +1073,16 @@ static int program_do_cmd (const ProgramContext *context, const char *host,
   const char *cmd = argv[0];
   if (strcmp (cmd, "add") == 0)
     ret = program_cmd_add (context, host, port, argc, argv);
+  else if (strcmp (cmd, "bench") == 0)
+    ret = program_cmd_bench (context, host, port, argc, argv);
+  else if (strcmp (cmd, "bench-parse") == 0)
+    ret = program_cmd_bench_parse (context, host, port, argc, argv);
+  else if (strcmp (cmd, "insert") == 0)
+    ret = program_cmd_insert (context, host, port, argc, argv);
+  else if (strcmp (cmd, "remove") == 0)
+    ret = program_cmd_remove (context, host, port, argc, argv);
+  else if (strcmp (cmd, "move") == 0)
+    ret = program_cmd_move (context, host, port, argc, argv);
   else if (strcmp (cmd, "playlist") == 0)
     ret = program_cmd_playlist (context, host, port, argc, argv);
   else if (strcmp (cmd, "stop") == 0)
@@ -670,6 +1103,10 @@ static int program_do_cmd (const ProgramContext *context, const char *host,
     ret = program_cmd_next (context, host, port, argc, argv);
   else if (strcmp (cmd, "prev") == 0)
     ret = program_cmd_prev (context, host, port, argc, argv);
+  else if (strcmp (cmd, "shuffle") == 0)
+    ret = program_cmd_shuffle (context, host, port, argc, argv);
+  else if (strcmp (cmd, "repeat") == 0)
+    ret = program_cmd_repeat (context, host, port, argc, argv);
   else if (strcmp (cmd, "volume") == 0)
     ret = program_cmd_volume (context, host, port, argc, argv);
   else if (strcmp (cmd, "meta-info") == 0)
@@ -678,6 +1115,8 @@ static int program_do_cmd (const ProgramContext *context, const char *host,
     ret = program_cmd_seek (context, host, port, argc, argv);
   else if (strcmp (cmd, "eq") == 0)
     ret = program_cmd_eq (context, host, port, argc, argv);
+  else if (strcmp (cmd, "levels") == 0)
+    ret = program_cmd_levels (context, host, port, argc, argv);
   else if (strcmp (cmd, "version") == 0)
     ret = program_cmd_version (context, host, port, argc, argv);
   else
@@ -32,8 +32,15 @@ void usage_show (FILE *fout, const char *argv0)
   fprintf (fout, "  -v,--version            show version\n");
   fprintf (fout, "\nCommands:\n");
   fprintf (fout, "  add {streams}       add files or streams to playlist\n");
+  fprintf (fout, "  bench [s] [N] [mix] [C]\n");
+  fprintf (fout, "                      load test for s sec with N threads;\n");
+  fprintf (fout, "                      C is persistent or per-request\n");
+  fprintf (fout, "  bench-parse [N] [T] time parsing N items T times\n");
   fprintf (fout, "  clear               stop playback and clear playlist\n");
   fprintf (fout, "  eq [0]..[10]        set equalizer levels, 0..10\n");
+  fprintf (fout, "  insert N {streams}  insert files or streams at N\n");
+  fprintf (fout, "  levels [sec]        show audio levels in dB, for sec\n");
+  fprintf (fout, "  move N M D          move items N to M to position D\n");
   fprintf (fout, "  next                play next in playlist\n");
   fprintf (fout, "  pause               pause playback:\n");
   fprintf (fout, "  play-now {streams}  as 'add', but clear playlist first\n");
@@ -41,7 +48,10 @@ void usage_show (FILE *fout, const char *argv0)
   fprintf (fout, "  play                resume paused playback\n");
   fprintf (fout, "  play N              play playlist item N (first is 0)\n");
   fprintf (fout, "  prev                play previous in playlist\n");
+  fprintf (fout, "  remove N [M]        remove items N to M from playlist\n");
+  fprintf (fout, "  repeat [M]          set or get repeat: off, one or all\n");
   fprintf (fout, "  seek {sec}          set playback position in seconds\n");
+  fprintf (fout, "  shuffle [on|off]    set or get shuffle mode\n");
   fprintf (fout, "  shutdown            shutdown the server\n");
   fprintf (fout, "  status              show playback status\n");
   fprintf (fout, "  stop                stop playback\n");
@@ -0,0 +1,610 @@
+/*==========================================================================
+
+  xine-server
+  audiotap.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A level meter, for clients that show VU meters or spectra. It is a
+  Xine audio post plugin, which passes the decoded audio through to the
+  output port unchanged, measuring it on the way: the RMS and peak
+  level of each channel, and the spectrum of the mix of all channels. A
+  measurement is made 'rate' times a second, and the latest one can be
+  read at any time.
+
+  The plugin is registered with Xine by the server itself, so nothing
+  needs to be installed in Xine's plugin directory. It is only wired
+  into a stream while clients are reading levels (see xine_interface.c),
+  and measures only while its lease is current, so it costs nothing
+  when no client is interested.
+
+  The spectrum is a radix-2 FFT of the most recent AUDIOTAP_FFT_SIZE
+  samples, with a Hann window. Samples are first converted to float in
+  a single pass over each buffer, and the FFT works on separate arrays
+  of real and imaginary parts, so that the inner loops are simple float
+  arithmetic that the compiler can vectorize.
+
+  All the measuring is done on Xine's audio output thread; only the
+  published measurement is shared, under a mutex.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <xine.h>
+#include <xine/xine_internal.h>
+#include <xine/xine_plugin.h>
+#include <xine/post.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "audiotap.h"
+
+// Samples in each spectrum. Must be a power of two. At 44.1kHz, each
+//  FFT bin is about 21Hz wide
+#define AUDIOTAP_FFT_SIZE 2048
+
+#define AUDIOTAP_PLUGIN_ID "xine-server-tap"
+
+struct _AudioTap
+  {
+  xine_t *xine;
+  xine_post_t *post;
+  int rate;
+  // End of the lease, in usec of CLOCK_MONOTONIC
+  int64_t lease_until;
+  // Format of the audio, set when the port is opened
+  int bits;
+  int channels;
+  int sample_rate;
+  // Samples between measurements
+  int interval;
+  // Each buffer, converted to float
+  float *conv;
+  size_t conv_size;
+  // Sums since the last measurement
+  int count;
+  double sum_sq[XINESERVER_LEVELS_MAX_CHANNELS];
+  float peak[XINESERVER_LEVELS_MAX_CHANNELS];
+  // The most recent mono samples, as a ring
+  float ring[AUDIOTAP_FFT_SIZE];
+  int ring_pos;
+  // FFT working space and tables
+  float re[AUDIOTAP_FFT_SIZE];
+  float im[AUDIOTAP_FFT_SIZE];
+  float window[AUDIOTAP_FFT_SIZE];
+  float cos_table[AUDIOTAP_FFT_SIZE / 2];
+  float sin_table[AUDIOTAP_FFT_SIZE / 2];
+  int bitrev[AUDIOTAP_FFT_SIZE];
+  // Scales bin power so a full-scale sine reads 1.0 in its band
+  double power_scale;
+  // FFT bins in each band, for the current sample rate
+  int band_first[XINESERVER_LEVELS_BANDS];
+  int band_last[XINESERVER_LEVELS_BANDS];
+  // The latest measurement, protected by mutex
+  pthread_mutex_t mutex;
+  XSLevels levels;
+  };
+
+// The post plugin instance. Xine's post_plugin_t must come first
+typedef struct _AudioTapPlugin
+  {
+  post_plugin_t post;
+  AudioTap *tap;
+  } AudioTapPlugin;
+
+static pthread_mutex_t audiotap_register_mutex = PTHREAD_MUTEX_INITIALIZER;
+static xine_t *audiotap_registered_xine = NULL;
+
+
+/*==========================================================================
+
+  audiotap_usec
+
+==========================================================================*/
+static int64_t audiotap_usec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+
+/*==========================================================================
+
+  audiotap_db
+
+  Convert a power (not amplitude) ratio to dB, no lower than the floor
+
+==========================================================================*/
+static double audiotap_db (double power)
+  {
+  double ret = power > 0 ? 10 * log10 (power) : XINESERVER_LEVELS_FLOOR;
+  return ret < XINESERVER_LEVELS_FLOOR ? XINESERVER_LEVELS_FLOOR : ret;
+  }
+
+
+/*==========================================================================
+
+  audiotap_set_format
+
+  Called when the port is opened. Works out the band edges as FFT
+  bins; a band too narrow to contain a bin uses the bin nearest its
+  centre
+
+==========================================================================*/
+static void audiotap_set_format (AudioTap *self, int bits, int rate,
+      int channels)
+  {
+  self->bits = bits;
+  self->sample_rate = rate;
+  self->channels = channels;
+  self->interval = rate / self->rate > 0 ? rate / self->rate : 1;
+  self->count = 0;
+  memset (self->sum_sq, 0, sizeof (self->sum_sq));
+  memset (self->peak, 0, sizeof (self->peak));
+  if (rate <= 0) return;
+
+  double ratio = (double)XINESERVER_LEVELS_MAX_FREQ
+    / XINESERVER_LEVELS_MIN_FREQ;
+  double bin_hz = (double)rate / AUDIOTAP_FFT_SIZE;
+  int max_bin = AUDIOTAP_FFT_SIZE / 2 - 1;
+  for (int b = 0; b < XINESERVER_LEVELS_BANDS; b++)
+    {
+    double lo = XINESERVER_LEVELS_MIN_FREQ
+      * pow (ratio, (double)b / XINESERVER_LEVELS_BANDS);
+    double hi = XINESERVER_LEVELS_MIN_FREQ
+      * pow (ratio, (double)(b + 1) / XINESERVER_LEVELS_BANDS);
+    int first = (int)ceil (lo / bin_hz);
+    int last = (int)ceil (hi / bin_hz) - 1;
+    if (last < first)
+      first = last = (int)(sqrt (lo * hi) / bin_hz + 0.5);
+    if (first < 1) first = 1;
+    if (last > max_bin) last = max_bin;
+    if (first > last) first = last;
+    self->band_first[b] = first;
+    self->band_last[b] = last;
+    }
+  }
+
+
+/*==========================================================================
+
+  audiotap_convert
+
+  Convert samples in Xine's output formats to float, with full scale
+  at 1.0. 32-bit samples are already float. Returns FALSE for formats
+  that are not understood
+
+==========================================================================*/
+static BOOL audiotap_convert (int bits, const void *mem, float *out,
+      size_t n)
+  {
+  switch (bits)
+    {
+    case 8:
+      {
+      const uint8_t *p = mem;
+      for (size_t i = 0; i < n; i++)
+        out[i] = ((int)p[i] - 128) * (1.0f / 128);
+      return TRUE;
+      }
+    case 16:
+      {
+      const int16_t *p = mem;
+      for (size_t i = 0; i < n; i++)
+        out[i] = p[i] * (1.0f / 32768);
+      return TRUE;
+      }
+    case 24:
+      {
+      const uint8_t *p = mem;
+      for (size_t i = 0; i < n; i++)
+        out[i] = (int32_t)(((uint32_t)p[3 * i] << 8)
+          | ((uint32_t)p[3 * i + 1] << 16) | ((uint32_t)p[3 * i + 2] << 24))
+          * (1.0f / 2147483648.0f);
+      return TRUE;
+      }
+    case 32:
+      memcpy (out, mem, n * sizeof (float));
+      return TRUE;
+    }
+  return FALSE;
+  }
+
+
+/*==========================================================================
+
+  audiotap_fft
+
+  In-place radix-2 FFT of re[] and im[]
+
+==========================================================================*/
+static void audiotap_fft (AudioTap *self)
+  {
+  float *re = self->re;
+  float *im = self->im;
+  const int n = AUDIOTAP_FFT_SIZE;
+  for (int i = 0; i < n; i++)
+    {
+    int j = self->bitrev[i];
+    if (j > i)
+      {
+      float t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+      }
+    }
+  for (int len = 2; len <= n; len <<= 1)
+    {
+    int half = len / 2;
+    int step = n / len;
+    for (int i = 0; i < n; i += len)
+      {
+      float *ar = re + i, *ai = im + i;
+      float *br = re + i + half, *bi = im + i + half;
+      for (int k = 0; k < half; k++)
+        {
+        float wr = self->cos_table[k * step];
+        float wi = -self->sin_table[k * step];
+        float xr = br[k] * wr - bi[k] * wi;
+        float xi = br[k] * wi + bi[k] * wr;
+        br[k] = ar[k] - xr;
+        bi[k] = ai[k] - xi;
+        ar[k] += xr;
+        ai[k] += xi;
+        }
+      }
+    }
+  }
+
+
+/*==========================================================================
+
+  audiotap_publish
+
+  Make a measurement from the sums since the last one, and the ring of
+  recent samples
+
+==========================================================================*/
+static void audiotap_publish (AudioTap *self)
+  {
+  XSLevels l;
+  memset (&l, 0, sizeof (XSLevels));
+  l.channels = self->channels < XINESERVER_LEVELS_MAX_CHANNELS
+    ? self->channels : XINESERVER_LEVELS_MAX_CHANNELS;
+  for (int c = 0; c < l.channels; c++)
+    {
+    l.rms[c] = audiotap_db (self->count ? self->sum_sq[c] / self->count : 0);
+    l.peak[c] = audiotap_db ((double)self->peak[c] * self->peak[c]);
+    self->sum_sq[c] = 0;
+    self->peak[c] = 0;
+    }
+  self->count = 0;
+
+  // Oldest sample first
+  int n1 = AUDIOTAP_FFT_SIZE - self->ring_pos;
+  for (int i = 0; i < n1; i++)
+    self->re[i] = self->ring[self->ring_pos + i] * self->window[i];
+  for (int i = n1; i < AUDIOTAP_FFT_SIZE; i++)
+    self->re[i] = self->ring[i - n1] * self->window[i];
+  memset (self->im, 0, sizeof (self->im));
+  audiotap_fft (self);
+  for (int b = 0; b < XINESERVER_LEVELS_BANDS; b++)
+    {
+    double power = 0;
+    for (int k = self->band_first[b]; k <= self->band_last[b]; k++)
+      power += (double)self->re[k] * self->re[k]
+        + (double)self->im[k] * self->im[k];
+    l.bands[b] = audiotap_db (power * self->power_scale);
+    }
+
+  pthread_mutex_lock (&self->mutex);
+  l.seq = self->levels.seq + 1;
+  self->levels = l;
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  audiotap_analyze
+
+==========================================================================*/
+static void audiotap_analyze (AudioTap *self, const audio_buffer_t *buf)
+  {
+  int channels = self->channels;
+  int n = buf->num_frames;
+  if (channels <= 0 || n <= 0 || !audiotap_is_leased (self)) return;
+
+  size_t samples = (size_t)n * channels;
+  if (samples > self->conv_size)
+    {
+    self->conv = realloc (self->conv, samples * sizeof (float));
+    self->conv_size = samples;
+    }
+  if (!audiotap_convert (self->bits, buf->mem, self->conv, samples))
+    return;
+
+  int measured = channels < XINESERVER_LEVELS_MAX_CHANNELS
+    ? channels : XINESERVER_LEVELS_MAX_CHANNELS;
+  float scale = 1.0f / channels;
+  for (int i = 0; i < n; i++)
+    {
+    const float *frame = self->conv + (size_t)i * channels;
+    float mix = 0;
+    for (int c = 0; c < channels; c++)
+      mix += frame[c];
+    for (int c = 0; c < measured; c++)
+      {
+      float v = frame[c];
+      self->sum_sq[c] += v * v;
+      if (fabsf (v) > self->peak[c]) self->peak[c] = fabsf (v);
+      }
+    self->ring[self->ring_pos] = mix * scale;
+    self->ring_pos = (self->ring_pos + 1) & (AUDIOTAP_FFT_SIZE - 1);
+    if (++self->count >= self->interval)
+      audiotap_publish (self);
+    }
+  }
+
+
+/*==========================================================================
+
+  audiotap_port_open
+
+==========================================================================*/
+static int audiotap_port_open (xine_audio_port_t *port_gen,
+      xine_stream_t *stream, uint32_t bits, uint32_t rate, int mode)
+  {
+  post_audio_port_t *port = (post_audio_port_t *)port_gen;
+  AudioTapPlugin *plugin = (AudioTapPlugin *)port->post;
+  _x_post_rewire (port->post);
+  _x_post_inc_usage (port);
+  port->stream = stream;
+  port->bits = bits;
+  port->rate = rate;
+  port->mode = mode;
+  if (plugin->tap)
+    audiotap_set_format (plugin->tap, bits, rate, _x_ao_mode2channels (mode));
+  return port->original_port->open (port->original_port, stream, bits,
+    rate, mode);
+  }
+
+
+/*==========================================================================
+
+  audiotap_port_close
+
+==========================================================================*/
+static void audiotap_port_close (xine_audio_port_t *port_gen,
+      xine_stream_t *stream)
+  {
+  post_audio_port_t *port = (post_audio_port_t *)port_gen;
+  port->stream = NULL;
+  port->original_port->close (port->original_port, stream);
+  _x_post_dec_usage (port);
+  }
+
+
+/*==========================================================================
+
+  audiotap_port_put_buffer
+
+  The buffer belongs to the output port once it has been passed on, so
+  it must be measured first
+
+==========================================================================*/
+static void audiotap_port_put_buffer (xine_audio_port_t *port_gen,
+      audio_buffer_t *buf, xine_stream_t *stream)
+  {
+  post_audio_port_t *port = (post_audio_port_t *)port_gen;
+  AudioTapPlugin *plugin = (AudioTapPlugin *)port->post;
+  if (plugin->tap)
+    audiotap_analyze (plugin->tap, buf);
+  port->original_port->put_buffer (port->original_port, buf, stream);
+  }
+
+
+/*==========================================================================
+
+  audiotap_dispose_plugin
+
+==========================================================================*/
+static void audiotap_dispose_plugin (post_plugin_t *post)
+  {
+  if (_x_post_dispose (post))
+    free (post);
+  }
+
+
+/*==========================================================================
+
+  audiotap_open_plugin
+
+==========================================================================*/
+static post_plugin_t *audiotap_open_plugin (post_class_t *class,
+      int inputs, xine_audio_port_t **audio_target,
+      xine_video_port_t **video_target)
+  {
+  if (!audio_target || !audio_target[0]) return NULL;
+  AudioTapPlugin *plugin = calloc (1, sizeof (AudioTapPlugin));
+  post_in_t *input;
+  post_out_t *output;
+  _x_post_init (&plugin->post, 1, 0);
+  post_audio_port_t *port = _x_post_intercept_audio_port (&plugin->post,
+    audio_target[0], &input, &output);
+  port->new_port.open = audiotap_port_open;
+  port->new_port.close = audiotap_port_close;
+  port->new_port.put_buffer = audiotap_port_put_buffer;
+  plugin->post.xine_post.audio_input[0] = &port->new_port;
+  plugin->post.dispose = audiotap_dispose_plugin;
+  return &plugin->post;
+  }
+
+
+/*==========================================================================
+
+  audiotap_init_class
+
+==========================================================================*/
+static void *audiotap_init_class (xine_t *xine, const void *data)
+  {
+  post_class_t *class = calloc (1, sizeof (post_class_t));
+  class->open_plugin = audiotap_open_plugin;
+  class->identifier = AUDIOTAP_PLUGIN_ID;
+  class->description = "xine-server level meter";
+  class->dispose = default_post_class_dispose;
+  return class;
+  }
+
+
+static const post_info_t audiotap_special_info =
+  { XINE_POST_TYPE_AUDIO_FILTER };
+
+static const plugin_info_t audiotap_plugin_info[] =
+  {
+  { PLUGIN_POST, 10, AUDIOTAP_PLUGIN_ID, XINE_VERSION_CODE,
+    &audiotap_special_info, audiotap_init_class },
+  { PLUGIN_NONE, 0, NULL, 0, NULL, NULL }
+  };
+
+
+/*==========================================================================
+
+  audiotap_create
+
+==========================================================================*/
+AudioTap *audiotap_create (xine_t *xine, xine_audio_port_t *ao_port,
+      int rate)
+  {
+  LOG_IN
+  // Zones share one Xine engine, which needs the plugin only once
+  pthread_mutex_lock (&audiotap_register_mutex);
+  if (audiotap_registered_xine != xine)
+    {
+    xine_register_plugins (xine, audiotap_plugin_info);
+    audiotap_registered_xine = xine;
+    }
+  pthread_mutex_unlock (&audiotap_register_mutex);
+
+  AudioTap *self = NULL;
+  xine_post_t *post = xine_post_init (xine, AUDIOTAP_PLUGIN_ID, 1,
+    &ao_port, NULL);
+  if (post)
+    {
+    self = malloc (sizeof (AudioTap));
+    memset (self, 0, sizeof (AudioTap));
+    self->xine = xine;
+    self->post = post;
+    self->rate = rate > 0 ? rate : AUDIOTAP_DEF_RATE;
+    pthread_mutex_init (&self->mutex, NULL);
+    for (int b = 0; b < XINESERVER_LEVELS_BANDS; b++)
+      self->levels.bands[b] = XINESERVER_LEVELS_FLOOR;
+
+    const int n = AUDIOTAP_FFT_SIZE;
+    double sum_sq = 0;
+    for (int i = 0; i < n; i++)
+      {
+      self->window[i] = 0.5 - 0.5 * cos (2 * M_PI * i / n);
+      sum_sq += (double)self->window[i] * self->window[i];
+      }
+    // A sine of amplitude A has power A^2/4 * n * sum(w^2) in the
+    //  bins of one half of the spectrum; scale that to A^2
+    self->power_scale = 4.0 / (n * sum_sq);
+    for (int i = 0; i < n / 2; i++)
+      {
+      self->cos_table[i] = cos (2 * M_PI * i / n);
+      self->sin_table[i] = sin (2 * M_PI * i / n);
+      }
+    int bits = 0;
+    while ((1 << bits) < n) bits++;
+    for (int i = 0; i < n; i++)
+      {
+      int r = 0;
+      for (int b = 0; b < bits; b++)
+        if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+      self->bitrev[i] = r;
+      }
+
+    ((AudioTapPlugin *)post)->tap = self;
+    }
+  else
+    log_warning ("Can't create Xine post plugin for level meter");
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  audiotap_destroy
+
+==========================================================================*/
+void audiotap_destroy (AudioTap *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    ((AudioTapPlugin *)self->post)->tap = NULL;
+    xine_post_dispose (self->xine, self->post);
+    if (self->conv) free (self->conv);
+    pthread_mutex_destroy (&self->mutex);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  audiotap_get_input
+
+==========================================================================*/
+xine_audio_port_t *audiotap_get_input (const AudioTap *self)
+  {
+  return self->post->audio_input[0];
+  }
+
+
+/*==========================================================================
+
+  audiotap_set_lease
+
+==========================================================================*/
+void audiotap_set_lease (AudioTap *self, int msec)
+  {
+  __atomic_store_n (&self->lease_until, audiotap_usec ()
+    + (int64_t)msec * 1000, __ATOMIC_RELAXED);
+  }
+
+
+/*==========================================================================
+
+  audiotap_is_leased
+
+==========================================================================*/
+BOOL audiotap_is_leased (AudioTap *self)
+  {
+  return audiotap_usec ()
+    < __atomic_load_n (&self->lease_until, __ATOMIC_RELAXED);
+  }
+
+
+/*==========================================================================
+
+  audiotap_get_levels
+
+==========================================================================*/
+void audiotap_get_levels (AudioTap *self, XSLevels *levels)
+  {
+  pthread_mutex_lock (&self->mutex);
+  *levels = self->levels;
+  pthread_mutex_unlock (&self->mutex);
+  }
+
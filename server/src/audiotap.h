@@ -0,0 +1,45 @@
+/*============================================================================
+
+  xine-server
+  audiotap.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <xine.h>
+#include "defs.h"
+#include "../../api/xine-server-api.h"
+
+struct _AudioTap;
+typedef struct _AudioTap AudioTap;
+
+// Measurements made each second, by default
+#define AUDIOTAP_DEF_RATE 20
+
+BEGIN_DECLS
+
+// Create a tap whose output goes to 'ao_port', making 'rate'
+//  measurements a second. Returns NULL if Xine can't create it. The
+//  tap does nothing until a stream is wired to audiotap_get_input()
+AudioTap          *audiotap_create (xine_t *xine, xine_audio_port_t *ao_port,
+                      int rate);
+
+// The stream must have been wired elsewhere first
+void               audiotap_destroy (AudioTap *self);
+
+xine_audio_port_t *audiotap_get_input (const AudioTap *self);
+
+// Measure until 'msec' from now, and then just pass audio through
+void               audiotap_set_lease (AudioTap *self, int msec);
+
+BOOL               audiotap_is_leased (AudioTap *self);
+
+// Get the most recent measurement
+void               audiotap_get_levels (AudioTap *self, XSLevels *levels);
+
+END_DECLS
+
+
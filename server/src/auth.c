@@ -0,0 +1,302 @@
+/*==========================================================================
+
+  xine-server
+  auth.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Roles, each with a secret token and the commands that it allows. A
+  client that sends a role's token with the 'auth' command has that
+  role until it disconnects: the token is checked once, and after that
+  each command costs a test of one bit. A role whose token is '-' is
+  given to clients that have not authenticated; without one, they can
+  send nothing but 'auth'.
+
+  The file has one role on each line -- a name, a token, and a comma-
+  separated list of commands, or '*' for all of them:
+
+    # role    token                               commands
+    admin     6c1f0e77d2a94b7e9a1f3b6c2d8e4f50    *
+    kitchen   53aa9b0c41e2f7d6a8b9c0d1e2f3a4b5    status,play,pause,zone
+    guest     -                                   status,version
+
+  Blank lines, and lines that start with '#', are ignored.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "cmdproc.h"
+#include "auth.h"
+
+struct _AuthRole
+  {
+  char *name;
+  char *token; // NULL for the role of clients that have not authenticated
+  uint64_t commands; // Bit N is set if command N is allowed
+  };
+
+struct _Auth
+  {
+  AuthRole *roles;
+  int nroles;
+  const AuthRole *guest;
+  };
+
+
+/*==========================================================================
+
+  auth_create
+
+==========================================================================*/
+Auth *auth_create (void)
+  {
+  LOG_IN
+  Auth *self = malloc (sizeof (Auth));
+  self->roles = NULL;
+  self->nroles = 0;
+  self->guest = NULL;
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  auth_clear
+
+==========================================================================*/
+static void auth_clear (Auth *self)
+  {
+  for (int i = 0; i < self->nroles; i++)
+    {
+    free (self->roles[i].name);
+    if (self->roles[i].token) free (self->roles[i].token);
+    }
+  free (self->roles);
+  self->roles = NULL;
+  self->nroles = 0;
+  self->guest = NULL;
+  }
+
+
+/*==========================================================================
+
+  auth_destroy
+
+==========================================================================*/
+void auth_destroy (Auth *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    auth_clear (self);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  auth_token_equal
+
+  Takes the same time, however much of the token is right
+
+==========================================================================*/
+static BOOL auth_token_equal (const char *a, const char *b)
+  {
+  size_t la = strlen (a);
+  size_t lb = strlen (b);
+  unsigned char diff = la != lb;
+  for (size_t i = 0; i < la; i++)
+    diff |= (unsigned char)a[i] ^ (unsigned char)(lb ? b[i % lb] : 0);
+  return diff == 0;
+  }
+
+
+/*==========================================================================
+
+  auth_parse_commands
+
+==========================================================================*/
+static BOOL auth_parse_commands (const char *list, uint64_t *commands,
+      char **error)
+  {
+  BOOL ret = TRUE;
+  *commands = 0;
+  if (strcmp (list, "*") == 0)
+    {
+    *commands = ~(uint64_t)0;
+    return TRUE;
+    }
+  char *s = strdup (list);
+  char *saveptr = NULL;
+  for (char *tok = strtok_r (s, ",", &saveptr); tok && ret;
+        tok = strtok_r (NULL, ",", &saveptr))
+    {
+    int i = cmdproc_command_index (tok);
+    if (i >= 0)
+      *commands |= (uint64_t)1 << i;
+    else
+      {
+      asprintf (error, "unknown command '%s'", tok);
+      ret = FALSE;
+      }
+    }
+  free (s);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  auth_load
+
+==========================================================================*/
+BOOL auth_load (Auth *self, const char *filename, char **error)
+  {
+  LOG_IN
+  BOOL ret = TRUE;
+  FILE *f = fopen (filename, "r");
+  if (f)
+    {
+    struct stat sb;
+    if (fstat (fileno (f), &sb) == 0 && (sb.st_mode & 077))
+      log_warning ("%s can be read by other users", filename);
+    auth_clear (self);
+    char *line = NULL;
+    size_t n = 0;
+    int lineno = 0;
+    BOOL have_guest = FALSE;
+    while (ret && getline (&line, &n, f) >= 0)
+      {
+      lineno++;
+      char *saveptr = NULL;
+      char *name = strtok_r (line, " \t\r\n", &saveptr);
+      if (!name || name[0] == '#') continue;
+      char *token = strtok_r (NULL, " \t\r\n", &saveptr);
+      char *list = strtok_r (NULL, " \t\r\n", &saveptr);
+      char *msg = NULL;
+      uint64_t commands = 0;
+      if (!token || !list || strtok_r (NULL, " \t\r\n", &saveptr))
+        asprintf (&msg, "expected a role, a token, and commands");
+      else if (strcmp (token, "-") == 0 && have_guest)
+        asprintf (&msg, "more than one role has no token");
+      else if (auth_parse_commands (list, &commands, &msg))
+        {
+        for (int i = 0; i < self->nroles && !msg; i++)
+          {
+          if (strcmp (self->roles[i].name, name) == 0)
+            asprintf (&msg, "role %s is given twice", name);
+          else if (self->roles[i].token
+              && strcmp (self->roles[i].token, token) == 0)
+            asprintf (&msg, "roles %s and %s have the same token",
+              self->roles[i].name, name);
+          }
+        }
+      if (msg)
+        {
+        asprintf (error, "%s line %d: %s", filename, lineno, msg);
+        free (msg);
+        ret = FALSE;
+        }
+      else
+        {
+        self->roles = realloc (self->roles,
+          (self->nroles + 1) * sizeof (AuthRole));
+        AuthRole *role = &self->roles[self->nroles++];
+        role->name = strdup (name);
+        role->token = strcmp (token, "-") == 0 ? NULL : strdup (token);
+        role->commands = commands;
+        if (!role->token) have_guest = TRUE;
+        }
+      }
+    if (line) free (line);
+    fclose (f);
+    // The array has stopped moving
+    for (int i = 0; i < self->nroles; i++)
+      if (!self->roles[i].token) self->guest = &self->roles[i];
+    if (ret && self->nroles == 0)
+      {
+      asprintf (error, "%s has no roles", filename);
+      ret = FALSE;
+      }
+    if (ret)
+      log_info ("Read %d roles from %s", self->nroles, filename);
+    else
+      auth_clear (self);
+    }
+  else
+    {
+    asprintf (error, "Can't open %s: %s", filename, strerror (errno));
+    ret = FALSE;
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  auth_login
+
+  Every token is compared, so that the time taken does not tell which
+  one nearly matched
+
+==========================================================================*/
+const AuthRole *auth_login (const Auth *self, const char *token)
+  {
+  const AuthRole *ret = NULL;
+  for (int i = 0; i < self->nroles; i++)
+    {
+    const AuthRole *role = &self->roles[i];
+    if (role->token && auth_token_equal (token, role->token))
+      ret = role;
+    }
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  auth_get_guest
+
+==========================================================================*/
+const AuthRole *auth_get_guest (const Auth *self)
+  {
+  return self->guest;
+  }
+
+
+/*==========================================================================
+
+  auth_role_get_name
+
+==========================================================================*/
+const char *auth_role_get_name (const AuthRole *role)
+  {
+  return role->name;
+  }
+
+
+/*==========================================================================
+
+  auth_role_allows
+
+==========================================================================*/
+BOOL auth_role_allows (const AuthRole *role, int command)
+  {
+  return command >= 0 && command < 64
+    && ((role->commands >> command) & 1) != 0;
+  }
+
+
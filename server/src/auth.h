@@ -0,0 +1,38 @@
+/*============================================================================
+
+  xine-server
+  auth.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+
+struct _Auth;
+typedef struct _Auth Auth;
+
+struct _AuthRole;
+typedef struct _AuthRole AuthRole;
+
+BEGIN_DECLS
+
+Auth           *auth_create (void);
+void            auth_destroy (Auth *self);
+// Read the roles from a file (see auth.c for the format). Returns FALSE,
+//  with an error message, if the file can't be read, or has mistakes
+BOOL            auth_load (Auth *self, const char *filename, char **error);
+// The role whose token this is, or NULL if none
+const AuthRole *auth_login (const Auth *self, const char *token);
+// The role of clients that have not authenticated, or NULL if they may
+//  not send anything but 'auth'
+const AuthRole *auth_get_guest (const Auth *self);
+const char     *auth_role_get_name (const AuthRole *role);
+// 'command' is an index from cmdproc_command_index()
+BOOL            auth_role_allows (const AuthRole *role, int command);
+
+END_DECLS
+
+
@@ -0,0 +1,811 @@
+/*==========================================================================
+
+  xine-server
+  broadcast.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Re-broadcasts the decoded audio to listeners over HTTP, so that one
+  server can fetch and decode a stream once, and other players on the
+  network can play it. Each listener gets a WAV header followed by
+  the PCM samples, in whatever format Xine decoded them to. Any player
+  that can play a WAV file from a URL can listen.
+
+  The audio is captured by a Xine audio post plugin, like the level
+  meter in audiotap.c, which passes it through to the output port
+  unchanged. The plugin copies each buffer into a single ring, and
+  each listener has a thread that sends from the ring straight to its
+  socket, so the audio is copied once however many listeners there
+  are. Nothing is copied when nobody is listening.
+
+  The writer never waits for listeners. A listener that falls behind
+  by most of the ring skips forward to the newest audio, and one that
+  takes no audio for BROADCAST_SEND_TIMEOUT_MSEC is dropped. Because a
+  listener sends without holding the lock, the writer might overwrite
+  the part of the ring being sent; the writer announces the extent of
+  each write before making it, so a listener can tell afterwards that
+  this happened, and skip forward. Either way, skipping keeps the
+  listener's stream a whole number of sample frames.
+
+  A WAV header can't describe a change of format, so listeners are
+  disconnected when the sample format or rate changes; most players
+  will simply reconnect.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <xine.h>
+#include <xine/xine_internal.h>
+#include <xine/xine_plugin.h>
+#include <xine/post.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "broadcast.h"
+
+#define BROADCAST_PLUGIN_ID "xine-server-broadcast"
+
+// A listener this close to being overtaken by the writer skips forward
+#define BROADCAST_SLACK (BROADCAST_RING_SIZE / 4)
+
+// Most bytes sent to a listener in one call
+#define BROADCAST_MAX_SEND (64 * 1024)
+
+// Longest HTTP request accepted
+#define BROADCAST_MAX_REQUEST 4096
+
+typedef struct _BroadcastClient
+  {
+  struct _Broadcast *owner;
+  int sock;
+  pthread_t thread;
+  BOOL active;
+  BOOL done;
+  } BroadcastClient;
+
+struct _Broadcast
+  {
+  char *host;
+  int port;
+  int sock;
+  pthread_t thread;
+  BOOL thread_running;
+  xine_t *xine;
+  xine_post_t *post;
+  // Everything below is protected by mutex. cond is broadcast when
+  //  audio is written, the format changes, or the broadcast stops
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  BOOL stop;
+  // Audio format, and a count of changes to it. bits is zero until
+  //  the first stream is opened
+  int bits;
+  int rate;
+  int channels;
+  int format_gen;
+  // The ring. Positions are counts of bytes ever written, so the byte
+  //  at position p is at ring[p % BROADCAST_RING_SIZE]. Everything
+  //  before write_pos has been written; everything before reserve_pos
+  //  is being, or has been, written
+  uint8_t *ring;
+  uint64_t write_pos;
+  uint64_t reserve_pos;
+  BroadcastClient clients[BROADCAST_MAX_CLIENTS];
+  int listeners;
+  // Statistics
+  int accepted;
+  int skips;
+  int drops;
+  int64_t bytes_sent;
+  };
+
+// The post plugin instance. Xine's post_plugin_t must come first
+typedef struct _BroadcastPlugin
+  {
+  post_plugin_t post;
+  Broadcast *broadcast;
+  } BroadcastPlugin;
+
+static pthread_mutex_t broadcast_register_mutex = PTHREAD_MUTEX_INITIALIZER;
+static xine_t *broadcast_registered_xine = NULL;
+
+
+/*==========================================================================
+
+  broadcast_create
+
+==========================================================================*/
+Broadcast *broadcast_create (const char *host, int port)
+  {
+  LOG_IN
+  Broadcast *self = malloc (sizeof (Broadcast));
+  memset (self, 0, sizeof (Broadcast));
+  self->host = strdup (host);
+  self->port = port;
+  self->sock = -1;
+  self->ring = malloc (BROADCAST_RING_SIZE);
+  pthread_mutex_init (&self->mutex, NULL);
+  pthread_cond_init (&self->cond, NULL);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  broadcast_reap
+
+  Join the threads of listeners that have gone. Caller must hold the
+  mutex
+
+==========================================================================*/
+static void broadcast_reap (Broadcast *self)
+  {
+  for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++)
+    {
+    BroadcastClient *client = &self->clients[i];
+    if (client->active && client->done)
+      {
+      pthread_join (client->thread, NULL);
+      client->active = FALSE;
+      }
+    }
+  }
+
+
+/*==========================================================================
+
+  broadcast_destroy
+
+==========================================================================*/
+void broadcast_destroy (Broadcast *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    pthread_mutex_lock (&self->mutex);
+    self->stop = TRUE;
+    pthread_cond_broadcast (&self->cond);
+    if (self->sock >= 0) shutdown (self->sock, SHUT_RDWR);
+    pthread_mutex_unlock (&self->mutex);
+    if (self->thread_running)
+      pthread_join (self->thread, NULL);
+    if (self->sock >= 0) close (self->sock);
+
+    // Wake listeners that are waiting on their sockets
+    pthread_mutex_lock (&self->mutex);
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++)
+      {
+      BroadcastClient *client = &self->clients[i];
+      if (client->active && client->sock >= 0)
+        shutdown (client->sock, SHUT_RDWR);
+      }
+    pthread_mutex_unlock (&self->mutex);
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS; i++)
+      {
+      if (self->clients[i].active)
+        pthread_join (self->clients[i].thread, NULL);
+      }
+
+    free (self->ring);
+    free (self->host);
+    pthread_mutex_destroy (&self->mutex);
+    pthread_cond_destroy (&self->cond);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  broadcast_set_format
+
+  Called when the port is opened. Listeners to the old format are
+  disconnected
+
+==========================================================================*/
+static void broadcast_set_format (Broadcast *self, int bits, int rate,
+      int channels)
+  {
+  pthread_mutex_lock (&self->mutex);
+  if (bits != self->bits || rate != self->rate
+       || channels != self->channels)
+    {
+    log_debug ("%s: format now %d bits, %d Hz, %d channels",
+      __PRETTY_FUNCTION__, bits, rate, channels);
+    self->bits = bits;
+    self->rate = rate;
+    self->channels = channels;
+    self->format_gen++;
+    pthread_cond_broadcast (&self->cond);
+    }
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  broadcast_write
+
+  Called on Xine's thread for each buffer of audio
+
+==========================================================================*/
+static void broadcast_write (Broadcast *self, const audio_buffer_t *buf)
+  {
+  pthread_mutex_lock (&self->mutex);
+  size_t n = (size_t)buf->num_frames * (self->bits / 8) * self->channels;
+  if (self->listeners == 0 || n == 0 || n > BROADCAST_SLACK)
+    {
+    pthread_mutex_unlock (&self->mutex);
+    return;
+    }
+  uint64_t pos = self->write_pos;
+  self->reserve_pos = pos + n;
+  pthread_mutex_unlock (&self->mutex);
+
+  size_t offset = pos % BROADCAST_RING_SIZE;
+  size_t n1 = n < BROADCAST_RING_SIZE - offset
+    ? n : BROADCAST_RING_SIZE - offset;
+  memcpy (self->ring + offset, buf->mem, n1);
+  if (n1 < n)
+    memcpy (self->ring, (const uint8_t *)buf->mem + n1, n - n1);
+
+  pthread_mutex_lock (&self->mutex);
+  self->write_pos = pos + n;
+  pthread_cond_broadcast (&self->cond);
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  broadcast_put_le
+
+==========================================================================*/
+static void broadcast_put_le (uint8_t *p, uint32_t v, int bytes)
+  {
+  for (int i = 0; i < bytes; i++)
+    p[i] = (v >> (8 * i)) & 0xFF;
+  }
+
+
+/*==========================================================================
+
+  broadcast_make_wav_header
+
+  A WAV header with the largest possible lengths, since the length of
+  the stream is not known. Xine's 32-bit samples are floats
+
+==========================================================================*/
+static void broadcast_make_wav_header (uint8_t header[44], int bits,
+      int rate, int channels)
+  {
+  int frame = (bits / 8) * channels;
+  memcpy (header, "RIFF", 4);
+  broadcast_put_le (header + 4, 0xFFFFFFFF, 4);
+  memcpy (header + 8, "WAVEfmt ", 8);
+  broadcast_put_le (header + 16, 16, 4);
+  broadcast_put_le (header + 20, bits == 32 ? 3 : 1, 2);
+  broadcast_put_le (header + 22, channels, 2);
+  broadcast_put_le (header + 24, rate, 4);
+  broadcast_put_le (header + 28, rate * frame, 4);
+  broadcast_put_le (header + 32, frame, 2);
+  broadcast_put_le (header + 34, bits, 2);
+  memcpy (header + 36, "data", 4);
+  broadcast_put_le (header + 40, 0xFFFFFFFF, 4);
+  }
+
+
+/*==========================================================================
+
+  broadcast_send_all
+
+==========================================================================*/
+static BOOL broadcast_send_all (int sock, const void *data, size_t n)
+  {
+  const uint8_t *p = data;
+  while (n > 0)
+    {
+    ssize_t sent = send (sock, p, n, MSG_NOSIGNAL);
+    if (sent <= 0) return FALSE;
+    p += sent;
+    n -= sent;
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  broadcast_read_request
+
+  Read the HTTP request headers, and return the method, which the
+  caller must free, or NULL if the request can't be read
+
+==========================================================================*/
+static char *broadcast_read_request (int sock)
+  {
+  char buff[BROADCAST_MAX_REQUEST + 1];
+  size_t len = 0;
+  while (len < BROADCAST_MAX_REQUEST)
+    {
+    ssize_t n = recv (sock, buff + len, BROADCAST_MAX_REQUEST - len, 0);
+    if (n <= 0) return NULL;
+    len += n;
+    buff[len] = 0;
+    if (strstr (buff, "\r\n\r\n") || strstr (buff, "\n\n"))
+      {
+      size_t l = strcspn (buff, " \r\n");
+      return strndup (buff, l);
+      }
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  broadcast_skip
+
+  Move a listener to the newest audio, keeping its stream a whole
+  number of frames: if it has sent part of a frame, it goes back far
+  enough to finish one. Caller must hold the mutex
+
+==========================================================================*/
+static uint64_t broadcast_skip (Broadcast *self, int64_t sent)
+  {
+  int frame = (self->bits / 8) * self->channels;
+  int partial = frame > 0 ? sent % frame : 0;
+  self->skips++;
+  return self->write_pos - (partial ? frame - partial : 0);
+  }
+
+
+/*==========================================================================
+
+  broadcast_stream
+
+  Send audio to a listener until it goes away, the format changes, or
+  the broadcast stops
+
+==========================================================================*/
+static void broadcast_stream (Broadcast *self, int sock)
+  {
+  pthread_mutex_lock (&self->mutex);
+  while (!self->stop && self->bits == 0)
+    pthread_cond_wait (&self->cond, &self->mutex);
+  if (self->stop)
+    {
+    pthread_mutex_unlock (&self->mutex);
+    return;
+    }
+  int gen = self->format_gen;
+  uint8_t header[44];
+  broadcast_make_wav_header (header, self->bits, self->rate,
+    self->channels);
+  self->listeners++;
+  uint64_t pos = self->write_pos;
+  pthread_mutex_unlock (&self->mutex);
+
+  BOOL ok = broadcast_send_all (sock, header, sizeof (header));
+  int64_t sent = 0;
+
+  pthread_mutex_lock (&self->mutex);
+  while (ok && !self->stop && self->format_gen == gen)
+    {
+    if (pos == self->write_pos)
+      {
+      pthread_cond_wait (&self->cond, &self->mutex);
+      continue;
+      }
+    if (self->reserve_pos > pos + BROADCAST_RING_SIZE - BROADCAST_SLACK)
+      {
+      pos = broadcast_skip (self, sent);
+      continue;
+      }
+    size_t offset = pos % BROADCAST_RING_SIZE;
+    size_t n = self->write_pos - pos;
+    if (n > BROADCAST_RING_SIZE - offset) n = BROADCAST_RING_SIZE - offset;
+    if (n > BROADCAST_MAX_SEND) n = BROADCAST_MAX_SEND;
+    pthread_mutex_unlock (&self->mutex);
+
+    ssize_t s = send (sock, self->ring + offset, n, MSG_NOSIGNAL);
+
+    pthread_mutex_lock (&self->mutex);
+    if (s <= 0)
+      {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+        log_debug ("%s: dropping slow listener", __PRETTY_FUNCTION__);
+        self->drops++;
+        }
+      ok = FALSE;
+      }
+    else
+      {
+      sent += s;
+      self->bytes_sent += s;
+      // The writer has been here while we were sending, so part of
+      //  what was sent is newer audio
+      if (self->reserve_pos > pos + BROADCAST_RING_SIZE)
+        pos = broadcast_skip (self, sent);
+      else
+        pos += s;
+      }
+    }
+  self->listeners--;
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  broadcast_client_thread
+
+==========================================================================*/
+static void *broadcast_client_thread (void *arg)
+  {
+  LOG_IN
+  BroadcastClient *client = (BroadcastClient *)arg;
+  Broadcast *self = client->owner;
+  char *method = broadcast_read_request (client->sock);
+  if (method && (strcmp (method, "GET") == 0
+       || strcmp (method, "HEAD") == 0))
+    {
+    static const char *response = "HTTP/1.0 200 OK\r\n"
+      "Content-Type: audio/wav\r\n"
+      "Cache-Control: no-cache, no-store\r\n"
+      "Connection: close\r\n\r\n";
+    if (broadcast_send_all (client->sock, response, strlen (response))
+         && strcmp (method, "GET") == 0)
+      broadcast_stream (self, client->sock);
+    }
+  else if (method)
+    {
+    static const char *response = "HTTP/1.0 405 Method Not Allowed\r\n"
+      "Allow: GET, HEAD\r\nConnection: close\r\n\r\n";
+    broadcast_send_all (client->sock, response, strlen (response));
+    }
+  if (method) free (method);
+
+  pthread_mutex_lock (&self->mutex);
+  close (client->sock);
+  client->sock = -1;
+  client->done = TRUE;
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  broadcast_thread
+
+  Accept listeners, each served by its own thread
+
+==========================================================================*/
+static void *broadcast_thread (void *arg)
+  {
+  LOG_IN
+  Broadcast *self = (Broadcast *)arg;
+  while (TRUE)
+    {
+    struct sockaddr_in address;
+    socklen_t addrlen = sizeof (address);
+    int sock = accept (self->sock, (struct sockaddr *)&address, &addrlen);
+    pthread_mutex_lock (&self->mutex);
+    if (self->stop)
+      {
+      pthread_mutex_unlock (&self->mutex);
+      if (sock >= 0) close (sock);
+      break;
+      }
+    if (sock < 0)
+      {
+      pthread_mutex_unlock (&self->mutex);
+      continue;
+      }
+    broadcast_reap (self);
+    BroadcastClient *client = NULL;
+    for (int i = 0; i < BROADCAST_MAX_CLIENTS && !client; i++)
+      if (!self->clients[i].active) client = &self->clients[i];
+    if (client)
+      {
+      log_debug ("%s: listener connected from %s", __PRETTY_FUNCTION__,
+        inet_ntoa (address.sin_addr));
+      struct timeval tv;
+      tv.tv_sec = BROADCAST_SEND_TIMEOUT_MSEC / 1000;
+      tv.tv_usec = (BROADCAST_SEND_TIMEOUT_MSEC % 1000) * 1000;
+      setsockopt (sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+      setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+      client->owner = self;
+      client->sock = sock;
+      client->active = TRUE;
+      client->done = FALSE;
+      self->accepted++;
+      pthread_create (&client->thread, NULL, broadcast_client_thread,
+        client);
+      }
+    else
+      {
+      log_warning ("Too many broadcast listeners");
+      static const char *response = "HTTP/1.0 503 Service Unavailable\r\n"
+        "Connection: close\r\n\r\n";
+      send (sock, response, strlen (response), MSG_NOSIGNAL);
+      close (sock);
+      }
+    pthread_mutex_unlock (&self->mutex);
+    }
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  broadcast_start
+
+==========================================================================*/
+BOOL broadcast_start (Broadcast *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  self->sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (self->sock >= 0)
+    {
+    int reuse = 1;
+    setsockopt (self->sock, SOL_SOCKET, SO_REUSEADDR, &reuse,
+      sizeof (reuse));
+    struct sockaddr_in address;
+    memset (&address, 0, sizeof (address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons (self->port);
+    address.sin_addr.s_addr = inet_addr (self->host);
+    if (bind (self->sock, (struct sockaddr *)&address,
+          sizeof (address)) == 0 && listen (self->sock, 5) == 0)
+      {
+      self->thread_running = TRUE;
+      pthread_create (&self->thread, NULL, broadcast_thread, self);
+      log_info ("Broadcasting audio on http://%s:%d/", self->host,
+        self->port);
+      ret = TRUE;
+      }
+    else
+      {
+      if (error) asprintf (error, "Can't listen on %s:%d: %s", self->host,
+        self->port, strerror (errno));
+      close (self->sock);
+      self->sock = -1;
+      }
+    }
+  else
+    {
+    if (error) asprintf (error, "Can't create socket: %s",
+      strerror (errno));
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  broadcast_port_open
+
+==========================================================================*/
+static int broadcast_port_open (xine_audio_port_t *port_gen,
+      xine_stream_t *stream, uint32_t bits, uint32_t rate, int mode)
+  {
+  post_audio_port_t *port = (post_audio_port_t *)port_gen;
+  BroadcastPlugin *plugin = (BroadcastPlugin *)port->post;
+  _x_post_rewire (port->post);
+  _x_post_inc_usage (port);
+  port->stream = stream;
+  port->bits = bits;
+  port->rate = rate;
+  port->mode = mode;
+  if (plugin->broadcast)
+    broadcast_set_format (plugin->broadcast, bits, rate,
+      _x_ao_mode2channels (mode));
+  return port->original_port->open (port->original_port, stream, bits,
+    rate, mode);
+  }
+
+
+/*==========================================================================
+
+  broadcast_port_close
+
+==========================================================================*/
+static void broadcast_port_close (xine_audio_port_t *port_gen,
+      xine_stream_t *stream)
+  {
+  post_audio_port_t *port = (post_audio_port_t *)port_gen;
+  port->stream = NULL;
+  port->original_port->close (port->original_port, stream);
+  _x_post_dec_usage (port);
+  }
+
+
+/*==========================================================================
+
+  broadcast_port_put_buffer
+
+  The buffer belongs to the output port once it has been passed on, so
+  it must be copied first
+
+==========================================================================*/
+static void broadcast_port_put_buffer (xine_audio_port_t *port_gen,
+      audio_buffer_t *buf, xine_stream_t *stream)
+  {
+  post_audio_port_t *port = (post_audio_port_t *)port_gen;
+  BroadcastPlugin *plugin = (BroadcastPlugin *)port->post;
+  if (plugin->broadcast)
+    broadcast_write (plugin->broadcast, buf);
+  port->original_port->put_buffer (port->original_port, buf, stream);
+  }
+
+
+/*==========================================================================
+
+  broadcast_dispose_plugin
+
+==========================================================================*/
+static void broadcast_dispose_plugin (post_plugin_t *post)
+  {
+  if (_x_post_dispose (post))
+    free (post);
+  }
+
+
+/*==========================================================================
+
+  broadcast_open_plugin
+
+==========================================================================*/
+static post_plugin_t *broadcast_open_plugin (post_class_t *class,
+      int inputs, xine_audio_port_t **audio_target,
+      xine_video_port_t **video_target)
+  {
+  if (!audio_target || !audio_target[0]) return NULL;
+  BroadcastPlugin *plugin = calloc (1, sizeof (BroadcastPlugin));
+  post_in_t *input;
+  post_out_t *output;
+  _x_post_init (&plugin->post, 1, 0);
+  post_audio_port_t *port = _x_post_intercept_audio_port (&plugin->post,
+    audio_target[0], &input, &output);
+  port->new_port.open = broadcast_port_open;
+  port->new_port.close = broadcast_port_close;
+  port->new_port.put_buffer = broadcast_port_put_buffer;
+  plugin->post.xine_post.audio_input[0] = &port->new_port;
+  plugin->post.dispose = broadcast_dispose_plugin;
+  return &plugin->post;
+  }
+
+
+/*==========================================================================
+
+  broadcast_init_class
+
+==========================================================================*/
+static void *broadcast_init_class (xine_t *xine, const void *data)
+  {
+  post_class_t *class = calloc (1, sizeof (post_class_t));
+  class->open_plugin = broadcast_open_plugin;
+  class->identifier = BROADCAST_PLUGIN_ID;
+  class->description = "xine-server network broadcast";
+  class->dispose = default_post_class_dispose;
+  return class;
+  }
+
+
+static const post_info_t broadcast_special_info =
+  { XINE_POST_TYPE_AUDIO_FILTER };
+
+static const plugin_info_t broadcast_plugin_info[] =
+  {
+  { PLUGIN_POST, 10, BROADCAST_PLUGIN_ID, XINE_VERSION_CODE,
+    &broadcast_special_info, broadcast_init_class },
+  { PLUGIN_NONE, 0, NULL, 0, NULL, NULL }
+  };
+
+
+/*==========================================================================
+
+  broadcast_attach
+
+==========================================================================*/
+BOOL broadcast_attach (Broadcast *self, xine_t *xine,
+      xine_audio_port_t *ao_port)
+  {
+  LOG_IN
+  pthread_mutex_lock (&broadcast_register_mutex);
+  if (broadcast_registered_xine != xine)
+    {
+    xine_register_plugins (xine, broadcast_plugin_info);
+    broadcast_registered_xine = xine;
+    }
+  pthread_mutex_unlock (&broadcast_register_mutex);
+
+  self->post = xine_post_init (xine, BROADCAST_PLUGIN_ID, 1, &ao_port,
+    NULL);
+  if (self->post)
+    {
+    self->xine = xine;
+    ((BroadcastPlugin *)self->post)->broadcast = self;
+    }
+  else
+    log_warning ("Can't create Xine post plugin for broadcast");
+  LOG_OUT
+  return self->post != NULL;
+  }
+
+
+/*==========================================================================
+
+  broadcast_detach
+
+==========================================================================*/
+void broadcast_detach (Broadcast *self)
+  {
+  LOG_IN
+  if (self->post)
+    {
+    ((BroadcastPlugin *)self->post)->broadcast = NULL;
+    xine_post_dispose (self->xine, self->post);
+    self->post = NULL;
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  broadcast_get_input
+
+==========================================================================*/
+xine_audio_port_t *broadcast_get_input (const Broadcast *self)
+  {
+  return self->post->audio_input[0];
+  }
+
+
+/*==========================================================================
+
+  broadcast_set_output
+
+==========================================================================*/
+BOOL broadcast_set_output (Broadcast *self, xine_audio_port_t *ao_port)
+  {
+  return xine_post_wire_audio_port
+    (xine_post_output (self->post, "audio out"), ao_port);
+  }
+
+
+/*==========================================================================
+
+  broadcast_get_stats
+
+==========================================================================*/
+void broadcast_get_stats (Broadcast *self, String *s)
+  {
+  pthread_mutex_lock (&self->mutex);
+  string_append_printf (s, " broadcast-listeners=%d broadcast-accepted=%d"
+    " broadcast-skips=%d broadcast-drops=%d broadcast-kb=%lld",
+    self->listeners, self->accepted, self->skips, self->drops,
+    (long long)(self->bytes_sent / 1024));
+  pthread_mutex_unlock (&self->mutex);
+  }
+
@@ -0,0 +1,61 @@
+/*============================================================================
+
+  xine-server
+  broadcast.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <xine.h>
+#include "defs.h"
+#include "string.h"
+
+struct _Broadcast;
+typedef struct _Broadcast Broadcast;
+
+// Decoded audio kept for listeners, in bytes. This is about six seconds
+//  of 16-bit stereo at 44.1kHz
+#define BROADCAST_RING_SIZE (1024 * 1024)
+
+// The most listeners served at once
+#define BROADCAST_MAX_CLIENTS 64
+
+// A listener that accepts no audio for this long is dropped
+#define BROADCAST_SEND_TIMEOUT_MSEC 5000
+
+BEGIN_DECLS
+
+Broadcast         *broadcast_create (const char *host, int port);
+
+// Stream and post plugin must have been unwired first, with
+//  broadcast_detach()
+void               broadcast_destroy (Broadcast *self);
+
+// Start accepting HTTP connections
+BOOL               broadcast_start (Broadcast *self, char **error);
+
+// Create the Xine post plugin that captures audio, with its output
+//  going to 'ao_port'. A stream should then be wired to
+//  broadcast_get_input()
+BOOL               broadcast_attach (Broadcast *self, xine_t *xine,
+                      xine_audio_port_t *ao_port);
+
+// Dispose of the post plugin. The stream must have been wired elsewhere
+//  first
+void               broadcast_detach (Broadcast *self);
+
+xine_audio_port_t *broadcast_get_input (const Broadcast *self);
+
+// Send the captured audio on to a different port, as when the audio
+//  driver is changed
+BOOL               broadcast_set_output (Broadcast *self,
+                      xine_audio_port_t *ao_port);
+
+void               broadcast_get_stats (Broadcast *self, String *s);
+
+END_DECLS
+
+
@@ -0,0 +1,451 @@
+/*==========================================================================
+
+  xine-server
+  clocksync.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Multi-room clock alignment. A master periodically announces, by UDP
+  (usually multicast), the stream it is playing, its playback position,
+  and the wall-clock time at which it sampled that position. A follower
+  that is playing the same stream works out where the master must be
+  now, and compares that with its own position. Small errors are
+  corrected gradually, by running Xine's fine speed control a little
+  fast or slow; large ones (after a pause, or at the start of a
+  stream) are corrected by seeking.
+
+  This relies on the hosts' wall clocks being in step -- NTP on a LAN
+  is usually good to a millisecond or so, and several instances on
+  the same host trivially share a clock.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "clocksync.h"
+#include "xine_interface.h"
+
+// How often the master announces its position
+#define CLOCKSYNC_INTERVAL_MSEC 100
+// Follower skew beyond which we seek, rather than adjust speed
+#define CLOCKSYNC_SEEK_MSEC 250
+// Follower skew within which we consider ourselves aligned
+#define CLOCKSYNC_DEADBAND_MSEC 2
+// Time over which a speed adjustment aims to remove the skew
+#define CLOCKSYNC_WINDOW_MSEC 2000
+// Largest speed adjustment, in parts per million (2%, which shifts
+//  the pitch too little to notice on most material)
+#define CLOCKSYNC_MAX_PPM 20000
+// Announcements to ignore after a seek, while the position settles
+#define CLOCKSYNC_SETTLE 5
+// If no announcement is heard for this long, the follower unlocks
+#define CLOCKSYNC_TIMEOUT_MSEC 2000
+#define CLOCKSYNC_MAGIC "XSSYNC"
+
+struct _ClockSync
+  {
+  XineInterface *xi;
+  ClockSyncMode mode;
+  char *group;
+  int port;
+  int sock;
+  pthread_t thread;
+  BOOL running;
+  BOOL stop;
+  pthread_mutex_t mutex; // Protects the statistics below
+  BOOL locked;
+  double skew; // Smoothed, in msec
+  int ppm;
+  int seeks;
+  int settle;
+  int64_t last_heard;
+  };
+
+
+/*==========================================================================
+
+  clocksync_now_msec
+
+  Wall-clock time, in msec since the epoch. This has to be real time,
+  not monotonic time, because it is compared between hosts.
+
+==========================================================================*/
+static int64_t clocksync_now_msec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+
+
+/*==========================================================================
+
+  clocksync_create
+
+==========================================================================*/
+ClockSync *clocksync_create (XineInterface *xi, ClockSyncMode mode,
+       const char *group, int port)
+  {
+  LOG_IN
+  log_debug ("%s: Creating clock sync, mode=%d", __PRETTY_FUNCTION__, mode);
+  ClockSync *self = malloc (sizeof (ClockSync));
+  self->xi = xi;
+  self->mode = mode;
+  self->group = strdup (group ? group : CLOCKSYNC_DEF_GROUP);
+  self->port = port > 0 ? port : CLOCKSYNC_DEF_PORT;
+  self->sock = -1;
+  self->running = FALSE;
+  self->stop = FALSE;
+  pthread_mutex_init (&self->mutex, NULL);
+  self->locked = FALSE;
+  self->skew = 0;
+  self->ppm = 0;
+  self->seeks = 0;
+  self->settle = 0;
+  self->last_heard = 0;
+  // Speed corrections would otherwise mute the audio
+  if (mode == CLOCKSYNC_FOLLOWER)
+    xine_interface_set_fine_speed_audio (xi, TRUE);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  clocksync_destroy
+
+==========================================================================*/
+void clocksync_destroy (ClockSync *self)
+  {
+  LOG_IN
+  log_debug ("%s: Destroying clock sync", __PRETTY_FUNCTION__);
+  if (self)
+    {
+    if (self->running)
+      {
+      self->stop = TRUE;
+      pthread_join (self->thread, NULL);
+      if (self->mode == CLOCKSYNC_FOLLOWER)
+        xine_interface_set_speed_ppm (self->xi, 0);
+      }
+    if (self->sock >= 0) close (self->sock);
+    pthread_mutex_destroy (&self->mutex);
+    free (self->group);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  clocksync_announce
+
+  Master: send the current stream and position, if playing
+
+==========================================================================*/
+static void clocksync_announce (ClockSync *self,
+       const struct sockaddr_in *dest)
+  {
+  LOG_IN
+  if (xine_interface_get_transport_status (self->xi)
+        == XINESERVER_TRANSPORT_PLAYING)
+    {
+    char *mrl = xine_interface_get_mrl (self->xi);
+    if (mrl)
+      {
+      int pos, len;
+      xine_interface_get_pos_len (self->xi, &pos, &len);
+      int64_t now = clocksync_now_msec ();
+      char *msg = NULL;
+      int l = asprintf (&msg, "%s %lld %d %s", CLOCKSYNC_MAGIC,
+        (long long)now, pos, mrl);
+      sendto (self->sock, msg, l, 0, (const struct sockaddr *)dest,
+        sizeof (*dest));
+      free (msg);
+      free (mrl);
+      }
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  clocksync_follow
+
+  Follower: compare our position with the master's announcement, and
+  correct any difference
+
+==========================================================================*/
+static void clocksync_follow (ClockSync *self, const char *msg)
+  {
+  LOG_IN
+  long long then = 0;
+  int master_pos = 0;
+  int n = 0;
+  if (sscanf (msg, CLOCKSYNC_MAGIC " %lld %d %n", &then, &master_pos, &n)
+        >= 2 && n > 0)
+    {
+    const char *master_mrl = msg + n;
+    char *mrl = xine_interface_get_mrl (self->xi);
+    if (mrl && strcmp (mrl, master_mrl) == 0
+          && xine_interface_get_transport_status (self->xi)
+             == XINESERVER_TRANSPORT_PLAYING)
+      {
+      int pos, len;
+      xine_interface_get_pos_len (self->xi, &pos, &len);
+      int64_t now = clocksync_now_msec ();
+      int64_t expected = master_pos + (now - then);
+      double skew = (double)(pos - expected);
+
+      pthread_mutex_lock (&self->mutex);
+      self->last_heard = now;
+      self->locked = TRUE;
+      if (self->settle > 0)
+        {
+        self->settle--;
+        }
+      else if (skew > CLOCKSYNC_SEEK_MSEC || skew < -CLOCKSYNC_SEEK_MSEC)
+        {
+        log_debug ("%s: skew %d msec, seeking to %d", __PRETTY_FUNCTION__,
+          (int)skew, (int)expected);
+        xine_interface_set_speed_ppm (self->xi, 0);
+        xine_interface_seek (self->xi, (int)expected);
+        self->ppm = 0;
+        self->skew = 0;
+        self->seeks++;
+        self->settle = CLOCKSYNC_SETTLE;
+        }
+      else
+        {
+        // Smooth out the jitter in Xine's position reports
+        self->skew = 0.7 * self->skew + 0.3 * skew;
+        int ppm = 0;
+        if (self->skew > CLOCKSYNC_DEADBAND_MSEC
+             || self->skew < -CLOCKSYNC_DEADBAND_MSEC)
+          {
+          ppm = (int)(-self->skew * 1000000 / CLOCKSYNC_WINDOW_MSEC);
+          if (ppm > CLOCKSYNC_MAX_PPM) ppm = CLOCKSYNC_MAX_PPM;
+          if (ppm < -CLOCKSYNC_MAX_PPM) ppm = -CLOCKSYNC_MAX_PPM;
+          }
+        if (ppm != self->ppm)
+          {
+          xine_interface_set_speed_ppm (self->xi, ppm);
+          self->ppm = ppm;
+          }
+        }
+      pthread_mutex_unlock (&self->mutex);
+      }
+    if (mrl) free (mrl);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  clocksync_thread
+
+==========================================================================*/
+static void *clocksync_thread (void *arg)
+  {
+  LOG_IN
+  ClockSync *self = (ClockSync *)arg;
+  struct sockaddr_in dest;
+  memset (&dest, 0, sizeof (dest));
+  dest.sin_family = AF_INET;
+  dest.sin_port = htons (self->port);
+  dest.sin_addr.s_addr = inet_addr (self->group);
+
+  while (!self->stop)
+    {
+    if (self->mode == CLOCKSYNC_MASTER)
+      {
+      clocksync_announce (self, &dest);
+      usleep (CLOCKSYNC_INTERVAL_MSEC * 1000);
+      }
+    else
+      {
+      char buff[2048];
+      // The receive timeout was set when the socket was opened, so
+      //  we get to check the stop flag regularly
+      int n = recv (self->sock, buff, sizeof (buff) - 1, 0);
+      if (n > 0)
+        {
+        buff[n] = 0;
+        clocksync_follow (self, buff);
+        }
+      pthread_mutex_lock (&self->mutex);
+      if (self->locked && clocksync_now_msec () - self->last_heard
+            > CLOCKSYNC_TIMEOUT_MSEC)
+        {
+        log_debug ("%s: Lost contact with master", __PRETTY_FUNCTION__);
+        self->locked = FALSE;
+        self->ppm = 0;
+        xine_interface_set_speed_ppm (self->xi, 0);
+        }
+      pthread_mutex_unlock (&self->mutex);
+      }
+    }
+
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  clocksync_start
+
+==========================================================================*/
+BOOL clocksync_start (ClockSync *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  log_info ("Starting clock sync as %s on %s:%d",
+    clocksync_mode_to_string (self->mode), self->group, self->port);
+
+  self->sock = socket (AF_INET, SOCK_DGRAM, 0);
+  if (self->sock >= 0)
+    {
+    in_addr_t group = inet_addr (self->group);
+    BOOL multicast = IN_MULTICAST (ntohl (group));
+    if (self->mode == CLOCKSYNC_MASTER)
+      {
+      unsigned char ttl = 1;
+      setsockopt (self->sock, IPPROTO_IP, IP_MULTICAST_TTL,
+        &ttl, sizeof (ttl));
+      int one = 1;
+      setsockopt (self->sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof (one));
+      ret = TRUE;
+      }
+    else
+      {
+      // Several followers may run on one host, so they must all be
+      //  able to bind the same port
+      int one = 1;
+      setsockopt (self->sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+      setsockopt (self->sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof (one));
+      struct timeval tv = {0, 250000};
+      setsockopt (self->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+      struct sockaddr_in addr;
+      memset (&addr, 0, sizeof (addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons (self->port);
+      addr.sin_addr.s_addr = htonl (INADDR_ANY);
+      if (bind (self->sock, (struct sockaddr *)&addr, sizeof (addr)) == 0)
+        {
+        ret = TRUE;
+        if (multicast)
+          {
+          struct ip_mreq mreq;
+          mreq.imr_multiaddr.s_addr = group;
+          mreq.imr_interface.s_addr = htonl (INADDR_ANY);
+          if (setsockopt (self->sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                &mreq, sizeof (mreq)) != 0)
+            {
+            asprintf (error, "Can't join multicast group %s: %s",
+              self->group, strerror (errno));
+            ret = FALSE;
+            }
+          }
+        }
+      else
+        {
+        asprintf (error, "Can't bind sync port %d: %s", self->port,
+          strerror (errno));
+        }
+      }
+    }
+  else
+    {
+    asprintf (error, "Can't create sync socket: %s", strerror (errno));
+    }
+
+  if (ret)
+    {
+    self->running = TRUE;
+    pthread_create (&self->thread, NULL, clocksync_thread, self);
+    }
+
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  clocksync_get_stats
+
+==========================================================================*/
+void clocksync_get_stats (ClockSync *self, BOOL *locked,
+       int *skew, int *ppm, int *seeks)
+  {
+  pthread_mutex_lock (&self->mutex);
+  *locked = self->locked;
+  *skew = (int)self->skew;
+  *ppm = self->ppm;
+  *seeks = self->seeks;
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  clocksync_get_mode
+
+==========================================================================*/
+ClockSyncMode clocksync_get_mode (const ClockSync *self)
+  {
+  return self->mode;
+  }
+
+
+/*==========================================================================
+
+  clocksync_mode_to_string
+
+==========================================================================*/
+const char *clocksync_mode_to_string (ClockSyncMode mode)
+  {
+  switch (mode)
+    {
+    case CLOCKSYNC_MASTER: return "master";
+    case CLOCKSYNC_FOLLOWER: return "follower";
+    default: return "off";
+    }
+  }
+
+
+/*==========================================================================
+
+  clocksync_mode_from_string
+
+==========================================================================*/
+BOOL clocksync_mode_from_string (const char *s, ClockSyncMode *mode)
+  {
+  BOOL ret = TRUE;
+  if (strcmp (s, "master") == 0)
+    *mode = CLOCKSYNC_MASTER;
+  else if (strcmp (s, "follower") == 0)
+    *mode = CLOCKSYNC_FOLLOWER;
+  else if (strcmp (s, "off") == 0)
+    *mode = CLOCKSYNC_OFF;
+  else
+    ret = FALSE;
+  return ret;
+  }
+
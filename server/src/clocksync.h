@@ -0,0 +1,50 @@
+/*============================================================================
+
+  xine-server
+  clocksync.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+#include "xine_interface.h"
+
+struct _ClockSync;
+typedef struct _ClockSync ClockSync;
+
+typedef enum _ClockSyncMode
+  {
+  CLOCKSYNC_OFF = 0,
+  CLOCKSYNC_MASTER = 1,
+  CLOCKSYNC_FOLLOWER = 2
+  } ClockSyncMode;
+
+// Default multicast group and UDP port for position announcements
+#define CLOCKSYNC_DEF_GROUP "239.255.30.1"
+#define CLOCKSYNC_DEF_PORT  30002
+
+BEGIN_DECLS
+
+// Create before Xine is initialized: a follower has to set up the 
+//  engine to play audio while it adjusts the speed
+ClockSync    *clocksync_create (XineInterface *xi, ClockSyncMode mode,
+                 const char *group, int port);
+void          clocksync_destroy (ClockSync *self);
+BOOL          clocksync_start (ClockSync *self, char **error);
+ClockSyncMode clocksync_get_mode (const ClockSync *self);
+const char   *clocksync_mode_to_string (ClockSyncMode mode);
+BOOL          clocksync_mode_from_string (const char *s, ClockSyncMode *mode);
+
+// Measured skew (follower position minus master position) in msec,
+//  current speed correction in parts per million, and the number
+//  of hard (seek) corrections. The skew is only meaningful when
+//  'locked' is TRUE -- that is, when the follower has recently
+//  heard from a master playing the same stream
+void          clocksync_get_stats (ClockSync *self, BOOL *locked,
+                 int *skew, int *ppm, int *seeks);
+
+END_DECLS
+
@@ -17,7 +17,9 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#include <math.h>
 #include <xine.h>
 #include "feature.h" 
 #include "defs.h" 
@@ -28,14 +30,30 @@
 #include "../../api/xine-server-api.h" 
 #include "xine_interface.h" 
 #include "notifier.h" 
+#include "clocksync.h" 
+#include "statefile.h" 
+#include "library.h" 
+#include "metacache.h" 
+#include "tagreader.h" 
+#include "shmstatus.h" 
+#include "broadcast.h" 
+#include "server.h" 
+#include "auth.h" 
+#include "scanner.h" 
+#include "shuffle.h" 
+#include "playlist.h" 
 
 #define OK_RESPONSE "0 OK\n"
 
+// Most matches that a search command will report. add-query has no 
+//  limit
+#define CMDPROC_MAX_SEARCH_RESULTS 500
+
 struct _CmdProc
   {
   BOOL request_quit;
   XineInterface *xi;
-  List *playlist; // List of char *
+  Playlist *playlist;
   // Position in the playlist. The first item is zero. When there is
   //   no playlist, or playback has been stopped, the position
   //   is -1
@@ -44,7 +62,63 @@ struct _CmdProc
   //   one thread could be playing the next item in the playlist,
   //   while another is clearing it
   pthread_mutex_t playlist_mutex;
+  // Held while a command that might change something runs, so that 
+  //   such commands run one at a time in each zone. Read-only commands
+  //   take only the locks of what they read, so they never wait for a
+  //   slow 'play' or 'add-dir' in this zone, or for anything in another
+  pthread_mutex_t write_mutex;
   Notifier *notifier;
+  // Zone name. The top-level command processor is "default"
+  char *name;
+  // Set for zones, which are owned by a top-level command processor 
+  CmdProc *parent;
+  // Other zones served by this process, as a list of CmdProc *. Only
+  //   the top-level command processor has zones
+  List *zones;
+  // Multi-room clock alignment, if enabled. Not owned by the command
+  //   processor
+  ClockSync *clocksync;
+  // Persistent state, if enabled. Not owned by the command processor
+  StateFile *statefile;
+  // Media library, if enabled. Not owned by the command processor, and
+  //   shared by all zones
+  Library *library;
+  // Tags for playlist items. Not owned, and shared by all zones
+  MetaCache *metacache;
+  // Status in shared memory, if enabled. Not owned by the command
+  //  processor
+  ShmStatus *shmstatus;
+  // Network broadcast, if enabled. Not owned by the command processor
+  Broadcast *broadcast;
+  // Not owned by the command processor
+  Server *server;
+  // Roles for clients, if they must authenticate. Not owned, and shared
+  //  by all zones
+  Auth *auth;
+  // Loudness normalization. Zones use the settings of the default zone
+  CmdProcReplayGain replaygain;
+  double replaygain_preamp;
+  // Playback being resumed from the saved state, in the background
+  pthread_t resume_thread;
+  BOOL resume_thread_running;
+  BOOL resume_pending;
+  int resume_index;
+  int resume_msec;
+  // Playback order. The shuffled order is a function of the seed
+  //   and the playlist length, so it is never stored
+  BOOL shuffle;
+  uint32_t shuffle_seed;
+  XSRepeatMode repeat;
+  // Items that have failed to play, one after another, at the end
+  //   of the previous item
+  int failed_items;
+  // Copies of the playlist position and length, and of the playback 
+  //   order, for status requests that find the playlist locked. They
+  //   are stored atomically each time the playlist mutex is released
+  int status_index;
+  int status_length;
+  BOOL status_shuffle;
+  XSRepeatMode status_repeat;
   }; 
 
 static BOOL cmdproc_play_playlist_entry (CmdProc *self, int index, 
@@ -52,6 +126,51 @@ static BOOL cmdproc_play_playlist_entry (CmdProc *self, int index,
 static void cmdproc_notify_playback_finished (void *arg); // Forward
 static void cmdproc_notify_progress (const char *msg, int percent, 
       void *arg); // Forward
+static void cmdproc_run_cmd (CmdProc *self, const char *cmd, 
+       CmdProcSession *session, char **response); // Forward
+
+
+/*==========================================================================
+
+  cmdproc_unlock_playlist
+
+  Publish the values that status requests read without the lock, and 
+  release the playlist mutex. Every change to the playlist or the
+  position is made with the mutex held, so none is missed
+
+==========================================================================*/
+static void cmdproc_unlock_playlist (CmdProc *self)
+  {
+  __atomic_store_n (&self->status_index, self->playlist_index, 
+    __ATOMIC_RELAXED);
+  __atomic_store_n (&self->status_length, playlist_length (self->playlist),
+    __ATOMIC_RELAXED);
+  __atomic_store_n (&self->status_shuffle, self->shuffle, __ATOMIC_RELAXED);
+  __atomic_store_n (&self->status_repeat, self->repeat, __ATOMIC_RELAXED);
+  pthread_mutex_unlock (&self->playlist_mutex);
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cancel_resume
+
+  A client that starts, stops or moves playback, or clears the
+  playlist, while Xine is starting, has said what it wants; resuming
+  the saved position afterwards would override it
+
+==========================================================================*/
+static void cmdproc_cancel_resume (CmdProc *self)
+  {
+  pthread_mutex_lock (&self->playlist_mutex);
+  if (self->resume_pending)
+    {
+    log_info ("Not resuming playback, because a client has changed it");
+    self->resume_pending = FALSE;
+    }
+  cmdproc_unlock_playlist (self);
+  }
+
 
 /*==========================================================================
 
@@ -65,13 +184,37 @@ CmdProc *cmdproc_create (XineInterface *xi, Notifier *notifier)
   CmdProc *self = malloc (sizeof (CmdProc));
   self->request_quit = FALSE;
   self->xi = xi;
-  self->playlist = list_create (free);
+  self->playlist = playlist_create ();
   self->playlist_index = -1;
   self->notifier = notifier;
+  self->name = strdup (CMDPROC_DEFAULT_ZONE);
+  self->parent = NULL;
+  self->zones = list_create (NULL);
+  self->clocksync = NULL;
+  self->statefile = NULL;
+  self->library = NULL;
+  self->metacache = NULL;
+  self->shmstatus = NULL;
+  self->broadcast = NULL;
+  self->server = NULL;
+  self->auth = NULL;
+  self->replaygain = CMDPROC_REPLAYGAIN_OFF;
+  self->replaygain_preamp = 0;
+  self->resume_thread_running = FALSE;
+  self->resume_pending = FALSE;
+  self->shuffle = FALSE;
+  self->shuffle_seed = 0;
+  self->repeat = XINESERVER_REPEAT_OFF;
+  self->status_index = -1;
+  self->status_length = 0;
+  self->status_shuffle = FALSE;
+  self->status_repeat = XINESERVER_REPEAT_OFF;
+  self->failed_items = 0;
   pthread_mutexattr_t attr;
   pthread_mutexattr_init(&attr);
   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
   pthread_mutex_init (&self->playlist_mutex, &attr);
+  pthread_mutex_init (&self->write_mutex, NULL);
   xine_interface_set_playback_finished_fn (self->xi,
                  cmdproc_notify_playback_finished, self);
   xine_interface_set_progress_fn (self->xi,
@@ -93,8 +236,26 @@ void cmdproc_destroy (CmdProc *self)
   log_debug ("%s: Destroying  command processor", __PRETTY_FUNCTION__); 
   if (self)
     {
+    if (self->resume_thread_running)
+      pthread_join (self->resume_thread, NULL);
+    if (self->zones)
+      {
+      int l = list_length (self->zones);
+      for (int i = 0; i < l; i++)
+        {
+        CmdProc *zone = list_get (self->zones, i);
+        XineInterface *xi = zone->xi;
+        cmdproc_stop_playback (zone);
+        cmdproc_destroy (zone);
+        xine_interface_destroy (xi);
+        }
+      list_destroy (self->zones);
+      }
     if (self->playlist)
-      list_destroy (self->playlist);
+      playlist_destroy (self->playlist);
+    if (self->name)
+      free (self->name);
+    pthread_mutex_destroy (&self->write_mutex);
     free (self);
     }
   LOG_OUT
@@ -126,10 +287,12 @@ static void cmdproc_cmd_playlist (CmdProc *self, List *argv, char **response)
   LOG_IN
   String *s_response = string_create ("0");
   pthread_mutex_lock (&self->playlist_mutex);
-  int l = list_length (self->playlist);
+  int l = playlist_length (self->playlist);
+  const char **entries = malloc ((l + 1) * sizeof (char *));
+  playlist_get_range (self->playlist, 0, l, entries);
   for (int i = 0; i < l; i++)
     {
-    const char *entry = list_get (self->playlist, i);
+    const char *entry = entries[i];
     String *s_entry = string_create (entry);
     String *esc_entry = string_substitute_all (s_entry, "\"", "\\\"");
     string_append (s_response, " \"");
@@ -138,7 +301,8 @@ static void cmdproc_cmd_playlist (CmdProc *self, List *argv, char **response)
     string_destroy (s_entry);
     string_destroy (esc_entry);
     }
-  pthread_mutex_unlock (&self->playlist_mutex);
+  free (entries);
+  cmdproc_unlock_playlist (self);
 
   string_append (s_response, "\n");
   *response = strdup (string_cstr (s_response)); 
@@ -155,6 +319,7 @@ static void cmdproc_cmd_playlist (CmdProc *self, List *argv, char **response)
 static void cmdproc_cmd_stop (CmdProc *self, List *argv, char **response)
   {
   LOG_IN
+  cmdproc_cancel_resume (self);
   
   // Don't invoke the notifier here -- stop_playback() will do it
   log_debug ("%s Stopping playback on client request", __PRETTY_FUNCTION__); 
@@ -173,6 +338,7 @@ static void cmdproc_cmd_stop (CmdProc *self, List *argv, char **response)
 static void cmdproc_cmd_pause (CmdProc *self, List *argv, char **response)
   {
   LOG_IN
+  cmdproc_cancel_resume (self);
 
   log_debug ("%s Pausing playback on client request", __PRETTY_FUNCTION__); 
   xine_interface_pause (self->xi);
@@ -183,6 +349,44 @@ static void cmdproc_cmd_pause (CmdProc *self, List *argv, char **response)
   LOG_OUT
   }
 
+/*==========================================================================
+
+  cmdproc_step
+
+  Find the item 'direction' (1 or -1) places from 'index' in the order
+  of playback, which is the order of the playlist unless shuffle is on.
+  An index of -1 stands for the start of the playlist. Returns -1 if 
+  there is no such item, which can only be at the ends of the playlist
+  when repeat is off. The playlist must be locked.
+
+==========================================================================*/
+static int cmdproc_step (const CmdProc *self, int index, int direction)
+  {
+  int length = playlist_length (self->playlist);
+  if (length <= 0) return -1;
+  int pos;
+  if (index < 0 || index >= length)
+    {
+    if (direction < 0) return -1;
+    pos = -1;
+    }
+  else if (self->shuffle)
+    pos = shuffle_unmap (self->shuffle_seed, length, index);
+  else
+    pos = index;
+
+  pos += direction;
+  if (pos < 0 || pos >= length)
+    {
+    if (self->repeat != XINESERVER_REPEAT_ALL) return -1;
+    pos = (pos + length) % length;
+    }
+  if (self->shuffle)
+    return shuffle_map (self->shuffle_seed, length, pos);
+  return pos;
+  }
+
+
 /*==========================================================================
 
   cmdproc_cmd_prev
@@ -191,14 +395,14 @@ static void cmdproc_cmd_pause (CmdProc *self, List *argv, char **response)
 static void cmdproc_cmd_prev (CmdProc *self, List *argv, char **response)
   {
   LOG_IN
+  cmdproc_cancel_resume (self);
 
   pthread_mutex_lock (&self->playlist_mutex);
 
   log_debug ("%s Previous item on client request", __PRETTY_FUNCTION__); 
-  int index = self->playlist_index;
-  if (index > 0)
+  int index = cmdproc_step (self, self->playlist_index, -1);
+  if (index >= 0)
     {
-    index--;
     int error_code;
     char *error = NULL;
     log_debug ("%s: Moving to playlist item %d", __PRETTY_FUNCTION__, index);
@@ -222,7 +426,7 @@ static void cmdproc_cmd_prev (CmdProc *self, List *argv, char **response)
        XINESERVER_ERR_PLAYLIST_START); 
     }
 
-  pthread_mutex_unlock (&self->playlist_mutex);
+  cmdproc_unlock_playlist (self);
   LOG_OUT
   }
 
@@ -234,14 +438,13 @@ static void cmdproc_cmd_prev (CmdProc *self, List *argv, char **response)
 static void cmdproc_cmd_next (CmdProc *self, List *argv, char **response)
   {
   LOG_IN
+  cmdproc_cancel_resume (self);
 
   log_debug ("%s Next item on client request", __PRETTY_FUNCTION__); 
   pthread_mutex_lock (&self->playlist_mutex);
-  int length = list_length (self->playlist);
-  int index = self->playlist_index;
-  if (index < length - 1 && length > 0)
+  int index = cmdproc_step (self, self->playlist_index, 1);
+  if (index >= 0)
     {
-    index++;
     int error_code;
     char *error = NULL;
     log_debug ("%s: Moving to playlist item %d", __PRETTY_FUNCTION__, index);
@@ -265,7 +468,7 @@ static void cmdproc_cmd_next (CmdProc *self, List *argv, char **response)
        XINESERVER_ERR_PLAYLIST_END); 
     }
 
-  pthread_mutex_unlock (&self->playlist_mutex);
+  cmdproc_unlock_playlist (self);
   LOG_OUT
   }
 
@@ -277,6 +480,7 @@ static void cmdproc_cmd_next (CmdProc *self, List *argv, char **response)
 static void cmdproc_cmd_clear (CmdProc *self, List *argv, char **response)
   {
   LOG_IN
+  cmdproc_cancel_resume (self);
 
   log_info ("Clearing playlist and stopping playback");
   log_debug ("%s Clearing on client request", __PRETTY_FUNCTION__); 
@@ -286,11 +490,12 @@ static void cmdproc_cmd_clear (CmdProc *self, List *argv, char **response)
      XSNOTIFY_EVENT_PLAYBACK_STOPPED, NOTIFY_MSG_STOPPED_PLAYBACK); 
   pthread_mutex_lock (&self->playlist_mutex);
   xine_interface_stop (self->xi);
-  list_destroy (self->playlist);
-  self->playlist = list_create (free);
+  playlist_clear (self->playlist);
   self->playlist_index = -1;
+  if (self->statefile)
+    statefile_log_clear (self->statefile);
 
-  pthread_mutex_unlock (&self->playlist_mutex);
+  cmdproc_unlock_playlist (self);
   asprintf (response, OK_RESPONSE); 
   LOG_OUT
   }
@@ -313,6 +518,8 @@ static void cmdproc_cmd_volume (CmdProc *self, List *argv, char **response)
     notifier_notify (self->notifier, XSNOTIFY_CLASS_AUDIO,
        XSNOTIFY_EVENT_VOLUME_CHANGED, NOTIFY_MSG_VOLUME_CHANGED); 
     xine_interface_set_volume (self->xi, vol);
+    if (self->statefile)
+      statefile_log_volume (self->statefile, vol);
     asprintf (response, OK_RESPONSE);
     }
   else
@@ -323,6 +530,49 @@ static void cmdproc_cmd_volume (CmdProc *self, List *argv, char **response)
   LOG_OUT
   }
 
+/*==========================================================================
+
+  cmdproc_cmd_output
+
+==========================================================================*/
+static void cmdproc_cmd_output (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+
+  if (list_length (argv) == 2)
+    {
+    const char *driver = string_cstr (list_get (argv, 1));
+    log_debug ("%s: switch output to %s", __PRETTY_FUNCTION__, driver);
+    int usec;
+    BOOL reopened;
+    char *error = NULL;
+    if (xine_interface_set_driver (self->xi, driver, &usec, &reopened, 
+         &error))
+      {
+      asprintf (response, "0 %s %d\n", reopened ? "reopened" : "rewired", 
+        usec);
+      }
+    else
+      {
+      // Reopened, but not resumed, means the driver did change
+      asprintf (response, "%d %s\n", reopened ? XINESERVER_ERR_PLAYBACK
+        : XINESERVER_ERR_BADARG, error);
+      free (error);
+      }
+    }
+  else if (list_length (argv) == 1)
+    {
+    const char *driver = xine_interface_get_driver (self->xi);
+    asprintf (response, "0 %s\n", driver ? driver : "auto");
+    }
+  else
+    {
+    asprintf (response, "%d output command takes one argument or none\n", 
+      XINESERVER_ERR_SYNTAX);
+    }
+  LOG_OUT
+  }
+
 /*==========================================================================
 
   cmdproc_cmd_eq
@@ -341,6 +591,8 @@ static void cmdproc_cmd_eq (CmdProc *self, List *argv, char **response)
       eq[i] = atoi (string_cstr(list_get (argv, i+1))); 
       }
     xine_interface_set_eq (self->xi, eq);
+    if (self->statefile)
+      statefile_log_eq (self->statefile, eq);
     asprintf (response, OK_RESPONSE);
     }
   else if (list_length (argv) == 1) 
@@ -359,6 +611,47 @@ static void cmdproc_cmd_eq (CmdProc *self, List *argv, char **response)
   LOG_OUT
   }
 
+/*==========================================================================
+
+  cmdproc_cmd_levels
+
+  Response is seq, channels, the RMS level of each channel, the peak
+  level of each channel, and then the spectrum bands, all in dB
+
+==========================================================================*/
+static void cmdproc_cmd_levels (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  XSLevels levels;
+  char *error = NULL;
+  if (list_length (argv) != 1)
+    {
+    asprintf (response, "%d levels command takes no arguments\n", 
+       XINESERVER_ERR_SYNTAX);
+    }
+  else if (xine_interface_get_levels (self->xi, &levels, &error))
+    {
+    String *s = string_create ("0");
+    string_append_printf (s, " %u %d", levels.seq, levels.channels);
+    for (int i = 0; i < levels.channels; i++)
+      string_append_printf (s, " %.1f", levels.rms[i]);
+    for (int i = 0; i < levels.channels; i++)
+      string_append_printf (s, " %.1f", levels.peak[i]);
+    for (int i = 0; i < XINESERVER_LEVELS_BANDS; i++)
+      string_append_printf (s, " %.1f", levels.bands[i]);
+    string_append (s, "\n");
+    *response = strdup (string_cstr (s));
+    string_destroy (s);
+    }
+  else
+    {
+    asprintf (response, "%d %s\n", XINESERVER_ERR_NOLEVELS, error);
+    free (error);
+    }
+  LOG_OUT
+  }
+
+
 /*==========================================================================
 
   cmdproc_cmd_seek
@@ -367,6 +660,7 @@ static void cmdproc_cmd_eq (CmdProc *self, List *argv, char **response)
 static void cmdproc_cmd_seek (CmdProc *self, List *argv, char **response)
   {
   LOG_IN
+  cmdproc_cancel_resume (self);
 
   log_debug ("%s Seeking on client request", __PRETTY_FUNCTION__); 
   if (list_length (argv) == 2)
@@ -405,6 +699,173 @@ char *cmdproc_escape_quotes (const char *s)
   }
 
 
+/*==========================================================================
+
+  cmdproc_cmd_playlist_meta
+
+  playlist-meta [start count]
+
+  Responds with the number of items reported, and six values for each:
+  MRL, state, title, artist, album and length in msec. Items whose tags
+  are not cached are queued to be read, and reported as "pending"
+
+==========================================================================*/
+static void cmdproc_cmd_playlist_meta (CmdProc *self, List *argv, 
+      char **response)
+  {
+  LOG_IN
+  MetaCache *metacache = self->parent ? self->parent->metacache 
+    : self->metacache;
+  int argc = list_length (argv);
+  uint64_t start = 0, count = INT_MAX;
+  if (argc != 1 && (argc != 3 
+       || !numberformat_read_integer (string_cstr (list_get (argv, 1)),
+             &start, TRUE)
+       || !numberformat_read_integer (string_cstr (list_get (argv, 2)),
+             &count, TRUE)))
+    {
+    asprintf (response, 
+      "%d playlist-meta command takes no arguments, or a start and count\n", 
+       XINESERVER_ERR_SYNTAX);
+    }
+  else if (!metacache)
+    {
+    asprintf (response, "%d Metadata cache is disabled\n", 
+       XINESERVER_ERR_BADCOMMAND);
+    }
+  else
+    {
+    // Copy the items, so the playlist is not locked while tags are
+    //  looked up
+    pthread_mutex_lock (&self->playlist_mutex);
+    int l = playlist_length (self->playlist);
+    int first = start < (uint64_t)l ? (int)start : l;
+    int n = count < (uint64_t)(l - first) ? (int)count : l - first;
+    char **mrls = malloc ((n + 1) * sizeof (char *));
+    playlist_get_range (self->playlist, first, n, (const char **)mrls);
+    for (int i = 0; i < n; i++)
+      mrls[i] = strdup (mrls[i]);
+    cmdproc_unlock_playlist (self);
+
+    String *s = string_create_empty ();
+    string_append_printf (s, "0 %d", n);
+    for (int i = 0; i < n; i++)
+      {
+      MetaCacheInfo info;
+      MetaCacheState state = metacache_lookup (metacache, mrls[i], &info);
+      char *mrl = cmdproc_escape_quotes (mrls[i]);
+      char *title = cmdproc_escape_quotes (info.title);
+      char *artist = cmdproc_escape_quotes (info.artist);
+      char *album = cmdproc_escape_quotes (info.album);
+      string_append_printf (s, " \"%s\" %s \"%s\" \"%s\" \"%s\" %d", mrl,
+        metacache_state_to_string (state), title, artist, album, 
+        info.msec);
+      free (mrl);
+      free (title);
+      free (artist);
+      free (album);
+      metacache_free_info (&info);
+      free (mrls[i]);
+      }
+    free (mrls);
+    asprintf (response, "%s\n", string_cstr (s));
+    string_destroy (s);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_append_mrls
+
+  Append MRLs to a response, quoted
+
+==========================================================================*/
+static void cmdproc_append_mrls (String *s, char *const *mrls, int count)
+  {
+  for (int i = 0; i < count; i++)
+    {
+    char *mrl = cmdproc_escape_quotes (mrls[i]);
+    string_append_printf (s, " \"%s\"", mrl);
+    free (mrl);
+    }
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_playlist_since
+
+  playlist-since version
+
+  Responds with the current playlist version and, if the log of changes
+  goes back far enough, the changes since the given version. Otherwise
+  responds with the whole playlist.
+
+==========================================================================*/
+static void cmdproc_cmd_playlist_since (CmdProc *self, List *argv, 
+      char **response)
+  {
+  LOG_IN
+  uint64_t since;
+  if (list_length (argv) == 2 && numberformat_read_integer 
+        (string_cstr (list_get (argv, 1)), &since, TRUE))
+    {
+    String *s = string_create_empty ();
+    pthread_mutex_lock (&self->playlist_mutex);
+    string_append_printf (s, "0 %lld", 
+      (long long)playlist_get_version (self->playlist));
+    const PlaylistOp **ops;
+    int n = playlist_get_changes (self->playlist, (int64_t)since, &ops);
+    if (n >= 0)
+      {
+      string_append_printf (s, " delta %d", n);
+      for (int i = 0; i < n; i++)
+        {
+        const PlaylistOp *op = ops[i];
+        switch (op->type)
+          {
+          case PLAYLIST_OP_INSERT:
+            string_append_printf (s, " insert %d %d", op->first, op->count);
+            cmdproc_append_mrls (s, op->mrls, op->count);
+            break;
+          case PLAYLIST_OP_REMOVE:
+            string_append_printf (s, " remove %d %d", op->first, op->count);
+            break;
+          case PLAYLIST_OP_MOVE:
+            string_append_printf (s, " move %d %d %d", op->first, op->count,
+              op->dest);
+            break;
+          case PLAYLIST_OP_CLEAR:
+            string_append (s, " clear");
+            break;
+          }
+        }
+      free (ops);
+      }
+    else
+      {
+      int l = playlist_length (self->playlist);
+      const char **entries = malloc ((l + 1) * sizeof (char *));
+      playlist_get_range (self->playlist, 0, l, entries);
+      string_append_printf (s, " full %d", l);
+      cmdproc_append_mrls (s, (char *const *)entries, l);
+      free (entries);
+      }
+    cmdproc_unlock_playlist (self);
+    asprintf (response, "%s\n", string_cstr (s));
+    string_destroy (s);
+    }
+  else
+    {
+    asprintf (response, "%d playlist-since command takes a version\n", 
+       XINESERVER_ERR_SYNTAX);
+    }
+  LOG_OUT
+  }
+
+
 /*==========================================================================
 
   cmdproc_cmd_meta_info
@@ -415,19 +876,19 @@ static void cmdproc_cmd_meta_info (CmdProc *self, List *argv, char **response)
   LOG_IN
 
   log_debug ("%s Getting meta-info on client request", __PRETTY_FUNCTION__); 
-  const char *title = xine_interface_get_meta_info 
+  char *title = xine_interface_get_meta_info 
       (self->xi, XINE_META_INFO_TITLE);
   char *esc_title = cmdproc_escape_quotes (title); 
-  const char *artist = xine_interface_get_meta_info 
+  char *artist = xine_interface_get_meta_info 
       (self->xi, XINE_META_INFO_ARTIST);
   char *esc_artist = cmdproc_escape_quotes (artist); 
-  const char *genre = xine_interface_get_meta_info 
+  char *genre = xine_interface_get_meta_info 
       (self->xi, XINE_META_INFO_GENRE);
   char *esc_genre = cmdproc_escape_quotes (genre); 
-  const char *album = xine_interface_get_meta_info 
+  char *album = xine_interface_get_meta_info 
       (self->xi, XINE_META_INFO_ALBUM);
   char *esc_album = cmdproc_escape_quotes (album); 
-  const char *composer = xine_interface_get_meta_info 
+  char *composer = xine_interface_get_meta_info 
       (self->xi, XINE_META_INFO_COMPOSER);
   char *esc_composer = cmdproc_escape_quotes (composer); 
   uint32_t bitrate = xine_interface_get_stream_info 
@@ -444,52 +905,201 @@ static void cmdproc_cmd_meta_info (CmdProc *self, List *argv, char **response)
   free (esc_genre);
   free (esc_album);
   free (esc_composer);
+  free (title);
+  free (artist);
+  free (genre);
+  free (album);
+  free (composer);
   
   LOG_OUT
   }
 
+/*==========================================================================
+
+  cmdproc_repeat_to_string
+
+==========================================================================*/
+static const char *cmdproc_repeat_to_string (XSRepeatMode mode)
+  {
+  switch (mode)
+    {
+    case XINESERVER_REPEAT_ONE: return "one";
+    case XINESERVER_REPEAT_ALL: return "all";
+    default: return "off";
+    }
+  }
+
 /*==========================================================================
 
   cmdproc_cmd_status
 
+  The server runs this alongside other commands (see 
+  cmdproc_classify), so it must not wait for the playlist, which 'play'
+  keeps locked while Xine opens the stream. If the playlist is locked,
+  the stream last opened is reported instead
+
 ==========================================================================*/
 static void cmdproc_cmd_status (CmdProc *self, List *argv, char **response)
   {
   LOG_IN
 
   log_debug ("%s Getting status on client request", __PRETTY_FUNCTION__); 
-  int playlist_length = list_length (self->playlist);
-  const char *stream = "-";
-  if (self->playlist_index >= 0 && self->playlist_index < playlist_length)
-    stream = list_get (self->playlist, self->playlist_index);
+  int index, playlist_len;
+  BOOL shuffle_on;
+  XSRepeatMode repeat_mode;
+  char *stream = NULL;
+  if (pthread_mutex_trylock (&self->playlist_mutex) == 0)
+    {
+    index = self->playlist_index;
+    playlist_len = playlist_length (self->playlist);
+    shuffle_on = self->shuffle;
+    repeat_mode = self->repeat;
+    if (index >= 0 && index < playlist_len)
+      stream = strdup (playlist_get (self->playlist, index));
+    cmdproc_unlock_playlist (self);
+    }
+  else
+    {
+    // The playlist is being changed. Report it as it was before, and
+    //  the stream that Xine is playing
+    index = __atomic_load_n (&self->status_index, __ATOMIC_RELAXED);
+    playlist_len = __atomic_load_n (&self->status_length, __ATOMIC_RELAXED);
+    shuffle_on = __atomic_load_n (&self->status_shuffle, __ATOMIC_RELAXED);
+    repeat_mode = __atomic_load_n (&self->status_repeat, __ATOMIC_RELAXED);
+    if (index >= 0)
+      stream = xine_interface_get_mrl (self->xi);
+    }
+  if (!stream) stream = strdup ("-");
 
   int pos, len;
   xine_interface_get_pos_len (self->xi, &pos, &len);
   XSTransportStatus status = xine_interface_get_transport_status (self->xi);
+  const char *shuffle = shuffle_on ? "on" : "off";
+  const char *repeat = cmdproc_repeat_to_string (repeat_mode);
   switch (status)
     {
     case XINESERVER_TRANSPORT_PLAYING:
-      asprintf (response, "0 playing %d %d \"%s\" %d %d\n", pos, len, 
-	stream, self->playlist_index, playlist_length); 
+      asprintf (response, "0 playing %d %d \"%s\" %d %d %s %s\n", pos, 
+	len, stream, index, playlist_len, shuffle, repeat); 
       break;
     case XINESERVER_TRANSPORT_STOPPED:
-      asprintf (response, "0 stopped %d %d \"%s\" %d %d\n", pos, len, 
-	stream, self->playlist_index, playlist_length); 
+      asprintf (response, "0 stopped %d %d \"%s\" %d %d %s %s\n", pos, 
+	len, stream, index, playlist_len, shuffle, repeat); 
       break;
     case XINESERVER_TRANSPORT_PAUSED:
-      asprintf (response, "0 paused %d %d \"%s\" %d %d\n", pos, len, 
-	stream, self->playlist_index, playlist_length); 
+      asprintf (response, "0 paused %d %d \"%s\" %d %d %s %s\n", pos, 
+	len, stream, index, playlist_len, shuffle, repeat); 
       break;
     case XINESERVER_TRANSPORT_BUFFERING:
-      asprintf (response, "0 buffering %d %d \"%s\" %d %d\n", pos, len, 
-	stream, self->playlist_index, playlist_length); 
+      asprintf (response, "0 buffering %d %d \"%s\" %d %d %s %s\n", pos, 
+	len, stream, index, playlist_len, shuffle, repeat); 
       break;
     }
+  free (stream);
+
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_shuffle
+
+==========================================================================*/
+static void cmdproc_cmd_shuffle (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  if (list_length (argv) == 1)
+    {
+    asprintf (response, "0 %s\n", self->shuffle ? "on" : "off"); 
+    }
+  else
+    {
+    const char *arg = string_cstr (list_get (argv, 1));
+    if (strcmp (arg, "on") == 0)
+      {
+      pthread_mutex_lock (&self->playlist_mutex);
+      if (!self->shuffle)
+        {
+        // A new order each time shuffle is turned on
+        struct timespec ts;
+        clock_gettime (CLOCK_REALTIME, &ts);
+        self->shuffle_seed = (uint32_t)ts.tv_sec * 2654435761u 
+          ^ (uint32_t)ts.tv_nsec ^ (uint32_t)getpid();
+        self->shuffle = TRUE;
+        }
+      cmdproc_unlock_playlist (self);
+      log_info ("Shuffle on");
+      asprintf (response, "0 on\n"); 
+      }
+    else if (strcmp (arg, "off") == 0)
+      {
+      pthread_mutex_lock (&self->playlist_mutex);
+      self->shuffle = FALSE;
+      cmdproc_unlock_playlist (self);
+      log_info ("Shuffle off");
+      asprintf (response, "0 off\n"); 
+      }
+    else
+      asprintf (response, "%d Shuffle must be on or off\n", 
+        XINESERVER_ERR_BADARG); 
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
 
+  cmdproc_cmd_repeat
+
+==========================================================================*/
+static void cmdproc_cmd_repeat (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  if (list_length (argv) == 1)
+    {
+    asprintf (response, "0 %s\n", cmdproc_repeat_to_string (self->repeat)); 
+    }
+  else
+    {
+    const char *arg = string_cstr (list_get (argv, 1));
+    int mode = -1;
+    if (strcmp (arg, "off") == 0)
+      mode = XINESERVER_REPEAT_OFF;
+    else if (strcmp (arg, "one") == 0)
+      mode = XINESERVER_REPEAT_ONE;
+    else if (strcmp (arg, "all") == 0)
+      mode = XINESERVER_REPEAT_ALL;
+    if (mode >= 0)
+      {
+      pthread_mutex_lock (&self->playlist_mutex);
+      self->repeat = mode;
+      cmdproc_unlock_playlist (self);
+      log_info ("Repeat %s", arg);
+      asprintf (response, "0 %s\n", arg); 
+      }
+    else
+      asprintf (response, "%d Repeat must be off, one, or all\n", 
+        XINESERVER_ERR_BADARG); 
+    }
   LOG_OUT
   }
 
 
+/*==========================================================================
+
+  cmdproc_stream_exists
+
+  Local files must be readable. Anything else is assumed to be a URL,
+  which can't be checked until it is played
+
+==========================================================================*/
+static BOOL cmdproc_stream_exists (const char *stream)
+  {
+  return stream[0] != '/' || access (stream, R_OK) == 0;
+  }
+
+
 /*==========================================================================
 
   cmdproc_cmd_add
@@ -509,11 +1119,16 @@ static void cmdproc_cmd_add (CmdProc *self, List *argv, char **response)
       { 
       const char *stream = string_cstr (list_get (argv, i));
       log_debug ("add to playlist: %s", stream);
-      if ((stream[0] == '/' && (access (stream, R_OK) == 0))
-	  || (stream[0] != '/'))
+      if (cmdproc_stream_exists (stream))
 	{
 	added = TRUE;
-	list_append (self->playlist, strdup (stream));
+        char *mrl = strdup (stream);
+        pthread_mutex_lock (&self->playlist_mutex);
+	playlist_insert (self->playlist, playlist_length (self->playlist), 
+          &mrl, 1);
+        if (self->statefile)
+          statefile_log_add (self->statefile, stream);
+        cmdproc_unlock_playlist (self);
 	}
       else
 	{
@@ -543,56 +1158,1036 @@ static void cmdproc_cmd_add (CmdProc *self, List *argv, char **response)
 
 /*==========================================================================
 
-  cmdproc_play_playlist_entry
+  cmdproc_add_items
+
+  Add many entries to the end of the playlist at once, with a single 
+  change notification. The playlist takes ownership of the strings,
+  but not of the array
 
 ==========================================================================*/
-static BOOL cmdproc_play_playlist_entry (CmdProc *self, int index, 
-        int *error_code, char **error)
+static void cmdproc_add_items (CmdProc *self, char **items, int count)
   {
   LOG_IN
-  BOOL ret = FALSE;
-  log_debug ("%s Play item %d on client request", __PRETTY_FUNCTION__,
-        index); 
-  pthread_mutex_lock (&self->playlist_mutex);
-  if (list_length (self->playlist) > 0) 
+  if (count > 0)
     {
-    log_debug ("%s: Playlist is not empty", __PRETTY_FUNCTION__);
-    if (index >= 0 && index < list_length (self->playlist))
-      {
-      log_debug ("playlist index %d is valid and in range", index);
-      const char *stream = list_get (self->playlist, index);
-      log_debug ("stream to play is %s", stream);
-      self->playlist_index = index;
-
-      ret = cmdproc_play_stream (self, stream, error_code, error);
-      if (ret)
-        {
-        *error_code = 0;
-        ret = TRUE;
-        }
-      else
-        {
-        // error codes have been set by cmdproc_play_stream
-        ret = FALSE;
-        }
-      }
-    else
+    pthread_mutex_lock (&self->playlist_mutex);
+    playlist_insert (self->playlist, playlist_length (self->playlist), 
+      items, count);
+    if (self->statefile)
       {
-      log_error ("%s: Playlist index %d is out of range", __PRETTY_FUNCTION__, 
-        index);
-      *error_code = XINESERVER_ERR_PLAYLIST_INDEX;
-      asprintf (error , "Playlist index %d out of range (0-%d)", 
-         index, list_length (self->playlist) - 1);
+      for (int i = 0; i < count; i++)
+        statefile_log_add (self->statefile, items[i]);
       }
+    cmdproc_unlock_playlist (self);
+    notifier_notify (self->notifier, XSNOTIFY_CLASS_PLAYLIST,
+       XSNOTIFY_EVENT_PL_CHANGED, NOTIFY_MSG_PL_CHANGED); 
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_add_dir
+
+  add-dir path [recursive]
+
+==========================================================================*/
+static void cmdproc_cmd_add_dir (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  int argc = list_length (argv);
+  if (argc == 2 || (argc == 3 
+       && strcmp (string_cstr (list_get (argv, 2)), "recursive") == 0))
+    {
+    const char *path = string_cstr (list_get (argv, 1));
+    char **items = NULL;
+    int count = 0;
+    char *error = NULL;
+    if (scanner_scan_directory (path, argc == 3, &items, &count, &error))
+      {
+      cmdproc_add_items (self, items, count);
+      free (items);
+      asprintf (response, "0 %d\n", count); 
+      }
+    else
+      {
+      asprintf (response, "%d %s\n", XINESERVER_ERR_NOFILE, error);
+      free (error);
+      }
+    }
+  else
+    {
+    asprintf (response, 
+       "%d add-dir command takes a directory and optionally 'recursive'\n",
+       XINESERVER_ERR_SYNTAX);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_add_playlist
+
+  add-m3u file, add-pls file
+
+==========================================================================*/
+static void cmdproc_cmd_add_playlist (CmdProc *self, List *argv, 
+       BOOL pls, char **response)
+  {
+  LOG_IN
+  if (list_length (argv) == 2)
+    {
+    const char *path = string_cstr (list_get (argv, 1));
+    char **items = NULL;
+    int count = 0;
+    char *error = NULL;
+    BOOL ok = pls ? scanner_read_pls (path, &items, &count, &error)
+                  : scanner_read_m3u (path, &items, &count, &error);
+    if (ok)
+      {
+      cmdproc_add_items (self, items, count);
+      free (items);
+      asprintf (response, "0 %d\n", count); 
+      }
+    else
+      {
+      asprintf (response, "%d %s\n", XINESERVER_ERR_NOFILE, error);
+      free (error);
+      }
+    }
+  else
+    {
+    asprintf (response, "%d %s command takes one argument\n", 
+       XINESERVER_ERR_SYNTAX, string_cstr (list_get (argv, 0)));
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_read_positions
+
+  Read 'n' playlist positions from the arguments, starting at the 
+  second
+
+==========================================================================*/
+static BOOL cmdproc_read_positions (List *argv, int n, int *positions)
+  {
+  if (list_length (argv) != n + 1) return FALSE;
+  for (int i = 0; i < n; i++)
+    {
+    uint64_t v;
+    if (!numberformat_read_integer (string_cstr (list_get (argv, i + 1)), 
+          &v, TRUE) || v > INT_MAX) 
+      return FALSE;
+    positions[i] = (int)v;
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_index_after_move
+
+  Where the item at 'index' ends up, when 'count' items are moved from
+  'first' to 'dest'
+
+==========================================================================*/
+static int cmdproc_index_after_move (int index, int first, int count, 
+      int dest)
+  {
+  if (index < 0) return index;
+  if (index >= first && index < first + count) 
+    return dest + index - first;
+  if (index >= first + count) index -= count;
+  if (index >= dest) index += count;
+  return index;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_insert
+
+  insert pos stream...
+
+==========================================================================*/
+static void cmdproc_cmd_insert (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  int argc = list_length (argv);
+  uint64_t v;
+  if (argc >= 3 && numberformat_read_integer 
+        (string_cstr (list_get (argv, 1)), &v, TRUE))
+    {
+    const char *missing = NULL;
+    for (int i = 2; i < argc && !missing; i++)
+      {
+      const char *stream = string_cstr (list_get (argv, i));
+      if (!cmdproc_stream_exists (stream)) missing = stream;
+      }
+    pthread_mutex_lock (&self->playlist_mutex);
+    int length = playlist_length (self->playlist);
+    if (missing)
+      {
+      log_warning ("%s: File not found: %s", __PRETTY_FUNCTION__, missing);
+      asprintf (response, "%d File not found %s\n", XINESERVER_ERR_NOFILE, 
+        missing);
+      }
+    else if (v > (uint64_t)length)
+      {
+      asprintf (response, "%d Playlist position %d out of range (0-%d)\n", 
+        XINESERVER_ERR_PLAYLIST_INDEX, (int)(v > INT_MAX ? INT_MAX : v), 
+        length);
+      }
+    else
+      {
+      int pos = (int)v;
+      int count = argc - 2;
+      char **items = malloc (count * sizeof (char *));
+      for (int i = 0; i < count; i++)
+        {
+        items[i] = strdup (string_cstr (list_get (argv, i + 2)));
+        if (self->statefile)
+          statefile_log_insert (self->statefile, pos + i, items[i]);
+        }
+      playlist_insert (self->playlist, pos, items, count);
+      free (items);
+      if (self->playlist_index >= pos) 
+        self->playlist_index += count;
+      if (self->resume_pending && self->resume_index >= pos) 
+        self->resume_index += count;
+      asprintf (response, OK_RESPONSE); 
+      }
+    cmdproc_unlock_playlist (self);
+    if (!missing && v <= (uint64_t)length)
+      notifier_notify (self->notifier, XSNOTIFY_CLASS_PLAYLIST,
+         XSNOTIFY_EVENT_PL_CHANGED, NOTIFY_MSG_PL_CHANGED); 
+    }
+  else
+    {
+    asprintf (response, 
+      "%d insert command takes a position and one or more streams\n", 
+      XINESERVER_ERR_SYNTAX);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_remove
+
+  remove from to
+
+  If the item being played is removed, playback continues with the item
+  that followed the removed ones, if there is one. If playback was 
+  paused, or there is no such item, it stops.
+
+==========================================================================*/
+static void cmdproc_cmd_remove (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  int pos[2];
+  if (cmdproc_read_positions (argv, 2, pos))
+    {
+    int first = pos[0];
+    int count = pos[1] - pos[0] + 1;
+    BOOL removed = FALSE;
+    BOOL stopped = FALSE;
+    BOOL moved_on = FALSE;
+    pthread_mutex_lock (&self->playlist_mutex);
+    int length = playlist_length (self->playlist);
+    if (count <= 0 || pos[1] >= length)
+      {
+      asprintf (response, "%d Playlist range %d-%d out of range (0-%d)\n", 
+        XINESERVER_ERR_PLAYLIST_INDEX, pos[0], pos[1], length - 1);
+      }
+    else
+      {
+      playlist_remove (self->playlist, first, count);
+      if (self->statefile)
+        statefile_log_remove (self->statefile, first, count);
+      removed = TRUE;
+      int index = self->playlist_index;
+      if (index >= first + count)
+        self->playlist_index -= count;
+      else if (index >= first)
+        {
+        XSTransportStatus status = 
+          xine_interface_get_transport_status (self->xi);
+        int error_code;
+        char *error = NULL;
+        if ((status == XINESERVER_TRANSPORT_PLAYING 
+               || status == XINESERVER_TRANSPORT_BUFFERING)
+             && first < length - count)
+          {
+          if (cmdproc_play_playlist_entry (self, first, &error_code, &error))
+            moved_on = TRUE;
+          else
+            {
+            log_warning ("Can't play next item: %s", error);
+            free (error);
+            }
+          }
+        if (!moved_on)
+          {
+          xine_interface_stop (self->xi);
+          self->playlist_index = -1;
+          stopped = TRUE;
+          }
+        }
+      if (self->resume_pending && self->resume_index >= first)
+        {
+        if (self->resume_index >= first + count)
+          self->resume_index -= count;
+        else
+          self->resume_index = first;
+        }
+      asprintf (response, OK_RESPONSE); 
+      }
+    cmdproc_unlock_playlist (self);
+    if (removed)
+      notifier_notify (self->notifier, XSNOTIFY_CLASS_PLAYLIST,
+         XSNOTIFY_EVENT_PL_CHANGED, NOTIFY_MSG_PL_CHANGED); 
+    if (moved_on)
+      notifier_notify (self->notifier, XSNOTIFY_CLASS_TRANSPORT,
+         XSNOTIFY_EVENT_CHANGED_PL_POSITION, NOTIFY_MSG_CHANGED_PL_POSITION); 
+    if (stopped)
+      notifier_notify (self->notifier, XSNOTIFY_CLASS_TRANSPORT,
+         XSNOTIFY_EVENT_PLAYBACK_STOPPED, NOTIFY_MSG_STOPPED_PLAYBACK); 
+    }
+  else
+    {
+    asprintf (response, 
+      "%d remove command takes the first and last positions to remove\n", 
+      XINESERVER_ERR_SYNTAX);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_move
+
+  move from to dest
+
+  'dest' is the position of the first moved item afterwards. Playback
+  is not interrupted.
+
+==========================================================================*/
+static void cmdproc_cmd_move (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  int pos[3];
+  if (cmdproc_read_positions (argv, 3, pos))
+    {
+    int first = pos[0];
+    int count = pos[1] - pos[0] + 1;
+    int dest = pos[2];
+    BOOL moved = FALSE;
+    pthread_mutex_lock (&self->playlist_mutex);
+    int length = playlist_length (self->playlist);
+    if (count <= 0 || pos[1] >= length)
+      {
+      asprintf (response, "%d Playlist range %d-%d out of range (0-%d)\n", 
+        XINESERVER_ERR_PLAYLIST_INDEX, pos[0], pos[1], length - 1);
+      }
+    else if (dest > length - count)
+      {
+      asprintf (response, "%d Destination %d out of range (0-%d)\n", 
+        XINESERVER_ERR_PLAYLIST_INDEX, dest, length - count);
+      }
+    else
+      {
+      playlist_move (self->playlist, first, count, dest);
+      if (self->statefile)
+        statefile_log_move (self->statefile, first, count, dest);
+      self->playlist_index = cmdproc_index_after_move 
+        (self->playlist_index, first, count, dest);
+      if (self->resume_pending)
+        self->resume_index = cmdproc_index_after_move 
+          (self->resume_index, first, count, dest);
+      moved = TRUE;
+      asprintf (response, OK_RESPONSE); 
+      }
+    cmdproc_unlock_playlist (self);
+    if (moved)
+      notifier_notify (self->notifier, XSNOTIFY_CLASS_PLAYLIST,
+         XSNOTIFY_EVENT_PL_CHANGED, NOTIFY_MSG_PL_CHANGED); 
+    }
+  else
+    {
+    asprintf (response, 
+      "%d move command takes the first and last positions to move, "
+      "and a destination\n", XINESERVER_ERR_SYNTAX);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_prefetch_gain
+
+  Queue an item to have its tags, including its ReplayGain values, read
+  by the metadata cache, so that they are cached by the time it plays.
+  The playlist must be locked
+
+==========================================================================*/
+static void cmdproc_prefetch_gain (CmdProc *self, int index)
+  {
+  CmdProc *top = self->parent ? self->parent : self;
+  if (top->replaygain != CMDPROC_REPLAYGAIN_OFF && top->metacache 
+       && index >= 0)
+    {
+    MetaCacheInfo info;
+    metacache_lookup (top->metacache, playlist_get (self->playlist, index),
+      &info);
+    metacache_free_info (&info);
+    }
+  }
+
+
+/*==========================================================================
+
+  cmdproc_play_playlist_entry
+
+==========================================================================*/
+static BOOL cmdproc_play_playlist_entry (CmdProc *self, int index, 
+        int *error_code, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  log_debug ("%s Play item %d on client request", __PRETTY_FUNCTION__,
+        index); 
+  pthread_mutex_lock (&self->playlist_mutex);
+  if (playlist_length (self->playlist) > 0) 
+    {
+    log_debug ("%s: Playlist is not empty", __PRETTY_FUNCTION__);
+    if (index >= 0 && index < playlist_length (self->playlist))
+      {
+      log_debug ("playlist index %d is valid and in range", index);
+      const char *stream = playlist_get (self->playlist, index);
+      log_debug ("stream to play is %s", stream);
+      self->playlist_index = index;
+
+      ret = cmdproc_play_stream (self, stream, error_code, error);
+      if (ret)
+        {
+        *error_code = 0;
+        cmdproc_prefetch_gain (self, cmdproc_step (self, index, 1));
+        ret = TRUE;
+        }
+      else
+        {
+        // error codes have been set by cmdproc_play_stream
+        ret = FALSE;
+        }
+      }
+    else
+      {
+      log_error ("%s: Playlist index %d is out of range", __PRETTY_FUNCTION__, 
+        index);
+      *error_code = XINESERVER_ERR_PLAYLIST_INDEX;
+      asprintf (error , "Playlist index %d out of range (0-%d)", 
+         index, playlist_length (self->playlist) - 1);
+      }
+    }
+  else
+    {
+    log_error ("%s: Can't play because playlist is empty", 
+        __PRETTY_FUNCTION__);
+    *error_code = XINESERVER_ERR_PLAYLIST_EMPTY;
+    asprintf (error, "Playlist empty"); 
+    }
+  cmdproc_unlock_playlist (self);
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_play
+
+==========================================================================*/
+static void cmdproc_cmd_play (CmdProc *self, int argc, List * argv, 
+       char **response)
+  {
+  LOG_IN
+  cmdproc_cancel_resume (self);
+
+  if (argc == 1)
+    {
+    log_debug ("%s: no arguments", __PRETTY_FUNCTION__);
+    xine_interface_resume (self->xi);
+    asprintf (response, OK_RESPONSE); 
+    }
+  else
+    {
+    log_debug ("%s: one arguments", __PRETTY_FUNCTION__);
+    const char *arg = string_cstr (list_get (argv, 1));
+    uint64_t v;
+    BOOL ok = numberformat_read_integer (arg, &v, TRUE);
+    if (ok)
+      {
+      int index = v;
+      int error_code = 0;
+      char *error = NULL;
+      if (cmdproc_play_playlist_entry (self, index, &error_code,
+            &error))
+        {
+        asprintf (response, OK_RESPONSE); 
+        }
+      else
+        {
+        asprintf (response, "%d %s\n", error_code, error); 
+        free (error);
+        }
+      }
+    else
+      {
+      log_error ("%s: Playlist index %s is not a number", 
+           __PRETTY_FUNCTION__, arg);
+      asprintf (response, "%d Bad number %s\n", XINESERVER_ERR_BADARG, 
+	   arg); 
+      }
+    }
+  LOG_OUT
+  }
+
+/*==========================================================================
+
+  cmdproc_get_library
+
+  Zones use the top-level command processor's library
+
+==========================================================================*/
+static Library *cmdproc_get_library (const CmdProc *self)
+  {
+  return self->parent ? self->parent->library : self->library;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_get_query
+
+  Search words may be sent as separate arguments, or as one quoted
+  argument. The caller must free the result
+
+==========================================================================*/
+static char *cmdproc_get_query (List *argv)
+  {
+  String *s = string_create_empty ();
+  int argc = list_length (argv);
+  for (int i = 1; i < argc; i++)
+    {
+    if (i > 1) string_append (s, " ");
+    string_append (s, string_cstr (list_get (argv, i)));
+    }
+  char *ret = strdup (string_cstr (s));
+  string_destroy (s);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_search
+
+  search words...
+
+  Responds with the number of matches, followed by four quoted
+  strings for each: path, artist, album, title
+
+==========================================================================*/
+static void cmdproc_cmd_search (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  Library *library = cmdproc_get_library (self);
+  if (!library)
+    {
+    asprintf (response, "%d No media library is configured\n", 
+      XINESERVER_ERR_NOLIBRARY);
+    }
+  else if (list_length (argv) >= 2)
+    {
+    char *query = cmdproc_get_query (argv);
+    int count;
+    LibraryMatch *matches = library_search (library, query, 
+      CMDPROC_MAX_SEARCH_RESULTS, &count);
+    String *s = string_create_empty ();
+    string_append_printf (s, "0 %d", count);
+    for (int i = 0; i < count; i++)
+      {
+      char *path = cmdproc_escape_quotes (matches[i].path);
+      char *artist = cmdproc_escape_quotes (matches[i].artist);
+      char *album = cmdproc_escape_quotes (matches[i].album);
+      char *title = cmdproc_escape_quotes (matches[i].title);
+      string_append_printf (s, " \"%s\" \"%s\" \"%s\" \"%s\"", 
+        path, artist, album, title);
+      free (path);
+      free (artist);
+      free (album);
+      free (title);
+      }
+    asprintf (response, "%s\n", string_cstr (s));
+    string_destroy (s);
+    library_free_matches (matches, count);
+    free (query);
+    }
+  else
+    {
+    asprintf (response, "%d search command takes one or more words\n", 
+       XINESERVER_ERR_SYNTAX);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_add_query
+
+  add-query words...
+
+  Add all the library tracks that match, in order of pathname 
+
+==========================================================================*/
+static void cmdproc_cmd_add_query (CmdProc *self, List *argv, 
+      char **response)
+  {
+  LOG_IN
+  Library *library = cmdproc_get_library (self);
+  if (!library)
+    {
+    asprintf (response, "%d No media library is configured\n", 
+      XINESERVER_ERR_NOLIBRARY);
+    }
+  else if (list_length (argv) >= 2)
+    {
+    char *query = cmdproc_get_query (argv);
+    int count;
+    LibraryMatch *matches = library_search (library, query, INT_MAX, 
+      &count);
+    char **items = malloc ((count + 1) * sizeof (char *));
+    for (int i = 0; i < count; i++)
+      {
+      items[i] = matches[i].path;
+      matches[i].path = NULL;
+      }
+    cmdproc_add_items (self, items, count);
+    free (items);
+    library_free_matches (matches, count);
+    free (query);
+    asprintf (response, "0 %d\n", count); 
+    }
+  else
+    {
+    asprintf (response, "%d add-query command takes one or more words\n", 
+       XINESERVER_ERR_SYNTAX);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_library
+
+  library [rescan]
+
+==========================================================================*/
+static void cmdproc_cmd_library (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  Library *library = cmdproc_get_library (self);
+  int argc = list_length (argv);
+  if (!library)
+    {
+    asprintf (response, "%d No media library is configured\n", 
+      XINESERVER_ERR_NOLIBRARY);
+    }
+  else if (argc == 1)
+    {
+    asprintf (response, "0 %d %d\n", library_get_track_count (library),
+      library_is_scanning (library));
+    }
+  else if (argc == 2 
+       && strcmp (string_cstr (list_get (argv, 1)), "rescan") == 0)
+    {
+    library_rescan (library);
+    asprintf (response, OK_RESPONSE); 
+    }
+  else
+    {
+    asprintf (response, "%d library command takes no argument, or 'rescan'\n", 
+       XINESERVER_ERR_SYNTAX);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_sync
+
+==========================================================================*/
+static void cmdproc_cmd_sync (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  if (self->clocksync)
+    {
+    BOOL locked;
+    int skew, ppm, seeks;
+    clocksync_get_stats (self->clocksync, &locked, &skew, &ppm, &seeks);
+    asprintf (response, "0 %s %d %d %d %d\n", 
+      clocksync_mode_to_string (clocksync_get_mode (self->clocksync)),
+      locked, skew, ppm, seeks);
+    }
+  else
+    {
+    asprintf (response, "0 %s 0 0 0 0\n", 
+      clocksync_mode_to_string (CLOCKSYNC_OFF));
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_stats
+
+  Reports server statistics as name=value pairs. At present, these are
+  just the times taken by each phase of Xine startup
+
+==========================================================================*/
+static void cmdproc_cmd_stats (CmdProc *self, List *argv, char **response)
+  {
+  LOG_IN
+  // Only the Xine figures belong to the zone; the rest are the 
+  //  process's, and are held by the default zone
+  CmdProc *top = self->parent ? self->parent : self;
+  String *s = string_create ("0");
+  xine_interface_get_startup_stats (self->xi, s);
+  if (top->statefile)
+    statefile_get_stats (top->statefile, s);
+  if (top->library)
+    library_get_stats (top->library, s);
+  if (top->metacache)
+    metacache_get_stats (top->metacache, s);
+  if (top->shmstatus)
+    shmstatus_get_stats (top->shmstatus, s);
+  if (top->broadcast)
+    broadcast_get_stats (top->broadcast, s);
+  if (top->server)
+    server_get_stats (top->server, s);
+  asprintf (response, "%s\n", string_cstr (s));
+  string_destroy (s);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_set_clocksync
+
+==========================================================================*/
+void cmdproc_set_clocksync (CmdProc *self, ClockSync *clocksync)
+  {
+  self->clocksync = clocksync;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_set_library
+
+==========================================================================*/
+void cmdproc_set_library (CmdProc *self, Library *library)
+  {
+  self->library = library;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_set_metacache
+
+==========================================================================*/
+void cmdproc_set_metacache (CmdProc *self, MetaCache *metacache)
+  {
+  self->metacache = metacache;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_set_replaygain
+
+==========================================================================*/
+void cmdproc_set_replaygain (CmdProc *self, CmdProcReplayGain mode,
+      double preamp)
+  {
+  self->replaygain = mode;
+  self->replaygain_preamp = preamp;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_replaygain_from_string
+
+==========================================================================*/
+BOOL cmdproc_replaygain_from_string (const char *s, CmdProcReplayGain *mode)
+  {
+  BOOL ret = TRUE;
+  if (strcmp (s, "track") == 0)
+    *mode = CMDPROC_REPLAYGAIN_TRACK;
+  else if (strcmp (s, "album") == 0)
+    *mode = CMDPROC_REPLAYGAIN_ALBUM;
+  else if (strcmp (s, "off") == 0)
+    *mode = CMDPROC_REPLAYGAIN_OFF;
+  else
+    ret = FALSE;
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_update_shm
+
+  Called by the shared memory writer, to copy the status and, if it 
+  has changed, the playlist
+
+==========================================================================*/
+static void cmdproc_update_shm (void *data, ShmStatus *shm)
+  {
+  CmdProc *self = (CmdProc *)data;
+  ShmStatusInfo info;
+  pthread_mutex_lock (&self->playlist_mutex);
+  info.playlist_index = self->playlist_index;
+  info.playlist_length = playlist_length (self->playlist);
+  info.stream = "-";
+  if (info.playlist_index >= 0 && info.playlist_index < info.playlist_length)
+    info.stream = playlist_get (self->playlist, info.playlist_index);
+  xine_interface_get_pos_len (self->xi, &info.position, &info.length);
+  info.transport_status = xine_interface_get_transport_status (self->xi);
+  info.shuffle = self->shuffle;
+  info.repeat = self->repeat;
+  shmstatus_write_status (shm, &info);
+
+  int64_t version = playlist_get_version (self->playlist);
+  if (version != shmstatus_get_playlist_version (shm))
+    {
+    int l = info.playlist_length;
+    const char **entries = malloc ((l + 1) * sizeof (char *));
+    playlist_get_range (self->playlist, 0, l, entries);
+    shmstatus_write_playlist (shm, version, entries, l);
+    free (entries);
+    }
+  cmdproc_unlock_playlist (self);
+  }
+
+
+/*==========================================================================
+
+  cmdproc_set_shmstatus
+
+==========================================================================*/
+void cmdproc_set_shmstatus (CmdProc *self, ShmStatus *shmstatus)
+  {
+  self->shmstatus = shmstatus;
+  if (shmstatus)
+    shmstatus_set_source_fn (shmstatus, cmdproc_update_shm, self);
+  }
+
+
+/*==========================================================================
+
+  cmdproc_set_broadcast
+
+==========================================================================*/
+void cmdproc_set_broadcast (CmdProc *self, Broadcast *broadcast)
+  {
+  self->broadcast = broadcast;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_set_server
+
+==========================================================================*/
+void cmdproc_set_server (CmdProc *self, Server *server)
+  {
+  self->server = server;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_set_auth
+
+==========================================================================*/
+void cmdproc_set_auth (CmdProc *self, Auth *auth)
+  {
+  self->auth = auth;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_get_transport
+
+  Called by the state file writer, to find the playlist index and
+  playback position. While playback is being resumed, report the
+  position being resumed, so a restart during Xine initialization 
+  does not lose it 
+
+==========================================================================*/
+static void cmdproc_get_transport (void *data, int *index, int *msec)
+  {
+  CmdProc *self = (CmdProc *)data;
+  pthread_mutex_lock (&self->playlist_mutex);
+  BOOL resume_pending = self->resume_pending;
+  if (resume_pending)
+    {
+    *index = self->resume_index;
+    *msec = self->resume_msec;
+    }
+  else
+    *index = self->playlist_index;
+  cmdproc_unlock_playlist (self);
+  if (!resume_pending)
+    {
+    int len;
+    xine_interface_get_pos_len (self->xi, msec, &len);
+    }
+  }
+
+
+/*==========================================================================
+
+  cmdproc_resume_thread
+
+==========================================================================*/
+static void *cmdproc_resume_thread (void *arg)
+  {
+  LOG_IN
+  CmdProc *self = (CmdProc *)arg;
+  // Don't hold the playlist lock while Xine is starting
+  BOOL ready = xine_interface_wait_ready (self->xi, NULL);
+  // Clients may have edited the playlist, or cancelled the resume,
+  //  while we waited
+  pthread_mutex_lock (&self->playlist_mutex);
+  if (ready && self->resume_pending)
+    {
+    int error_code;
+    char *error = NULL;
+    int index = self->resume_index;
+    int msec = self->resume_msec;
+    log_info ("Resuming playlist item %d at %d msec", index, msec);
+    if (cmdproc_play_playlist_entry (self, index, &error_code, &error))
+      {
+      if (msec > 0)
+        xine_interface_seek (self->xi, msec);
+      }
+    else
+      {
+      log_warning ("Can't resume playback: %s", error);
+      free (error);
+      }
+    }
+  self->resume_pending = FALSE;
+  cmdproc_unlock_playlist (self);
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_restore_state
+
+  Load the playlist, volume and EQ from the state file, and record
+  changes to them from now on. If 'resume' is set, playback restarts
+  at the saved position, once Xine is ready. This must be called 
+  before statefile_start()
+
+==========================================================================*/
+void cmdproc_restore_state (CmdProc *self, StateFile *statefile, 
+      BOOL resume)
+  {
+  LOG_IN
+  int count;
+  char *const *entries = statefile_get_entries (statefile, &count);
+  pthread_mutex_lock (&self->playlist_mutex);
+  playlist_clear (self->playlist);
+  char **items = malloc ((count + 1) * sizeof (char *));
+  for (int i = 0; i < count; i++)
+    items[i] = strdup (entries[i]);
+  playlist_insert (self->playlist, 0, items, count);
+  free (items);
+  cmdproc_unlock_playlist (self);
+  if (count > 0)
+    notifier_notify (self->notifier, XSNOTIFY_CLASS_PLAYLIST,
+       XSNOTIFY_EVENT_PL_CHANGED, NOTIFY_MSG_PL_CHANGED); 
+
+  int volume = statefile_get_volume (statefile);
+  if (volume >= 0)
+    xine_interface_set_volume (self->xi, volume);
+  int eq[10];
+  if (statefile_get_eq (statefile, eq))
+    xine_interface_set_eq (self->xi, eq);
+
+  self->statefile = statefile;
+  statefile_set_transport_fn (statefile, cmdproc_get_transport, self);
+
+  int index = statefile_get_index (statefile);
+  if (resume && index >= 0 && index < count)
+    {
+    pthread_mutex_lock (&self->playlist_mutex);
+    self->resume_index = index;
+    self->resume_msec = statefile_get_position (statefile);
+    self->resume_pending = TRUE;
+    cmdproc_unlock_playlist (self);
+    self->resume_thread_running = TRUE;
+    pthread_create (&self->resume_thread, NULL, cmdproc_resume_thread, self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_find_zone
+
+  Returns NULL if there is no zone of the specified name. The top-level
+  command processor can be addressed as a zone by its own name.
+
+==========================================================================*/
+static CmdProc *cmdproc_find_zone (CmdProc *self, const char *name)
+  {
+  LOG_IN
+  CmdProc *ret = NULL;
+  if (strcmp (self->name, name) == 0)
+    ret = self;
+  int l = list_length (self->zones);
+  for (int i = 0; i < l && !ret; i++)
+    {
+    CmdProc *zone = list_get (self->zones, i);
+    if (strcmp (zone->name, name) == 0)
+      ret = zone;
     }
-  else
-    {
-    log_error ("%s: Can't play because playlist is empty", 
-        __PRETTY_FUNCTION__);
-    *error_code = XINESERVER_ERR_PLAYLIST_EMPTY;
-    asprintf (error, "Playlist empty"); 
-    }
-  pthread_mutex_unlock (&self->playlist_mutex);
   LOG_OUT
   return ret;
   }
@@ -600,62 +2195,271 @@ static BOOL cmdproc_play_playlist_entry (CmdProc *self, int index,
 
 /*==========================================================================
 
-  cmdproc_cmd_play
+  cmdproc_add_zone
+
+  Add a named zone, with its own playlist and lock, played through the
+  specified XineInterface. The interface should already have been
+  initialized, and is owned by the command processor from this point.
+  Returns FALSE if a zone of the same name exists already.
 
 ==========================================================================*/
-static void cmdproc_cmd_play (CmdProc *self, int argc, List * argv, 
-       char **response)
+BOOL cmdproc_add_zone (CmdProc *self, const char *name, XineInterface *xi)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  if (cmdproc_find_zone (self, name))
+    {
+    log_error ("%s: Duplicate zone name %s", __PRETTY_FUNCTION__, name);
+    }
+  else
+    {
+    log_info ("Adding zone %s", name);
+    CmdProc *zone = cmdproc_create (xi, self->notifier);
+    free (zone->name);
+    zone->name = strdup (name);
+    zone->parent = self;
+    list_append (self->zones, zone);
+    ret = TRUE;
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_join_args
+
+  Reassemble tokenized arguments into a command line, quoting each
+  argument so that string_tokenize() will give back the same tokens. 
+  The caller must free the result.
+
+==========================================================================*/
+static char *cmdproc_join_args (List *argv, int first)
   {
   LOG_IN
+  String *s = string_create_empty ();
+  int argc = list_length (argv);
+  for (int i = first; i < argc; i++)
+    {
+    String *arg = string_clone (list_get (argv, i));
+    String *esc_bs = string_substitute_all (arg, "\\", "\\\\");
+    String *esc_arg = string_substitute_all (esc_bs, "\"", "\\\"");
+    if (i > first) string_append (s, " ");
+    string_append (s, "\"");
+    string_append (s, string_cstr (esc_arg));
+    string_append (s, "\"");
+    string_destroy (arg);
+    string_destroy (esc_bs);
+    string_destroy (esc_arg);
+    }
+  char *ret = strdup (string_cstr (s));
+  string_destroy (s);
+  LOG_OUT
+  return ret;
+  }
+
 
+/*==========================================================================
+
+  cmdproc_cmd_zone
+
+  "zone" on its own lists the zones; "zone name cmd [args]" runs the
+  command against the named zone's playlist and stream.
+
+==========================================================================*/
+static void cmdproc_cmd_zone (CmdProc *self, List *argv, 
+       CmdProcSession *session, char **response)
+  {
+  LOG_IN
+  int argc = list_length (argv);
   if (argc == 1)
     {
-    log_debug ("%s: no arguments", __PRETTY_FUNCTION__);
-    xine_interface_resume (self->xi);
-    asprintf (response, OK_RESPONSE); 
+    String *s_response = string_create ("0 \"");
+    string_append (s_response, self->name);
+    string_append (s_response, "\"");
+    int l = list_length (self->zones);
+    for (int i = 0; i < l; i++)
+      {
+      CmdProc *zone = list_get (self->zones, i);
+      string_append (s_response, " \"");
+      string_append (s_response, zone->name);
+      string_append (s_response, "\"");
+      }
+    string_append (s_response, "\n");
+    *response = strdup (string_cstr (s_response)); 
+    string_destroy (s_response);
+    }
+  else if (argc == 2)
+    {
+    asprintf (response, "%d zone command takes a zone name and a command\n", 
+       XINESERVER_ERR_SYNTAX);
     }
   else
     {
-    log_debug ("%s: one arguments", __PRETTY_FUNCTION__);
-    const char *arg = string_cstr (list_get (argv, 1));
-    uint64_t v;
-    BOOL ok = numberformat_read_integer (arg, &v, TRUE);
-    if (ok)
+    const char *name = string_cstr (list_get (argv, 1));
+    const char *zcmd = string_cstr (list_get (argv, 2));
+    CmdProc *zone = cmdproc_find_zone (self, name);
+    if (!zone)
       {
-      int index = v;
-      int error_code = 0;
-      char *error = NULL;
-      if (cmdproc_play_playlist_entry (self, index, &error_code,
-            &error))
-        {
-        asprintf (response, OK_RESPONSE); 
-        }
-      else
-        {
-        asprintf (response, "%d %s\n", error_code, error); 
-        free (error);
-        }
+      asprintf (response, "%d No such zone %s\n", XINESERVER_ERR_NOZONE, 
+        name);
+      }
+    else if (strcmp (zcmd, XINESERVER_CMD_SHUTDOWN) == 0 
+          || strcmp (zcmd, XINESERVER_CMD_ZONE) == 0
+          || strcmp (zcmd, XINESERVER_CMD_AUTH) == 0)
+      {
+      asprintf (response, "%d Command %s cannot be sent to a zone\n", 
+         XINESERVER_ERR_BADCOMMAND, zcmd);
       }
     else
       {
-      log_error ("%s: Playlist index %s is not a number", 
-           __PRETTY_FUNCTION__, arg);
-      asprintf (response, "%d Bad number %s\n", XINESERVER_ERR_BADARG, 
-	   arg); 
+      log_debug ("%s: Passing command %s to zone %s", __PRETTY_FUNCTION__, 
+        zcmd, name);
+      char *zone_cmd = cmdproc_join_args (argv, 2);
+      cmdproc_do_cmd (zone, zone_cmd, session, response);
+      free (zone_cmd);
+      }
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  cmdproc_cmd_auth
+
+  A token that is not accepted takes away any role that the session 
+  had. Without an Auth, any token is accepted
+
+==========================================================================*/
+static void cmdproc_cmd_auth (CmdProc *self, List *argv, 
+       CmdProcSession *session, char **response)
+  {
+  LOG_IN
+  Auth *auth = self->parent ? self->parent->auth : self->auth;
+  if (list_length (argv) != 2)
+    {
+    asprintf (response, "%d auth command takes a token\n", 
+       XINESERVER_ERR_SYNTAX);
+    }
+  else if (!auth)
+    {
+    asprintf (response, OK_RESPONSE);
+    }
+  else
+    {
+    const AuthRole *role = auth_login (auth, 
+      string_cstr (list_get (argv, 1)));
+    if (session) session->role = role;
+    if (role)
+      {
+      log_debug ("%s: Client authenticated as %s", __PRETTY_FUNCTION__,
+        auth_role_get_name (role));
+      asprintf (response, "0 %s\n", auth_role_get_name (role));
+      }
+    else
+      {
+      log_warning ("Client sent a token that is not known");
+      asprintf (response, "%d Token not accepted\n", XINESERVER_ERR_AUTH);
       }
     }
   LOG_OUT
   }
 
+
+/*==========================================================================
+
+  cmdproc_log_text
+
+==========================================================================*/
+const char *cmdproc_log_text (const char *cmd)
+  {
+  const char *s = cmd + strspn (cmd, " \t\"");
+  size_t len = strlen (XINESERVER_CMD_AUTH);
+  if (strncmp (s, XINESERVER_CMD_AUTH, len) == 0 
+       && strchr (" \t\"", s[len]))
+    return XINESERVER_CMD_AUTH " (token not shown)";
+  return cmd;
+  }
+
+
+/*==========================================================================
+
+  cmdproc_allows
+
+  Whether the session's role, or the role for clients that have not
+  authenticated, allows a command. A command that has no index is
+  not allowed, so that one added to the dispatcher but not to
+  cmdproc_command_index() can't be run by every role
+
+==========================================================================*/
+static BOOL cmdproc_allows (const CmdProc *self, 
+       const CmdProcSession *session, const char *cmd)
+  {
+  const Auth *auth = self->parent ? self->parent->auth : self->auth;
+  if (!auth || !session) return TRUE;
+  int i = cmdproc_command_index (cmd);
+  if (i < 0) return FALSE;
+  const AuthRole *role = session->role ? session->role 
+    : auth_get_guest (auth);
+  return role && auth_role_allows (role, i);
+  }
+
+
+/*==========================================================================
+
+  cmdproc_zone_command
+
+  If 'cmd' is 'zone {name} {command}', returns the command that it 
+  carries; otherwise NULL
+
+==========================================================================*/
+static const char *cmdproc_zone_command (const char *cmd)
+  {
+  cmd += strspn (cmd, " \t");
+  size_t len = strlen (XINESERVER_CMD_ZONE);
+  if (strncmp (cmd, XINESERVER_CMD_ZONE, len) != 0 
+       || (cmd[len] != ' ' && cmd[len] != '\t'))
+    return NULL;
+  cmd += len;
+  cmd += strspn (cmd, " \t");
+  cmd += strcspn (cmd, " \t");
+  cmd += strspn (cmd, " \t");
+  return cmd[0] ? cmd : NULL;
+  }
+
+
 /*==========================================================================
 
   cmdproc_do_cmd
 
+  A zone command takes the zone's lock, when it is passed on to the 
+  zone, and not this one's
+
+==========================================================================*/
+void cmdproc_do_cmd (CmdProc *self, const char *cmd, 
+       CmdProcSession *session, char **response)
+  {
+  BOOL write = !cmdproc_zone_command (cmd) 
+    && cmdproc_classify (cmd) == CMDPROC_CLASS_WRITE;
+  if (write) pthread_mutex_lock (&self->write_mutex);
+  cmdproc_run_cmd (self, cmd, session, response);
+  if (write) pthread_mutex_unlock (&self->write_mutex);
+  }
+
+
+/*==========================================================================
+
+  cmdproc_run_cmd
+
 ==========================================================================*/
-void cmdproc_do_cmd (CmdProc *self, const char *cmd, char **response)
+static void cmdproc_run_cmd (CmdProc *self, const char *cmd, 
+       CmdProcSession *session, char **response)
   {
   LOG_IN
-  log_debug ("%s: command=%s", __PRETTY_FUNCTION__, cmd);
+  log_debug ("%s: command=%s", __PRETTY_FUNCTION__, 
+    cmdproc_log_text (cmd));
   if (strlen (cmd) > 0)
     {
     String *s_cmd = string_create (cmd);
@@ -665,10 +2469,24 @@ void cmdproc_do_cmd (CmdProc *self, const char *cmd, char **response)
       {
       const char *cmd = string_cstr (list_get (argv, 0)); 
       log_debug ("%s: Got cmd %s", __PRETTY_FUNCTION__, cmd);
-      if (strcmp (cmd, XINESERVER_CMD_SHUTDOWN) == 0)
+      if (strcmp (cmd, XINESERVER_CMD_AUTH) == 0)
+        {
+        log_debug ("%s: Got auth command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_auth (self, argv, session, response);
+        }
+      else if (!cmdproc_allows (self, session, cmd))
+        {
+        if (cmdproc_command_index (cmd) < 0)
+          asprintf (response, "%d Unknown command %s\n", 
+              XINESERVER_ERR_BADCOMMAND, cmd);
+        else
+          asprintf (response, "%d Command %s is not allowed\n", 
+              XINESERVER_ERR_DENIED, cmd);
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_SHUTDOWN) == 0)
         {
         log_debug ("%s, Requesting shutdown", __PRETTY_FUNCTION__);
-        self->request_quit = TRUE;
+        __atomic_store_n (&self->request_quit, TRUE, __ATOMIC_RELEASE);
         asprintf (response, OK_RESPONSE);
         }
       else if (strcmp (cmd, XINESERVER_CMD_PLAY) == 0)
@@ -701,6 +2519,46 @@ void cmdproc_do_cmd (CmdProc *self, const char *cmd, char **response)
         log_debug ("%s: Got playlist command", __PRETTY_FUNCTION__);
         cmdproc_cmd_playlist (self, argv, response); 
         }
+      else if (strcmp (cmd, XINESERVER_CMD_PLAYLIST_META) == 0)
+        {
+        log_debug ("%s: Got playlist-meta command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_playlist_meta (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_SHUFFLE) == 0)
+        {
+        log_debug ("%s: Got shuffle command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_shuffle (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_REPEAT) == 0)
+        {
+        log_debug ("%s: Got repeat command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_repeat (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_INSERT) == 0)
+        {
+        log_debug ("%s: Got insert command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_insert (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_REMOVE) == 0)
+        {
+        log_debug ("%s: Got remove command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_remove (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_MOVE) == 0)
+        {
+        log_debug ("%s: Got move command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_move (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_PLAYLIST_SINCE) == 0)
+        {
+        log_debug ("%s: Got playlist-since command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_playlist_since (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_LEVELS) == 0)
+        {
+        log_debug ("%s: Got levels command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_levels (self, argv, response); 
+        }
       else if (strcmp (cmd, XINESERVER_CMD_CLEAR) == 0)
         {
         log_debug ("%s: Got clear command", __PRETTY_FUNCTION__);
@@ -736,6 +2594,56 @@ void cmdproc_do_cmd (CmdProc *self, const char *cmd, char **response)
         log_debug ("%s: Got eq command", __PRETTY_FUNCTION__);
         cmdproc_cmd_eq (self, argv, response); 
         }
+      else if (strcmp (cmd, XINESERVER_CMD_SYNC) == 0)
+        {
+        log_debug ("%s: Got sync command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_sync (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_ADD_DIR) == 0)
+        {
+        log_debug ("%s: Got add-dir command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_add_dir (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_ADD_M3U) == 0)
+        {
+        log_debug ("%s: Got add-m3u command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_add_playlist (self, argv, FALSE, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_ADD_PLS) == 0)
+        {
+        log_debug ("%s: Got add-pls command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_add_playlist (self, argv, TRUE, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_SEARCH) == 0)
+        {
+        log_debug ("%s: Got search command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_search (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_ADD_QUERY) == 0)
+        {
+        log_debug ("%s: Got add-query command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_add_query (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_LIBRARY) == 0)
+        {
+        log_debug ("%s: Got library command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_library (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_OUTPUT) == 0)
+        {
+        log_debug ("%s: Got output command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_output (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_STATS) == 0)
+        {
+        log_debug ("%s: Got stats command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_stats (self, argv, response); 
+        }
+      else if (strcmp (cmd, XINESERVER_CMD_ZONE) == 0)
+        {
+        log_debug ("%s: Got zone command", __PRETTY_FUNCTION__);
+        cmdproc_cmd_zone (self, argv, session, response); 
+        }
       else if (strcmp (cmd, XINESERVER_CMD_VERSION) == 0)
         {
         log_debug ("%s: Got version command", __PRETTY_FUNCTION__);
@@ -759,17 +2667,88 @@ void cmdproc_do_cmd (CmdProc *self, const char *cmd, char **response)
     asprintf (response, "%d Empty command\n", XINESERVER_ERR_SYNTAX);
     }
 
+  // Most commands change something that shared memory readers see
+  if (self->shmstatus)
+    shmstatus_poke (self->shmstatus);
+
   LOG_OUT
   }
 
+/*==========================================================================
+
+  cmdproc_classify
+
+  Only the first word of the command counts. Commands sent to a zone
+  are treated as if they change something. Fast commands must be
+  safe to run at the same time as any other
+
+==========================================================================*/
+CmdProcClass cmdproc_classify (const char *cmd)
+  {
+  // A zone command is whatever the command it carries is
+  const char *zcmd = cmdproc_zone_command (cmd);
+  if (zcmd) return cmdproc_classify (zcmd);
+  if (strncmp (cmd, XINESERVER_CMD_AUTH, strlen (XINESERVER_CMD_AUTH)) == 0
+      && strchr (" \t", cmd[strlen (XINESERVER_CMD_AUTH)]))
+    return CMDPROC_CLASS_SESSION;
+  static const char *fast[] = { XINESERVER_CMD_STATUS, 
+    XINESERVER_CMD_VERSION, NULL };
+  static const char *read[] = { XINESERVER_CMD_PLAYLIST, 
+    XINESERVER_CMD_PLAYLIST_META, XINESERVER_CMD_PLAYLIST_SINCE,
+    XINESERVER_CMD_META_INFO,
+    XINESERVER_CMD_LEVELS, XINESERVER_CMD_SEARCH, XINESERVER_CMD_STATS, 
+    NULL };
+  while (*cmd == ' ' || *cmd == '\t') cmd++;
+  size_t len = strcspn (cmd, " \t");
+  for (int i = 0; fast[i]; i++)
+    if (strlen (fast[i]) == len && strncmp (cmd, fast[i], len) == 0)
+      return CMDPROC_CLASS_FAST;
+  for (int i = 0; read[i]; i++)
+    if (strlen (read[i]) == len && strncmp (cmd, read[i], len) == 0)
+      return CMDPROC_CLASS_READ;
+  return CMDPROC_CLASS_WRITE;
+  }
+
+/*==========================================================================
+
+  cmdproc_command_index
+
+  The index of each command is its position in this list, so new
+  commands go at the end. Roles (see auth.c) keep a bit for each
+
+==========================================================================*/
+int cmdproc_command_index (const char *cmd)
+  {
+  static const char *commands[] = { XINESERVER_CMD_ADD, 
+    XINESERVER_CMD_PLAYLIST, XINESERVER_CMD_STOP, XINESERVER_CMD_PLAY,
+    XINESERVER_CMD_STATUS, XINESERVER_CMD_SHUTDOWN, XINESERVER_CMD_PAUSE,
+    XINESERVER_CMD_CLEAR, XINESERVER_CMD_NEXT, XINESERVER_CMD_PREV,
+    XINESERVER_CMD_VOLUME, XINESERVER_CMD_META_INFO, XINESERVER_CMD_SEEK,
+    XINESERVER_CMD_EQ, XINESERVER_CMD_VERSION, XINESERVER_CMD_ZONE,
+    XINESERVER_CMD_SYNC, XINESERVER_CMD_STATS, XINESERVER_CMD_OUTPUT,
+    XINESERVER_CMD_ADD_DIR, XINESERVER_CMD_ADD_M3U, XINESERVER_CMD_ADD_PLS,
+    XINESERVER_CMD_SEARCH, XINESERVER_CMD_ADD_QUERY, 
+    XINESERVER_CMD_LIBRARY, XINESERVER_CMD_PLAYLIST_META, 
+    XINESERVER_CMD_SHUFFLE, XINESERVER_CMD_REPEAT, XINESERVER_CMD_INSERT,
+    XINESERVER_CMD_REMOVE, XINESERVER_CMD_MOVE, 
+    XINESERVER_CMD_PLAYLIST_SINCE, XINESERVER_CMD_LEVELS, NULL };
+  for (int i = 0; commands[i]; i++)
+    if (strcmp (cmd, commands[i]) == 0) return i;
+  return -1;
+  }
+
 /*==========================================================================
 
   cmdproc_has_requested_shutdown
 
+  Also TRUE if Xine has failed to initialize in the background, since
+  nothing could then be played
+
 ==========================================================================*/
 BOOL cmdproc_has_requested_shutdown (const CmdProc *self)
   {
-  return self->request_quit;
+  return __atomic_load_n (&self->request_quit, __ATOMIC_ACQUIRE)
+    || xine_interface_has_failed (self->xi);
   }
 
 /*==========================================================================
@@ -819,30 +2798,35 @@ static void cmdproc_notify_playback_finished (void *arg)
 
   int index = self->playlist_index;
 
-  const char *old_stream = list_get (self->playlist, index);
+  const char *old_stream = playlist_get (self->playlist, index);
+  if (!old_stream) old_stream = "-";
   log_info ("Playback finished for stream '%s'", old_stream);
   notifier_notify (self->notifier, XSNOTIFY_CLASS_TRANSPORT,
      XSNOTIFY_EVENT_STREAM_FINISHED, "%s %s", NOTIFY_MSG_STREAM_FINISHED, 
        old_stream); 
 
-  int length = list_length (self->playlist); 
-  index++;
-  if (index < length)
+  // Repeat an item that played, but go on from one that failed
+  if (self->repeat != XINESERVER_REPEAT_ONE || self->failed_items > 0)
+    index = cmdproc_step (self, index, 1);
+  // With repeat on, stop if every item has failed
+  if (index >= 0 && self->failed_items < playlist_length (self->playlist))
     {
     int error_code = 0;
     char *error = NULL;
     log_debug ("%s: Moving to playlist item %d", __PRETTY_FUNCTION__, index);
-    const char *stream = list_get (self->playlist, index);
+    const char *stream = playlist_get (self->playlist, index);
     log_debug ("%s: next item is %s", __PRETTY_FUNCTION__, stream);
     BOOL ok = cmdproc_play_stream (self, stream, &error_code, &error);
     if (ok)
       {
       self->playlist_index = index;
+      self->failed_items = 0;
       }
     else
       { 
       log_error ("%s: %s", __PRETTY_FUNCTION__, error); 
       free (error);
+      self->failed_items++;
       // Try to move onto the next item. This is a recursive call,
       //  and may be troublesome where there is a long playlist
       //  with many broken items, because of stack usage
@@ -856,11 +2840,14 @@ static void cmdproc_notify_playback_finished (void *arg)
     log_debug ("%s: At end of playlist", __PRETTY_FUNCTION__);
     index = -1;
     self->playlist_index = -1;
+    self->failed_items = 0;
     notifier_notify (self->notifier, XSNOTIFY_CLASS_TRANSPORT,
        XSNOTIFY_EVENT_PL_FINISHED, NOTIFY_MSG_PL_FINISHED); 
     }
 
-  pthread_mutex_unlock (&self->playlist_mutex);
+  cmdproc_unlock_playlist (self);
+  if (self->shmstatus)
+    shmstatus_poke (self->shmstatus);
   LOG_OUT
   }
 
@@ -875,6 +2862,50 @@ BOOL cmdproc_init_xine (CmdProc *self)
   }
 
 
+/*==========================================================================
+
+  cmdproc_apply_gain
+
+  Set the gain for an item that is about to play, from its ReplayGain
+  tags. In album mode, the album gain is used if there is one, and the
+  track gain if not; in track mode, the other way round. The gain is
+  reduced, if necessary, so that the item's peak is not clipped. Items
+  without tags, including streams, play at unity gain
+
+==========================================================================*/
+static void cmdproc_apply_gain (CmdProc *self, const char *stream)
+  {
+  CmdProc *top = self->parent ? self->parent : self;
+  if (top->replaygain == CMDPROC_REPLAYGAIN_OFF) return;
+
+  TagGain g;
+  BOOL ok = FALSE;
+  if (top->metacache)
+    ok = metacache_get_gain (top->metacache, stream, &g);
+  else if (stream[0] == '/')
+    {
+    TagInfo t;
+    ok = tagreader_read (stream, &t);
+    g = t.gain;
+    tagreader_free (&t);
+    }
+
+  double db = 0;
+  if (ok && (g.have_track || g.have_album))
+    {
+    BOOL album = (top->replaygain == CMDPROC_REPLAYGAIN_ALBUM 
+      && g.have_album) || !g.have_track;
+    double peak = album ? g.album_peak : g.track_peak;
+    db = (album ? g.album_gain : g.track_gain) + top->replaygain_preamp;
+    if (peak > 0 && db > -20 * log10 (peak))
+      db = -20 * log10 (peak);
+    log_debug ("%s: %s gain %.2f dB for %s", __PRETTY_FUNCTION__, 
+      album ? "album" : "track", db, stream);
+    }
+  xine_interface_set_gain (self->xi, db);
+  }
+
+
 /*==========================================================================
 
   cmdproc_play_stream
@@ -893,6 +2924,7 @@ BOOL cmdproc_play_stream (CmdProc *self,
   if ((stream[0] == '/' && (access (stream, R_OK) == 0))
         || (stream[0] != '/'))
     {
+    cmdproc_apply_gain (self, stream);
     if (xine_interface_play_stream (self->xi, stream, error))
       {
       log_info ("%s %s", NOTIFY_MSG_NEW_STREAM, stream);
@@ -928,7 +2960,9 @@ void cmdproc_stop_playback (CmdProc *self)
 
   log_debug ("%s: Stopping playback", __PRETTY_FUNCTION__); 
 
+  pthread_mutex_lock (&self->playlist_mutex);
   self->playlist_index = -1;
+  cmdproc_unlock_playlist (self);
   xine_interface_stop (self->xi);
   notifier_notify (self->notifier, XSNOTIFY_CLASS_TRANSPORT,
        XSNOTIFY_EVENT_PLAYBACK_STOPPED, NOTIFY_MSG_STOPPED_PLAYBACK); 
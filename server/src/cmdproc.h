@@ -17,15 +17,92 @@ struct _CmdProc;
 typedef struct _CmdProc CmdProc;
 
 struct _XineInterface;
+struct _ClockSync;
+struct _StateFile;
+struct _Library;
+struct _MetaCache;
+struct _ShmStatus;
+struct _Broadcast;
+struct _Server;
+
+// Which ReplayGain value, if any, sets the loudness of each item
+typedef enum
+  {
+  CMDPROC_REPLAYGAIN_OFF = 0,
+  CMDPROC_REPLAYGAIN_TRACK,
+  CMDPROC_REPLAYGAIN_ALBUM
+  } CmdProcReplayGain;
+
+// How a command may be run alongside others. Read-only commands may
+//  run at the same time as any others; other commands run one at a 
+//  time in each zone, and cmdproc_do_cmd() sees to that. A zone 
+//  command is classed by the command it carries. Fast commands take 
+//  so little time that the server runs them as soon as they arrive
+typedef enum
+  {
+  CMDPROC_CLASS_WRITE = 0,
+  CMDPROC_CLASS_READ,
+  CMDPROC_CLASS_FAST,
+  // Changes only the session of the client that sent it
+  CMDPROC_CLASS_SESSION
+  } CmdProcClass;
+
+struct _Auth;
+struct _AuthRole;
+
+// What one client connection has established, with the 'auth' command.
+//  The server keeps one for each connection, starting zeroed
+typedef struct _CmdProcSession
+  {
+  // Limits the commands the client may send, when there is an Auth.
+  //  NULL until the client authenticates
+  const struct _AuthRole *role;
+  } CmdProcSession;
+
+// Name by which the top-level command processor is known, when 
+//  zones are in use
+#define CMDPROC_DEFAULT_ZONE "default"
 
 BEGIN_DECLS
 CmdProc    *cmdproc_create (struct _XineInterface *xi, Notifier *notifier); 
 void        cmdproc_destroy (CmdProc *self);
-void        cmdproc_do_cmd (CmdProc *self, const char *cmd, char **response);
+// 'session' may be NULL, for commands that are not from a client, which
+//  are not limited by any role
+void        cmdproc_do_cmd (CmdProc *self, const char *cmd, 
+                CmdProcSession *session, char **response);
+CmdProcClass cmdproc_classify (const char *cmd);
+// A number from 0 to 63 for each command, or -1 if it is not known
+int         cmdproc_command_index (const char *cmd);
+// The command line as it may be logged: 'auth' without its token
+const char *cmdproc_log_text (const char *cmd);
 BOOL        cmdproc_has_requested_shutdown (const CmdProc *self);
 void        cmdproc_stop_playback (CmdProc *self);
 BOOL        cmdproc_play_stream (CmdProc *self, 
                 const char *stream, int *error_code, char **error);
+BOOL        cmdproc_add_zone (CmdProc *self, const char *name, 
+                struct _XineInterface *xi);
+void        cmdproc_set_clocksync (CmdProc *self, 
+                struct _ClockSync *clocksync);
+void        cmdproc_restore_state (CmdProc *self, 
+                struct _StateFile *statefile, BOOL resume);
+void        cmdproc_set_library (CmdProc *self, struct _Library *library);
+void        cmdproc_set_metacache (CmdProc *self, 
+                struct _MetaCache *metacache);
+void        cmdproc_set_shmstatus (CmdProc *self, 
+                struct _ShmStatus *shmstatus);
+void        cmdproc_set_broadcast (CmdProc *self, 
+                struct _Broadcast *broadcast);
+// The server whose counters 'stats' reports
+void        cmdproc_set_server (CmdProc *self, struct _Server *server);
+// Roles that clients must authenticate as; NULL to allow anything
+void        cmdproc_set_auth (CmdProc *self, struct _Auth *auth);
+// Set loudness normalization, for this command processor and its
+//  zones. 'preamp' is in dB, and is added to the gain of items that
+//  have ReplayGain tags
+void        cmdproc_set_replaygain (CmdProc *self, CmdProcReplayGain mode,
+                double preamp);
+BOOL        cmdproc_replaygain_from_string (const char *s, 
+                CmdProcReplayGain *mode);
 END_DECLS
 
 
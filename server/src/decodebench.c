@@ -0,0 +1,271 @@
+/*==========================================================================
+
+  xine-server
+  decodebench.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Measures how fast Xine can decode, by playing items faster than real
+  time, and comparing the length of each item with the time it took.
+  Xine decodes ahead of its clock, so an item finishes in about its
+  length divided by the speed, unless decoding can't keep up; a rate
+  close to the speed means that the speed, rather than decoding, was
+  the limit. With the 'none' driver nothing is heard; at speeds other
+  than 1, Xine drops the decoded audio rather than play it fast,
+  unless its configuration says otherwise.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <xine.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "list.h"
+#include "decodebench.h"
+
+// Time allowed for an item to finish, on top of twice its length
+#define DECODEBENCH_GRACE_MSEC 30000
+
+// Interval at which the length of an item is read while waiting
+#define DECODEBENCH_POLL_MSEC 100
+
+typedef struct _DecodeBenchCodec
+  {
+  char *codec;
+  int items;
+  int64_t media_msec;
+  int64_t usec;
+  } DecodeBenchCodec;
+
+typedef struct _DecodeBenchWait
+  {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  BOOL finished;
+  } DecodeBenchWait;
+
+
+/*==========================================================================
+
+  decodebench_usec
+
+==========================================================================*/
+static int64_t decodebench_usec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+
+/*==========================================================================
+
+  decodebench_codec_free
+
+==========================================================================*/
+static void decodebench_codec_free (void *item)
+  {
+  DecodeBenchCodec *c = (DecodeBenchCodec *)item;
+  free (c->codec);
+  free (c);
+  }
+
+
+/*==========================================================================
+
+  decodebench_finished
+
+  Called on Xine's event thread when an item ends
+
+==========================================================================*/
+static void decodebench_finished (void *data)
+  {
+  DecodeBenchWait *w = (DecodeBenchWait *)data;
+  pthread_mutex_lock (&w->mutex);
+  w->finished = TRUE;
+  pthread_cond_signal (&w->cond);
+  pthread_mutex_unlock (&w->mutex);
+  }
+
+
+/*==========================================================================
+
+  decodebench_item
+
+  Play one item to the end. 'len' is set to its length in msec, as
+  reported by Xine, and 'usec' to the time it took
+
+==========================================================================*/
+static BOOL decodebench_item (XineInterface *xi, int speed,
+      const char *mrl, DecodeBenchWait *w, int *len, int64_t *usec,
+      char **codec, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  int pos = 0;
+  *len = 0;
+  *codec = NULL;
+  pthread_mutex_lock (&w->mutex);
+  w->finished = FALSE;
+  pthread_mutex_unlock (&w->mutex);
+
+  int64_t t0 = decodebench_usec ();
+  if (xine_interface_play_stream (xi, mrl, error))
+    {
+    if (speed > 1)
+      xine_interface_set_speed_ppm (xi, (speed - 1) * 1000000);
+    *codec = xine_interface_get_meta_info (xi, XINE_META_INFO_AUDIOCODEC);
+    xine_interface_get_pos_len (xi, &pos, len);
+
+    pthread_mutex_lock (&w->mutex);
+    while (!w->finished)
+      {
+      int64_t elapsed = decodebench_usec () - t0;
+      if (elapsed / 1000 > DECODEBENCH_GRACE_MSEC + 2 * (int64_t)*len)
+        break;
+      struct timespec ts;
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_nsec += DECODEBENCH_POLL_MSEC * 1000000L;
+      if (ts.tv_nsec >= 1000000000L)
+        {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+        }
+      pthread_cond_timedwait (&w->cond, &w->mutex, &ts);
+      if (!w->finished)
+        {
+        int l = 0;
+        pthread_mutex_unlock (&w->mutex);
+        xine_interface_get_pos_len (xi, &pos, &l);
+        pthread_mutex_lock (&w->mutex);
+        if (l > *len) *len = l;
+        }
+      }
+    ret = w->finished;
+    pthread_mutex_unlock (&w->mutex);
+    *usec = decodebench_usec () - t0;
+
+    if (!ret)
+      {
+      xine_interface_stop (xi);
+      asprintf (error, "did not finish in %d sec",
+        (int)(*usec / 1000000));
+      }
+    else if (*len <= 0)
+      {
+      asprintf (error, "length not known");
+      ret = FALSE;
+      }
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  decodebench_print
+
+==========================================================================*/
+static void decodebench_print (FILE *out, const char *name,
+      const char *codec, int64_t media_msec, int64_t usec, int speed)
+  {
+  double rate = usec > 0 ? media_msec * 1000.0 / usec : 0;
+  fprintf (out, "%-32s %-12s %9.1f %8.2f %9.1fx%s\n", name, codec,
+    media_msec / 1000.0, usec / 1000000.0, rate,
+    rate >= 0.95 * speed ? " *" : "");
+  }
+
+
+/*==========================================================================
+
+  decodebench_run
+
+==========================================================================*/
+int decodebench_run (XineInterface *xi, int speed,
+      char *const *mrls, int count, FILE *out)
+  {
+  LOG_IN
+  int failures = 0;
+  BOOL limited = FALSE;
+  if (speed < 1) speed = 1;
+  DecodeBenchWait w;
+  pthread_mutex_init (&w.mutex, NULL);
+  pthread_cond_init (&w.cond, NULL);
+  xine_interface_set_playback_finished_fn (xi, decodebench_finished, &w);
+  List *codecs = list_create (decodebench_codec_free);
+
+  fprintf (out, "%-32s %-12s %9s %8s %10s\n", "item", "codec",
+    "audio s", "time s", "realtime");
+  for (int i = 0; i < count; i++)
+    {
+    int len;
+    int64_t usec;
+    char *codec;
+    char *error = NULL;
+    const char *name = strrchr (mrls[i], '/');
+    name = name ? name + 1 : mrls[i];
+    if (decodebench_item (xi, speed, mrls[i], &w, &len, &usec, &codec,
+          &error))
+      {
+      decodebench_print (out, name, codec, len, usec, speed);
+      if (usec > 0 && len * 1000.0 / usec >= 0.95 * speed) limited = TRUE;
+      DecodeBenchCodec *c = NULL;
+      for (int j = 0; j < list_length (codecs) && !c; j++)
+        {
+        DecodeBenchCodec *cj = list_get (codecs, j);
+        if (strcmp (cj->codec, codec) == 0) c = cj;
+        }
+      if (!c)
+        {
+        c = malloc (sizeof (DecodeBenchCodec));
+        memset (c, 0, sizeof (DecodeBenchCodec));
+        c->codec = strdup (codec);
+        list_append (codecs, c);
+        }
+      c->items++;
+      c->media_msec += len;
+      c->usec += usec;
+      }
+    else
+      {
+      fprintf (out, "%-32s %s\n", name, error);
+      failures++;
+      }
+    if (codec) free (codec);
+    if (error) free (error);
+    }
+  xine_interface_stop (xi);
+  xine_interface_set_playback_finished_fn (xi, NULL, NULL);
+
+  if (list_length (codecs) > 0)
+    {
+    fprintf (out, "\n%-32s %-12s %9s %8s %10s\n", "codec", "items",
+      "audio s", "time s", "realtime");
+    for (int j = 0; j < list_length (codecs); j++)
+      {
+      DecodeBenchCodec *c = list_get (codecs, j);
+      char items[16];
+      snprintf (items, sizeof (items), "%d", c->items);
+      decodebench_print (out, c->codec, items, c->media_msec, c->usec,
+        speed);
+      }
+    }
+  if (limited)
+    fprintf (out, "\n* limited by the speed (%dx), not by decoding\n",
+      speed);
+
+  list_destroy (codecs);
+  pthread_mutex_destroy (&w.mutex);
+  pthread_cond_destroy (&w.cond);
+  LOG_OUT
+  return failures;
+  }
+
@@ -0,0 +1,29 @@
+/*============================================================================
+
+  xine-server
+  decodebench.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdio.h>
+#include "defs.h"
+#include "xine_interface.h"
+
+// How many times faster than real time Xine is asked to play, by default
+#define DECODEBENCH_DEF_SPEED 32
+
+BEGIN_DECLS
+
+// Play each of the 'count' items through the (initialized) interface at
+//  'speed' times real time, and write the decoding rate of each, and of
+//  each codec, to 'out'. Returns the number of items that could not be
+//  played
+int decodebench_run (XineInterface *xi, int speed,
+                      char *const *mrls, int count, FILE *out);
+
+END_DECLS
+
+
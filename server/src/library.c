@@ -0,0 +1,1618 @@
+/*==========================================================================
+
+  xine-server
+  library.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A searchable index of the audio files under one or more directories.
+
+  The index is a single block of memory -- the "image" -- which is
+  written to disk as it is, and mapped back into memory with mmap() at
+  the next startup, so loading it costs no more than one pass over it
+  to check that it is sound, however large the library. The image holds a table of tracks, sorted by pathname,
+  a pool of strings, and a trigram index: for each sequence of three
+  bytes that occurs in any track's search text, the (sorted) list of
+  tracks in which it occurs.
+
+  The search text for a track is its artist, album, title, genre and
+  filename, in lower case. A search for some words finds the tracks
+  that contain all the trigrams of all the words, by intersecting
+  their lists, and then checks that each candidate really does contain
+  each word. Words shorter than three bytes can't be looked up, so they
+  are only checked.
+
+  Scanning is done on a background thread: the directories are listed
+  by the scanner, tags are read by a pool of threads, and the new
+  image replaces the old one when it is complete. Files whose
+  modification time matches the index are not read again, so a scan of
+  an unchanged library costs little more than listing the directories.
+
+  Between scans, a watcher reports files that are added, changed and
+  removed. These changes are not written into the image, which can't
+  be modified; instead, removed tracks are flagged, and added ones are
+  kept in a separate, small, sorted array, which is searched in full. 
+  When there are too many changes, a scan builds a new image.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "scanner.h"
+#include "tagreader.h"
+#include "watcher.h"
+#include "file.h"
+#include "../../api/xine-server-api.h"
+#include "../../api/xine-server-ext.h"
+#include "library.h"
+
+#define LIBRARY_MAGIC "XSLIB01"
+
+#define LIBRARY_MIN_THREADS 2
+#define LIBRARY_MAX_THREADS 8
+
+// Number of changes from the watcher after which the image is rebuilt,
+//  rather than searching the changes separately
+#define LIBRARY_MAX_CHANGES 2000
+
+#define LIBRARY_MAX_EVENTS 256
+
+// The image header. All offsets are from the start of the image
+typedef struct _LibraryHeader
+  {
+  char magic[8];
+  uint32_t n_tracks;
+  uint32_t n_keys;
+  uint32_t n_postings;
+  uint32_t roots; // Offset in string pool of the roots the index covers
+  uint64_t tracks_offset;
+  uint64_t keys_offset;
+  uint64_t key_index_offset;
+  uint64_t postings_offset;
+  uint64_t strings_offset;
+  uint64_t size;
+  } LibraryHeader;
+
+// String values are offsets into the string pool. Offset zero is an
+//  empty string
+typedef struct _LibraryTrack
+  {
+  uint32_t path;
+  uint32_t title;
+  uint32_t artist;
+  uint32_t album;
+  uint32_t genre;
+  uint32_t text;
+  int64_t mtime;
+  } LibraryTrack;
+
+typedef struct _LibraryImage
+  {
+  BYTE *data;
+  size_t size;
+  BOOL mapped;
+  const LibraryHeader *header;
+  const LibraryTrack *tracks;
+  // Sorted trigram keys. The tracks for keys[i] are
+  //  postings[key_index[i]] to postings[key_index[i+1] - 1]
+  const uint32_t *keys;
+  const uint32_t *key_index;
+  const uint32_t *postings;
+  const char *strings;
+  } LibraryImage;
+
+// A track added since the image was built. The strings are owned
+typedef struct _LibraryExtra
+  {
+  char *path;
+  char *title;
+  char *artist;
+  char *album;
+  char *genre;
+  char *text;
+  int64_t mtime;
+  } LibraryExtra;
+
+struct _Library
+  {
+  char *roots;
+  char *index_path;
+  // Held for reading during a search, and for writing while the
+  //  image is replaced
+  pthread_rwlock_t lock;
+  LibraryImage *image;
+  // Changes made by the watcher since the image was built: a flag for 
+  //  each track in the image that has been removed or replaced, and
+  //  the tracks that are not in the image
+  BYTE *deleted;
+  int deleted_count;
+  LibraryExtra *extras;
+  int extra_count;
+  int extra_size;
+  // Held by whichever of the scan and update threads is changing the
+  //  index. Between them, they are the only writers
+  pthread_mutex_t update_mutex;
+  pthread_mutex_t scan_mutex;
+  pthread_t scan_thread;
+  BOOL scan_thread_running;
+  BOOL scanning;
+  BOOL rescan_pending;
+  BOOL stop;
+  Watcher *watcher;
+  pthread_t update_thread;
+  BOOL update_thread_running;
+  // Statistics
+  int load_usec;
+  int scan_msec;
+  int scan_read;
+  int build_msec;
+  int last_search_usec;
+  int updates;
+  };
+
+
+/*==========================================================================
+
+  library_usec
+
+==========================================================================*/
+static int64_t library_usec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+
+/*==========================================================================
+
+  library_create
+
+==========================================================================*/
+Library *library_create (const char *roots, const char *index_path)
+  {
+  LOG_IN
+  Library *self = malloc (sizeof (Library));
+  memset (self, 0, sizeof (Library));
+  self->roots = strdup (roots);
+  if (index_path)
+    self->index_path = strdup (index_path);
+  pthread_rwlock_init (&self->lock, NULL);
+  pthread_mutex_init (&self->update_mutex, NULL);
+  pthread_mutex_init (&self->scan_mutex, NULL);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  library_image_destroy
+
+==========================================================================*/
+static void library_image_destroy (LibraryImage *image)
+  {
+  if (image)
+    {
+    if (image->mapped)
+      munmap (image->data, image->size);
+    else
+      free (image->data);
+    free (image);
+    }
+  }
+
+
+/*==========================================================================
+
+  library_image_check_contents
+
+  Check that, in an image whose sections fit, every string offset 
+  falls in the string pool, the key index runs forwards through the
+  postings, and each key's postings are ascending track numbers. An
+  index file that is damaged, or not of our making, could otherwise 
+  make a search read outside the image
+
+==========================================================================*/
+static BOOL library_image_check_contents (const BYTE *data, size_t size)
+  {
+  const LibraryHeader *h = (const LibraryHeader *)data;
+  uint64_t pool_len = size - h->strings_offset;
+  if (h->roots >= pool_len) return FALSE;
+
+  const LibraryTrack *tracks = 
+    (const LibraryTrack *)(data + h->tracks_offset);
+  for (uint32_t i = 0; i < h->n_tracks; i++)
+    {
+    const LibraryTrack *t = &tracks[i];
+    if (t->path >= pool_len || t->title >= pool_len 
+         || t->artist >= pool_len || t->album >= pool_len 
+         || t->genre >= pool_len || t->text >= pool_len)
+      return FALSE;
+    }
+
+  const uint32_t *key_index = 
+    (const uint32_t *)(data + h->key_index_offset);
+  const uint32_t *postings = (const uint32_t *)(data + h->postings_offset);
+  if (key_index[0] != 0 || key_index[h->n_keys] > h->n_postings) 
+    return FALSE;
+  for (uint32_t i = 0; i < h->n_keys; i++)
+    {
+    if (key_index[i] > key_index[i + 1]) return FALSE;
+    for (uint32_t j = key_index[i]; j < key_index[i + 1]; j++)
+      {
+      if (postings[j] >= h->n_tracks 
+           || (j > key_index[i] && postings[j] <= postings[j - 1]))
+        return FALSE;
+      }
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  library_image_create
+
+  Wrap a block of memory as an image, checking that its header is
+  consistent, and its contents safe to use. Returns NULL, and does not
+  take ownership of the data, if it is not
+
+==========================================================================*/
+static LibraryImage *library_image_create (BYTE *data, size_t size,
+      BOOL mapped)
+  {
+  const LibraryHeader *h = (const LibraryHeader *)data;
+  if (size < sizeof (LibraryHeader)
+       || memcmp (h->magic, LIBRARY_MAGIC, 8) != 0
+       || h->size != size
+       || h->tracks_offset > size || h->keys_offset > size
+       || h->key_index_offset > size || h->postings_offset > size
+       || h->tracks_offset % 8 != 0 || h->keys_offset % 4 != 0
+       || h->key_index_offset % 4 != 0 || h->postings_offset % 4 != 0
+       || h->tracks_offset + (uint64_t)h->n_tracks * sizeof (LibraryTrack)
+            > size
+       || h->keys_offset + (uint64_t)h->n_keys * 4 > size
+       || h->key_index_offset + ((uint64_t)h->n_keys + 1) * 4 > size
+       || h->postings_offset + (uint64_t)h->n_postings * 4 > size
+       || h->strings_offset >= size
+       || data[size - 1] != 0
+       || !library_image_check_contents (data, size))
+    return NULL;
+
+  LibraryImage *image = malloc (sizeof (LibraryImage));
+  image->data = data;
+  image->size = size;
+  image->mapped = mapped;
+  image->header = h;
+  image->tracks = (const LibraryTrack *)(data + h->tracks_offset);
+  image->keys = (const uint32_t *)(data + h->keys_offset);
+  image->key_index = (const uint32_t *)(data + h->key_index_offset);
+  image->postings = (const uint32_t *)(data + h->postings_offset);
+  image->strings = (const char *)(data + h->strings_offset);
+  return image;
+  }
+
+
+/*==========================================================================
+
+  library_image_load
+
+  Map a saved index. Returns NULL if it does not exist, or is not valid
+
+==========================================================================*/
+static LibraryImage *library_image_load (const char *path)
+  {
+  LibraryImage *image = NULL;
+  int fd = open (path, O_RDONLY);
+  if (fd >= 0)
+    {
+    struct stat sb;
+    if (fstat (fd, &sb) == 0 && sb.st_size > 0)
+      {
+      void *data = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED)
+        {
+        image = library_image_create (data, sb.st_size, TRUE);
+        if (image)
+          madvise (data, sb.st_size, MADV_WILLNEED);
+        else
+          {
+          log_warning ("Library index %s is not valid", path);
+          munmap (data, sb.st_size);
+          }
+        }
+      }
+    close (fd);
+    }
+  return image;
+  }
+
+
+/*==========================================================================
+
+  library_image_save
+
+==========================================================================*/
+static BOOL library_image_save (const LibraryImage *image, const char *path)
+  {
+  BOOL ret = FALSE;
+  char *tmp;
+  asprintf (&tmp, "%s.tmp", path);
+  FILE *f = fopen (tmp, "w");
+  if (f)
+    {
+    BOOL ok = fwrite (image->data, 1, image->size, f) == image->size;
+    if (fclose (f) == 0 && ok && rename (tmp, path) == 0)
+      ret = TRUE;
+    else
+      unlink (tmp);
+    }
+  if (!ret)
+    log_warning ("Can't write library index %s: %s", path, strerror (errno));
+  free (tmp);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  library_normalize
+
+  Lower-case ASCII letters, and turn control characters into spaces.
+  Other bytes, including UTF-8 sequences, are unchanged. 'out' must
+  have room for strlen(s) + 1 bytes
+
+==========================================================================*/
+static void library_normalize (const char *s, char *out)
+  {
+  for (; *s; s++, out++)
+    {
+    unsigned char c = *s;
+    if (c >= 'A' && c <= 'Z')
+      *out = c + ('a' - 'A');
+    else if (c < ' ')
+      *out = ' ';
+    else
+      *out = c;
+    }
+  *out = 0;
+  }
+
+
+/*==========================================================================
+
+  library_make_text
+
+  The text that a search is matched against. The caller must free it
+
+==========================================================================*/
+static char *library_make_text (const char *path, const TagInfo *t)
+  {
+  const char *base = strrchr (path, '/');
+  base = base ? base + 1 : path;
+  char *raw;
+  asprintf (&raw, "%s %s %s %s %s", t->artist ? t->artist : "",
+    t->album ? t->album : "", t->title ? t->title : "",
+    t->genre ? t->genre : "", base);
+  char *text = malloc (strlen (raw) + 1);
+  library_normalize (raw, text);
+  free (raw);
+  return text;
+  }
+
+
+/*==========================================================================
+
+  library_trigrams
+
+  Put the distinct trigrams of a normalized string into 'keys', which
+  must have room for strlen(s) entries, and return how many there are.
+  Trigrams that include a space are not used, since query words
+  never contain spaces
+
+==========================================================================*/
+static int library_compare_u32 (const void *a, const void *b)
+  {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+  }
+
+static int library_compare_u64 (const void *a, const void *b)
+  {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+  }
+
+static int library_trigrams (const char *s, uint32_t *keys)
+  {
+  int n = 0;
+  const unsigned char *p = (const unsigned char *)s;
+  size_t len = strlen (s);
+  for (size_t i = 0; i + 3 <= len; i++)
+    {
+    if (p[i] == ' ' || p[i + 1] == ' ' || p[i + 2] == ' ') continue;
+    keys[n++] = (p[i] << 16) | (p[i + 1] << 8) | p[i + 2];
+    }
+  qsort (keys, n, sizeof (uint32_t), library_compare_u32);
+  int u = 0;
+  for (int i = 0; i < n; i++)
+    if (u == 0 || keys[i] != keys[u - 1])
+      keys[u++] = keys[i];
+  return u;
+  }
+
+
+/*==========================================================================
+
+  Growable string pool
+
+==========================================================================*/
+typedef struct _LibraryPool
+  {
+  char *data;
+  size_t len;
+  size_t size;
+  } LibraryPool;
+
+static uint32_t library_pool_add (LibraryPool *pool, const char *s)
+  {
+  if (!s || !s[0]) return 0;
+  size_t l = strlen (s) + 1;
+  if (pool->len + l > pool->size)
+    {
+    while (pool->len + l > pool->size)
+      pool->size *= 2;
+    pool->data = realloc (pool->data, pool->size);
+    }
+  uint32_t ret = pool->len;
+  memcpy (pool->data + pool->len, s, l);
+  pool->len += l;
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  Hash map from trigram key to a dense slot number, used while building
+
+==========================================================================*/
+typedef struct _LibraryKeyMap
+  {
+  uint32_t *table; // key + 1, or zero if empty
+  uint32_t *slots;
+  uint32_t capacity;
+  uint32_t count;
+  } LibraryKeyMap;
+
+static uint32_t library_keymap_hash (uint32_t key)
+  {
+  key *= 2654435761u;
+  return key ^ (key >> 16);
+  }
+
+static uint32_t library_keymap_slot (LibraryKeyMap *m, uint32_t key)
+  {
+  if (2 * (m->count + 1) > m->capacity)
+    {
+    LibraryKeyMap n;
+    n.capacity = m->capacity ? m->capacity * 2 : 65536;
+    n.table = calloc (n.capacity, sizeof (uint32_t));
+    n.slots = malloc (n.capacity * sizeof (uint32_t));
+    n.count = m->count;
+    for (uint32_t i = 0; i < m->capacity; i++)
+      {
+      if (m->table[i])
+        {
+        uint32_t h = library_keymap_hash (m->table[i] - 1) & (n.capacity - 1);
+        while (n.table[h]) h = (h + 1) & (n.capacity - 1);
+        n.table[h] = m->table[i];
+        n.slots[h] = m->slots[i];
+        }
+      }
+    free (m->table);
+    free (m->slots);
+    *m = n;
+    }
+  uint32_t h = library_keymap_hash (key) & (m->capacity - 1);
+  while (m->table[h])
+    {
+    if (m->table[h] == key + 1) return m->slots[h];
+    h = (h + 1) & (m->capacity - 1);
+    }
+  m->table[h] = key + 1;
+  m->slots[h] = m->count;
+  return m->count++;
+  }
+
+
+/*==========================================================================
+
+  library_image_build
+
+  Build an image from tracks sorted by pathname. Two passes are made
+  over the tracks' trigrams: the first counts the tracks for each key,
+  so that the second can put each track directly into its place.
+  Because tracks are visited in order, each key's list comes out
+  sorted
+
+==========================================================================*/
+static LibraryImage *library_image_build (const char *roots, char **paths,
+      TagInfo *tags, int64_t *mtimes, int n)
+  {
+  LOG_IN
+  // Offset zero is the empty string
+  LibraryPool pool = {malloc (65536), 1, 65536};
+  pool.data[0] = 0;
+  LibraryTrack *tracks = malloc ((n ? n : 1) * sizeof (LibraryTrack));
+  LibraryKeyMap map = {NULL, NULL, 0, 0};
+  uint32_t *counts = NULL;
+  size_t counts_size = 0;
+  uint32_t roots_offset = library_pool_add (&pool, roots);
+
+  // Pass 1: strings, and the number of tracks for each trigram
+  uint32_t *keys = malloc (4096 * sizeof (uint32_t));
+  size_t keys_size = 4096;
+  uint64_t n_postings = 0;
+  for (int i = 0; i < n; i++)
+    {
+    TagInfo *t = &tags[i];
+    char *text = library_make_text (paths[i], t);
+
+    tracks[i].path = library_pool_add (&pool, paths[i]);
+    tracks[i].title = library_pool_add (&pool, t->title);
+    tracks[i].artist = library_pool_add (&pool, t->artist);
+    tracks[i].album = library_pool_add (&pool, t->album);
+    tracks[i].genre = library_pool_add (&pool, t->genre);
+    tracks[i].text = library_pool_add (&pool, text);
+    tracks[i].mtime = mtimes[i];
+
+    size_t l = strlen (text);
+    if (l > keys_size)
+      {
+      keys_size = l;
+      keys = realloc (keys, keys_size * sizeof (uint32_t));
+      }
+    int nk = library_trigrams (text, keys);
+    for (int k = 0; k < nk; k++)
+      {
+      uint32_t slot = library_keymap_slot (&map, keys[k]);
+      if (slot >= counts_size)
+        {
+        size_t old = counts_size;
+        counts_size = counts_size ? counts_size * 2 : 65536;
+        counts = realloc (counts, counts_size * sizeof (uint32_t));
+        memset (counts + old, 0, (counts_size - old) * sizeof (uint32_t));
+        }
+      counts[slot]++;
+      }
+    n_postings += nk;
+    free (text);
+    }
+
+  // Order the keys, and work out where each key's tracks go
+  uint32_t n_keys = map.count;
+  uint32_t *slot_key = malloc ((n_keys + 1) * sizeof (uint32_t));
+  for (uint32_t h = 0; h < map.capacity; h++)
+    if (map.table[h]) slot_key[map.slots[h]] = map.table[h] - 1;
+  uint64_t *order = malloc ((n_keys + 1) * sizeof (uint64_t));
+  for (uint32_t s = 0; s < n_keys; s++)
+    order[s] = ((uint64_t)slot_key[s] << 32) | s;
+  // Each key is packed with its slot, so sorting the packed values
+  //  sorts by key
+  qsort (order, n_keys, sizeof (uint64_t), library_compare_u64);
+
+  // Lay out the image
+  uint64_t off = (sizeof (LibraryHeader) + 7) & ~7;
+  uint64_t tracks_offset = off;
+  off += (uint64_t)n * sizeof (LibraryTrack);
+  uint64_t keys_offset = off;
+  off += ((uint64_t)n_keys * 4 + 7) & ~7;
+  uint64_t key_index_offset = off;
+  off += (((uint64_t)n_keys + 1) * 4 + 7) & ~7;
+  uint64_t postings_offset = off;
+  off += (n_postings * 4 + 7) & ~7;
+  uint64_t strings_offset = off;
+  off += pool.len;
+  size_t size = off;
+
+  BYTE *data = calloc (1, size);
+  LibraryHeader *h = (LibraryHeader *)data;
+  memcpy (h->magic, LIBRARY_MAGIC, 8);
+  h->n_tracks = n;
+  h->n_keys = n_keys;
+  h->n_postings = n_postings;
+  h->roots = roots_offset;
+  h->tracks_offset = tracks_offset;
+  h->keys_offset = keys_offset;
+  h->key_index_offset = key_index_offset;
+  h->postings_offset = postings_offset;
+  h->strings_offset = strings_offset;
+  h->size = size;
+  memcpy (data + tracks_offset, tracks, (size_t)n * sizeof (LibraryTrack));
+  memcpy (data + strings_offset, pool.data, pool.len);
+
+  uint32_t *out_keys = (uint32_t *)(data + keys_offset);
+  uint32_t *key_index = (uint32_t *)(data + key_index_offset);
+  uint32_t *postings = (uint32_t *)(data + postings_offset);
+  // 'fill' is where the next track for each slot goes
+  uint32_t *fill = malloc ((n_keys + 1) * sizeof (uint32_t));
+  uint32_t pos = 0;
+  for (uint32_t i = 0; i < n_keys; i++)
+    {
+    uint32_t slot = order[i] & 0xFFFFFFFF;
+    out_keys[i] = order[i] >> 32;
+    key_index[i] = pos;
+    fill[slot] = pos;
+    pos += counts[slot];
+    }
+  key_index[n_keys] = pos;
+
+  // Pass 2: place the tracks
+  const char *strings = (const char *)(data + strings_offset);
+  for (int i = 0; i < n; i++)
+    {
+    int nk = library_trigrams (strings + tracks[i].text, keys);
+    for (int k = 0; k < nk; k++)
+      {
+      uint32_t slot = library_keymap_slot (&map, keys[k]);
+      postings[fill[slot]++] = i;
+      }
+    }
+
+  free (fill);
+  free (order);
+  free (slot_key);
+  free (counts);
+  free (keys);
+  free (map.table);
+  free (map.slots);
+  free (tracks);
+  free (pool.data);
+  LOG_OUT
+  return library_image_create (data, size, FALSE);
+  }
+
+
+/*==========================================================================
+
+  library_compare_path
+
+==========================================================================*/
+static int library_compare_path (const void *i1, const void *i2)
+  {
+  return strcmp (*(const char **)i1, *(const char **)i2);
+  }
+
+
+/*==========================================================================
+
+  library_is_playable
+
+==========================================================================*/
+static BOOL library_is_playable (const char *path)
+  {
+  const char *base = strrchr (path, '/');
+  base = base ? base + 1 : path;
+  const char *ext = strrchr (base, '.');
+  if (base[0] != '.' && ext && ext != base)
+    return xineserver_ext_is_playable (ext + 1);
+  return FALSE;
+  }
+
+
+/*==========================================================================
+
+  library_lower_bound
+
+  The first track in the image whose path is not less than 'path'
+
+==========================================================================*/
+static int library_lower_bound (const LibraryImage *image, const char *path)
+  {
+  int lo = 0, hi = image->header->n_tracks;
+  while (lo < hi)
+    {
+    int mid = lo + (hi - lo) / 2;
+    if (strcmp (image->strings + image->tracks[mid].path, path) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  return lo;
+  }
+
+
+/*==========================================================================
+
+  library_find_path
+
+  Returns the index in the image of a track, or -1
+
+==========================================================================*/
+static int library_find_path (const LibraryImage *image, const char *path)
+  {
+  int i = library_lower_bound (image, path);
+  if (i < (int)image->header->n_tracks
+       && strcmp (image->strings + image->tracks[i].path, path) == 0)
+    return i;
+  return -1;
+  }
+
+
+/*==========================================================================
+
+  library_find_extra
+
+  Returns the index in the (sorted) extras of a track, or the index at
+  which it should be inserted, negated and less one
+
+==========================================================================*/
+static int library_find_extra (const Library *self, const char *path)
+  {
+  int lo = 0, hi = self->extra_count;
+  while (lo < hi)
+    {
+    int mid = lo + (hi - lo) / 2;
+    int c = strcmp (self->extras[mid].path, path);
+    if (c == 0) return mid;
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  return -lo - 1;
+  }
+
+
+/*==========================================================================
+
+  library_free_extra
+
+==========================================================================*/
+static void library_free_extra (LibraryExtra *e)
+  {
+  free (e->path);
+  if (e->title) free (e->title);
+  if (e->artist) free (e->artist);
+  if (e->album) free (e->album);
+  if (e->genre) free (e->genre);
+  free (e->text);
+  }
+
+
+/*==========================================================================
+
+  library_set_image
+
+  Replace the image, discarding the watcher's changes, which the new 
+  image includes. The caller must hold the write lock
+
+==========================================================================*/
+static void library_set_image (Library *self, LibraryImage *image)
+  {
+  library_image_destroy (self->image);
+  self->image = image;
+  if (self->deleted) free (self->deleted);
+  self->deleted = calloc (image->header->n_tracks + 1, 1);
+  self->deleted_count = 0;
+  for (int i = 0; i < self->extra_count; i++)
+    library_free_extra (&self->extras[i]);
+  self->extra_count = 0;
+  }
+
+
+/*==========================================================================
+
+  library_remove_locked
+
+  Remove a track, or all the tracks in a directory. The caller must 
+  hold the write lock
+
+==========================================================================*/
+static void library_remove_locked (Library *self, const char *path, 
+      BOOL is_dir)
+  {
+  const LibraryImage *image = self->image;
+  char *prefix = NULL;
+  size_t prefix_len = 0;
+  if (is_dir)
+    {
+    asprintf (&prefix, "%s/", path);
+    prefix_len = strlen (prefix);
+    }
+
+  if (image && is_dir)
+    {
+    // Paths in a directory are together, since tracks are sorted
+    for (int i = library_lower_bound (image, prefix);
+          i < (int)image->header->n_tracks
+          && strncmp (image->strings + image->tracks[i].path, prefix,
+             prefix_len) == 0; i++)
+      {
+      if (!self->deleted[i])
+        {
+        self->deleted[i] = 1;
+        self->deleted_count++;
+        }
+      }
+    }
+  else if (image)
+    {
+    int i = library_find_path (image, path);
+    if (i >= 0 && !self->deleted[i])
+      {
+      self->deleted[i] = 1;
+      self->deleted_count++;
+      }
+    }
+
+  int n = 0;
+  for (int i = 0; i < self->extra_count; i++)
+    {
+    LibraryExtra *e = &self->extras[i];
+    if (is_dir ? strncmp (e->path, prefix, prefix_len) == 0 
+          : strcmp (e->path, path) == 0)
+      library_free_extra (e);
+    else
+      self->extras[n++] = *e;
+    }
+  self->extra_count = n;
+  if (prefix) free (prefix);
+  }
+
+
+/*==========================================================================
+
+  library_add_file
+
+  Read a file's tags, and add it to the index, replacing any existing
+  entry for it. The caller must hold the update mutex
+
+==========================================================================*/
+static void library_add_file (Library *self, const char *path)
+  {
+  if (!library_is_playable (path)) return;
+  time_t mtime = file_get_mtime (path);
+  if (mtime < 0) return; // Already gone
+
+  TagInfo t;
+  tagreader_read (path, &t);
+  LibraryExtra e;
+  e.path = strdup (path);
+  e.title = t.title ? strdup (t.title) : NULL;
+  e.artist = t.artist ? strdup (t.artist) : NULL;
+  e.album = t.album ? strdup (t.album) : NULL;
+  e.genre = t.genre ? strdup (t.genre) : NULL;
+  e.text = library_make_text (path, &t);
+  e.mtime = mtime;
+  tagreader_free (&t);
+
+  pthread_rwlock_wrlock (&self->lock);
+  library_remove_locked (self, path, FALSE);
+  int i = -library_find_extra (self, path) - 1;
+  if (self->extra_count == self->extra_size)
+    {
+    self->extra_size = self->extra_size ? self->extra_size * 2 : 64;
+    self->extras = realloc (self->extras, 
+      self->extra_size * sizeof (LibraryExtra));
+    }
+  memmove (self->extras + i + 1, self->extras + i, 
+    (self->extra_count - i) * sizeof (LibraryExtra));
+  self->extras[i] = e;
+  self->extra_count++;
+  pthread_rwlock_unlock (&self->lock);
+  }
+
+
+/*==========================================================================
+
+  library_find_known
+
+  If the index has a track with this path and modification time, copy
+  its tags, and return TRUE. The caller must hold the update mutex, so
+  that nothing changes the index
+
+==========================================================================*/
+static BOOL library_find_known (const Library *self, const char *path,
+      int64_t mtime, TagInfo *t)
+  {
+  const LibraryImage *image = self->image;
+  const char *title = NULL, *artist = NULL, *album = NULL, *genre = NULL;
+  BOOL found = FALSE;
+  int i = image ? library_find_path (image, path) : -1;
+  if (i >= 0 && !self->deleted[i] && image->tracks[i].mtime == mtime)
+    {
+    const LibraryTrack *track = &image->tracks[i];
+    title = image->strings + track->title;
+    artist = image->strings + track->artist;
+    album = image->strings + track->album;
+    genre = image->strings + track->genre;
+    found = TRUE;
+    }
+  else if (self->extra_count > 0 
+       && (i = library_find_extra (self, path)) >= 0
+       && self->extras[i].mtime == mtime)
+    {
+    const LibraryExtra *e = &self->extras[i];
+    title = e->title;
+    artist = e->artist;
+    album = e->album;
+    genre = e->genre;
+    found = TRUE;
+    }
+  if (found)
+    {
+    t->title = title && title[0] ? strdup (title) : NULL;
+    t->artist = artist && artist[0] ? strdup (artist) : NULL;
+    t->album = album && album[0] ? strdup (album) : NULL;
+    t->genre = genre && genre[0] ? strdup (genre) : NULL;
+    }
+  return found;
+  }
+
+
+/*==========================================================================
+
+  Tag reading, shared by a pool of threads. Files whose modification
+  time matches the index are not read again
+
+==========================================================================*/
+typedef struct _LibraryReadJob
+  {
+  Library *library;
+  char **paths;
+  TagInfo *tags;
+  int64_t *mtimes;
+  int count;
+  int next;
+  int read;
+  } LibraryReadJob;
+
+static void *library_read_thread (void *arg)
+  {
+  LibraryReadJob *job = (LibraryReadJob *)arg;
+  int i;
+  while (!job->library->stop
+      && (i = __atomic_fetch_add (&job->next, 1, __ATOMIC_RELAXED))
+        < job->count)
+    {
+    job->mtimes[i] = file_get_mtime (job->paths[i]);
+    if (!library_find_known (job->library, job->paths[i], job->mtimes[i],
+          &job->tags[i]))
+      {
+      tagreader_read (job->paths[i], &job->tags[i]);
+      __atomic_fetch_add (&job->read, 1, __ATOMIC_RELAXED);
+      }
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  library_scan
+
+  List the library directories, and rebuild the index if any file has
+  been added, removed or modified since it was built
+
+==========================================================================*/
+static void library_scan (Library *self)
+  {
+  LOG_IN
+  pthread_mutex_lock (&self->update_mutex);
+  int64_t start = library_usec ();
+
+  char **paths = NULL;
+  int count = 0;
+  char *roots = strdup (self->roots);
+  char *save;
+  for (char *root = strtok_r (roots, ",", &save); root && !self->stop;
+        root = strtok_r (NULL, ",", &save))
+    {
+    char **items;
+    int n;
+    char *error = NULL;
+    if (scanner_scan_directory (root, TRUE, &items, &n, &error))
+      {
+      paths = realloc (paths, (count + n + 1) * sizeof (char *));
+      memcpy (paths + count, items, n * sizeof (char *));
+      count += n;
+      free (items);
+      }
+    else
+      {
+      log_warning ("Library: %s", error);
+      free (error);
+      }
+    }
+  free (roots);
+  // Each root's files are sorted, but the roots may overlap or be out
+  //  of order
+  qsort (paths, count, sizeof (char *), library_compare_path);
+  int u = 0;
+  for (int i = 0; i < count; i++)
+    {
+    if (u > 0 && strcmp (paths[i], paths[u - 1]) == 0)
+      free (paths[i]);
+    else
+      paths[u++] = paths[i];
+    }
+  count = u;
+
+  TagInfo *tags = calloc (count + 1, sizeof (TagInfo));
+  int64_t *mtimes = calloc (count + 1, sizeof (int64_t));
+  LibraryReadJob job = {self, paths, tags, mtimes, count, 0, 0};
+  int nthreads = 2 * sysconf (_SC_NPROCESSORS_ONLN);
+  if (nthreads < LIBRARY_MIN_THREADS) nthreads = LIBRARY_MIN_THREADS;
+  if (nthreads > LIBRARY_MAX_THREADS) nthreads = LIBRARY_MAX_THREADS;
+  pthread_t threads[LIBRARY_MAX_THREADS];
+  for (int i = 0; i < nthreads; i++)
+    pthread_create (&threads[i], NULL, library_read_thread, &job);
+  for (int i = 0; i < nthreads; i++)
+    pthread_join (threads[i], NULL);
+  self->scan_msec = (library_usec () - start) / 1000;
+  self->scan_read = job.read;
+
+  // Every file that was not read is in the index, so if none was read,
+  //  and the number of files is the same, nothing has changed
+  BOOL changed = !self->image || job.read > 0 
+    || count != library_get_track_count (self);
+  if (!self->stop && changed)
+    {
+    start = library_usec ();
+    LibraryImage *image = library_image_build (self->roots, paths, tags,
+      mtimes, count);
+    self->build_msec = (library_usec () - start) / 1000;
+    if (self->index_path)
+      library_image_save (image, self->index_path);
+
+    pthread_rwlock_wrlock (&self->lock);
+    library_set_image (self, image);
+    pthread_rwlock_unlock (&self->lock);
+    log_info ("Library: indexed %d tracks (%d read) in %d msec", count,
+      job.read, self->scan_msec + self->build_msec);
+    }
+  else if (!self->stop)
+    log_info ("Library: %d tracks are up to date", count);
+
+  for (int i = 0; i < count; i++)
+    tagreader_free (&tags[i]);
+  free (tags);
+  free (mtimes);
+  scanner_free_items (paths, count);
+  pthread_mutex_unlock (&self->update_mutex);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  library_scan_thread
+
+==========================================================================*/
+static void *library_scan_thread (void *arg)
+  {
+  LOG_IN
+  Library *self = (Library *)arg;
+  BOOL again;
+  do
+    {
+    library_scan (self);
+    pthread_mutex_lock (&self->scan_mutex);
+    again = self->rescan_pending && !self->stop;
+    self->rescan_pending = FALSE;
+    if (!again) self->scanning = FALSE;
+    pthread_mutex_unlock (&self->scan_mutex);
+    } while (again);
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  library_rescan
+
+==========================================================================*/
+BOOL library_rescan (Library *self)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  pthread_mutex_lock (&self->scan_mutex);
+  if (self->scanning)
+    {
+    // Scan again when this one finishes, as it might have missed
+    //  something
+    self->rescan_pending = TRUE;
+    }
+  else if (!self->stop)
+    {
+    if (self->scan_thread_running)
+      pthread_join (self->scan_thread, NULL);
+    self->scanning = TRUE;
+    self->scan_thread_running = TRUE;
+    pthread_create (&self->scan_thread, NULL, library_scan_thread, self);
+    ret = TRUE;
+    }
+  pthread_mutex_unlock (&self->scan_mutex);
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  library_update_thread
+
+  Apply changes reported by the watcher
+
+==========================================================================*/
+static void *library_update_thread (void *arg)
+  {
+  LOG_IN
+  Library *self = (Library *)arg;
+  WatcherEvent events[LIBRARY_MAX_EVENTS];
+  while (!self->stop)
+    {
+    int n = watcher_get_events (self->watcher, events, LIBRARY_MAX_EVENTS,
+      500);
+    if (n == 0) continue;
+
+    BOOL rescan = FALSE;
+    pthread_mutex_lock (&self->update_mutex);
+    for (int i = 0; i < n; i++)
+      {
+      WatcherEvent *e = &events[i];
+      if (e->type == WATCHER_OVERFLOW)
+        rescan = TRUE;
+      else if (e->type == WATCHER_REMOVED)
+        {
+        log_debug ("%s: removed %s", __PRETTY_FUNCTION__, e->path);
+        pthread_rwlock_wrlock (&self->lock);
+        library_remove_locked (self, e->path, e->is_dir);
+        pthread_rwlock_unlock (&self->lock);
+        self->updates++;
+        }
+      else if (e->is_dir)
+        {
+        // Files may have been put in the directory before it was 
+        //  watched, so read all of it
+        char **items;
+        int count;
+        char *error = NULL;
+        if (scanner_scan_directory (e->path, TRUE, &items, &count, &error))
+          {
+          for (int j = 0; j < count && !self->stop; j++)
+            library_add_file (self, items[j]);
+          scanner_free_items (items, count);
+          }
+        else
+          free (error);
+        self->updates++;
+        }
+      else
+        {
+        log_debug ("%s: added %s", __PRETTY_FUNCTION__, e->path);
+        library_add_file (self, e->path);
+        self->updates++;
+        }
+      if (e->path) free (e->path);
+      }
+    if (self->deleted_count + self->extra_count > LIBRARY_MAX_CHANGES
+         && !library_is_scanning (self))
+      rescan = TRUE;
+    pthread_mutex_unlock (&self->update_mutex);
+
+    if (rescan)
+      library_rescan (self);
+    }
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  library_start
+
+==========================================================================*/
+void library_start (Library *self)
+  {
+  LOG_IN
+  LibraryImage *image = NULL;
+  if (self->index_path)
+    {
+    int64_t start = library_usec ();
+    image = library_image_load (self->index_path);
+    if (image && strcmp (image->strings + image->header->roots,
+          self->roots) != 0)
+      {
+      log_info ("Library directories have changed; index will be rebuilt");
+      library_image_destroy (image);
+      image = NULL;
+      }
+    self->load_usec = library_usec () - start;
+    }
+
+  if (image)
+    {
+    pthread_rwlock_wrlock (&self->lock);
+    library_set_image (self, image);
+    pthread_rwlock_unlock (&self->lock);
+    log_info ("Library: loaded %d tracks from %s", image->header->n_tracks,
+      self->index_path);
+    }
+
+  // Start watching before scanning, so nothing is missed in between
+  char *error = NULL;
+  self->watcher = watcher_create (self->roots);
+  if (watcher_start (self->watcher, &error))
+    {
+    self->update_thread_running = TRUE;
+    pthread_create (&self->update_thread, NULL, library_update_thread, 
+      self);
+    }
+  else
+    {
+    log_warning ("Library changes will not be tracked: %s", error);
+    free (error);
+    watcher_destroy (self->watcher);
+    self->watcher = NULL;
+    }
+
+  // Even if the index was loaded, files may have changed while the
+  //  server was not running. Checking modification times finds them
+  //  without reading every file
+  library_rescan (self);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  library_destroy
+
+==========================================================================*/
+void library_destroy (Library *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    pthread_mutex_lock (&self->scan_mutex);
+    self->stop = TRUE;
+    pthread_mutex_unlock (&self->scan_mutex);
+    if (self->update_thread_running)
+      pthread_join (self->update_thread, NULL);
+    if (self->watcher) watcher_destroy (self->watcher);
+    if (self->scan_thread_running)
+      pthread_join (self->scan_thread, NULL);
+    library_image_destroy (self->image);
+    if (self->deleted) free (self->deleted);
+    for (int i = 0; i < self->extra_count; i++)
+      library_free_extra (&self->extras[i]);
+    if (self->extras) free (self->extras);
+    pthread_rwlock_destroy (&self->lock);
+    pthread_mutex_destroy (&self->update_mutex);
+    pthread_mutex_destroy (&self->scan_mutex);
+    free (self->roots);
+    if (self->index_path) free (self->index_path);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  library_is_scanning
+
+==========================================================================*/
+BOOL library_is_scanning (Library *self)
+  {
+  pthread_mutex_lock (&self->scan_mutex);
+  BOOL ret = self->scanning;
+  pthread_mutex_unlock (&self->scan_mutex);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  library_get_track_count
+
+==========================================================================*/
+int library_get_track_count (Library *self)
+  {
+  pthread_rwlock_rdlock (&self->lock);
+  int ret = self->extra_count - self->deleted_count;
+  if (self->image) ret += self->image->header->n_tracks;
+  pthread_rwlock_unlock (&self->lock);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  library_find_key
+
+  Returns the number of tracks for a trigram, and sets 'list' to point
+  to them
+
+==========================================================================*/
+static uint32_t library_find_key (const LibraryImage *image, uint32_t key,
+      const uint32_t **list)
+  {
+  uint32_t lo = 0, hi = image->header->n_keys;
+  while (lo < hi)
+    {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (image->keys[mid] < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  if (lo < image->header->n_keys && image->keys[lo] == key)
+    {
+    *list = image->postings + image->key_index[lo];
+    return image->key_index[lo + 1] - image->key_index[lo];
+    }
+  return 0;
+  }
+
+
+/*==========================================================================
+
+  library_intersect
+
+  Remove from 'ids' any that are not in 'list', which is sorted.
+  Returns the new count
+
+==========================================================================*/
+static uint32_t library_intersect (uint32_t *ids, uint32_t n,
+      const uint32_t *list, uint32_t list_len)
+  {
+  uint32_t out = 0, j = 0;
+  for (uint32_t i = 0; i < n && j < list_len; i++)
+    {
+    // The lists are often very different in length, so skip forward
+    //  through the longer one in increasing steps
+    uint32_t step = 1;
+    while (j + step < list_len && list[j + step] < ids[i])
+      {
+      j += step;
+      step *= 2;
+      }
+    while (j < list_len && list[j] < ids[i]) j++;
+    if (j < list_len && list[j] == ids[i])
+      ids[out++] = ids[i];
+    }
+  return out;
+  }
+
+
+/*==========================================================================
+
+  library_match_words
+
+==========================================================================*/
+static BOOL library_match_words (const char *text, char **words, int nwords)
+  {
+  for (int w = 0; w < nwords; w++)
+    if (!strstr (text, words[w])) return FALSE;
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  library_add_match
+
+==========================================================================*/
+static void library_add_match (LibraryMatch **matches, int *n, int *size,
+      const char *path, const char *title, const char *artist, 
+      const char *album)
+  {
+  if (*n == *size)
+    {
+    *size = *size ? *size * 2 : 64;
+    *matches = realloc (*matches, *size * sizeof (LibraryMatch));
+    }
+  LibraryMatch *m = &(*matches)[(*n)++];
+  m->path = strdup (path);
+  m->title = strdup (title ? title : "");
+  m->artist = strdup (artist ? artist : "");
+  m->album = strdup (album ? album : "");
+  }
+
+
+/*==========================================================================
+
+  library_compare_match
+
+==========================================================================*/
+static int library_compare_match (const void *m1, const void *m2)
+  {
+  return strcmp (((const LibraryMatch *)m1)->path, 
+    ((const LibraryMatch *)m2)->path);
+  }
+
+
+/*==========================================================================
+
+  library_search
+
+==========================================================================*/
+LibraryMatch *library_search (Library *self, const char *query, int max,
+      int *count)
+  {
+  LOG_IN
+  int64_t start = library_usec ();
+  char *q = malloc (strlen (query) + 1);
+  library_normalize (query, q);
+
+  // Split into words
+  char **words = malloc ((strlen (q) / 2 + 2) * sizeof (char *));
+  int nwords = 0;
+  char *save;
+  for (char *w = strtok_r (q, " ", &save); w; w = strtok_r (NULL, " ", &save))
+    words[nwords++] = w;
+
+  LibraryMatch *matches = NULL;
+  int n = 0;
+  int size = 0;
+
+  pthread_rwlock_rdlock (&self->lock);
+  const LibraryImage *image = self->image;
+  if (image && nwords > 0)
+    {
+    // Find the shortest track list for any trigram in the query
+    uint32_t *keys = malloc ((strlen (query) + 1) * sizeof (uint32_t));
+    const uint32_t *best = NULL;
+    uint32_t best_len = 0;
+    BOOL indexed = FALSE;
+    BOOL none = FALSE;
+    for (int w = 0; w < nwords && !none; w++)
+      {
+      int nk = library_trigrams (words[w], keys);
+      for (int k = 0; k < nk; k++)
+        {
+        const uint32_t *list;
+        uint32_t len = library_find_key (image, keys[k], &list);
+        if (len == 0)
+          {
+          none = TRUE;
+          break;
+          }
+        if (!indexed || len < best_len)
+          {
+          best = list;
+          best_len = len;
+          indexed = TRUE;
+          }
+        }
+      }
+
+    uint32_t *ids = NULL;
+    uint32_t nids = 0;
+    if (none)
+      nids = 0;
+    else if (indexed)
+      {
+      ids = malloc (best_len * sizeof (uint32_t));
+      memcpy (ids, best, best_len * sizeof (uint32_t));
+      nids = best_len;
+      for (int w = 0; w < nwords && nids > 0; w++)
+        {
+        int nk = library_trigrams (words[w], keys);
+        for (int k = 0; k < nk && nids > 0; k++)
+          {
+          const uint32_t *list;
+          uint32_t len = library_find_key (image, keys[k], &list);
+          if (list != best)
+            nids = library_intersect (ids, nids, list, len);
+          }
+        }
+      }
+    else
+      {
+      // No word long enough to look up -- check every track
+      nids = image->header->n_tracks;
+      ids = malloc ((nids + 1) * sizeof (uint32_t));
+      for (uint32_t i = 0; i < nids; i++) ids[i] = i;
+      }
+
+    const char *strings = image->strings;
+    for (uint32_t i = 0; i < nids && n < max; i++)
+      {
+      const LibraryTrack *t = &image->tracks[ids[i]];
+      if (!self->deleted[ids[i]] 
+           && library_match_words (strings + t->text, words, nwords))
+        library_add_match (&matches, &n, &size, strings + t->path, 
+          strings + t->title, strings + t->artist, strings + t->album);
+      }
+    if (ids) free (ids);
+    free (keys);
+    }
+
+  // Tracks added since the image was built
+  if (nwords > 0 && self->extra_count > 0)
+    {
+    int base = n;
+    for (int i = 0; i < self->extra_count && n < base + max; i++)
+      {
+      const LibraryExtra *e = &self->extras[i];
+      if (library_match_words (e->text, words, nwords))
+        library_add_match (&matches, &n, &size, e->path, e->title,
+          e->artist, e->album);
+      }
+    if (n > base)
+      {
+      qsort (matches, n, sizeof (LibraryMatch), library_compare_match);
+      while (n > max)
+        {
+        n--;
+        free (matches[n].path);
+        free (matches[n].title);
+        free (matches[n].artist);
+        free (matches[n].album);
+        }
+      }
+    }
+  pthread_rwlock_unlock (&self->lock);
+
+  free (words);
+  free (q);
+  self->last_search_usec = library_usec () - start;
+  *count = n;
+  LOG_OUT
+  return matches;
+  }
+
+
+/*==========================================================================
+
+  library_free_matches
+
+==========================================================================*/
+void library_free_matches (LibraryMatch *matches, int count)
+  {
+  for (int i = 0; i < count; i++)
+    {
+    free (matches[i].path);
+    free (matches[i].title);
+    free (matches[i].artist);
+    free (matches[i].album);
+    }
+  free (matches);
+  }
+
+
+/*==========================================================================
+
+  library_get_stats
+
+==========================================================================*/
+void library_get_stats (Library *self, String *s)
+  {
+  string_append_printf (s, " library-tracks=%d library-scanning=%d"
+    " library-load-us=%d library-scan-ms=%d library-scan-read=%d"
+    " library-build-ms=%d library-search-us=%d library-watches=%d"
+    " library-updates=%d", library_get_track_count (self),
+    library_is_scanning (self), self->load_usec, self->scan_msec,
+    self->scan_read, self->build_msec, self->last_search_usec,
+    self->watcher ? watcher_get_watch_count (self->watcher) : 0,
+    self->updates);
+  }
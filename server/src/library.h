@@ -0,0 +1,57 @@
+/*============================================================================
+
+  xine-server
+  library.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "string.h"
+
+struct _Library;
+typedef struct _Library Library;
+
+// A search result. All strings are UTF-8, and any tags that are not
+//  known are empty strings, not NULL
+typedef struct _LibraryMatch
+  {
+  char *path;
+  char *title;
+  char *artist;
+  char *album;
+  } LibraryMatch;
+
+BEGIN_DECLS
+
+// 'roots' is a comma-separated list of directories. 'index_path' may be
+//  NULL, in which case the index is not saved, and the library is
+//  scanned at every startup
+Library      *library_create (const char *roots, const char *index_path);
+void          library_destroy (Library *self);
+
+// Load the saved index if it matches the configured roots, start 
+//  watching the directories for changes, and start a scan in the 
+//  background. If the index was loaded, the scan only reads files
+//  that have changed since it was saved
+void          library_start (Library *self);
+
+// Start a background rescan, unless one is running. Returns FALSE if
+//  a scan is already in progress
+BOOL          library_rescan (Library *self);
+BOOL          library_is_scanning (Library *self);
+int           library_get_track_count (Library *self);
+
+// Find tracks whose artist, album, title, genre or filename contain
+//  all the words in the query, regardless of case. Results are sorted
+//  by pathname, and there are at most 'max' of them
+LibraryMatch *library_search (Library *self, const char *query, int max,
+                 int *count);
+void          library_free_matches (LibraryMatch *matches, int count);
+
+void          library_get_stats (Library *self, String *s);
+
+END_DECLS
+
@@ -144,6 +144,32 @@ void list_append (List *self, void *item)
   }
 
 
+/*==========================================================================
+  list_append_array
+  Append a number of items at once. list_append() has to walk the list
+    to find the end, so adding many items one at a time takes time
+    proportional to the square of the number of items
+*==========================================================================*/
+void list_append_array (List *self, void **items, int count)
+  {
+  LOG_IN
+  pthread_mutex_lock (&self->mutex);
+  ListItem **tail = &self->head;
+  while (*tail)
+    tail = &(*tail)->next;
+  for (int n = 0; n < count; n++)
+    {
+    ListItem *i = malloc (sizeof (ListItem));
+    i->data = items[n];
+    i->next = NULL;
+    *tail = i;
+    tail = &i->next;
+    }
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
+  }
+
+
 /*==========================================================================
   list_length
 *==========================================================================*/
@@ -38,6 +38,7 @@ typedef void (*ListItemFreeFn) (void *);
 List   *list_create (ListItemFreeFn free_fn);
 void    list_destroy (List *);
 void    list_append (List *self, void *item);
+void    list_append_array (List *self, void **items, int count);
 void    list_prepend (List *self, void *item);
 void   *list_get (List *self, int index);
 void    list_dump (List *self);
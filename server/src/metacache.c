@@ -0,0 +1,537 @@
+/*==========================================================================
+
+  xine-server
+  metacache.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A cache of tags for playlist items, so that clients can show titles
+  for items that are not playing.
+
+  Entries are keyed by MRL, and record the modification time of the
+  file they were read from, so that a file that has changed is read
+  again. They are kept in a hash table, and on a list in order of use;
+  when the cache is full, the least recently used entry is discarded.
+
+  Tags are not read when they are asked for: the item is put on a queue
+  and the caller is told that its tags are pending. A background thread,
+  running at low priority, takes items from the queue and opens each
+  one on a secondary Xine stream, which is never played, to read its
+  tags. Only local files are probed; a network stream might never
+  finish opening.
+
+  The probe also reads ReplayGain values from the file's tags, which
+  Xine does not report, so that the gain for the next item to play is
+  usually known before it starts.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "file.h"
+#include "xine_interface.h"
+#include "tagreader.h"
+#include "metacache.h"
+
+typedef struct _MetaCacheEntry
+  {
+  char *mrl;
+  int64_t mtime;
+  MetaCacheState state;
+  char *title;
+  char *artist;
+  char *album;
+  int msec;
+  // ReplayGain values, valid if have_gain is set
+  BOOL have_gain;
+  TagGain gain;
+  // Order of use, most recent first
+  struct _MetaCacheEntry *prev;
+  struct _MetaCacheEntry *next;
+  // Next entry in the same hash bucket
+  struct _MetaCacheEntry *chain;
+  } MetaCacheEntry;
+
+struct _MetaCache
+  {
+  XineInterface *xi;
+  int size;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  MetaCacheEntry **buckets;
+  int n_buckets;
+  int count;
+  MetaCacheEntry *head;
+  MetaCacheEntry *tail;
+  // MRLs waiting to be probed, as a ring buffer of 'size' entries
+  char **queue;
+  int queue_head;
+  int queue_count;
+  pthread_t thread;
+  BOOL thread_running;
+  BOOL stop;
+  // Statistics
+  int hits;
+  int misses;
+  int probes;
+  int failures;
+  int64_t probe_usec;
+  };
+
+
+/*==========================================================================
+
+  metacache_create
+
+==========================================================================*/
+MetaCache *metacache_create (XineInterface *xi, int size)
+  {
+  LOG_IN
+  MetaCache *self = malloc (sizeof (MetaCache));
+  memset (self, 0, sizeof (MetaCache));
+  self->xi = xi;
+  self->size = size > 0 ? size : 1;
+  self->n_buckets = 64;
+  while (self->n_buckets < self->size) self->n_buckets *= 2;
+  self->buckets = calloc (self->n_buckets, sizeof (MetaCacheEntry *));
+  self->queue = malloc (self->size * sizeof (char *));
+  pthread_mutex_init (&self->mutex, NULL);
+  pthread_cond_init (&self->cond, NULL);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  metacache_free_entry
+
+==========================================================================*/
+static void metacache_free_entry (MetaCacheEntry *e)
+  {
+  free (e->mrl);
+  if (e->title) free (e->title);
+  if (e->artist) free (e->artist);
+  if (e->album) free (e->album);
+  free (e);
+  }
+
+
+/*==========================================================================
+
+  metacache_destroy
+
+==========================================================================*/
+void metacache_destroy (MetaCache *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    pthread_mutex_lock (&self->mutex);
+    self->stop = TRUE;
+    pthread_cond_signal (&self->cond);
+    pthread_mutex_unlock (&self->mutex);
+    if (self->thread_running)
+      pthread_join (self->thread, NULL);
+
+    MetaCacheEntry *e = self->head;
+    while (e)
+      {
+      MetaCacheEntry *next = e->next;
+      metacache_free_entry (e);
+      e = next;
+      }
+    for (int i = 0; i < self->queue_count; i++)
+      free (self->queue[(self->queue_head + i) % self->size]);
+    free (self->queue);
+    free (self->buckets);
+    pthread_mutex_destroy (&self->mutex);
+    pthread_cond_destroy (&self->cond);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  metacache_hash
+
+==========================================================================*/
+static int metacache_hash (const MetaCache *self, const char *mrl)
+  {
+  uint32_t h = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)mrl; *p; p++)
+    h = (h ^ *p) * 16777619u;
+  return h & (self->n_buckets - 1);
+  }
+
+
+/*==========================================================================
+
+  metacache_find
+
+==========================================================================*/
+static MetaCacheEntry *metacache_find (const MetaCache *self,
+      const char *mrl)
+  {
+  MetaCacheEntry *e = self->buckets[metacache_hash (self, mrl)];
+  while (e && strcmp (e->mrl, mrl) != 0)
+    e = e->chain;
+  return e;
+  }
+
+
+/*==========================================================================
+
+  metacache_unlink
+
+  Remove an entry from the list in order of use
+
+==========================================================================*/
+static void metacache_unlink (MetaCache *self, MetaCacheEntry *e)
+  {
+  if (e->prev) e->prev->next = e->next; else self->head = e->next;
+  if (e->next) e->next->prev = e->prev; else self->tail = e->prev;
+  e->prev = NULL;
+  e->next = NULL;
+  }
+
+
+/*==========================================================================
+
+  metacache_touch
+
+  Make an entry the most recently used
+
+==========================================================================*/
+static void metacache_touch (MetaCache *self, MetaCacheEntry *e)
+  {
+  if (self->head != e)
+    {
+    metacache_unlink (self, e);
+    e->next = self->head;
+    if (self->head) self->head->prev = e;
+    self->head = e;
+    if (!self->tail) self->tail = e;
+    }
+  }
+
+
+/*==========================================================================
+
+  metacache_remove
+
+==========================================================================*/
+static void metacache_remove (MetaCache *self, MetaCacheEntry *e)
+  {
+  MetaCacheEntry **p = &self->buckets[metacache_hash (self, e->mrl)];
+  while (*p != e) p = &(*p)->chain;
+  *p = e->chain;
+  metacache_unlink (self, e);
+  self->count--;
+  metacache_free_entry (e);
+  }
+
+
+/*==========================================================================
+
+  metacache_insert
+
+  Add an empty entry, discarding the least recently used entry if the
+  cache is full
+
+==========================================================================*/
+static MetaCacheEntry *metacache_insert (MetaCache *self, const char *mrl)
+  {
+  if (self->count >= self->size && self->tail)
+    metacache_remove (self, self->tail);
+  MetaCacheEntry *e = calloc (1, sizeof (MetaCacheEntry));
+  e->mrl = strdup (mrl);
+  e->msec = -1;
+  int h = metacache_hash (self, mrl);
+  e->chain = self->buckets[h];
+  self->buckets[h] = e;
+  e->next = self->head;
+  if (self->head) self->head->prev = e;
+  self->head = e;
+  if (!self->tail) self->tail = e;
+  self->count++;
+  return e;
+  }
+
+
+/*==========================================================================
+
+  metacache_get_mtime
+
+  The modification time of a local file, or -1 if it does not exist or
+  the MRL is not a local file
+
+==========================================================================*/
+static int64_t metacache_get_mtime (const char *mrl)
+  {
+  if (mrl[0] == '/')
+    return file_get_mtime (mrl);
+  if (strncmp (mrl, "file://", 7) == 0)
+    return file_get_mtime (mrl + 7);
+  return -1;
+  }
+
+
+/*==========================================================================
+
+  metacache_lookup
+
+==========================================================================*/
+MetaCacheState metacache_lookup (MetaCache *self, const char *mrl,
+      MetaCacheInfo *info)
+  {
+  LOG_IN
+  MetaCacheState ret = METACACHE_FAILED;
+  const char *title = NULL, *artist = NULL, *album = NULL;
+  info->msec = -1;
+  int64_t mtime = metacache_get_mtime (mrl);
+
+  pthread_mutex_lock (&self->mutex);
+  if (mtime >= 0)
+    {
+    MetaCacheEntry *e = metacache_find (self, mrl);
+    if (e && e->state == METACACHE_PENDING)
+      {
+      self->misses++;
+      ret = METACACHE_PENDING;
+      }
+    else if (e && e->mtime == mtime)
+      {
+      self->hits++;
+      metacache_touch (self, e);
+      ret = e->state;
+      title = e->title;
+      artist = e->artist;
+      album = e->album;
+      info->msec = e->msec;
+      }
+    else
+      {
+      self->misses++;
+      if (e) metacache_remove (self, e);
+      if (self->queue_count < self->size)
+        {
+        e = metacache_insert (self, mrl);
+        e->state = METACACHE_PENDING;
+        e->mtime = mtime;
+        self->queue[(self->queue_head + self->queue_count) % self->size]
+          = strdup (mrl);
+        self->queue_count++;
+        pthread_cond_signal (&self->cond);
+        }
+      ret = METACACHE_PENDING;
+      }
+    }
+  info->title = strdup (title ? title : "");
+  info->artist = strdup (artist ? artist : "");
+  info->album = strdup (album ? album : "");
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  metacache_read_gain
+
+  Read the ReplayGain values from a local file's tags
+
+==========================================================================*/
+static BOOL metacache_read_gain (const char *mrl, TagGain *gain)
+  {
+  TagInfo t;
+  const char *path = strncmp (mrl, "file://", 7) == 0 ? mrl + 7 : mrl;
+  BOOL ret = tagreader_read (path, &t);
+  *gain = t.gain;
+  tagreader_free (&t);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  metacache_get_gain
+
+==========================================================================*/
+BOOL metacache_get_gain (MetaCache *self, const char *mrl, TagGain *gain)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  memset (gain, 0, sizeof (TagGain));
+  int64_t mtime = metacache_get_mtime (mrl);
+  if (mtime >= 0)
+    {
+    pthread_mutex_lock (&self->mutex);
+    MetaCacheEntry *e = metacache_find (self, mrl);
+    if (e && e->have_gain && e->mtime == mtime)
+      {
+      *gain = e->gain;
+      ret = TRUE;
+      }
+    pthread_mutex_unlock (&self->mutex);
+
+    if (!ret)
+      {
+      // Queue the item, so that its other tags are cached too
+      MetaCacheInfo info;
+      metacache_lookup (self, mrl, &info);
+      metacache_free_info (&info);
+      ret = metacache_read_gain (mrl, gain);
+      pthread_mutex_lock (&self->mutex);
+      e = metacache_find (self, mrl);
+      if (ret && e && e->mtime == mtime)
+        {
+        e->gain = *gain;
+        e->have_gain = TRUE;
+        }
+      pthread_mutex_unlock (&self->mutex);
+      }
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  metacache_thread
+
+==========================================================================*/
+static void *metacache_thread (void *arg)
+  {
+  LOG_IN
+  MetaCache *self = (MetaCache *)arg;
+  // Probing should not compete with playback. On Linux, each thread
+  //  has its own priority
+  setpriority (PRIO_PROCESS, syscall (SYS_gettid), 19);
+
+  pthread_mutex_lock (&self->mutex);
+  while (!self->stop)
+    {
+    if (self->queue_count == 0)
+      {
+      pthread_cond_wait (&self->cond, &self->mutex);
+      continue;
+      }
+    char *mrl = self->queue[self->queue_head];
+    self->queue_head = (self->queue_head + 1) % self->size;
+    self->queue_count--;
+    pthread_mutex_unlock (&self->mutex);
+
+    int64_t mtime = metacache_get_mtime (mrl);
+    char *title, *artist, *album;
+    int msec;
+    struct timespec t0, t1;
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    BOOL ok = xine_interface_probe (self->xi, mrl, &title, &artist,
+      &album, &msec);
+    TagGain gain;
+    BOOL have_gain = metacache_read_gain (mrl, &gain);
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    log_debug ("%s: probed %s: %s", __PRETTY_FUNCTION__, mrl,
+      ok ? "OK" : "failed");
+
+    pthread_mutex_lock (&self->mutex);
+    self->probes++;
+    if (!ok) self->failures++;
+    self->probe_usec += (int64_t)(t1.tv_sec - t0.tv_sec) * 1000000
+      + (t1.tv_nsec - t0.tv_nsec) / 1000;
+    // The entry may have been discarded while the item was probed
+    MetaCacheEntry *e = metacache_find (self, mrl);
+    if (!e) e = metacache_insert (self, mrl);
+    if (e->title) free (e->title);
+    if (e->artist) free (e->artist);
+    if (e->album) free (e->album);
+    e->title = title;
+    e->artist = artist;
+    e->album = album;
+    e->msec = msec;
+    e->have_gain = have_gain;
+    e->gain = gain;
+    e->mtime = mtime;
+    e->state = ok ? METACACHE_OK : METACACHE_FAILED;
+    free (mrl);
+    }
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  metacache_start
+
+==========================================================================*/
+void metacache_start (MetaCache *self)
+  {
+  LOG_IN
+  self->thread_running = TRUE;
+  pthread_create (&self->thread, NULL, metacache_thread, self);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  metacache_free_info
+
+==========================================================================*/
+void metacache_free_info (MetaCacheInfo *info)
+  {
+  free (info->title);
+  free (info->artist);
+  free (info->album);
+  }
+
+
+/*==========================================================================
+
+  metacache_state_to_string
+
+==========================================================================*/
+const char *metacache_state_to_string (MetaCacheState state)
+  {
+  switch (state)
+    {
+    case METACACHE_OK: return "ok";
+    case METACACHE_PENDING: return "pending";
+    default: return "failed";
+    }
+  }
+
+
+/*==========================================================================
+
+  metacache_get_stats
+
+==========================================================================*/
+void metacache_get_stats (MetaCache *self, String *s)
+  {
+  pthread_mutex_lock (&self->mutex);
+  string_append_printf (s, " meta-cache-entries=%d meta-cache-size=%d"
+    " meta-cache-hits=%d meta-cache-misses=%d meta-cache-probes=%d"
+    " meta-cache-probe-failures=%d meta-cache-probe-us=%d", self->count,
+    self->size, self->hits, self->misses, self->probes, self->failures,
+    self->probes ? (int)(self->probe_usec / self->probes) : 0);
+  pthread_mutex_unlock (&self->mutex);
+  }
+
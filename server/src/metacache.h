@@ -0,0 +1,70 @@
+/*============================================================================
+
+  xine-server
+  metacache.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "string.h"
+#include "tagreader.h"
+
+struct _MetaCache;
+typedef struct _MetaCache MetaCache;
+
+struct _XineInterface;
+
+#define METACACHE_DEF_SIZE 5000
+
+typedef enum
+  {
+  // Tags are known
+  METACACHE_OK = 0,
+  // The item is waiting to be probed
+  METACACHE_PENDING,
+  // The item could not be opened, or is not a local file
+  METACACHE_FAILED
+  } MetaCacheState;
+
+// Tags for one item. Tags that are not known are empty strings, and
+//  a length that is not known is -1
+typedef struct _MetaCacheInfo
+  {
+  char *title;
+  char *artist;
+  char *album;
+  int msec;
+  } MetaCacheInfo;
+
+BEGIN_DECLS
+
+// 'size' is the greatest number of items whose tags are kept. Probing
+//  uses a secondary stream of the given interface
+MetaCache     *metacache_create (struct _XineInterface *xi, int size);
+void           metacache_destroy (MetaCache *self);
+void           metacache_start (MetaCache *self);
+
+// Get the tags for an item. If they are not cached, or the file has
+//  been modified since they were, the item is queued to be probed, and
+//  the result is METACACHE_PENDING. The caller must call
+//  metacache_free_info() in every case
+MetaCacheState metacache_lookup (MetaCache *self, const char *mrl,
+                  MetaCacheInfo *info);
+void           metacache_free_info (MetaCacheInfo *info);
+
+// Get the ReplayGain values for an item, which are read from its tags
+//  when it is probed. If they are not cached, they are read from the
+//  file now, which costs only a couple of small reads, and the item is
+//  queued to be probed for its other tags. Returns FALSE if the item
+//  is not a local file, or can't be read
+BOOL           metacache_get_gain (MetaCache *self, const char *mrl,
+                  TagGain *gain);
+const char    *metacache_state_to_string (MetaCacheState state);
+
+void           metacache_get_stats (MetaCache *self, String *s);
+
+END_DECLS
+
@@ -0,0 +1,505 @@
+/*==========================================================================
+
+  xine-server
+  playlist.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  The playlist, as an implicit treap: a binary tree, in which an
+  item's position is given by the number of items to its left, rather
+  than by a key. Each node records the size of its subtree, so an item
+  can be found by index by walking down from the root. Each node also
+  has a random priority, and no node has a higher priority than its
+  parent; this keeps the tree's depth proportional to the logarithm of
+  its size, on average, whatever order items are added in.
+
+  Every edit is made by splitting the tree at the positions concerned,
+  and joining the pieces back together in a different order, each of
+  which takes time proportional to the depth. A block of new items is
+  made into a tree of its own, in time proportional to its size, before 
+  it is joined in.
+
+  Each change increases the playlist's version, and is recorded in a
+  log, so that clients can ask for the changes since the version they
+  have, rather than for the whole playlist. The log is limited both
+  in the number of changes, and in the total number of items added, 
+  and the oldest changes are discarded to keep within the limits.
+
+==========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "playlist.h"
+
+typedef struct _PlaylistNode
+  {
+  char *mrl;
+  uint32_t priority;
+  int size;
+  struct _PlaylistNode *left;
+  struct _PlaylistNode *right;
+  } PlaylistNode;
+
+// Most changes kept in the log
+#define PLAYLIST_LOG_OPS 1024
+
+// Most items added by the changes in the log. A larger insertion 
+//  empties the log
+#define PLAYLIST_LOG_ITEMS 10000
+
+struct _Playlist
+  {
+  PlaylistNode *root;
+  uint32_t random;
+  int64_t version;
+  // Ring buffer of changes, oldest first
+  PlaylistOp log[PLAYLIST_LOG_OPS];
+  int log_head;
+  int log_count;
+  int log_items;
+  // The earliest version from which changes can be reported
+  int64_t log_base;
+  };
+
+
+/*==========================================================================
+
+  playlist_create
+
+==========================================================================*/
+Playlist *playlist_create (void)
+  {
+  LOG_IN
+  Playlist *self = malloc (sizeof (Playlist));
+  memset (self, 0, sizeof (Playlist));
+  self->random = 2463534242u;
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  self->version = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  self->log_base = self->version;
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  playlist_free_tree
+
+==========================================================================*/
+static void playlist_free_tree (PlaylistNode *n)
+  {
+  if (n)
+    {
+    playlist_free_tree (n->left);
+    playlist_free_tree (n->right);
+    free (n->mrl);
+    free (n);
+    }
+  }
+
+
+/*==========================================================================
+
+  playlist_drop_oldest
+
+  Discard the oldest change in the log
+
+==========================================================================*/
+static void playlist_drop_oldest (Playlist *self)
+  {
+  PlaylistOp *op = &self->log[self->log_head];
+  if (op->mrls)
+    {
+    for (int i = 0; i < op->count; i++)
+      free (op->mrls[i]);
+    free (op->mrls);
+    self->log_items -= op->count;
+    }
+  self->log_base = op->version;
+  self->log_head = (self->log_head + 1) % PLAYLIST_LOG_OPS;
+  self->log_count--;
+  }
+
+
+/*==========================================================================
+
+  playlist_log
+
+  Increase the version, and record a change. The MRLs of inserted items
+  are copied
+
+==========================================================================*/
+static void playlist_log (Playlist *self, PlaylistOpType type, int first,
+      int count, int dest, char *const *mrls)
+  {
+  self->version++;
+  int items = type == PLAYLIST_OP_INSERT ? count : 0;
+  if (items > PLAYLIST_LOG_ITEMS)
+    {
+    while (self->log_count > 0)
+      playlist_drop_oldest (self);
+    self->log_base = self->version;
+    return;
+    }
+  while (self->log_count == PLAYLIST_LOG_OPS 
+      || (self->log_count > 0 && self->log_items + items > PLAYLIST_LOG_ITEMS))
+    playlist_drop_oldest (self);
+
+  PlaylistOp *op = 
+    &self->log[(self->log_head + self->log_count) % PLAYLIST_LOG_OPS];
+  op->version = self->version;
+  op->type = type;
+  op->first = first;
+  op->count = count;
+  op->dest = dest;
+  op->mrls = NULL;
+  if (items > 0)
+    {
+    op->mrls = malloc (items * sizeof (char *));
+    for (int i = 0; i < items; i++)
+      op->mrls[i] = strdup (mrls[i]);
+    self->log_items += items;
+    }
+  self->log_count++;
+  }
+
+
+/*==========================================================================
+
+  playlist_destroy
+
+==========================================================================*/
+void playlist_destroy (Playlist *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    playlist_free_tree (self->root);
+    while (self->log_count > 0)
+      playlist_drop_oldest (self);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  playlist_size
+
+==========================================================================*/
+static inline int playlist_size (const PlaylistNode *n)
+  {
+  return n ? n->size : 0;
+  }
+
+
+/*==========================================================================
+
+  playlist_update
+
+  Recalculate the size of a node's subtree from its children
+
+==========================================================================*/
+static inline void playlist_update (PlaylistNode *n)
+  {
+  n->size = 1 + playlist_size (n->left) + playlist_size (n->right);
+  }
+
+
+/*==========================================================================
+
+  playlist_split
+
+  Split a tree into its first 'k' items, and the rest
+
+==========================================================================*/
+static void playlist_split (PlaylistNode *t, int k, PlaylistNode **a,
+      PlaylistNode **b)
+  {
+  if (!t)
+    {
+    *a = NULL;
+    *b = NULL;
+    }
+  else if (playlist_size (t->left) < k)
+    {
+    playlist_split (t->right, k - playlist_size (t->left) - 1, 
+      &t->right, b);
+    playlist_update (t);
+    *a = t;
+    }
+  else
+    {
+    playlist_split (t->left, k, a, &t->left);
+    playlist_update (t);
+    *b = t;
+    }
+  }
+
+
+/*==========================================================================
+
+  playlist_merge
+
+  Join two trees, with all the items of 'a' before those of 'b'
+
+==========================================================================*/
+static PlaylistNode *playlist_merge (PlaylistNode *a, PlaylistNode *b)
+  {
+  if (!a) return b;
+  if (!b) return a;
+  if (a->priority > b->priority)
+    {
+    a->right = playlist_merge (a->right, b);
+    playlist_update (a);
+    return a;
+    }
+  b->left = playlist_merge (a, b->left);
+  playlist_update (b);
+  return b;
+  }
+
+
+/*==========================================================================
+
+  playlist_build
+
+  Make a tree of new items. The nodes on the right-hand edge of the 
+  tree are kept on a stack; each new node goes at the bottom of the
+  edge, after taking as its left subtree the nodes of lower priority.
+  Each node is popped off the stack at most once, so this takes time
+  proportional to the number of items
+
+==========================================================================*/
+static PlaylistNode *playlist_build (Playlist *self, char **mrls, int count)
+  {
+  PlaylistNode **stack = malloc (count * sizeof (PlaylistNode *));
+  int depth = 0;
+  for (int i = 0; i < count; i++)
+    {
+    PlaylistNode *n = malloc (sizeof (PlaylistNode));
+    n->mrl = mrls[i];
+    // xorshift32
+    self->random ^= self->random << 13;
+    self->random ^= self->random >> 17;
+    self->random ^= self->random << 5;
+    n->priority = self->random;
+    n->size = 1;
+    n->left = NULL;
+    n->right = NULL;
+    PlaylistNode *last = NULL;
+    while (depth > 0 && stack[depth - 1]->priority < n->priority)
+      {
+      // Its right subtree, if any, was popped and sized just before it
+      last = stack[--depth];
+      playlist_update (last);
+      }
+    n->left = last;
+    if (depth > 0) stack[depth - 1]->right = n;
+    stack[depth++] = n;
+    }
+  while (depth > 1)
+    playlist_update (stack[--depth]);
+  PlaylistNode *root = NULL;
+  if (depth > 0)
+    {
+    root = stack[0];
+    playlist_update (root);
+    }
+  free (stack);
+  return root;
+  }
+
+
+/*==========================================================================
+
+  playlist_length
+
+==========================================================================*/
+int playlist_length (const Playlist *self)
+  {
+  return playlist_size (self->root);
+  }
+
+
+/*==========================================================================
+
+  playlist_get
+
+==========================================================================*/
+const char *playlist_get (const Playlist *self, int index)
+  {
+  const PlaylistNode *n = self->root;
+  if (index < 0 || index >= playlist_size (n)) return NULL;
+  while (n)
+    {
+    int l = playlist_size (n->left);
+    if (index < l)
+      n = n->left;
+    else if (index == l)
+      return n->mrl;
+    else
+      {
+      index -= l + 1;
+      n = n->right;
+      }
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  playlist_collect
+
+  Store the items of a subtree from 'first' to 'first + count - 1', 
+  which are within it
+
+==========================================================================*/
+static void playlist_collect (const PlaylistNode *n, int first, int count,
+      const char **mrls)
+  {
+  if (!n || count <= 0) return;
+  int l = playlist_size (n->left);
+  if (first < l)
+    playlist_collect (n->left, first, l - first < count ? l - first : count,
+      mrls);
+  if (first <= l && l < first + count)
+    mrls[l - first] = n->mrl;
+  if (first + count > l + 1)
+    {
+    int rfirst = first > l + 1 ? first - l - 1 : 0;
+    playlist_collect (n->right, rfirst, first + count - l - 1 - rfirst,
+      mrls + l + 1 + rfirst - first);
+    }
+  }
+
+
+/*==========================================================================
+
+  playlist_get_range
+
+==========================================================================*/
+int playlist_get_range (const Playlist *self, int first, int count,
+      const char **mrls)
+  {
+  int length = playlist_size (self->root);
+  if (first < 0) first = 0;
+  if (first > length) first = length;
+  if (count > length - first) count = length - first;
+  if (count < 0) count = 0;
+  playlist_collect (self->root, first, count, mrls);
+  return count;
+  }
+
+
+/*==========================================================================
+
+  playlist_insert
+
+==========================================================================*/
+void playlist_insert (Playlist *self, int pos, char **mrls, int count)
+  {
+  LOG_IN
+  if (count > 0)
+    {
+    playlist_log (self, PLAYLIST_OP_INSERT, pos, count, 0, mrls);
+    PlaylistNode *a, *b;
+    playlist_split (self->root, pos, &a, &b);
+    self->root = playlist_merge (playlist_merge (a, 
+      playlist_build (self, mrls, count)), b);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  playlist_remove
+
+==========================================================================*/
+void playlist_remove (Playlist *self, int first, int count)
+  {
+  LOG_IN
+  playlist_log (self, PLAYLIST_OP_REMOVE, first, count, 0, NULL);
+  PlaylistNode *a, *mid, *b;
+  playlist_split (self->root, first, &a, &b);
+  playlist_split (b, count, &mid, &b);
+  playlist_free_tree (mid);
+  self->root = playlist_merge (a, b);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  playlist_move
+
+==========================================================================*/
+void playlist_move (Playlist *self, int first, int count, int dest)
+  {
+  LOG_IN
+  playlist_log (self, PLAYLIST_OP_MOVE, first, count, dest, NULL);
+  PlaylistNode *a, *mid, *b;
+  playlist_split (self->root, first, &a, &b);
+  playlist_split (b, count, &mid, &b);
+  playlist_split (playlist_merge (a, b), dest, &a, &b);
+  self->root = playlist_merge (playlist_merge (a, mid), b);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  playlist_clear
+
+==========================================================================*/
+void playlist_clear (Playlist *self)
+  {
+  LOG_IN
+  playlist_log (self, PLAYLIST_OP_CLEAR, 0, 0, 0, NULL);
+  playlist_free_tree (self->root);
+  self->root = NULL;
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  playlist_get_version
+
+==========================================================================*/
+int64_t playlist_get_version (const Playlist *self)
+  {
+  return self->version;
+  }
+
+
+/*==========================================================================
+
+  playlist_get_changes
+
+==========================================================================*/
+int playlist_get_changes (const Playlist *self, int64_t since,
+      const PlaylistOp ***ops)
+  {
+  if (since < self->log_base || since > self->version) 
+    {
+    *ops = NULL;
+    return -1;
+    }
+  int n = (int)(self->version - since);
+  *ops = malloc ((n + 1) * sizeof (PlaylistOp *));
+  for (int i = 0; i < n; i++)
+    (*ops)[i] = &self->log[(self->log_head + self->log_count - n + i) 
+      % PLAYLIST_LOG_OPS];
+  return n;
+  }
+
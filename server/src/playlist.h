@@ -0,0 +1,87 @@
+/*============================================================================
+
+  xine-server
+  playlist.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+
+struct _Playlist;
+typedef struct _Playlist Playlist;
+
+typedef enum
+  {
+  PLAYLIST_OP_INSERT = 0,
+  PLAYLIST_OP_REMOVE,
+  PLAYLIST_OP_MOVE,
+  PLAYLIST_OP_CLEAR
+  } PlaylistOpType;
+
+// A change to the playlist, as recorded in its log. 'mrls' is only 
+//  set for PLAYLIST_OP_INSERT, and 'dest' for PLAYLIST_OP_MOVE
+typedef struct _PlaylistOp
+  {
+  int64_t version;
+  PlaylistOpType type;
+  int first;
+  int count;
+  int dest;
+  char **mrls;
+  } PlaylistOp;
+
+BEGIN_DECLS
+
+// A sequence of MRLs, in which access by index, and inserting, removing
+//  and moving ranges of items, all take time proportional to the 
+//  logarithm of the length. A playlist is not thread-safe: the caller
+//  must lock it
+Playlist   *playlist_create (void);
+void        playlist_destroy (Playlist *self);
+
+int         playlist_length (const Playlist *self);
+
+// Returns NULL if the index is out of range
+const char *playlist_get (const Playlist *self, int index);
+
+// Store pointers to up to 'count' items, starting at 'first', in 
+//  'mrls', which must have room for them. The pointers belong to the 
+//  playlist, and are only valid until it is next changed. Returns the
+//  number stored
+int         playlist_get_range (const Playlist *self, int first, int count,
+              const char **mrls);
+
+// Insert items so that the first is at position 'pos', which must be
+//  between 0 and the length. The playlist takes ownership of the 
+//  strings, but not of the array
+void        playlist_insert (Playlist *self, int pos, char **mrls, 
+              int count);
+
+// The range given by 'first' and 'count' must be within the playlist
+void        playlist_remove (Playlist *self, int first, int count);
+
+// Move a range of items so that the first of them is at position 'dest'
+//  afterwards, which must be between 0 and the length less 'count'
+void        playlist_move (Playlist *self, int first, int count, int dest);
+
+void        playlist_clear (Playlist *self);
+
+// Every change increases the version by one. Versions start from
+//  the time the playlist was created, in microseconds, so that 
+//  versions from an earlier run of the server are always lower
+int64_t     playlist_get_version (const Playlist *self);
+
+// Get the changes made since version 'since', oldest first, as an
+//  array of pointers to ops that belong to the playlist, and are only
+//  valid until it is next changed. The caller must free the array.
+//  Returns -1 if the log does not go back that far, in which case
+//  the caller must fetch the whole playlist
+int         playlist_get_changes (const Playlist *self, int64_t since,
+              const PlaylistOp ***ops);
+
+END_DECLS
+
@@ -6,7 +6,7 @@
   Distributed under the terms of the GPL v3.0
 
 ==========================================================================*/
-
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -23,8 +23,404 @@
 #include "cmdproc.h" 
 #include "xine_interface.h" 
 #include "notifier.h" 
+#include "clocksync.h" 
+#include "statefile.h" 
+#include "library.h" 
+#include "metacache.h" 
+#include "shmstatus.h" 
+#include "audiotap.h" 
+#include "broadcast.h" 
+#include "decodebench.h" 
+#include "auth.h" 
 #include "../../api/xine-server-api.h" 
 
+/*==========================================================================
+  program_add_zones
+
+  The "zones" setting is a comma-separated list of name[:driver] 
+  entries. Each zone gets its own audio port, stream and playlist, 
+  but shares the Xine engine of the default zone. 
+==========================================================================*/
+static void program_add_zones (const ProgramContext *context, 
+        XineInterface *engine, CmdProc *cmdproc)
+  {
+  const char *zones = program_context_get (context, "zones");
+  if (zones)
+    {
+    String *s_zones = string_create (zones);
+    List *l_zones = string_split (s_zones, ",");
+    int l = list_length (l_zones);
+    for (int i = 0; i < l; i++)
+      {
+      char *spec = strdup (string_cstr (list_get (l_zones, i)));
+      const char *driver = program_context_get (context, "driver");
+      char *colon = strchr (spec, ':');
+      if (colon)
+        {
+        *colon = 0;
+        driver = colon + 1;
+        }
+      if (spec[0])
+        {
+        XineInterface *zxi = xine_interface_create_zone (engine, driver);
+        // The zone's initialization will wait for the engine's
+        xine_interface_init_async (zxi);
+        if (!cmdproc_add_zone (cmdproc, spec, zxi))
+          xine_interface_destroy (zxi);
+        }
+      free (spec);
+      }
+    list_destroy (l_zones);
+    string_destroy (s_zones);
+    }
+  }
+
+
+/*==========================================================================
+  program_set_cache_dir
+
+  Xine keeps a cache of its plugin catalogue in 
+  $XDG_CACHE_HOME/xine-lib/plugins.cache (or $HOME/.cache/...). When the 
+  cache is usable, xine_init() does not need to open and probe every 
+  plugin, which is by far the slowest part of startup. A daemon may run 
+  with no usable home directory, so the location can be set explicitly. 
+==========================================================================*/
+static void program_set_cache_dir (const ProgramContext *context)
+  {
+  const char *cache_dir = program_context_get (context, "cache-dir");
+  if (cache_dir)
+    setenv ("XDG_CACHE_HOME", cache_dir, 1);
+
+  char *cache_file = NULL;
+  const char *xdg = getenv ("XDG_CACHE_HOME");
+  const char *home = getenv ("HOME");
+  if (xdg && xdg[0])
+    asprintf (&cache_file, "%s/xine-lib/plugins.cache", xdg);
+  else if (home && home[0])
+    asprintf (&cache_file, "%s/.cache/xine-lib/plugins.cache", home);
+
+  if (cache_file)
+    {
+    if (access (cache_file, R_OK) == 0)
+      log_info ("Using Xine plugin cache %s", cache_file);
+    else
+      log_info ("Xine plugin cache %s not found; "
+        "it will be created at startup", cache_file);
+    free (cache_file);
+    }
+  else
+    log_warning ("No location for the Xine plugin cache; "
+        "startup will be slow");
+  }
+
+
+/*==========================================================================
+  program_start_clocksync
+
+  Returns NULL if clock sync is not enabled, or can't be started. Sync
+  applies to the default zone only.
+==========================================================================*/
+static ClockSync *program_start_clocksync (const ProgramContext *context, 
+        XineInterface *xi)
+  {
+  ClockSync *ret = NULL;
+  const char *s_mode = program_context_get (context, "sync");
+  if (s_mode)
+    {
+    ClockSyncMode mode;
+    if (clocksync_mode_from_string (s_mode, &mode))
+      {
+      if (mode != CLOCKSYNC_OFF)
+        {
+        ClockSync *clocksync = clocksync_create (xi, mode, 
+          program_context_get (context, "sync-group"),
+          program_context_get_integer (context, "sync-port", 
+            CLOCKSYNC_DEF_PORT));
+        char *error = NULL;
+        if (clocksync_start (clocksync, &error))
+          ret = clocksync;
+        else
+          {
+          log_error ("Can't start clock sync: %s", error);
+          free (error);
+          clocksync_destroy (clocksync);
+          }
+        }
+      }
+    else
+      log_error ("Unknown sync mode '%s'", s_mode);
+    }
+  return ret;
+  }
+
+
+/*==========================================================================
+  program_start_statefile
+
+  Returns NULL if state persistence is not enabled. Otherwise, restores
+  the state into the (default zone's) command processor, and starts 
+  recording changes to it
+==========================================================================*/
+static StateFile *program_start_statefile (const ProgramContext *context, 
+        CmdProc *cmdproc)
+  {
+  StateFile *ret = NULL;
+  const char *path = program_context_get (context, "state-file");
+  if (path)
+    {
+    ret = statefile_create (path);
+    statefile_load (ret);
+    cmdproc_restore_state (cmdproc, ret, 
+      program_context_get_boolean (context, "resume", FALSE));
+    char *error = NULL;
+    if (!statefile_start (ret, &error))
+      {
+      log_error ("Can't write state file: %s", error);
+      free (error);
+      }
+    }
+  return ret;
+  }
+
+
+/*==========================================================================
+  program_start_library
+
+  Returns NULL if no library directories are configured. The index is
+  kept in $HOME/.xine-server-library unless --library-index says
+  otherwise
+==========================================================================*/
+static Library *program_start_library (const ProgramContext *context, 
+        CmdProc *cmdproc)
+  {
+  Library *ret = NULL;
+  const char *roots = program_context_get (context, "library");
+  if (roots)
+    {
+    char *index_path = NULL;
+    const char *path = program_context_get (context, "library-index");
+    if (path)
+      index_path = strdup (path);
+    else if (getenv ("HOME"))
+      asprintf (&index_path, "%s/.xine-server-library", getenv ("HOME"));
+    ret = library_create (roots, index_path);
+    if (index_path) free (index_path);
+    library_start (ret);
+    cmdproc_set_library (cmdproc, ret);
+    }
+  return ret;
+  }
+
+
+/*==========================================================================
+  program_start_replaygain
+
+  Loudness normalization applies to all zones
+==========================================================================*/
+static void program_start_replaygain (const ProgramContext *context, 
+        CmdProc *cmdproc)
+  {
+  const char *s_mode = program_context_get (context, "replaygain");
+  if (s_mode)
+    {
+    CmdProcReplayGain mode;
+    if (cmdproc_replaygain_from_string (s_mode, &mode))
+      {
+      const char *preamp = program_context_get (context, 
+        "replaygain-preamp");
+      cmdproc_set_replaygain (cmdproc, mode, preamp ? atof (preamp) : 0);
+      }
+    else
+      log_error ("Unknown replaygain mode '%s'", s_mode);
+    }
+  }
+
+
+/*==========================================================================
+  program_start_rate_limit
+
+  --rate-limit is a number of commands a second, optionally followed by
+  a colon and the largest burst
+==========================================================================*/
+static void program_start_rate_limit (const ProgramContext *context, 
+        Server *server)
+  {
+  const char *s_rate = program_context_get (context, "rate-limit");
+  if (s_rate)
+    {
+    double rate = 0;
+    int burst = 0;
+    ServerRatePolicy policy = SERVER_RATE_DELAY;
+    const char *s_policy = program_context_get (context, 
+      "rate-limit-policy");
+    if (sscanf (s_rate, "%lf:%d", &rate, &burst) < 1 || rate <= 0)
+      log_error ("Bad rate limit '%s'", s_rate);
+    else if (s_policy && !server_rate_policy_from_string (s_policy, 
+          &policy))
+      log_error ("Unknown rate limit policy '%s'", s_policy);
+    else
+      server_set_rate_limit (server, rate, burst, policy);
+    }
+  }
+
+
+/*==========================================================================
+  program_start_auth
+
+  Returns FALSE if there is an auth file, but it can't be read; the 
+  server should not then start, open to anyone. Otherwise, sets 'auth' 
+  to the roles read, or NULL if clients need not authenticate
+==========================================================================*/
+static BOOL program_start_auth (const ProgramContext *context, 
+        CmdProc *cmdproc, Auth **auth)
+  {
+  BOOL ret = TRUE;
+  *auth = NULL;
+  const char *path = program_context_get (context, "auth-file");
+  if (path)
+    {
+    char *error = NULL;
+    *auth = auth_create ();
+    if (auth_load (*auth, path, &error))
+      cmdproc_set_auth (cmdproc, *auth);
+    else
+      {
+      log_error ("Can't read auth file: %s", error);
+      free (error);
+      auth_destroy (*auth);
+      *auth = NULL;
+      ret = FALSE;
+      }
+    }
+  return ret;
+  }
+
+
+/*==========================================================================
+  program_start_shmstatus
+
+  Returns NULL if shared memory status is not enabled, or can't be
+  started. Like clock sync, it applies to the default zone only
+==========================================================================*/
+static ShmStatus *program_start_shmstatus (const ProgramContext *context, 
+        CmdProc *cmdproc)
+  {
+  ShmStatus *ret = NULL;
+  const char *name = program_context_get (context, "shm");
+  if (name)
+    {
+    ShmStatus *shmstatus = shmstatus_create (name, 
+      SHMSTATUS_DEF_PLAYLIST_SIZE);
+    char *error = NULL;
+    if (shmstatus_start (shmstatus, &error))
+      {
+      cmdproc_set_shmstatus (cmdproc, shmstatus);
+      ret = shmstatus;
+      }
+    else
+      {
+      log_error ("Can't start shared memory status: %s", error);
+      free (error);
+      shmstatus_destroy (shmstatus);
+      }
+    }
+  return ret;
+  }
+
+
+/*==========================================================================
+  program_start_broadcast
+
+  Returns NULL if broadcasting is not enabled, or can't be started. The
+  setting is a port, optionally preceded by the IP to bind to; if 
+  there isn't one, the control port's IP is used. Only the default
+  zone is broadcast
+==========================================================================*/
+static Broadcast *program_start_broadcast (const ProgramContext *context, 
+        XineInterface *xi)
+  {
+  Broadcast *ret = NULL;
+  const char *s = program_context_get (context, "broadcast");
+  if (s)
+    {
+    char *host;
+    const char *colon = strrchr (s, ':');
+    if (colon)
+      host = strndup (s, colon - s);
+    else
+      {
+      const char *h = program_context_get (context, "host");
+      host = strdup (h ? h : "127.0.0.1");
+      }
+    int port = atoi (colon ? colon + 1 : s);
+    if (port > 0)
+      {
+      Broadcast *broadcast = broadcast_create (host, port);
+      char *error = NULL;
+      if (broadcast_start (broadcast, &error))
+        {
+        xine_interface_set_broadcast (xi, broadcast);
+        ret = broadcast;
+        }
+      else
+        {
+        log_error ("Can't start broadcast: %s", error);
+        free (error);
+        broadcast_destroy (broadcast);
+        }
+      }
+    else
+      log_error ("Bad broadcast port '%s'", s);
+    free (host);
+    }
+  return ret;
+  }
+
+
+/*==========================================================================
+  program_decode_bench
+
+  Play the files named on the command line as fast as Xine will decode
+  them, with the audio driver given by --driver, and report the speed.
+  Returns non-zero if any could not be played
+==========================================================================*/
+static int program_decode_bench (const ProgramContext *context)
+  {
+  int ret = 0;
+  int argc = program_context_get_nonswitch_argc (context);
+  char **argv = program_context_get_nonswitch_argv (context);
+  if (argc > 1)
+    {
+    program_set_cache_dir (context);
+    XineInterface *xi = xine_interface_create 
+       (program_context_get (context, "driver"),
+          program_context_get (context, "config"));
+    xine_interface_set_ramp_msec (xi, 0);
+    char *error = NULL;
+    if (xine_interface_init (xi, &error))
+      {
+      if (decodebench_run (xi, program_context_get_integer (context, 
+            "bench-speed", DECODEBENCH_DEF_SPEED), argv + 1, argc - 1, 
+            stdout) > 0)
+        ret = 1;
+      }
+    else
+      {
+      fprintf (stderr, NAME ": Can't initialize Xine: %s\n", error);
+      free (error);
+      ret = 1;
+      }
+    xine_interface_destroy (xi);
+    }
+  else
+    {
+    fprintf (stderr, NAME ": --decode-bench needs files to play\n");
+    ret = 1;
+    }
+  return ret;
+  }
+
+
 /*==========================================================================
   program_run
 
@@ -32,6 +428,7 @@
 ==========================================================================*/
 int program_run (ProgramContext *context)
   {
+  int ret = 0;
   if (program_context_get_boolean (context, "list-drivers", FALSE))
     {
     XineInterface *xi = xine_interface_create (NULL, NULL);
@@ -44,6 +441,10 @@ int program_run (ProgramContext *context)
       }
     xine_interface_destroy (xi);
     }
+  else if (program_context_get_boolean (context, "decode-bench", FALSE))
+    {
+    ret = program_decode_bench (context);
+    }
   else
     {
     // We need to daemonize before initializing Xine, else
@@ -55,64 +456,118 @@ int program_run (ProgramContext *context)
 
     Notifier *notifier = notifier_create ();
 
+    program_set_cache_dir (context);
     XineInterface *xi = xine_interface_create 
        (program_context_get (context, "driver"),
           program_context_get (context, "config"));
    
-    char *error = NULL;
-    if (xine_interface_init (xi, &error))
+    // Xine is initialized in the background, so we can accept
+    //  connections straight away. Commands that need Xine will
+    //  wait for it 
+    xine_interface_set_ramp_msec (xi, program_context_get_integer (context,
+          "fade", XINE_INTERFACE_DEF_RAMP_MSEC));
+    xine_interface_set_levels_rate (xi, program_context_get_integer 
+          (context, "levels-rate", AUDIOTAP_DEF_RATE));
+    Broadcast *broadcast = program_start_broadcast (context, xi);
+    ClockSync *clocksync = program_start_clocksync (context, xi);
+    xine_interface_init_async (xi);
+    CmdProc *cmdproc = cmdproc_create (xi, notifier);
+    cmdproc_set_broadcast (cmdproc, broadcast);
+    program_add_zones (context, xi, cmdproc);
+    cmdproc_set_clocksync (cmdproc, clocksync);
+    StateFile *statefile = program_start_statefile (context, cmdproc);
+    Library *library = program_start_library (context, cmdproc);
+    MetaCache *metacache = NULL;
+    int meta_cache_size = program_context_get_integer (context, 
+          "meta-cache", METACACHE_DEF_SIZE);
+    if (meta_cache_size > 0)
       {
-      CmdProc *cmdproc = cmdproc_create (xi, notifier);
-      
-      int port = program_context_get_integer (context, "port", 
-	    XINESERVER_DEF_PORT);
-      const char *host = program_context_get (context, "host");
-      if (!host) host = "127.0.0.1";
-      Server *server = server_create (host, port, cmdproc);
-      char *error = NULL;
+      metacache = metacache_create (xi, meta_cache_size);
+      metacache_start (metacache);
+      cmdproc_set_metacache (cmdproc, metacache);
+      }
+    program_start_replaygain (context, cmdproc);
+    ShmStatus *shmstatus = program_start_shmstatus (context, cmdproc);
+    Auth *auth = NULL;
+    BOOL auth_ok = program_start_auth (context, cmdproc, &auth);
+    
+    int port = program_context_get_integer (context, "port", 
+          XINESERVER_DEF_PORT);
+    const char *host = program_context_get (context, "host");
+    if (!host) host = "127.0.0.1";
+    Server *server = server_create (host, port, cmdproc);
+    server_set_listen (server, program_context_get (context, "listen"));
+    server_set_backlog (server, program_context_get_integer (context, 
+      "listen-backlog", SERVER_DEF_BACKLOG));
+    server_set_threads (server, program_context_get_integer (context, 
+      "server-threads", 1));
+    server_set_workers (server, program_context_get_integer (context, 
+      "server-workers", SERVER_DEF_WORKERS));
+    program_start_rate_limit (context, server);
+    cmdproc_set_server (cmdproc, server);
+    char *error = NULL;
 
 
-      notifier_notify (notifier, XSNOTIFY_CLASS_SERVER, 
-	 XSNOTIFY_EVENT_STARTUP, NOTIFY_MSG_SERVER_STARTUP);
-      if (server_start (server, &error))
-	{
-	// The server thread can be run as a real thread, if we
-	//  need to do concurrent work here. This is for future
-	//  expansion -- right now we just run the server thread
-	//  in this thread
+    notifier_notify (notifier, XSNOTIFY_CLASS_SERVER, 
+       XSNOTIFY_EVENT_STARTUP, NOTIFY_MSG_SERVER_STARTUP);
+    if (!auth_ok)
+      {
+      // program_start_auth() has said why
+      ret = -1;
+      }
+    else if (server_start (server, &error))
+      {
+      // The server thread can be run as a real thread, if we
+      //  need to do concurrent work here. This is for future
+      //  expansion -- right now we just run the server thread
+      //  in this thread
     /*
-	BOOL stop = FALSE;
-	while (!stop)
-	  {
-	  usleep (1000000);
-	  printf ("tick\n");
-	  if (!server_is_running (server)) 
-	    stop = TRUE;
-	  }
+      BOOL stop = FALSE;
+      while (!stop)
+        {
+        usleep (1000000);
+        printf ("tick\n");
+        if (!server_is_running (server)) 
+          stop = TRUE;
+        }
     */
-	}
-      else
-	{
-	log_error ("Can't initialize server: %s", error);
-	free (error);
-	}
-
-      server_destroy (server);
-      cmdproc_stop_playback (cmdproc);
-      cmdproc_destroy (cmdproc);
       }
     else
       {
-      log_error ("Can't initialize Xine: %s", error);
+      log_error ("Can't initialize server: %s", error);
       free (error);
       }
+    if (xine_interface_has_failed (xi))
+      {
+      log_error ("Shutting down, because Xine could not be initialized");
+      ret = -1;
+      }
+
+    server_destroy (server);
+    if (auth) auth_destroy (auth);
+    if (shmstatus) 
+      {
+      cmdproc_set_shmstatus (cmdproc, NULL);
+      shmstatus_destroy (shmstatus);
+      }
+    // Do this before stopping playback, so that the final state
+    //  includes the playback position
+    if (statefile) statefile_destroy (statefile);
+    if (library) library_destroy (library);
+    if (clocksync) clocksync_destroy (clocksync);
+    cmdproc_stop_playback (cmdproc);
+    cmdproc_destroy (cmdproc);
+    // Not until now: the command processors, and their Xine event
+    //  handlers, look up replay gain in the cache
+    if (metacache) metacache_destroy (metacache);
 
     xine_interface_destroy (xi);
+    if (broadcast) broadcast_destroy (broadcast);
     notifier_notify (notifier, XSNOTIFY_CLASS_SERVER, 
         XSNOTIFY_EVENT_SHUTDOWN, NOTIFY_MSG_SERVER_SHUTDOWN);
     notifier_destroy (notifier);
     }
-  return 0;
+  return ret;
   }
 
 
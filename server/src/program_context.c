@@ -126,6 +126,31 @@ BOOL program_context_parse_command_line (ProgramContext *self,
       {"host", required_argument, NULL, 'h'},
       {"driver", required_argument, NULL, 'd'},
       {"list-drivers", no_argument, NULL, 0},
+      {"zones", required_argument, NULL, 'z'},
+      {"sync", required_argument, NULL, 0},
+      {"sync-group", required_argument, NULL, 0},
+      {"sync-port", required_argument, NULL, 0},
+      {"cache-dir", required_argument, NULL, 0},
+      {"state-file", required_argument, NULL, 0},
+      {"resume", no_argument, NULL, 0},
+      {"library", required_argument, NULL, 0},
+      {"library-index", required_argument, NULL, 0},
+      {"meta-cache", required_argument, NULL, 0},
+      {"fade", required_argument, NULL, 0},
+      {"shm", required_argument, NULL, 0},
+      {"replaygain", required_argument, NULL, 0},
+      {"replaygain-preamp", required_argument, NULL, 0},
+      {"levels-rate", required_argument, NULL, 0},
+      {"broadcast", required_argument, NULL, 0},
+      {"decode-bench", no_argument, NULL, 0},
+      {"bench-speed", required_argument, NULL, 0},
+      {"listen", required_argument, NULL, 0},
+      {"listen-backlog", required_argument, NULL, 0},
+      {"server-threads", required_argument, NULL, 0},
+      {"server-workers", required_argument, NULL, 0},
+      {"rate-limit", required_argument, NULL, 0},
+      {"rate-limit-policy", required_argument, NULL, 0},
+      {"auth-file", required_argument, NULL, 0},
       {0, 0, 0, 0}
     };
 
@@ -133,7 +158,7 @@ BOOL program_context_parse_command_line (ProgramContext *self,
    while (ret)
      {
      int option_index = 0;
-     opt = getopt_long (argc, argv, "h:vl:p:d:c:",
+     opt = getopt_long (argc, argv, "h:vl:p:d:c:z:",
      long_options, &option_index);
 
      if (opt == -1) break;
@@ -162,6 +187,68 @@ BOOL program_context_parse_command_line (ProgramContext *self,
            program_context_put (self, "host", optarg); 
          else if (strcmp (long_options[option_index].name, "config") == 0)
            program_context_put (self, "config", optarg); 
+         else if (strcmp (long_options[option_index].name, "zones") == 0)
+           program_context_put (self, "zones", optarg); 
+         else if (strcmp (long_options[option_index].name, "sync") == 0)
+           program_context_put (self, "sync", optarg); 
+         else if (strcmp (long_options[option_index].name, "sync-group") == 0)
+           program_context_put (self, "sync-group", optarg); 
+         else if (strcmp (long_options[option_index].name, "sync-port") == 0)
+           program_context_put_integer (self, "sync-port", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "cache-dir") == 0)
+           program_context_put (self, "cache-dir", optarg); 
+         else if (strcmp (long_options[option_index].name, "state-file") == 0)
+           program_context_put (self, "state-file", optarg); 
+         else if (strcmp (long_options[option_index].name, "resume") == 0)
+           program_context_put_boolean (self, "resume", TRUE); 
+         else if (strcmp (long_options[option_index].name, "library") == 0)
+           program_context_put (self, "library", optarg); 
+         else if (strcmp (long_options[option_index].name, 
+             "library-index") == 0)
+           program_context_put (self, "library-index", optarg); 
+         else if (strcmp (long_options[option_index].name, "meta-cache") == 0)
+           program_context_put_integer (self, "meta-cache", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "fade") == 0)
+           program_context_put_integer (self, "fade", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "shm") == 0)
+           program_context_put (self, "shm", optarg); 
+         else if (strcmp (long_options[option_index].name, "replaygain") == 0)
+           program_context_put (self, "replaygain", optarg); 
+         else if (strcmp (long_options[option_index].name, 
+             "replaygain-preamp") == 0)
+           program_context_put (self, "replaygain-preamp", optarg); 
+         else if (strcmp (long_options[option_index].name, "levels-rate") == 0)
+           program_context_put_integer (self, "levels-rate", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "broadcast") == 0)
+           program_context_put (self, "broadcast", optarg); 
+         else if (strcmp (long_options[option_index].name, 
+             "decode-bench") == 0)
+           program_context_put_boolean (self, "decode-bench", TRUE);
+         else if (strcmp (long_options[option_index].name, "bench-speed") == 0)
+           program_context_put_integer (self, "bench-speed", atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, "listen") == 0)
+           program_context_put (self, "listen", optarg); 
+         else if (strcmp (long_options[option_index].name, 
+             "listen-backlog") == 0)
+           program_context_put_integer (self, "listen-backlog", 
+             atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, 
+             "server-threads") == 0)
+           program_context_put_integer (self, "server-threads", 
+             atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, 
+             "server-workers") == 0)
+           program_context_put_integer (self, "server-workers", 
+             atoi (optarg)); 
+         else if (strcmp (long_options[option_index].name, 
+             "rate-limit") == 0)
+           program_context_put (self, "rate-limit", optarg); 
+         else if (strcmp (long_options[option_index].name, 
+             "rate-limit-policy") == 0)
+           program_context_put (self, "rate-limit-policy", optarg); 
+         else if (strcmp (long_options[option_index].name, 
+             "auth-file") == 0)
+           program_context_put (self, "auth-file", optarg); 
          else
            exit (-1);
          break;
@@ -176,6 +263,7 @@ BOOL program_context_parse_command_line (ProgramContext *self,
        case 'd': program_context_put (self, "driver", optarg); break;
        case 'h': program_context_put (self, "host", optarg); break;
        case 'c': program_context_put (self, "config", optarg); break;
+       case 'z': program_context_put (self, "zones", optarg); break;
        default:
          ret = FALSE; 
        }
@@ -0,0 +1,404 @@
+/*==========================================================================
+
+  xine-server
+  scanner.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Expansion of directories and playlist files into playlist entries.
+
+  Directories are scanned by a pool of threads that share a stack of
+  directories still to be read. Most of the time is spent waiting for
+  the filesystem -- especially on an SD card or network share -- so
+  several directories can usefully be read at once, even on a single
+  CPU. The type of each entry is taken from readdir() where the
+  filesystem supplies it, so most entries need no stat() call.
+  Symbolic links to directories are not followed, to avoid loops.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "scanner.h"
+#include "../../api/xine-server-ext.h"
+
+#define SCANNER_MIN_THREADS 2
+#define SCANNER_MAX_THREADS 8
+
+// A growable array of strings
+typedef struct _ScannerArray
+  {
+  char **items;
+  int count;
+  int size;
+  } ScannerArray;
+
+// State shared by the threads scanning one directory tree
+typedef struct _ScannerJob
+  {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  // Directories waiting to be read
+  ScannerArray dirs;
+  // Number of threads currently reading a directory. When this is zero
+  //  and there are no directories waiting, the scan is finished
+  int busy;
+  BOOL recursive;
+  ScannerArray files;
+  } ScannerJob;
+
+
+/*==========================================================================
+
+  scanner_array_add
+
+  Takes ownership of the string
+
+==========================================================================*/
+static void scanner_array_add (ScannerArray *a, char *s)
+  {
+  if (a->count == a->size)
+    {
+    a->size = a->size ? a->size * 2 : 64;
+    a->items = realloc (a->items, a->size * sizeof (char *));
+    }
+  a->items[a->count++] = s;
+  }
+
+
+/*==========================================================================
+
+  scanner_array_add_all
+
+  Move all the strings from one array to another
+
+==========================================================================*/
+static void scanner_array_add_all (ScannerArray *a, ScannerArray *from)
+  {
+  for (int i = 0; i < from->count; i++)
+    scanner_array_add (a, from->items[i]);
+  from->count = 0;
+  }
+
+
+/*==========================================================================
+
+  scanner_is_playable
+
+==========================================================================*/
+static BOOL scanner_is_playable (const char *name)
+  {
+  const char *ext = strrchr (name, '.');
+  if (ext && ext != name)
+    return xineserver_ext_is_playable (ext + 1);
+  return FALSE;
+  }
+
+
+/*==========================================================================
+
+  scanner_read_directory
+
+  Read one directory, adding playable files to 'files' and, if
+  scanning recursively, subdirectories to 'dirs'
+
+==========================================================================*/
+static void scanner_read_directory (const char *dir, BOOL recursive,
+      ScannerArray *files, ScannerArray *dirs)
+  {
+  DIR *d = opendir (dir);
+  if (d)
+    {
+    struct dirent *de;
+    while ((de = readdir (d)))
+      {
+      const char *name = de->d_name;
+      if (name[0] == '.') continue; // Includes . and ..
+      unsigned char type = de->d_type;
+      if (type == DT_DIR && !recursive) continue;
+      if (type == DT_REG && !scanner_is_playable (name)) continue;
+
+      char *path;
+      if (dir[strlen (dir) - 1] == '/')
+        asprintf (&path, "%s%s", dir, name);
+      else
+        asprintf (&path, "%s/%s", dir, name);
+
+      if (type == DT_UNKNOWN || type == DT_LNK)
+        {
+        // Follow links to files, but not links to directories
+        struct stat sb;
+        if (lstat (path, &sb) == 0 && S_ISDIR (sb.st_mode))
+          type = DT_DIR;
+        else if (stat (path, &sb) == 0 && S_ISREG (sb.st_mode))
+          type = DT_REG;
+        else
+          type = DT_UNKNOWN;
+        }
+
+      if (type == DT_DIR && recursive)
+        scanner_array_add (dirs, path);
+      else if (type == DT_REG && scanner_is_playable (name))
+        scanner_array_add (files, path);
+      else
+        free (path);
+      }
+    closedir (d);
+    }
+  else
+    log_warning ("Can't read directory %s: %s", dir, strerror (errno));
+  }
+
+
+/*==========================================================================
+
+  scanner_thread
+
+==========================================================================*/
+static void *scanner_thread (void *arg)
+  {
+  LOG_IN
+  ScannerJob *job = (ScannerJob *)arg;
+  ScannerArray files = {NULL, 0, 0};
+  ScannerArray dirs = {NULL, 0, 0};
+  pthread_mutex_lock (&job->mutex);
+  while (TRUE)
+    {
+    while (job->dirs.count == 0 && job->busy > 0)
+      pthread_cond_wait (&job->cond, &job->mutex);
+    if (job->dirs.count == 0) break;
+
+    char *dir = job->dirs.items[--job->dirs.count];
+    job->busy++;
+    pthread_mutex_unlock (&job->mutex);
+
+    scanner_read_directory (dir, job->recursive, &files, &dirs);
+    free (dir);
+
+    pthread_mutex_lock (&job->mutex);
+    scanner_array_add_all (&job->dirs, &dirs);
+    job->busy--;
+    pthread_cond_broadcast (&job->cond);
+    }
+  scanner_array_add_all (&job->files, &files);
+  pthread_mutex_unlock (&job->mutex);
+  if (files.items) free (files.items);
+  if (dirs.items) free (dirs.items);
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  scanner_compare
+
+==========================================================================*/
+static int scanner_compare (const void *i1, const void *i2)
+  {
+  return strcmp (*(const char **)i1, *(const char **)i2);
+  }
+
+
+/*==========================================================================
+
+  scanner_scan_directory
+
+==========================================================================*/
+BOOL scanner_scan_directory (const char *path, BOOL recursive,
+      char ***items, int *count, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  struct stat sb;
+  if (stat (path, &sb) == 0 && S_ISDIR (sb.st_mode))
+    {
+    ScannerJob job;
+    memset (&job, 0, sizeof (job));
+    pthread_mutex_init (&job.mutex, NULL);
+    pthread_cond_init (&job.cond, NULL);
+    job.recursive = recursive;
+    scanner_array_add (&job.dirs, strdup (path));
+
+    int nthreads = 1;
+    if (recursive)
+      {
+      nthreads = 2 * sysconf (_SC_NPROCESSORS_ONLN);
+      if (nthreads < SCANNER_MIN_THREADS) nthreads = SCANNER_MIN_THREADS;
+      if (nthreads > SCANNER_MAX_THREADS) nthreads = SCANNER_MAX_THREADS;
+      }
+    pthread_t threads[SCANNER_MAX_THREADS];
+    for (int i = 0; i < nthreads; i++)
+      pthread_create (&threads[i], NULL, scanner_thread, &job);
+    for (int i = 0; i < nthreads; i++)
+      pthread_join (threads[i], NULL);
+
+    if (job.dirs.items) free (job.dirs.items);
+    pthread_mutex_destroy (&job.mutex);
+    pthread_cond_destroy (&job.cond);
+
+    qsort (job.files.items, job.files.count, sizeof (char *),
+      scanner_compare);
+    log_debug ("%s: found %d files in %s using %d threads",
+      __PRETTY_FUNCTION__, job.files.count, path, nthreads);
+    *items = job.files.items;
+    *count = job.files.count;
+    ret = TRUE;
+    }
+  else
+    {
+    asprintf (error, "Not a directory: %s", path);
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  scanner_add_entry
+
+  Add a playlist file entry, resolving relative pathnames and skipping
+  local files that don't exist
+
+==========================================================================*/
+static void scanner_add_entry (ScannerArray *a, const char *dir,
+      const char *entry)
+  {
+  char *path;
+  if (entry[0] == '/' || strstr (entry, "://"))
+    path = strdup (entry);
+  else
+    asprintf (&path, "%s/%s", dir, entry);
+
+  if (path[0] != '/' || access (path, R_OK) == 0)
+    scanner_array_add (a, path);
+  else
+    {
+    log_warning ("%s: File not found: %s", __PRETTY_FUNCTION__, path);
+    free (path);
+    }
+  }
+
+
+/*==========================================================================
+
+  scanner_read_playlist
+
+  Read an M3U or PLS file. Each line is trimmed of leading and
+  trailing whitespace. For M3U, blank lines and comment lines are
+  skipped. For PLS, only FileN= lines are used, in the order in
+  which they appear
+
+==========================================================================*/
+static BOOL scanner_read_playlist (const char *path, BOOL pls,
+      char ***items, int *count, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  FILE *f = fopen (path, "r");
+  if (f)
+    {
+    ScannerArray a = {NULL, 0, 0};
+    char *dir = strdup (path);
+    char *slash = strrchr (dir, '/');
+    if (slash == dir)
+      dir[1] = 0;
+    else if (slash)
+      *slash = 0;
+    else
+      strcpy (dir, ".");
+
+    char *line = NULL;
+    size_t n = 0;
+    while (getline (&line, &n, f) >= 0)
+      {
+      char *s = line;
+      while (*s == ' ' || *s == '\t') s++;
+      char *end = s + strlen (s);
+      while (end > s && (end[-1] == '\n' || end[-1] == '\r'
+          || end[-1] == ' ' || end[-1] == '\t'))
+        *--end = 0;
+      // UTF-8 byte order mark, which some M3U8 files have
+      if ((unsigned char)s[0] == 0xEF && (unsigned char)s[1] == 0xBB
+          && (unsigned char)s[2] == 0xBF)
+        s += 3;
+      if (s[0] == 0) continue;
+
+      if (pls)
+        {
+        if (strncasecmp (s, "file", 4) == 0)
+          {
+          char *eq = strchr (s, '=');
+          if (eq && eq[1])
+            scanner_add_entry (&a, dir, eq + 1);
+          }
+        }
+      else if (s[0] != '#')
+        scanner_add_entry (&a, dir, s);
+      }
+    if (line) free (line);
+    free (dir);
+    fclose (f);
+    *items = a.items;
+    *count = a.count;
+    ret = TRUE;
+    }
+  else
+    {
+    asprintf (error, "Can't open %s: %s", path, strerror (errno));
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  scanner_read_m3u
+
+==========================================================================*/
+BOOL scanner_read_m3u (const char *path, char ***items, int *count,
+      char **error)
+  {
+  return scanner_read_playlist (path, FALSE, items, count, error);
+  }
+
+
+/*==========================================================================
+
+  scanner_read_pls
+
+==========================================================================*/
+BOOL scanner_read_pls (const char *path, char ***items, int *count,
+      char **error)
+  {
+  return scanner_read_playlist (path, TRUE, items, count, error);
+  }
+
+
+/*==========================================================================
+
+  scanner_free_items
+
+==========================================================================*/
+void scanner_free_items (char **items, int count)
+  {
+  if (items)
+    {
+    for (int i = 0; i < count; i++)
+      free (items[i]);
+    free (items);
+    }
+  }
+
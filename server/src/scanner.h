@@ -0,0 +1,39 @@
+/*============================================================================
+
+  xine-server
+  scanner.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+BEGIN_DECLS
+
+// Find the playable files in a directory, and optionally its
+//  subdirectories, sorted by pathname. On success, *items is a newly
+//  allocated array of *count newly allocated pathnames, and the caller
+//  owns both. Free them with scanner_free_items() or, having taken
+//  ownership of the strings, free() just the array. *items is NULL
+//  if nothing was found. On failure *items is unchanged, and *error 
+//  must be freed
+BOOL  scanner_scan_directory (const char *path, BOOL recursive,
+         char ***items, int *count, char **error);
+
+// Read the entries of an M3U or PLS playlist. Relative pathnames are
+//  taken to be relative to the playlist's directory. Local files that
+//  do not exist are skipped. Ownership of *items is as for
+//  scanner_scan_directory()
+BOOL  scanner_read_m3u (const char *path, char ***items, int *count,
+         char **error);
+BOOL  scanner_read_pls (const char *path, char ***items, int *count,
+         char **error);
+
+// Free each of the 'count' strings and then the array. items may
+//  be NULL
+void  scanner_free_items (char **items, int count);
+
+END_DECLS
+
@@ -5,6 +5,30 @@
   Copyright (c)2020 Kevin Boone
   Distributed under the terms of the GPL v3.0
 
+  The server listens on any number of addresses -- IPv4, IPv6, or Unix
+  sockets -- from one or more threads. Each thread has its own
+  connections, and waits on them and on the listening sockets with
+  poll(). With more than one thread, each has its own socket for each
+  TCP address, bound with SO_REUSEPORT, so that the kernel shares new
+  connections between them; Unix sockets are served by the first
+  thread only. 
+
+  Commands are run by a pool of worker threads, so that a slow one --
+  'play' waits for Xine to open the stream, 'add' checks every file --
+  holds up only the client that sent it. Each connection's commands
+  are run one at a time, in the order they were sent. Read-only
+  commands from different connections may run alongside any others;
+  other commands run one at a time in each zone. Fast commands, 
+  'status' and 'version', are run by the I/O thread as soon as they 
+  arrive, unless the client is still waiting for an earlier response.
+
+  Clients that send the same read-only command at the same time share
+  one response: the second waits for the first to finish, rather than
+  doing the work again. A client may also be limited to a number of
+  commands a second, counted by its address (or, on a Unix socket, its
+  user ID), with a token bucket; over the limit its commands are either
+  held back, by not reading them, or refused.
+
 ==========================================================================*/
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -14,25 +38,150 @@
 #include <getopt.h>
 #include <wchar.h>
 #include <time.h>
+#include <math.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
 #include <pthread.h>
 #include "feature.h" 
 #include "defs.h" 
 #include "log.h" 
 #include "string.h" 
+#include "list.h" 
 #include "server.h" 
 #include "cmdproc.h" 
+#include "../../api/xine-server-api.h" 
 
-struct _Server
+// Most client connections open at once, in each thread
+#define SERVER_MAX_CONNECTIONS 64
+
+// Most listening sockets in each thread
+#define SERVER_MAX_LISTENERS 16
+
+// Time after which a connection that has sent nothing is closed
+#define SERVER_IDLE_SEC 60
+
+// Time allowed to write a response to a client that is not reading it
+#define SERVER_SEND_TIMEOUT_SEC 10
+
+// Time for which the kernel holds a new TCP connection, waiting for the
+//  client to send something, before the server is told about it
+#define SERVER_DEFER_ACCEPT_SEC 5
+
+// Interval at which the server checks for shutdown and idle clients
+#define SERVER_POLL_MSEC 1000
+
+#define SERVER_READ_CHUNK 4096
+
+// Longest request line. It is generous, because insert takes any number
+//  of streams, but a client can't make the server buffer without limit
+#define SERVER_MAX_LINE (1024 * 1024)
+
+// Hash table size for the rate limits of clients. Must be a power of 2
+#define SERVER_RATE_BUCKETS 256
+
+// A command waiting for a worker
+typedef struct _ServerCmd
+  {
+  char *line;
+  CmdProcClass cls;
+  char *response; // Already known, if not NULL
+  struct _ServerCmd *next;
+  } ServerCmd;
+
+// The rate limit of one client, which may have several connections
+typedef struct _ServerRate
+  {
+  char *client;
+  double tokens;
+  int64_t last_usec; // When the tokens were last topped up
+  int conns;
+  struct _ServerRate *chain;
+  } ServerRate;
+
+// A read-only command being run, whose response is shared with other
+//  clients that send the same command meanwhile
+typedef struct _ServerFlight
+  {
+  char *line;
+  uint64_t write_seq; // The server's write_seq when the command started
+  const struct _AuthRole *role; // Of the client that started it
+  char *response; // Copied here, if anyone is waiting
+  BOOL done;
+  int waiters;
+  struct _ServerFlight *next;
+  } ServerFlight;
+
+typedef struct _ServerConn
   {
   int sock;
+  char *buff;
+  int len;
+  int size;
+  BOOL keep_alive;
+  BOOL finished; // Has sent the one command it may send
+  BOOL eof;
+  time_t last_active;
+  ServerRate *rate; // NULL, if not rate-limited
+  int64_t throttle_until; // Not read until then, if not zero
+  BOOL held; // The next command has been held back already
+  CmdProcSession session; // Used by whichever thread runs its commands
+  // The rest is protected by the server's queue_mutex
+  ServerCmd *cmds;
+  ServerCmd *last_cmd;
+  BOOL scheduled; // On the run queue, or being run by a worker
+  BOOL orphaned; // Dropped by its thread while scheduled
+  struct _ServerConn *next_run;
+  } ServerConn;
+
+// One of the threads that accept connections and read commands
+typedef struct _ServerIO
+  {
+  Server *server;
+  pthread_t thread;
+  int listeners[SERVER_MAX_LISTENERS];
+  int nlisteners;
+  ServerConn *conns[SERVER_MAX_CONNECTIONS];
+  int nconns;
+  } ServerIO;
+
+struct _Server
+  {
   int port;
   char *host;
-  struct sockaddr_in address; 
+  char *listen;
+  int backlog;
+  int nthreads;
+  ServerIO *io;
+  List *unix_paths;
+  int nworkers;
+  pthread_t workers[SERVER_MAX_WORKERS];
+  pthread_mutex_t queue_mutex;
+  pthread_cond_t queue_cond;
+  ServerConn *run_head; // Connections with commands to run
+  ServerConn *run_tail;
+  BOOL stopping;
+  // Commands per second allowed to each client; zero for no limit
+  double rate;
+  int burst;
+  ServerRatePolicy rate_policy;
+  pthread_mutex_t rate_mutex;
+  ServerRate *rates[SERVER_RATE_BUCKETS];
+  pthread_mutex_t flight_mutex;
+  pthread_cond_t flight_cond;
+  ServerFlight *flights;
+  uint64_t write_seq; // Counts commands that might change something
+  // Counters for the 'stats' command
+  uint64_t n_commands;
+  uint64_t n_inline;
+  uint64_t n_coalesced;
+  uint64_t n_rate_limited;
   BOOL inited;
   CmdProc *cmdproc;
   BOOL is_running;
@@ -49,9 +198,32 @@ Server *server_create (const char *host, int port, CmdProc *cmdproc)
   LOG_IN
   log_debug ("%s: Creating server, port=%d", __PRETTY_FUNCTION__, port);
   Server *self = malloc (sizeof (Server));
-  self->sock = 0;
   self->port = port;
   self->host = strdup (host);
+  self->listen = NULL;
+  self->backlog = SERVER_DEF_BACKLOG;
+  self->nthreads = 1;
+  self->io = NULL;
+  self->unix_paths = list_create (free);
+  self->nworkers = SERVER_DEF_WORKERS;
+  pthread_mutex_init (&self->queue_mutex, NULL);
+  pthread_cond_init (&self->queue_cond, NULL);
+  self->run_head = NULL;
+  self->run_tail = NULL;
+  self->stopping = FALSE;
+  self->rate = 0;
+  self->burst = 0;
+  self->rate_policy = SERVER_RATE_DELAY;
+  pthread_mutex_init (&self->rate_mutex, NULL);
+  memset (self->rates, 0, sizeof (self->rates));
+  pthread_mutex_init (&self->flight_mutex, NULL);
+  pthread_cond_init (&self->flight_cond, NULL);
+  self->flights = NULL;
+  self->write_seq = 0;
+  self->n_commands = 0;
+  self->n_inline = 0;
+  self->n_coalesced = 0;
+  self->n_rate_limited = 0;
   self->inited = FALSE;
   self->cmdproc = cmdproc;
   self->is_running = FALSE;
@@ -61,50 +233,738 @@ Server *server_create (const char *host, int port, CmdProc *cmdproc)
 
 /*==========================================================================
 
-  server_thread 
+  server_set_listen
 
 ==========================================================================*/
-static void *server_thread (void *arg)
+void server_set_listen (Server *self, const char *addresses)
+  {
+  if (self->listen) free (self->listen);
+  self->listen = addresses ? strdup (addresses) : NULL;
+  }
+
+/*==========================================================================
+
+  server_set_backlog
+
+==========================================================================*/
+void server_set_backlog (Server *self, int backlog)
+  {
+  self->backlog = backlog > 0 ? backlog : SERVER_DEF_BACKLOG;
+  }
+
+/*==========================================================================
+
+  server_set_threads
+
+==========================================================================*/
+void server_set_threads (Server *self, int threads)
+  {
+  if (threads < 1) threads = 1;
+  if (threads > SERVER_MAX_THREADS) threads = SERVER_MAX_THREADS;
+  self->nthreads = threads;
+  }
+
+/*==========================================================================
+
+  server_set_workers
+
+==========================================================================*/
+void server_set_workers (Server *self, int workers)
+  {
+  if (workers < 1) workers = 1;
+  if (workers > SERVER_MAX_WORKERS) workers = SERVER_MAX_WORKERS;
+  self->nworkers = workers;
+  }
+
+/*==========================================================================
+
+  server_set_rate_limit
+
+  Allow each client 'rate' commands a second, with bursts of up to
+  'burst'. A rate of zero means no limit
+
+==========================================================================*/
+void server_set_rate_limit (Server *self, double rate, int burst,
+       ServerRatePolicy policy)
+  {
+  self->rate = rate > 0 ? rate : 0;
+  self->burst = burst >= 1 ? burst : (rate > 1 ? (int)ceil (rate) : 1);
+  self->rate_policy = policy;
+  }
+
+/*==========================================================================
+
+  server_rate_policy_from_string
+
+==========================================================================*/
+BOOL server_rate_policy_from_string (const char *s, 
+       ServerRatePolicy *policy)
+  {
+  BOOL ret = TRUE;
+  if (strcmp (s, "delay") == 0)
+    *policy = SERVER_RATE_DELAY;
+  else if (strcmp (s, "reject") == 0)
+    *policy = SERVER_RATE_REJECT;
+  else
+    ret = FALSE;
+  return ret;
+  }
+
+/*==========================================================================
+
+  server_usec
+
+==========================================================================*/
+static int64_t server_usec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+/*==========================================================================
+
+  server_client_name
+
+  The name by which a client's rate limit is known: its IP address, or
+  its user ID on a Unix socket. Empty if it can't be found
+
+==========================================================================*/
+static void server_client_name (int sock, char *name, size_t len)
+  {
+  struct sockaddr_storage ss;
+  socklen_t sslen = sizeof (ss);
+  name[0] = 0;
+  if (getpeername (sock, (struct sockaddr *)&ss, &sslen) != 0) return;
+  if (ss.ss_family == AF_INET)
+    inet_ntop (AF_INET, &((struct sockaddr_in *)&ss)->sin_addr, name, len);
+  else if (ss.ss_family == AF_INET6)
+    inet_ntop (AF_INET6, &((struct sockaddr_in6 *)&ss)->sin6_addr, 
+      name, len);
+  else if (ss.ss_family == AF_UNIX)
+    {
+    struct ucred cred;
+    socklen_t credlen = sizeof (cred);
+    if (getsockopt (sock, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) == 0)
+      snprintf (name, len, "uid:%d", (int)cred.uid);
+    }
+  }
+
+/*==========================================================================
+
+  server_rate_refill
+
+  Top up a client's tokens for the time since they were last topped
+  up. The rate_mutex must be held
+
+==========================================================================*/
+static void server_rate_refill (Server *self, ServerRate *r, int64_t now)
+  {
+  r->tokens += (now - r->last_usec) * self->rate / 1000000.0;
+  if (r->tokens > self->burst) r->tokens = self->burst;
+  r->last_usec = now;
+  }
+
+/*==========================================================================
+
+  server_rate_acquire
+
+  Find, or make, the rate limit for a new connection from 'client'.
+  Limits are kept after the client disconnects, so that it can't start
+  afresh by reconnecting, until its tokens have built up again
+
+==========================================================================*/
+static ServerRate *server_rate_acquire (Server *self, const char *client)
+  {
+  uint32_t h = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)client; *p; p++)
+    h = (h ^ *p) * 16777619u;
+  int64_t now = server_usec ();
+  ServerRate *r = NULL;
+  pthread_mutex_lock (&self->rate_mutex);
+  ServerRate **p = &self->rates[h & (SERVER_RATE_BUCKETS - 1)];
+  while (*p)
+    {
+    ServerRate *e = *p;
+    if (strcmp (e->client, client) == 0)
+      r = e;
+    else if (e->conns == 0)
+      {
+      server_rate_refill (self, e, now);
+      if (e->tokens >= self->burst)
+        {
+        *p = e->chain;
+        free (e->client);
+        free (e);
+        continue;
+        }
+      }
+    p = &e->chain;
+    }
+  if (!r)
+    {
+    r = malloc (sizeof (ServerRate));
+    r->client = strdup (client);
+    r->tokens = self->burst;
+    r->last_usec = now;
+    r->conns = 0;
+    r->chain = self->rates[h & (SERVER_RATE_BUCKETS - 1)];
+    self->rates[h & (SERVER_RATE_BUCKETS - 1)] = r;
+    }
+  r->conns++;
+  pthread_mutex_unlock (&self->rate_mutex);
+  return r;
+  }
+
+/*==========================================================================
+
+  server_rate_take
+
+  Take a token for one command. Returns zero if there was one, or the
+  time in usec until there will be. A command held back more than once
+  is counted once
+
+==========================================================================*/
+static int64_t server_rate_take (Server *self, ServerConn *conn)
+  {
+  if (!conn->rate) return 0;
+  int64_t ret = 0;
+  pthread_mutex_lock (&self->rate_mutex);
+  server_rate_refill (self, conn->rate, server_usec ());
+  if (conn->rate->tokens >= 1)
+    conn->rate->tokens -= 1;
+  else
+    ret = (int64_t)((1 - conn->rate->tokens) * 1000000.0 / self->rate) + 1;
+  pthread_mutex_unlock (&self->rate_mutex);
+  if (ret && !conn->held)
+    __atomic_fetch_add (&self->n_rate_limited, 1, __ATOMIC_RELAXED);
+  conn->held = ret && self->rate_policy == SERVER_RATE_DELAY;
+  return ret;
+  }
+
+/*==========================================================================
+
+  server_conn_close
+
+==========================================================================*/
+static void server_conn_close (Server *self, ServerConn *conn)
+  {
+  log_debug ("%s: Closing client connection, socket=%d", 
+     __PRETTY_FUNCTION__, conn->sock);
+  close (conn->sock);
+  free (conn->buff);
+  while (conn->cmds)
+    {
+    ServerCmd *cmd = conn->cmds;
+    conn->cmds = cmd->next;
+    free (cmd->line);
+    if (cmd->response) free (cmd->response);
+    free (cmd);
+    }
+  if (conn->rate)
+    {
+    pthread_mutex_lock (&self->rate_mutex);
+    conn->rate->conns--;
+    pthread_mutex_unlock (&self->rate_mutex);
+    }
+  free (conn);
+  }
+
+/*==========================================================================
+
+  server_conn_drop
+
+  Called by a connection's I/O thread, which forgets about it. If a
+  worker has it, the worker closes it when there is nothing more to run
+
+==========================================================================*/
+static void server_conn_drop (Server *self, ServerConn *conn)
+  {
+  pthread_mutex_lock (&self->queue_mutex);
+  BOOL scheduled = conn->scheduled;
+  conn->orphaned = scheduled;
+  pthread_mutex_unlock (&self->queue_mutex);
+  if (!scheduled) server_conn_close (self, conn);
+  }
+
+/*==========================================================================
+
+  server_conn_is_scheduled
+
+==========================================================================*/
+static BOOL server_conn_is_scheduled (Server *self, ServerConn *conn)
+  {
+  pthread_mutex_lock (&self->queue_mutex);
+  BOOL ret = conn->scheduled;
+  pthread_mutex_unlock (&self->queue_mutex);
+  return ret;
+  }
+
+/*==========================================================================
+
+  server_conn_write
+
+  Write the whole of a response. The socket blocks, as it did when
+  there was only one client at a time; a client that stops reading
+  is dropped after SERVER_SEND_TIMEOUT_SEC
+
+==========================================================================*/
+static BOOL server_conn_write (ServerConn *conn, const char *s)
+  {
+  size_t len = strlen (s);
+  while (len > 0)
+    {
+    ssize_t n = send (conn->sock, s, len, MSG_NOSIGNAL);
+    if (n <= 0) return FALSE;
+    s += n;
+    len -= n;
+    }
+  return TRUE;
+  }
+
+/*==========================================================================
+
+  server_run_cmd
+
+  Run a command. The command processor serializes the commands that
+  might change something, zone by zone. A read-only command that is 
+  already being run for another client is not run again, so long as 
+  nothing has been changed since it started, and its response is 
+  shared
+
+==========================================================================*/
+static char *server_run_cmd (Server *self, const char *line, 
+       CmdProcClass cls, CmdProcSession *session)
+  {
+  if (strcmp (line, XINESERVER_CMD_KEEPALIVE) == 0)
+    return strdup ("0 OK\n");
+  __atomic_fetch_add (&self->n_commands, 1, __ATOMIC_RELAXED);
+  char *response;
+  if (cls == CMDPROC_CLASS_SESSION)
+    {
+    cmdproc_do_cmd (self->cmdproc, line, session, &response);
+    return response;
+    }
+  if (cls == CMDPROC_CLASS_WRITE)
+    {
+    cmdproc_do_cmd (self->cmdproc, line, session, &response);
+    pthread_mutex_lock (&self->flight_mutex);
+    self->write_seq++;
+    pthread_mutex_unlock (&self->flight_mutex);
+    return response;
+    }
+
+  pthread_mutex_lock (&self->flight_mutex);
+  ServerFlight *f = self->flights;
+  // Clients with different roles may not be allowed the same response
+  while (f && (f->write_seq != self->write_seq || f->role != session->role
+      || strcmp (f->line, line) != 0))
+    f = f->next;
+  if (f)
+    {
+    f->waiters++;
+    __atomic_fetch_add (&self->n_coalesced, 1, __ATOMIC_RELAXED);
+    while (!f->done)
+      pthread_cond_wait (&self->flight_cond, &self->flight_mutex);
+    response = strdup (f->response);
+    if (--f->waiters == 0)
+      {
+      free (f->response);
+      free (f->line);
+      free (f);
+      }
+    pthread_mutex_unlock (&self->flight_mutex);
+    return response;
+    }
+  f = malloc (sizeof (ServerFlight));
+  f->line = strdup (line);
+  f->write_seq = self->write_seq;
+  f->role = session->role;
+  f->response = NULL;
+  f->done = FALSE;
+  f->waiters = 0;
+  f->next = self->flights;
+  self->flights = f;
+  pthread_mutex_unlock (&self->flight_mutex);
+
+  cmdproc_do_cmd (self->cmdproc, line, session, &response);
+
+  pthread_mutex_lock (&self->flight_mutex);
+  ServerFlight **p = &self->flights;
+  while (*p != f) p = &(*p)->next;
+  *p = f->next;
+  if (f->waiters > 0)
+    {
+    f->response = strdup (response);
+    f->done = TRUE;
+    pthread_cond_broadcast (&self->flight_cond);
+    }
+  else
+    {
+    free (f->line);
+    free (f);
+    }
+  pthread_mutex_unlock (&self->flight_mutex);
+  return response;
+  }
+
+/*==========================================================================
+
+  server_schedule
+
+  Put a connection at the end of the run queue. The queue_mutex must
+  be held
+
+==========================================================================*/
+static void server_schedule (Server *self, ServerConn *conn)
+  {
+  conn->next_run = NULL;
+  if (self->run_tail)
+    self->run_tail->next_run = conn;
+  else
+    self->run_head = conn;
+  self->run_tail = conn;
+  pthread_cond_signal (&self->queue_cond);
+  }
+
+/*==========================================================================
+
+  server_queue_cmd
+
+==========================================================================*/
+static void server_queue_cmd (Server *self, ServerConn *conn, 
+       const char *line, CmdProcClass cls, char *response)
+  {
+  ServerCmd *cmd = malloc (sizeof (ServerCmd));
+  cmd->line = strdup (line);
+  cmd->cls = cls;
+  cmd->response = response;
+  cmd->next = NULL;
+  pthread_mutex_lock (&self->queue_mutex);
+  if (conn->last_cmd)
+    conn->last_cmd->next = cmd;
+  else
+    conn->cmds = cmd;
+  conn->last_cmd = cmd;
+  if (!conn->scheduled)
+    {
+    conn->scheduled = TRUE;
+    server_schedule (self, conn);
+    }
+  pthread_mutex_unlock (&self->queue_mutex);
+  }
+
+/*==========================================================================
+
+  server_worker
+
+  Run the next command of each connection on the run queue, and put
+  the connection back at the end of the queue if it has sent more. A
+  connection that should be closed is shut down, so that its I/O
+  thread sees the end of the input and closes it
+
+==========================================================================*/
+static void *server_worker (void *arg)
   {
   LOG_IN
   Server *self = (Server *)arg;
-  int addrlen = sizeof(self->address); 
-  log_debug ("%s: server thread start", __PRETTY_FUNCTION__); 
-  while (!cmdproc_has_requested_shutdown (self->cmdproc))
+  pthread_mutex_lock (&self->queue_mutex);
+  while (!self->stopping)
     {
-    int client_sock = accept (self->sock, (struct sockaddr *)&self->address, 
-          (socklen_t*)&addrlen);
-    log_debug ("%s: Accepted client connection, socket=%d", 
-       __PRETTY_FUNCTION__, client_sock);
+    ServerConn *conn = self->run_head;
+    if (!conn)
+      {
+      pthread_cond_wait (&self->queue_cond, &self->queue_mutex);
+      continue;
+      }
+    self->run_head = conn->next_run;
+    if (!self->run_head) self->run_tail = NULL;
+    ServerCmd *cmd = conn->cmds;
+    conn->cmds = cmd->next;
+    if (!conn->cmds) conn->last_cmd = NULL;
+    pthread_mutex_unlock (&self->queue_mutex);
+
+    char *response = cmd->response ? cmd->response 
+      : server_run_cmd (self, cmd->line, cmd->cls, &conn->session);
+    if (!server_conn_write (conn, response) || conn->finished
+        || cmdproc_has_requested_shutdown (self->cmdproc))
+      shutdown (conn->sock, SHUT_RDWR);
+    free (response);
+    free (cmd->line);
+    free (cmd);
 
-    String *buff = string_create_empty();
-    BOOL got_line = FALSE; 
-    int n;
-    do
+    pthread_mutex_lock (&self->queue_mutex);
+    if (conn->cmds)
+      server_schedule (self, conn);
+    else
       {
-      char buf[1];
-      n = read (client_sock, &buf, 1);
-      if (buf[0] == '\r')
-        got_line = TRUE;
-      else
-        string_append_byte (buff, buf[0]); 
-      } while (n > 0 && !got_line); 
+      conn->scheduled = FALSE;
+      if (conn->orphaned)
+        {
+        pthread_mutex_unlock (&self->queue_mutex);
+        server_conn_close (self, conn);
+        pthread_mutex_lock (&self->queue_mutex);
+        }
+      }
+    }
+  pthread_mutex_unlock (&self->queue_mutex);
+  LOG_OUT
+  return NULL;
+  }
+
+/*==========================================================================
+
+  server_conn_do_lines
+
+  Run each complete line that the client has sent. Lines end with CR or 
+  LF, and the empty line between the CR and LF of a CRLF pair is 
+  skipped. Returns FALSE when the connection should be closed -- after
+  the first response, unless the client asked to keep it open. Lines
+  after the first are ignored if it did not. At the end of the input, 
+  what is left is run even if it has no line ending, as the server 
+  always has
+
+==========================================================================*/
+static BOOL server_conn_do_lines (Server *self, ServerConn *conn)
+  {
+  BOOL ret = TRUE;
+  int start = 0;
+  while (ret && !conn->finished && start < conn->len)
+    {
+    int end = start;
+    while (end < conn->len && conn->buff[end] != '\r' 
+        && conn->buff[end] != '\n')
+      end++;
+    if (end == conn->len && !conn->eof) break;
+    char c = conn->buff[end];
+    conn->buff[end] = 0;
+    const char *line = conn->buff + start;
+    if (line[0] == 0)
+      {
+      start = end < conn->len ? end + 1 : end;
+      continue;
+      }
+
+    char *response = NULL;
+    BOOL keep_alive = strcmp (line, XINESERVER_CMD_KEEPALIVE) == 0;
+    if (!keep_alive)
+      {
+      int64_t wait = server_rate_take (self, conn);
+      if (wait && self->rate_policy == SERVER_RATE_DELAY)
+        {
+        // Leave the line to be run when the client has a token
+        conn->buff[end] = c;
+        conn->throttle_until = server_usec () + wait;
+        break;
+        }
+      if (wait)
+        asprintf (&response, "%d Too many requests\n", 
+          XINESERVER_ERR_RATELIMIT);
+      }
+    start = end < conn->len ? end + 1 : end;
 
     log_debug ("%s: Client said: %s", __PRETTY_FUNCTION__, 
-          string_cstr(buff));
-  
-    char *response;
-    cmdproc_do_cmd (self->cmdproc, string_cstr (buff), &response);
+      cmdproc_log_text (line));
+    CmdProcClass cls = CMDPROC_CLASS_FAST;
+    if (keep_alive)
+      conn->keep_alive = TRUE;
+    else
+      {
+      if (!response) cls = cmdproc_classify (line);
+      if (!conn->keep_alive) conn->finished = TRUE;
+      }
+    if ((response || cls == CMDPROC_CLASS_FAST 
+          || cls == CMDPROC_CLASS_SESSION) 
+        && !server_conn_is_scheduled (self, conn))
+      {
+      if (!response)
+        {
+        response = server_run_cmd (self, line, cls, &conn->session);
+        if (!keep_alive)
+          __atomic_fetch_add (&self->n_inline, 1, __ATOMIC_RELAXED);
+        }
+      ret = server_conn_write (conn, response) && !conn->finished;
+      free (response); 
+      }
+    else
+      server_queue_cmd (self, conn, line, cls, response);
+    // A shutdown should not wait for other clients' next requests
+    if (cmdproc_has_requested_shutdown (self->cmdproc)) ret = FALSE;
+    }
+  if (conn->finished) start = conn->len;
+  memmove (conn->buff, conn->buff + start, conn->len - start);
+  conn->len -= start;
+  return ret && (!conn->eof || conn->throttle_until != 0);
+  }
+
+/*==========================================================================
 
-    write (client_sock, response, strlen (response));
-    
-    free (response); 
-    string_destroy (buff);
+  server_conn_read
 
-    close (client_sock);
+  Returns FALSE when the connection should be closed
+
+==========================================================================*/
+static BOOL server_conn_read (Server *self, ServerConn *conn)
+  {
+  if (conn->size - conn->len < SERVER_READ_CHUNK)
+    {
+    conn->size = conn->len + SERVER_READ_CHUNK;
+    conn->buff = realloc (conn->buff, conn->size + 1);
     }
+  ssize_t n = recv (conn->sock, conn->buff + conn->len, SERVER_READ_CHUNK, 
+    MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) return TRUE;
+  if (n > 0) 
+    {
+    conn->len += n;
+    conn->last_active = time (NULL);
+    }
+  else
+    conn->eof = TRUE;
+  BOOL ret = server_conn_do_lines (self, conn);
+  // Whatever is left is the start of a line, unless the client is
+  //  being throttled
+  if (ret && conn->len > SERVER_MAX_LINE && !conn->throttle_until)
+    {
+    log_warning ("Closing client connection: request longer than %d bytes",
+      SERVER_MAX_LINE);
+    // A worker may be writing a response; this one would get mixed in
+    if (!server_conn_is_scheduled (self, conn))
+      {
+      char *response;
+      asprintf (&response, "%d Request too long\n", XINESERVER_ERR_SYNTAX);
+      server_conn_write (conn, response);
+      free (response);
+      }
+    ret = FALSE;
+    }
+  return ret;
+  }
+
+/*==========================================================================
+
+  server_accept
+
+  The listening sockets do not block: when several threads share one,
+  all of them are woken, but only one gets the connection
+
+==========================================================================*/
+static void server_accept (ServerIO *io, int listener)
+  {
+  int client_sock = accept4 (listener, NULL, NULL, SOCK_CLOEXEC);
+  if (client_sock < 0) return;
+  log_debug ("%s: Accepted client connection, socket=%d", 
+     __PRETTY_FUNCTION__, client_sock);
+  struct timeval tv = { SERVER_SEND_TIMEOUT_SEC, 0 };
+  setsockopt (client_sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+  int nodelay = 1;
+  // Fails harmlessly on Unix sockets
+  setsockopt (client_sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, 
+    sizeof (nodelay));
+  ServerConn *conn = malloc (sizeof (ServerConn));
+  memset (conn, 0, sizeof (ServerConn));
+  io->conns[io->nconns++] = conn;
+  conn->sock = client_sock;
+  conn->last_active = time (NULL);
+  if (io->server->rate > 0)
+    {
+    char name[INET6_ADDRSTRLEN + 16];
+    server_client_name (client_sock, name, sizeof (name));
+    if (name[0]) conn->rate = server_rate_acquire (io->server, name);
+    }
+  }
+
+/*==========================================================================
+
+  server_thread 
+
+  Clients may send any number of requests on one connection, if they
+  first send 'keep-alive'; otherwise the connection is closed after the
+  first response. A client that is slow to send its request, or whose
+  request is slow to run, does not hold up the rest
+
+==========================================================================*/
+static void *server_thread (void *arg)
+  {
+  LOG_IN
+  ServerIO *io = (ServerIO *)arg;
+  Server *self = io->server;
+  struct pollfd fds[SERVER_MAX_CONNECTIONS + SERVER_MAX_LISTENERS];
+  log_debug ("%s: server thread start", __PRETTY_FUNCTION__); 
+  while (!cmdproc_has_requested_shutdown (self->cmdproc))
+    {
+    int nfds = 0;
+    int timeout = SERVER_POLL_MSEC;
+    int64_t now_usec = server_usec ();
+    for (int i = 0; i < io->nconns; i++)
+      {
+      // A connection held back by its rate limit is not read until
+      //  the limit allows
+      ServerConn *conn = io->conns[i];
+      if (conn->throttle_until)
+        {
+        int64_t msec = (conn->throttle_until - now_usec + 999) / 1000;
+        if (msec < timeout) timeout = msec > 0 ? (int)msec : 0;
+        }
+      fds[nfds].fd = conn->throttle_until ? -1 : conn->sock;
+      fds[nfds].events = POLLIN;
+      fds[nfds].revents = 0;
+      nfds++;
+      }
+    // While the thread is full, new clients wait in the listen backlog,
+    //  or are taken by another thread
+    int nconns = io->nconns;
+    int nlisteners = nconns < SERVER_MAX_CONNECTIONS ? io->nlisteners : 0;
+    for (int i = 0; i < nlisteners; i++)
+      {
+      fds[nfds].fd = io->listeners[i];
+      fds[nfds].events = POLLIN;
+      fds[nfds].revents = 0;
+      nfds++;
+      }
+    int n = poll (fds, nfds, timeout);
+    if (n < 0 && errno != EINTR)
+      {
+      log_error ("Can't poll client sockets: %s", strerror (errno)); 
+      break;
+      }
+
+    time_t now = time (NULL);
+    for (int i = nconns - 1; i >= 0; i--)
+      {
+      ServerConn *conn = io->conns[i];
+      BOOL keep = TRUE;
+      if (conn->throttle_until)
+        {
+        if (server_usec () >= conn->throttle_until)
+          {
+          conn->throttle_until = 0;
+          keep = server_conn_do_lines (self, conn);
+          }
+        }
+      else if (n > 0 && fds[i].revents != 0)
+        keep = server_conn_read (self, conn);
+      else if (now - conn->last_active > SERVER_IDLE_SEC
+          && !server_conn_is_scheduled (self, conn))
+        keep = FALSE;
+      if (!keep)
+        { 
+        server_conn_drop (self, conn);
+        io->conns[i] = io->conns[--io->nconns];
+        } 
+      }
+    for (int i = 0; i < nlisteners && n > 0; i++)
+      {
+      if (fds[nconns + i].revents != 0
+          && io->nconns < SERVER_MAX_CONNECTIONS
+          && !cmdproc_has_requested_shutdown (self->cmdproc))
+        server_accept (io, io->listeners[i]);
+      }
+    }
+  for (int i = 0; i < io->nconns; i++)
+    server_conn_drop (self, io->conns[i]);
+  io->nconns = 0;
   log_debug ("%s: server thread finished", __PRETTY_FUNCTION__); 
-  self->is_running = FALSE;
   LOG_OUT
   return NULL;
   }
@@ -113,6 +973,9 @@ static void *server_thread (void *arg)
 
   server_start
 
+  Runs the first thread in the caller's thread, and returns when the
+  server shuts down
+
 ==========================================================================*/
 BOOL server_start (Server *self, char **error)
   {
@@ -123,76 +986,266 @@ BOOL server_start (Server *self, char **error)
   if (server_init (self, error))
     {
     log_debug ("%s: server init OK", __PRETTY_FUNCTION__);
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, 1);
-
-    /* The server thread is currently not run as a separate thread
-       but, for future expansion, it can be */
-
-    // Need to create in detached state, else memory
-    //  will never be freed because nothing calls
-    //  pthread_join() on the thread
-    /*
-    pthread_t p;
     self->is_running = TRUE;
-    pthread_create (&p, &attr, server_thread, self);
-    pthread_attr_destroy(&attr);
-    */
-    server_thread (self);
+    for (int i = 0; i < self->nworkers; i++)
+      pthread_create (&self->workers[i], NULL, server_worker, self);
+    for (int i = 1; i < self->nthreads; i++)
+      pthread_create (&self->io[i].thread, NULL, server_thread,
+        &self->io[i]);
+    server_thread (&self->io[0]);
+    for (int i = 1; i < self->nthreads; i++)
+      pthread_join (self->io[i].thread, NULL);
+
+    // Commands that have started are allowed to finish; those still
+    //  waiting are not run
+    pthread_mutex_lock (&self->queue_mutex);
+    self->stopping = TRUE;
+    pthread_cond_broadcast (&self->queue_cond);
+    pthread_mutex_unlock (&self->queue_mutex);
+    for (int i = 0; i < self->nworkers; i++)
+      pthread_join (self->workers[i], NULL);
+    while (self->run_head)
+      {
+      ServerConn *conn = self->run_head;
+      self->run_head = conn->next_run;
+      server_conn_close (self, conn);
+      }
+    self->run_tail = NULL;
+    self->is_running = FALSE;
     }
   else
     {
     log_debug ("%s: server init failed", __PRETTY_FUNCTION__);
     ret = FALSE;
     }
-  
+
   LOG_OUT
   return ret;
   }
 
 /*==========================================================================
 
-  server_init
+  server_listen_unix
 
 ==========================================================================*/
-BOOL server_init (Server *self, char **error)
+static BOOL server_listen_unix (Server *self, const char *path,
+       char **error)
   {
-  LOG_IN
-  BOOL ret = FALSE;
-  log_debug ("%s: server_init, port=%d", __PRETTY_FUNCTION__, self->port);
+  struct sockaddr_un addr;
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+    asprintf (error, "Socket path too long: %s", path);
+    return FALSE;
+    }
+  strcpy (addr.sun_path, path);
 
-  self->sock = socket (AF_INET, SOCK_STREAM, 0);  
+  // A socket left behind by a server that did not shut down cleanly
+  //  would stop the bind. Anything else at the path is left alone
+  struct stat sb;
+  if (lstat (path, &sb) == 0 && S_ISSOCK (sb.st_mode))
+    unlink (path);
 
-  if (self->sock >= 0)
+  ServerIO *io = &self->io[0];
+  if (io->nlisteners == SERVER_MAX_LISTENERS)
+    {
+    asprintf (error, "Too many listen addresses");
+    return FALSE;
+    }
+  int sock = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+    {
+    asprintf (error, "Can't create socket: %s", strerror (errno)); 
+    return FALSE;
+    }
+  if (bind (sock, (struct sockaddr *)&addr, sizeof (addr)) != 0)
+    {
+    asprintf (error, "Can't bind to %s: %s", path, strerror (errno));
+    close (sock);
+    return FALSE;
+    }
+  if (listen (sock, self->backlog) != 0)
     {
-    memset (&self->address, 0, sizeof (self->address));
-    self->address.sin_family = AF_INET;
-    self->address.sin_port = htons (self->port);
-    self->address.sin_addr.s_addr = inet_addr(self->host);
-    if (bind (self->sock, (struct sockaddr *)&self->address, 
-          sizeof (self->address)) == 0)
+    asprintf (error, "Can't listen on %s: %s", path, strerror (errno));
+    close (sock);
+    // The bind made the socket file, so it is ours to remove
+    unlink (path);
+    return FALSE;
+    }
+  // Only a path that is being listened on is removed at shutdown
+  list_append (self->unix_paths, strdup (path));
+  io->listeners[io->nlisteners++] = sock;
+  log_info ("Listening on %s", path);
+  return TRUE;
+  }
+
+/*==========================================================================
+
+  server_listen_tcp
+
+  Listen on every address that host:port resolves to, from each thread
+
+==========================================================================*/
+static BOOL server_listen_tcp (Server *self, const char *host,
+       const char *port, char **error)
+  {
+  struct addrinfo hints, *addrs;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+  int gai = getaddrinfo (host, port, &hints, &addrs);
+  if (gai != 0)
+    {
+    asprintf (error, "Can't resolve listen address %s: %s",
+      host ? host : "*", gai_strerror (gai));
+    return FALSE;
+    }
+
+  BOOL ret = TRUE;
+  for (struct addrinfo *ai = addrs; ai && ret; ai = ai->ai_next)
+    {
+    char name[INET6_ADDRSTRLEN];
+    void *a = ai->ai_family == AF_INET6
+      ? (void *)&((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr
+      : (void *)&((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+    inet_ntop (ai->ai_family, a, name, sizeof (name));
+    for (int t = 0; t < self->nthreads && ret; t++)
       {
-      if (listen(self->sock, 5) == 0) 
+      ServerIO *io = &self->io[t];
+      if (io->nlisteners == SERVER_MAX_LISTENERS)
+        { 
+        asprintf (error, "Too many listen addresses");
+        ret = FALSE;
+        break;
+        } 
+      int sock = socket (ai->ai_family,
+        ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+      if (sock < 0)
+        { 
+        asprintf (error, "Can't create socket: %s", strerror (errno));
+        ret = FALSE;
+        break;
+        } 
+      // Connections that the server has closed linger for a while, and
+      //  would otherwise stop it binding the port again if restarted
+      int on = 1;
+      setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+      if (self->nthreads > 1)
+        setsockopt (sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on));
+      // So that :: does not stop 0.0.0.0 being bound as well
+      if (ai->ai_family == AF_INET6)
+        setsockopt (sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof (on));
+      int defer = SERVER_DEFER_ACCEPT_SEC;
+      setsockopt (sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer,
+        sizeof (defer));
+      if (bind (sock, ai->ai_addr, ai->ai_addrlen) != 0)
         { 
-        ret = TRUE;
-        self->inited = TRUE;
+        asprintf (error, "Can't bind to %s port %s: %s", name, port,
+          strerror (errno));
+        close (sock);
+        ret = FALSE;
+        } 
+      else if (listen (sock, self->backlog) != 0)
+        { 
+        asprintf (error, "Can't listen on %s port %s: %s", name, port,
+          strerror (errno));
+        close (sock);
+        ret = FALSE;
         } 
       else
-        {
-        asprintf (error, "Can't listen to socket: %s", strerror (errno)); 
-        }
+        io->listeners[io->nlisteners++] = sock;
       }
-    else
+    if (ret) log_info ("Listening on %s port %s", name, port);
+    }
+  freeaddrinfo (addrs);
+  return ret;
+  }
+
+/*==========================================================================
+
+  server_listen_address
+
+  Addresses are host:port, [IPv6 address]:port, host, port, or
+  unix:path (or just a path). A missing host or port is taken from
+  --host or --port, and a host of * means all interfaces
+
+==========================================================================*/
+static BOOL server_listen_address (Server *self, const char *address,
+       char **error)
+  {
+  if (strncmp (address, "unix:", 5) == 0)
+    return server_listen_unix (self, address + 5, error);
+  if (address[0] == '/')
+    return server_listen_unix (self, address, error);
+
+  char *host = NULL;
+  char port[16];
+  snprintf (port, sizeof (port), "%d", self->port);
+  const char *colon = strrchr (address, ':');
+  if (address[0] == '[')
+    {
+    const char *close = strchr (address, ']');
+    if (!close || (close[1] != 0 && close[1] != ':'))
       {
-      asprintf (error, "Can't bind to socket: %s", strerror (errno)); 
+      asprintf (error, "Bad listen address: %s", address);
+      return FALSE;
       }
+    host = strndup (address + 1, close - address - 1);
+    if (close[1] == ':') snprintf (port, sizeof (port), "%s", close + 2);
+    }
+  else if (colon && strchr (address, ':') == colon)
+    {
+    host = strndup (address, colon - address);
+    snprintf (port, sizeof (port), "%s", colon + 1);
+    }
+  else if (address[0] && strspn (address, "0123456789") == strlen (address))
+    {
+    host = strdup (self->host);
+    snprintf (port, sizeof (port), "%s", address);
     }
   else
+    host = strdup (address); // Host only, or a bare IPv6 address
+
+  BOOL ret = server_listen_tcp (self,
+    strcmp (host, "*") == 0 || host[0] == 0 ? NULL : host, port, error);
+  free (host);
+  return ret;
+  }
+
+/*==========================================================================
+
+  server_init
+
+==========================================================================*/
+BOOL server_init (Server *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = TRUE;
+  log_debug ("%s: server_init, port=%d", __PRETTY_FUNCTION__, self->port);
+
+  self->io = malloc (self->nthreads * sizeof (ServerIO));
+  for (int i = 0; i < self->nthreads; i++)
     {
-    asprintf (error, "Can't create socket: %s", strerror (errno)); 
+    self->io[i].server = self;
+    self->io[i].nlisteners = 0;
+    self->io[i].nconns = 0;
     }
 
+  char *addresses = strdup (self->listen ? self->listen : self->host);
+  char *saveptr = NULL;
+  for (char *tok = strtok_r (addresses, ",", &saveptr); tok && ret;
+        tok = strtok_r (NULL, ",", &saveptr))
+    ret = server_listen_address (self, tok, error);
+  free (addresses);
+  if (ret && self->io[0].nlisteners == 0)
+    {
+    asprintf (error, "No listen addresses");
+    ret = FALSE;
+    }
+  self->inited = ret;
+
   LOG_OUT
   return ret;
   }
@@ -209,7 +1262,32 @@ void server_destroy (Server *self)
   log_debug ("%s: destroying server", __PRETTY_FUNCTION__);
   if (self)
     {
-    if (self->sock) close (self->sock);
+    if (self->io)
+      {
+      for (int i = 0; i < self->nthreads; i++)
+        for (int j = 0; j < self->io[i].nlisteners; j++)
+          close (self->io[i].listeners[j]);
+      free (self->io);
+      }
+    for (int i = 0; i < list_length (self->unix_paths); i++)
+      unlink (list_get (self->unix_paths, i));
+    list_destroy (self->unix_paths);
+    for (int i = 0; i < SERVER_RATE_BUCKETS; i++)
+      {
+      while (self->rates[i])
+        {
+        ServerRate *r = self->rates[i];
+        self->rates[i] = r->chain;
+        free (r->client);
+        free (r);
+        }
+      }
+    pthread_mutex_destroy (&self->rate_mutex);
+    pthread_mutex_destroy (&self->flight_mutex);
+    pthread_cond_destroy (&self->flight_cond);
+    pthread_mutex_destroy (&self->queue_mutex);
+    pthread_cond_destroy (&self->queue_cond);
+    if (self->listen) free (self->listen);
     if (self->host) free (self->host);
     free (self);
     }
@@ -217,6 +1295,35 @@ void server_destroy (Server *self)
   }
 
 
+/*==========================================================================
+
+  server_get_stats
+
+  Append counters to a 'stats' response
+
+==========================================================================*/
+void server_get_stats (Server *self, String *s)
+  {
+  int clients = 0;
+  pthread_mutex_lock (&self->rate_mutex);
+  for (int i = 0; i < SERVER_RATE_BUCKETS; i++)
+    for (ServerRate *r = self->rates[i]; r; r = r->chain)
+      clients++;
+  pthread_mutex_unlock (&self->rate_mutex);
+  string_append_printf (s, " server-commands=%llu server-inline=%llu"
+    " server-coalesced=%llu server-rate-limited=%llu"
+    " server-rate-clients=%d",
+    (unsigned long long)__atomic_load_n (&self->n_commands, 
+      __ATOMIC_RELAXED),
+    (unsigned long long)__atomic_load_n (&self->n_inline, 
+      __ATOMIC_RELAXED),
+    (unsigned long long)__atomic_load_n (&self->n_coalesced, 
+      __ATOMIC_RELAXED),
+    (unsigned long long)__atomic_load_n (&self->n_rate_limited, 
+      __ATOMIC_RELAXED),
+    clients);
+  }
+
 /*==========================================================================
 
   server_is_running
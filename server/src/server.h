@@ -10,17 +10,47 @@
 
 #include <stdint.h>
 #include "defs.h"
+#include "string.h"
 #include "cmdproc.h"
 
+// Default length of the queue of connections waiting to be accepted
+#define SERVER_DEF_BACKLOG 128
+
+// Most threads that can accept connections and read commands
+#define SERVER_MAX_THREADS 16
+
+// Threads that run commands, by default, and at most
+#define SERVER_DEF_WORKERS 2
+#define SERVER_MAX_WORKERS 16
+
+// What happens to a client's commands over its rate limit: they are
+//  not read until it allows, or they are refused with an error
+typedef enum
+  {
+  SERVER_RATE_DELAY = 0,
+  SERVER_RATE_REJECT
+  } ServerRatePolicy;
+
 struct _Server;
 typedef struct _Server Server;
 
 BEGIN_DECLS
 Server    *server_create (const char *host, int port, CmdProc *cmdproc);
 void       server_destroy (Server *self);
+// A comma-separated list of addresses to listen on, instead of host:port.
+//  The setters must be called before server_init()
+void       server_set_listen (Server *self, const char *addresses);
+void       server_set_backlog (Server *self, int backlog);
+void       server_set_threads (Server *self, int threads);
+void       server_set_workers (Server *self, int workers);
+void       server_set_rate_limit (Server *self, double rate, int burst,
+               ServerRatePolicy policy);
+BOOL       server_rate_policy_from_string (const char *s, 
+               ServerRatePolicy *policy);
 BOOL       server_init (Server *self, char **error);
 BOOL       server_start (Server *self, char **error);
 BOOL       server_is_running (const Server *self);
+void       server_get_stats (Server *self, String *s);
 END_DECLS
 
 
@@ -0,0 +1,383 @@
+/*==========================================================================
+
+  xine-server
+  shmstatus.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A POSIX shared memory segment that local clients can map, to read the
+  status and the playlist without connecting to the server. The layout
+  is XSShmHeader, defined in the API header, followed by the playlist
+  table.
+
+  A thread writes the segment every SHMSTATUS_INTERVAL_MSEC, or sooner
+  if poked, by calling back to the command processor. The playlist is
+  only written when its version changes. The status and the playlist
+  each have a sequence count (a 'seqlock'), which is made odd before
+  writing and even afterwards, so that readers can take a consistent
+  copy without any locking, and without the server ever waiting for a
+  reader. The segment is read-only to other users.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "shmstatus.h"
+
+// The playlist table starts on a page boundary after the header
+#define SHMSTATUS_TABLE_ALIGN 4096
+
+struct _ShmStatus
+  {
+  char *name;
+  int64_t playlist_size;
+  XSShmHeader *header;
+  size_t size;
+  ShmStatusFn fn;
+  void *data;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+  BOOL thread_running;
+  BOOL stop;
+  BOOL poked;
+  // Statistics
+  int status_writes;
+  int playlist_writes;
+  int64_t playlist_usec;
+  };
+
+
+/*==========================================================================
+
+  shmstatus_usec
+
+==========================================================================*/
+static int64_t shmstatus_usec (clockid_t clock)
+  {
+  struct timespec ts;
+  clock_gettime (clock, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+
+/*==========================================================================
+
+  shmstatus_create
+
+==========================================================================*/
+ShmStatus *shmstatus_create (const char *name, int64_t playlist_size)
+  {
+  LOG_IN
+  ShmStatus *self = malloc (sizeof (ShmStatus));
+  memset (self, 0, sizeof (ShmStatus));
+  asprintf (&self->name, "%s%s", name[0] == '/' ? "" : "/", name);
+  self->playlist_size = playlist_size;
+  pthread_mutex_init (&self->mutex, NULL);
+  pthread_cond_init (&self->cond, NULL);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  shmstatus_begin_write
+
+  Make a sequence count odd, so readers know to wait
+
+==========================================================================*/
+static void shmstatus_begin_write (uint32_t *seq)
+  {
+  __atomic_store_n (seq, *seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  }
+
+
+/*==========================================================================
+
+  shmstatus_end_write
+
+==========================================================================*/
+static void shmstatus_end_write (uint32_t *seq)
+  {
+  __atomic_store_n (seq, *seq + 1, __ATOMIC_RELEASE);
+  }
+
+
+/*==========================================================================
+
+  shmstatus_destroy
+
+==========================================================================*/
+void shmstatus_destroy (ShmStatus *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    pthread_mutex_lock (&self->mutex);
+    self->stop = TRUE;
+    pthread_cond_signal (&self->cond);
+    pthread_mutex_unlock (&self->mutex);
+    if (self->thread_running)
+      pthread_join (self->thread, NULL);
+
+    if (self->header)
+      {
+      // Clients that still have the segment mapped will see that
+      //  it is no longer being updated
+      shmstatus_begin_write (&self->header->status_seq);
+      shmstatus_begin_write (&self->header->playlist_seq);
+      self->header->magic = 0;
+      self->header->transport_status = XINESERVER_TRANSPORT_STOPPED;
+      shmstatus_end_write (&self->header->playlist_seq);
+      shmstatus_end_write (&self->header->status_seq);
+      munmap (self->header, self->size);
+      shm_unlink (self->name);
+      }
+    free (self->name);
+    pthread_mutex_destroy (&self->mutex);
+    pthread_cond_destroy (&self->cond);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  shmstatus_set_source_fn
+
+==========================================================================*/
+void shmstatus_set_source_fn (ShmStatus *self, ShmStatusFn fn, void *data)
+  {
+  pthread_mutex_lock (&self->mutex);
+  self->fn = fn;
+  self->data = data;
+  self->poked = TRUE;
+  pthread_cond_signal (&self->cond);
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  shmstatus_poke
+
+==========================================================================*/
+void shmstatus_poke (ShmStatus *self)
+  {
+  pthread_mutex_lock (&self->mutex);
+  self->poked = TRUE;
+  pthread_cond_signal (&self->cond);
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  shmstatus_write_status
+
+==========================================================================*/
+void shmstatus_write_status (ShmStatus *self, const ShmStatusInfo *info)
+  {
+  XSShmHeader *h = self->header;
+  shmstatus_begin_write (&h->status_seq);
+  h->transport_status = info->transport_status;
+  h->position = info->position;
+  h->length = info->length;
+  h->playlist_index = info->playlist_index;
+  h->playlist_length = info->playlist_length;
+  h->shuffle = info->shuffle;
+  h->repeat = info->repeat;
+  h->updated = shmstatus_usec (CLOCK_REALTIME);
+  strncpy (h->stream, info->stream, XINESERVER_SHM_STREAM_MAX - 1);
+  h->stream[XINESERVER_SHM_STREAM_MAX - 1] = 0;
+  shmstatus_end_write (&h->status_seq);
+  pthread_mutex_lock (&self->mutex);
+  self->status_writes++;
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  shmstatus_get_playlist_version
+
+==========================================================================*/
+int64_t shmstatus_get_playlist_version (const ShmStatus *self)
+  {
+  return self->header->playlist_version;
+  }
+
+
+/*==========================================================================
+
+  shmstatus_write_playlist
+
+==========================================================================*/
+void shmstatus_write_playlist (ShmStatus *self, int64_t version,
+      const char *const *entries, int count)
+  {
+  XSShmHeader *h = self->header;
+  int64_t t0 = shmstatus_usec (CLOCK_MONOTONIC);
+  uint64_t needed = (uint64_t)count * sizeof (uint32_t);
+  for (int i = 0; i < count; i++)
+    needed += strlen (entries[i]) + 1;
+
+  shmstatus_begin_write (&h->playlist_seq);
+  h->playlist_version = version;
+  if (needed <= h->playlist_size)
+    {
+    char *table = (char *)h + h->playlist_offset;
+    uint32_t *offsets = (uint32_t *)table;
+    uint32_t o = count * sizeof (uint32_t);
+    for (int i = 0; i < count; i++)
+      {
+      size_t l = strlen (entries[i]) + 1;
+      offsets[i] = o;
+      memcpy (table + o, entries[i], l);
+      o += l;
+      }
+    h->playlist_count = count;
+    }
+  else
+    h->playlist_count = -1;
+  shmstatus_end_write (&h->playlist_seq);
+
+  if (h->playlist_count < 0)
+    log_warning ("Playlist of %d items is too large for shared memory",
+      count);
+  pthread_mutex_lock (&self->mutex);
+  self->playlist_writes++;
+  self->playlist_usec += shmstatus_usec (CLOCK_MONOTONIC) - t0;
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  shmstatus_thread
+
+==========================================================================*/
+static void *shmstatus_thread (void *arg)
+  {
+  LOG_IN
+  ShmStatus *self = (ShmStatus *)arg;
+  pthread_mutex_lock (&self->mutex);
+  while (!self->stop)
+    {
+    if (!self->poked)
+      {
+      struct timespec ts;
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_sec += SHMSTATUS_INTERVAL_MSEC / 1000;
+      ts.tv_nsec += (SHMSTATUS_INTERVAL_MSEC % 1000) * 1000000L;
+      if (ts.tv_nsec >= 1000000000L)
+        {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+        }
+      pthread_cond_timedwait (&self->cond, &self->mutex, &ts);
+      if (self->stop) break;
+      }
+    self->poked = FALSE;
+    ShmStatusFn fn = self->fn;
+    void *data = self->data;
+    pthread_mutex_unlock (&self->mutex);
+
+    if (fn) fn (data, self);
+
+    pthread_mutex_lock (&self->mutex);
+    }
+  pthread_mutex_unlock (&self->mutex);
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  shmstatus_start
+
+==========================================================================*/
+BOOL shmstatus_start (ShmStatus *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  size_t offset = (sizeof (XSShmHeader) + SHMSTATUS_TABLE_ALIGN - 1)
+    / SHMSTATUS_TABLE_ALIGN * SHMSTATUS_TABLE_ALIGN;
+  size_t size = offset + self->playlist_size;
+
+  // A segment left by a server that did not shut down cleanly might
+  //  still be mapped by clients; they will keep the old one
+  shm_unlink (self->name);
+  int fd = shm_open (self->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd >= 0)
+    {
+    void *p = MAP_FAILED;
+    if (ftruncate (fd, size) == 0)
+      p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED)
+      {
+      XSShmHeader *h = p;
+      h->header_size = sizeof (XSShmHeader);
+      h->size = size;
+      h->playlist_offset = offset;
+      h->playlist_size = self->playlist_size;
+      h->transport_status = XINESERVER_TRANSPORT_STOPPED;
+      h->playlist_index = -1;
+      strcpy (h->stream, "-");
+      __atomic_store_n (&h->magic, XINESERVER_SHM_MAGIC, __ATOMIC_RELEASE);
+      self->header = h;
+      self->size = size;
+      self->thread_running = TRUE;
+      pthread_create (&self->thread, NULL, shmstatus_thread, self);
+      log_info ("Serving status in shared memory %s", self->name);
+      ret = TRUE;
+      }
+    else
+      {
+      if (error) asprintf (error, "Can't map %s: %s", self->name,
+        strerror (errno));
+      shm_unlink (self->name);
+      }
+    close (fd);
+    }
+  else
+    {
+    if (error) asprintf (error, "Can't create %s: %s", self->name,
+      strerror (errno));
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  shmstatus_get_stats
+
+==========================================================================*/
+void shmstatus_get_stats (ShmStatus *self, String *s)
+  {
+  pthread_mutex_lock (&self->mutex);
+  string_append_printf (s, " shm-status-writes=%d shm-playlist-writes=%d"
+    " shm-playlist-us=%d", self->status_writes, self->playlist_writes,
+    self->playlist_writes
+      ? (int)(self->playlist_usec / self->playlist_writes) : 0);
+  pthread_mutex_unlock (&self->mutex);
+  }
+
@@ -0,0 +1,64 @@
+/*============================================================================
+
+  xine-server
+  shmstatus.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+#include "string.h"
+#include "../../api/xine-server-api.h"
+
+struct _ShmStatus;
+typedef struct _ShmStatus ShmStatus;
+
+// Room for the playlist table, in bytes. The segment is sparse, so
+//  memory is only used for as much of this as the playlist needs
+#define SHMSTATUS_DEF_PLAYLIST_SIZE (64 * 1024 * 1024)
+
+// How often the status is written, if nothing prompts it sooner
+#define SHMSTATUS_INTERVAL_MSEC 100
+
+typedef struct _ShmStatusInfo
+  {
+  XSTransportStatus transport_status;
+  int position;
+  int length;
+  int playlist_index;
+  int playlist_length;
+  BOOL shuffle;
+  XSRepeatMode repeat;
+  const char *stream;
+  } ShmStatusInfo;
+
+// Called on the writer thread, which should respond by calling
+//  shmstatus_write_status() and, if the playlist has changed since
+//  shmstatus_get_playlist_version(), shmstatus_write_playlist()
+typedef void (*ShmStatusFn)(void *data, ShmStatus *shm);
+
+BEGIN_DECLS
+
+ShmStatus    *shmstatus_create (const char *name, int64_t playlist_size);
+void          shmstatus_destroy (ShmStatus *self);
+BOOL          shmstatus_start (ShmStatus *self, char **error);
+void          shmstatus_set_source_fn (ShmStatus *self, ShmStatusFn fn,
+                 void *data);
+
+// Ask the writer thread to update the segment now, rather than at
+//  the next interval. Does not block
+void          shmstatus_poke (ShmStatus *self);
+
+void          shmstatus_write_status (ShmStatus *self,
+                 const ShmStatusInfo *info);
+int64_t       shmstatus_get_playlist_version (const ShmStatus *self);
+void          shmstatus_write_playlist (ShmStatus *self, int64_t version,
+                 const char *const *entries, int count);
+
+void          shmstatus_get_stats (ShmStatus *self, String *s);
+
+END_DECLS
+
@@ -0,0 +1,130 @@
+/*==========================================================================
+
+  xine-server
+  shuffle.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Shuffled playlist order, without storing it.
+
+  A Feistel network -- a few rounds of mixing one half of a number
+  with a hash of the other half -- is a permutation of all the numbers
+  of a given bit width, whatever hash is used, and is easily inverted.
+  The width is the smallest even number of bits that covers the
+  playlist, so it is less than four times the playlist length. Numbers
+  that fall outside the playlist are put through the network again
+  until they fall inside ("cycle walking"), which keeps it a
+  permutation, and takes fewer than four steps on average.
+
+==========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "feature.h"
+#include "defs.h"
+#include "shuffle.h"
+
+#define SHUFFLE_ROUNDS 4
+
+
+/*==========================================================================
+
+  shuffle_half_bits
+
+  The number of bits in each half of the Feistel network for n items
+
+==========================================================================*/
+static int shuffle_half_bits (uint32_t n)
+  {
+  int k = 1;
+  while (k < 16 && ((uint64_t)1 << (2 * k)) < n) k++;
+  return k;
+  }
+
+
+/*==========================================================================
+
+  shuffle_hash
+
+==========================================================================*/
+static uint32_t shuffle_hash (uint32_t seed, int round, uint32_t x)
+  {
+  uint32_t h = x * 0x9E3779B1u ^ (seed + round * 0x85EBCA6Bu);
+  h ^= h >> 15;
+  h *= 0x2C1B3C6Du;
+  h ^= h >> 12;
+  h *= 0x297A2D39u;
+  h ^= h >> 15;
+  return h;
+  }
+
+
+/*==========================================================================
+
+  shuffle_encrypt
+
+==========================================================================*/
+static uint32_t shuffle_encrypt (uint32_t seed, int k, uint32_t x)
+  {
+  uint32_t mask = ((uint32_t)1 << k) - 1;
+  uint32_t l = x >> k, r = x & mask;
+  for (int round = 0; round < SHUFFLE_ROUNDS; round++)
+    {
+    uint32_t t = r;
+    r = l ^ (shuffle_hash (seed, round, r) & mask);
+    l = t;
+    }
+  return (l << k) | r;
+  }
+
+
+/*==========================================================================
+
+  shuffle_decrypt
+
+==========================================================================*/
+static uint32_t shuffle_decrypt (uint32_t seed, int k, uint32_t x)
+  {
+  uint32_t mask = ((uint32_t)1 << k) - 1;
+  uint32_t l = x >> k, r = x & mask;
+  for (int round = SHUFFLE_ROUNDS - 1; round >= 0; round--)
+    {
+    uint32_t t = l;
+    l = r ^ (shuffle_hash (seed, round, l) & mask);
+    r = t;
+    }
+  return (l << k) | r;
+  }
+
+
+/*==========================================================================
+
+  shuffle_map
+
+==========================================================================*/
+uint32_t shuffle_map (uint32_t seed, uint32_t n, uint32_t i)
+  {
+  int k = shuffle_half_bits (n);
+  uint32_t x = i;
+  do
+    x = shuffle_encrypt (seed, k, x);
+  while (x >= n);
+  return x;
+  }
+
+
+/*==========================================================================
+
+  shuffle_unmap
+
+==========================================================================*/
+uint32_t shuffle_unmap (uint32_t seed, uint32_t n, uint32_t i)
+  {
+  int k = shuffle_half_bits (n);
+  uint32_t x = i;
+  do
+    x = shuffle_decrypt (seed, k, x);
+  while (x >= n);
+  return x;
+  }
+
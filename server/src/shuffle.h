@@ -0,0 +1,24 @@
+/*============================================================================
+
+  xine-server
+  shuffle.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+
+BEGIN_DECLS
+
+// A pseudo-random permutation of 0..n-1, chosen by 'seed'.
+//  shuffle_map() gives the item at position i of the shuffled order,
+//  and shuffle_unmap() the position of item i. Both take constant
+//  time, on average, and no storage, however large n is
+uint32_t shuffle_map (uint32_t seed, uint32_t n, uint32_t i);
+uint32_t shuffle_unmap (uint32_t seed, uint32_t n, uint32_t i);
+
+END_DECLS
+
@@ -0,0 +1,929 @@
+/*==========================================================================
+
+  xine-server
+  statefile.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Persistent playlist and transport state. Changes are recorded as
+  one-line records, appended to a journal by a background thread, so
+  that the command processor never waits for the disk. The writer
+  keeps its own copy of the state, built by applying the same records,
+  and from time to time writes it out in full as a snapshot (in the
+  same record format), after which the journal starts afresh.
+
+  Records are:
+    G gen     -- generation; the journal applies only to the snapshot
+                   of the same generation
+    A mrl     -- playlist entry added (\ and newline escaped)
+    N pos mrl -- playlist entry inserted at a position
+    R first count     -- playlist entries removed
+    M first count dest -- playlist entries moved
+    C         -- playlist cleared
+    I index   -- playlist index
+    P msec    -- playback position
+    V volume
+    E b1...b10
+
+  The snapshot is replaced by renaming a new file over it, and the new
+  snapshot has a higher generation than the old journal. So a crash at
+  any point leaves either the old snapshot and its journal, or the new
+  snapshot and a journal that will be ignored, or a journal with a
+  partial last line, which is discarded.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "statefile.h"
+
+// How often the writer thread checks the playback position
+#define STATEFILE_POLL_MSEC 1000
+
+// The journal is compacted into a snapshot when it has more records
+//  than this, and more records than there are playlist entries. So
+//  the cost of compaction is proportional to the number of changes
+#define STATEFILE_COMPACT_MIN 4096
+
+struct _StateFile
+  {
+  char *path;
+  char *journal_path;
+  pthread_t thread;
+  BOOL thread_running;
+  // mutex and cond protect the pending records and the stop flag
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  char *pending;
+  size_t pending_len;
+  size_t pending_size;
+  BOOL stop;
+  StateFileTransportFn transport_fn;
+  void *transport_data;
+  // The persisted state. After statefile_start(), this belongs to the
+  //   writer thread
+  char **entries;
+  int n_entries;
+  int max_entries;
+  int index;
+  int position;
+  int volume;
+  int eq[10];
+  BOOL have_eq;
+  int generation;
+  // Journal, open for appending, and the number of records in it
+  FILE *journal;
+  int journal_records;
+  // Statistics. journal_records and compactions are read by other 
+  //   threads, so the writer thread changes them atomically
+  int load_usec;
+  int loaded_entries;
+  int compactions;
+  };
+
+
+/*==========================================================================
+
+  statefile_usec
+
+==========================================================================*/
+static int64_t statefile_usec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+
+/*==========================================================================
+
+  statefile_create
+
+==========================================================================*/
+StateFile *statefile_create (const char *path)
+  {
+  LOG_IN
+  StateFile *self = malloc (sizeof (StateFile));
+  memset (self, 0, sizeof (StateFile));
+  self->path = strdup (path);
+  asprintf (&self->journal_path, "%s.journal", path);
+  pthread_mutex_init (&self->mutex, NULL);
+  pthread_cond_init (&self->cond, NULL);
+  self->index = -1;
+  self->volume = -1;
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  statefile_clear_entries
+
+==========================================================================*/
+static void statefile_clear_entries (StateFile *self)
+  {
+  for (int i = 0; i < self->n_entries; i++)
+    free (self->entries[i]);
+  self->n_entries = 0;
+  }
+
+
+/*==========================================================================
+
+  statefile_insert_entry
+
+  Insert an entry, unescaping its MRL
+
+==========================================================================*/
+static void statefile_insert_entry (StateFile *self, int pos, 
+      const char *arg)
+  {
+  if (pos < 0 || pos > self->n_entries) return;
+  if (self->n_entries == self->max_entries)
+    {
+    self->max_entries = self->max_entries ? self->max_entries * 2 : 256;
+    self->entries = realloc (self->entries,
+      self->max_entries * sizeof (char *));
+    }
+  char *mrl = malloc (strlen (arg) + 1);
+  char *p = mrl;
+  for (const char *q = arg; *q; q++)
+    {
+    if (*q == '\\' && q[1])
+      {
+      q++;
+      *p++ = (*q == 'n') ? '\n' : *q;
+      }
+    else
+      *p++ = *q;
+    }
+  *p = 0;
+  memmove (self->entries + pos + 1, self->entries + pos, 
+    (self->n_entries - pos) * sizeof (char *));
+  self->entries[pos] = mrl;
+  self->n_entries++;
+  }
+
+
+/*==========================================================================
+
+  statefile_remove_entries
+
+==========================================================================*/
+static void statefile_remove_entries (StateFile *self, int first, int count)
+  {
+  if (first < 0 || count < 0 || first + count > self->n_entries) return;
+  for (int i = first; i < first + count; i++)
+    free (self->entries[i]);
+  memmove (self->entries + first, self->entries + first + count, 
+    (self->n_entries - first - count) * sizeof (char *));
+  self->n_entries -= count;
+  }
+
+
+/*==========================================================================
+
+  statefile_move_entries
+
+==========================================================================*/
+static void statefile_move_entries (StateFile *self, int first, int count,
+      int dest)
+  {
+  if (first < 0 || count < 0 || first + count > self->n_entries 
+       || dest < 0 || dest + count > self->n_entries) return;
+  char **moved = malloc (count * sizeof (char *));
+  memcpy (moved, self->entries + first, count * sizeof (char *));
+  memmove (self->entries + first, self->entries + first + count, 
+    (self->n_entries - first - count) * sizeof (char *));
+  memmove (self->entries + dest + count, self->entries + dest, 
+    (self->n_entries - count - dest) * sizeof (char *));
+  memcpy (self->entries + dest, moved, count * sizeof (char *));
+  free (moved);
+  }
+
+
+/*==========================================================================
+
+  statefile_index_after_move
+
+  Where the item at 'index' ends up when 'count' items from 'first'
+  are moved to 'dest'; the same calculation the command processor
+  makes for the playing item
+
+==========================================================================*/
+static int statefile_index_after_move (int index, int first, int count, 
+      int dest)
+  {
+  if (index < 0) return index;
+  if (index >= first && index < first + count) 
+    return dest + index - first;
+  if (index >= first + count) index -= count;
+  if (index >= dest) index += count;
+  return index;
+  }
+
+
+/*==========================================================================
+
+  statefile_apply
+
+  Apply one record (without its line terminator) to the in-memory
+  state. Unrecognized records are ignored.
+
+==========================================================================*/
+static void statefile_apply (StateFile *self, const char *rec)
+  {
+  const char *arg = rec[0] && rec[1] == ' ' ? rec + 2 : "";
+  switch (rec[0])
+    {
+    case 'A':
+      statefile_insert_entry (self, self->n_entries, arg);
+      break;
+    case 'N':
+      {
+      char *mrl;
+      int pos = strtol (arg, &mrl, 10);
+      if (*mrl == ' ' && pos >= 0 && pos <= self->n_entries)
+        {
+        statefile_insert_entry (self, pos, mrl + 1);
+        if (self->index >= pos) self->index++;
+        }
+      }
+      break;
+    case 'R':
+      {
+      char *end;
+      int first = strtol (arg, &end, 10);
+      int count = strtol (end, &end, 10);
+      if (first < 0 || count < 0 || first + count > self->n_entries) break;
+      statefile_remove_entries (self, first, count);
+      if (self->index >= first + count)
+        self->index -= count;
+      else if (self->index >= first)
+        {
+        // The current item went; the server plays on from the same
+        //  slot, if there is one, and a later I record will say so
+        self->index = first < self->n_entries ? first : -1;
+        self->position = 0;
+        }
+      }
+      break;
+    case 'M':
+      {
+      char *end;
+      int first = strtol (arg, &end, 10);
+      int count = strtol (end, &end, 10);
+      int dest = strtol (end, &end, 10);
+      if (first < 0 || count < 0 || first + count > self->n_entries 
+           || dest < 0 || dest + count > self->n_entries) break;
+      statefile_move_entries (self, first, count, dest);
+      self->index = statefile_index_after_move (self->index, first, count,
+        dest);
+      }
+      break;
+    case 'C':
+      statefile_clear_entries (self);
+      self->index = -1;
+      self->position = 0;
+      break;
+    case 'I':
+      self->index = atoi (arg);
+      break;
+    case 'P':
+      self->position = atoi (arg);
+      break;
+    case 'V':
+      self->volume = atoi (arg);
+      break;
+    case 'E':
+      {
+      char *end = (char *)arg;
+      for (int i = 0; i < 10; i++)
+        self->eq[i] = strtol (end, &end, 10);
+      self->have_eq = TRUE;
+      }
+      break;
+    case 'G':
+      self->generation = atoi (arg);
+      break;
+    }
+  }
+
+
+/*==========================================================================
+
+  statefile_apply_buffer
+
+  Apply the complete records in a buffer, which is modified. A final
+  record with no line terminator is incomplete, and is ignored.
+  Returns the number of records applied. If 'generation' is not
+  negative, the buffer must start with a G record with that
+  generation, or nothing is applied
+
+==========================================================================*/
+static int statefile_apply_buffer (StateFile *self, char *buf, size_t len,
+      int generation)
+  {
+  int count = 0;
+  char *p = buf;
+  char *end = buf + len;
+  if (generation >= 0)
+    {
+    if (len < 2 || buf[0] != 'G' || atoi (buf + 1) != generation)
+      return 0;
+    }
+  while (p < end)
+    {
+    char *nl = memchr (p, '\n', end - p);
+    if (!nl) break;
+    *nl = 0;
+    if (p[0] == 'G')
+      statefile_apply (self, p);
+    else if (p[0] != '#')
+      {
+      statefile_apply (self, p);
+      count++;
+      }
+    p = nl + 1;
+    }
+  return count;
+  }
+
+
+/*==========================================================================
+
+  statefile_read_file
+
+  Read a whole file into memory. Returns NULL if it does not exist or
+  can't be read.
+
+==========================================================================*/
+static char *statefile_read_file (const char *path, size_t *len)
+  {
+  char *ret = NULL;
+  FILE *f = fopen (path, "r");
+  if (f)
+    {
+    fseek (f, 0, SEEK_END);
+    long size = ftell (f);
+    fseek (f, 0, SEEK_SET);
+    if (size >= 0)
+      {
+      ret = malloc (size + 1);
+      *len = fread (ret, 1, size, f);
+      ret[*len] = 0;
+      }
+    fclose (f);
+    }
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  statefile_load
+
+==========================================================================*/
+void statefile_load (StateFile *self)
+  {
+  LOG_IN
+  int64_t t0 = statefile_usec ();
+  size_t len;
+  char *buf = statefile_read_file (self->path, &len);
+  if (buf)
+    {
+    statefile_apply_buffer (self, buf, len, -1);
+    free (buf);
+    buf = statefile_read_file (self->journal_path, &len);
+    if (buf)
+      {
+      int n = statefile_apply_buffer (self, buf, len, self->generation);
+      log_debug ("%s: applied %d journal records", __PRETTY_FUNCTION__, n);
+      free (buf);
+      }
+    }
+  else if (errno != ENOENT)
+    {
+    log_warning ("Can't read state file %s: %s", self->path,
+      strerror (errno));
+    }
+  self->load_usec = (int)(statefile_usec () - t0);
+  self->loaded_entries = self->n_entries;
+  log_info ("Loaded %d playlist entries from %s in %d msec",
+    self->n_entries, self->path, self->load_usec / 1000);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  statefile_open_journal
+
+  Start a new, empty journal for the current generation
+
+==========================================================================*/
+static BOOL statefile_open_journal (StateFile *self, char **error)
+  {
+  BOOL ret = FALSE;
+  if (self->journal) fclose (self->journal);
+  self->journal = fopen (self->journal_path, "w");
+  if (self->journal)
+    {
+    fprintf (self->journal, "G %d\n", self->generation);
+    fflush (self->journal);
+    __atomic_store_n (&self->journal_records, 0, __ATOMIC_RELAXED);
+    ret = TRUE;
+    }
+  else
+    {
+    if (error)
+      asprintf (error, "Can't write %s: %s", self->journal_path,
+        strerror (errno));
+    }
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  statefile_write_escaped
+
+==========================================================================*/
+static void statefile_write_escaped (FILE *f, const char *s)
+  {
+  for (; *s; s++)
+    {
+    if (*s == '\\') fputs ("\\\\", f);
+    else if (*s == '\n') fputs ("\\n", f);
+    else fputc (*s, f);
+    }
+  }
+
+
+/*==========================================================================
+
+  statefile_compact
+
+  Write the whole state as a new snapshot of the next generation, and
+  start a new journal
+
+==========================================================================*/
+static BOOL statefile_compact (StateFile *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  int64_t t0 = statefile_usec ();
+  char *tmp;
+  asprintf (&tmp, "%s.tmp", self->path);
+  FILE *f = fopen (tmp, "w");
+  if (f)
+    {
+    fprintf (f, "# xine-server state\n");
+    fprintf (f, "G %d\n", self->generation + 1);
+    if (self->volume >= 0)
+      fprintf (f, "V %d\n", self->volume);
+    if (self->have_eq)
+      {
+      fprintf (f, "E");
+      for (int i = 0; i < 10; i++)
+        fprintf (f, " %d", self->eq[i]);
+      fprintf (f, "\n");
+      }
+    for (int i = 0; i < self->n_entries; i++)
+      {
+      fputs ("A ", f);
+      statefile_write_escaped (f, self->entries[i]);
+      fputc ('\n', f);
+      }
+    fprintf (f, "I %d\n", self->index);
+    fprintf (f, "P %d\n", self->position);
+    BOOL ok = (fflush (f) == 0 && fdatasync (fileno (f)) == 0);
+    fclose (f);
+    if (ok && rename (tmp, self->path) == 0)
+      {
+      self->generation++;
+      __atomic_add_fetch (&self->compactions, 1, __ATOMIC_RELAXED);
+      ret = statefile_open_journal (self, error);
+      log_debug ("%s: wrote %d entries in %d msec", __PRETTY_FUNCTION__,
+        self->n_entries, (int)((statefile_usec () - t0) / 1000));
+      }
+    else
+      {
+      if (error)
+        asprintf (error, "Can't write %s: %s", self->path, strerror (errno));
+      unlink (tmp);
+      }
+    }
+  else
+    {
+    if (error)
+      asprintf (error, "Can't write %s: %s", tmp, strerror (errno));
+    }
+  free (tmp);
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  statefile_write_records
+
+  Append complete records to the journal, and apply them. The buffer is
+  modified
+
+==========================================================================*/
+static void statefile_write_records (StateFile *self, char *buf, size_t len)
+  {
+  if (self->journal)
+    {
+    fwrite (buf, 1, len, self->journal);
+    fflush (self->journal);
+    }
+  __atomic_add_fetch (&self->journal_records, 
+    statefile_apply_buffer (self, buf, len, -1), __ATOMIC_RELAXED);
+  }
+
+
+/*==========================================================================
+
+  statefile_poll_transport
+
+==========================================================================*/
+static void statefile_poll_transport (StateFile *self)
+  {
+  if (self->transport_fn)
+    {
+    int index = -1, msec = 0;
+    self->transport_fn (self->transport_data, &index, &msec);
+    if (index != self->index || msec / 1000 != self->position / 1000)
+      {
+      char *rec;
+      asprintf (&rec, "I %d\nP %d\n", index, msec);
+      statefile_write_records (self, rec, strlen (rec));
+      free (rec);
+      }
+    }
+  }
+
+
+/*==========================================================================
+
+  statefile_thread
+
+==========================================================================*/
+static void *statefile_thread (void *arg)
+  {
+  LOG_IN
+  StateFile *self = (StateFile *)arg;
+  int64_t last_poll = 0;
+  BOOL stop = FALSE;
+  while (!stop)
+    {
+    pthread_mutex_lock (&self->mutex);
+    if (!self->stop && self->pending_len == 0)
+      {
+      struct timespec ts;
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_sec += STATEFILE_POLL_MSEC / 1000;
+      ts.tv_nsec += (STATEFILE_POLL_MSEC % 1000) * 1000000L;
+      if (ts.tv_nsec >= 1000000000L)
+        {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+        }
+      pthread_cond_timedwait (&self->cond, &self->mutex, &ts);
+      }
+    char *buf = self->pending;
+    size_t len = self->pending_len;
+    self->pending = NULL;
+    self->pending_len = 0;
+    self->pending_size = 0;
+    stop = self->stop;
+    pthread_mutex_unlock (&self->mutex);
+
+    if (buf)
+      {
+      statefile_write_records (self, buf, len);
+      free (buf);
+      }
+
+    int64_t now = statefile_usec ();
+    if (stop || now - last_poll >= STATEFILE_POLL_MSEC * 1000)
+      {
+      statefile_poll_transport (self);
+      last_poll = now;
+      }
+
+    if (stop || (self->journal_records > STATEFILE_COMPACT_MIN
+         && self->journal_records > self->n_entries))
+      {
+      char *error = NULL;
+      if (!statefile_compact (self, &error))
+        {
+        log_warning ("Can't save state: %s", error);
+        free (error);
+        }
+      }
+    }
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  statefile_start
+
+  Write a fresh snapshot of whatever was loaded -- this discards any
+  partial record at the end of the old journal -- and start the writer
+  thread
+
+==========================================================================*/
+BOOL statefile_start (StateFile *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = statefile_compact (self, error);
+  if (ret)
+    {
+    self->thread_running = TRUE;
+    pthread_create (&self->thread, NULL, statefile_thread, self);
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  statefile_set_transport_fn
+
+==========================================================================*/
+void statefile_set_transport_fn (StateFile *self,
+       StateFileTransportFn fn, void *data)
+  {
+  self->transport_fn = fn;
+  self->transport_data = data;
+  }
+
+
+/*==========================================================================
+
+  statefile_destroy
+
+  Stopping the writer thread writes a final snapshot, including the
+  current playback position
+
+==========================================================================*/
+void statefile_destroy (StateFile *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    if (self->thread_running)
+      {
+      pthread_mutex_lock (&self->mutex);
+      self->stop = TRUE;
+      pthread_cond_signal (&self->cond);
+      pthread_mutex_unlock (&self->mutex);
+      pthread_join (self->thread, NULL);
+      }
+    if (self->journal) fclose (self->journal);
+    statefile_clear_entries (self);
+    if (self->entries) free (self->entries);
+    if (self->pending) free (self->pending);
+    free (self->path);
+    free (self->journal_path);
+    pthread_mutex_destroy (&self->mutex);
+    pthread_cond_destroy (&self->cond);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  statefile_queue
+
+  Add a record to the pending buffer, and wake the writer thread
+
+==========================================================================*/
+static void statefile_queue (StateFile *self, const char *rec, size_t len)
+  {
+  if (!self->thread_running) return;
+  pthread_mutex_lock (&self->mutex);
+  if (self->pending_len + len > self->pending_size)
+    {
+    size_t size = self->pending_size ? self->pending_size : 4096;
+    while (size < self->pending_len + len) size *= 2;
+    self->pending = realloc (self->pending, size);
+    self->pending_size = size;
+    }
+  memcpy (self->pending + self->pending_len, rec, len);
+  self->pending_len += len;
+  pthread_cond_signal (&self->cond);
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  statefile_queue_mrl
+
+  Queue a record that ends with an MRL, escaping it
+
+==========================================================================*/
+static void statefile_queue_mrl (StateFile *self, const char *prefix,
+      const char *mrl)
+  {
+  size_t pl = strlen (prefix);
+  char *rec = malloc (pl + 2 * strlen (mrl) + 2);
+  memcpy (rec, prefix, pl);
+  char *p = rec + pl;
+  for (const char *q = mrl; *q; q++)
+    {
+    if (*q == '\\') { *p++ = '\\'; *p++ = '\\'; }
+    else if (*q == '\n') { *p++ = '\\'; *p++ = 'n'; }
+    else *p++ = *q;
+    }
+  *p++ = '\n';
+  statefile_queue (self, rec, p - rec);
+  free (rec);
+  }
+
+
+/*==========================================================================
+
+  statefile_log_add
+
+==========================================================================*/
+void statefile_log_add (StateFile *self, const char *mrl)
+  {
+  statefile_queue_mrl (self, "A ", mrl);
+  }
+
+
+/*==========================================================================
+
+  statefile_log_insert
+
+==========================================================================*/
+void statefile_log_insert (StateFile *self, int pos, const char *mrl)
+  {
+  char prefix[32];
+  snprintf (prefix, sizeof (prefix), "N %d ", pos);
+  statefile_queue_mrl (self, prefix, mrl);
+  }
+
+
+/*==========================================================================
+
+  statefile_log_remove
+
+==========================================================================*/
+void statefile_log_remove (StateFile *self, int first, int count)
+  {
+  char rec[64];
+  int l = snprintf (rec, sizeof (rec), "R %d %d\n", first, count);
+  statefile_queue (self, rec, l);
+  }
+
+
+/*==========================================================================
+
+  statefile_log_move
+
+==========================================================================*/
+void statefile_log_move (StateFile *self, int first, int count, int dest)
+  {
+  char rec[64];
+  int l = snprintf (rec, sizeof (rec), "M %d %d %d\n", first, count, dest);
+  statefile_queue (self, rec, l);
+  }
+
+
+/*==========================================================================
+
+  statefile_log_clear
+
+==========================================================================*/
+void statefile_log_clear (StateFile *self)
+  {
+  statefile_queue (self, "C\n", 2);
+  }
+
+
+/*==========================================================================
+
+  statefile_log_volume
+
+==========================================================================*/
+void statefile_log_volume (StateFile *self, int volume)
+  {
+  char rec[32];
+  int l = snprintf (rec, sizeof (rec), "V %d\n", volume);
+  statefile_queue (self, rec, l);
+  }
+
+
+/*==========================================================================
+
+  statefile_log_eq
+
+==========================================================================*/
+void statefile_log_eq (StateFile *self, const int eq[10])
+  {
+  char rec[128];
+  int l = snprintf (rec, sizeof (rec), "E %d %d %d %d %d %d %d %d %d %d\n",
+    eq[0], eq[1], eq[2], eq[3], eq[4], eq[5], eq[6], eq[7], eq[8], eq[9]);
+  statefile_queue (self, rec, l);
+  }
+
+
+/*==========================================================================
+
+  statefile_get_entries
+
+==========================================================================*/
+char *const *statefile_get_entries (const StateFile *self, int *count)
+  {
+  *count = self->n_entries;
+  return self->entries;
+  }
+
+
+/*==========================================================================
+
+  statefile_get_index
+
+==========================================================================*/
+int statefile_get_index (const StateFile *self)
+  {
+  return self->index;
+  }
+
+
+/*==========================================================================
+
+  statefile_get_position
+
+==========================================================================*/
+int statefile_get_position (const StateFile *self)
+  {
+  return self->position;
+  }
+
+
+/*==========================================================================
+
+  statefile_get_volume
+
+  Returns -1 if no volume was saved
+
+==========================================================================*/
+int statefile_get_volume (const StateFile *self)
+  {
+  return self->volume;
+  }
+
+
+/*==========================================================================
+
+  statefile_get_eq
+
+  Returns FALSE if no EQ levels were saved
+
+==========================================================================*/
+BOOL statefile_get_eq (const StateFile *self, int eq[10])
+  {
+  if (self->have_eq)
+    memcpy (eq, self->eq, sizeof (self->eq));
+  return self->have_eq;
+  }
+
+
+/*==========================================================================
+
+  statefile_get_stats
+
+==========================================================================*/
+void statefile_get_stats (StateFile *self, String *s)
+  {
+  string_append_printf (s, " state-load-ms=%d state-loaded-entries=%d"
+    " state-journal-records=%d state-compactions=%d",
+    self->load_usec / 1000, self->loaded_entries, 
+    __atomic_load_n (&self->journal_records, __ATOMIC_RELAXED),
+    __atomic_load_n (&self->compactions, __ATOMIC_RELAXED));
+  }
+
@@ -0,0 +1,60 @@
+/*============================================================================
+
+  xine-server
+  statefile.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+#include "string.h"
+
+struct _StateFile;
+typedef struct _StateFile StateFile;
+
+// Called periodically on the writer thread, to find the current
+//  playlist index and playback position (msec). These change too
+//  often to be logged by the command processor as they happen
+typedef void (*StateFileTransportFn)(void *data, int *index, int *msec);
+
+BEGIN_DECLS
+
+StateFile    *statefile_create (const char *path);
+void          statefile_destroy (StateFile *self);
+
+// Read the snapshot and journal, if they exist. This must be done
+//  before statefile_start(). Missing or unreadable files just result
+//  in an empty state
+void          statefile_load (StateFile *self);
+BOOL          statefile_start (StateFile *self, char **error);
+void          statefile_set_transport_fn (StateFile *self,
+                 StateFileTransportFn fn, void *data);
+
+// The state as loaded. The entries belong to the StateFile, and are
+//  only valid until statefile_start() is called
+char *const  *statefile_get_entries (const StateFile *self, int *count);
+int           statefile_get_index (const StateFile *self);
+int           statefile_get_position (const StateFile *self);
+int           statefile_get_volume (const StateFile *self);
+BOOL          statefile_get_eq (const StateFile *self, int eq[10]);
+
+// Record changes. These only queue the change for the writer thread,
+//  and do not block on I/O. If the writer could not be started, they
+//  do nothing
+void          statefile_log_add (StateFile *self, const char *mrl);
+void          statefile_log_insert (StateFile *self, int pos, 
+                 const char *mrl);
+void          statefile_log_remove (StateFile *self, int first, int count);
+void          statefile_log_move (StateFile *self, int first, int count,
+                 int dest);
+void          statefile_log_clear (StateFile *self);
+void          statefile_log_volume (StateFile *self, int volume);
+void          statefile_log_eq (StateFile *self, const int eq[10]);
+
+void          statefile_get_stats (StateFile *self, String *s);
+
+END_DECLS
+
@@ -0,0 +1,686 @@
+/*==========================================================================
+
+  xine-server
+  tagreader.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  A lightweight reader for the common audio tag formats, used to index
+  a music library without opening each file in Xine. Only the title,
+  artist, album and genre are extracted, along with any ReplayGain
+  values, which are used for loudness normalization. This code reads
+  only the parts of the file that contain tags, skipping embedded
+  pictures, so a file typically costs a couple of small reads.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "convertutf.h"
+#include "tagreader.h"
+
+// Upper limits on the amount of data read, in case of corrupt files
+#define TAGREADER_MAX_ID3     (1024 * 1024)
+#define TAGREADER_MAX_BLOCK   (1024 * 1024)
+#define TAGREADER_MAX_MOOV    (8 * 1024 * 1024)
+#define TAGREADER_MAX_PAGES   16
+
+/*==========================================================================
+
+  Byte-order helpers
+
+==========================================================================*/
+static uint32_t tagreader_be32 (const BYTE *p)
+  {
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+  }
+
+static uint32_t tagreader_le32 (const BYTE *p)
+  {
+  return ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+  }
+
+static uint32_t tagreader_syncsafe (const BYTE *p)
+  {
+  return ((p[0] & 0x7F) << 21) | ((p[1] & 0x7F) << 14)
+    | ((p[2] & 0x7F) << 7) | (p[3] & 0x7F);
+  }
+
+
+/*==========================================================================
+
+  tagreader_read_at
+
+  Read exactly 'len' bytes at 'offset', or return FALSE
+
+==========================================================================*/
+static BOOL tagreader_read_at (FILE *f, long offset, BYTE *buf, size_t len)
+  {
+  if (fseek (f, offset, SEEK_SET) != 0) return FALSE;
+  return fread (buf, 1, len, f) == len;
+  }
+
+
+/*==========================================================================
+
+  tagreader_read_alloc
+
+  Read 'len' bytes at 'offset' into a new buffer, or return NULL
+
+==========================================================================*/
+static BYTE *tagreader_read_alloc (FILE *f, long offset, size_t len)
+  {
+  BYTE *buf = malloc (len + 1);
+  if (!tagreader_read_at (f, offset, buf, len))
+    {
+    free (buf);
+    return NULL;
+    }
+  return buf;
+  }
+
+
+/*==========================================================================
+
+  tagreader_set
+
+  Set a tag from UTF-8 text of known length, unless it is already set.
+  Trailing spaces and NULs are removed; empty values are ignored
+
+==========================================================================*/
+static void tagreader_set (char **field, const char *s, size_t len)
+  {
+  if (*field) return;
+  while (len > 0 && (s[len - 1] == 0 || s[len - 1] == ' '))
+    len--;
+  if (len == 0) return;
+  char *v = malloc (len + 1);
+  memcpy (v, s, len);
+  v[len] = 0;
+  *field = v;
+  }
+
+
+/*==========================================================================
+
+  tagreader_set_latin1
+
+==========================================================================*/
+static void tagreader_set_latin1 (char **field, const BYTE *s, size_t len)
+  {
+  if (*field) return;
+  char *v = malloc (2 * len + 1);
+  char *p = v;
+  for (size_t i = 0; i < len && s[i]; i++)
+    {
+    if (s[i] < 0x80)
+      *p++ = s[i];
+    else
+      {
+      *p++ = 0xC0 | (s[i] >> 6);
+      *p++ = 0x80 | (s[i] & 0x3F);
+      }
+    }
+  tagreader_set (field, v, p - v);
+  free (v);
+  }
+
+
+/*==========================================================================
+
+  tagreader_set_utf16
+
+  'big_endian' is the byte order to assume if there is no byte order
+  mark
+
+==========================================================================*/
+static void tagreader_set_utf16 (char **field, const BYTE *s, size_t len,
+      BOOL big_endian)
+  {
+  if (*field) return;
+  if (len >= 2 && s[0] == 0xFF && s[1] == 0xFE)
+    { big_endian = FALSE; s += 2; len -= 2; }
+  else if (len >= 2 && s[0] == 0xFE && s[1] == 0xFF)
+    { big_endian = TRUE; s += 2; len -= 2; }
+  size_t n = len / 2;
+  UTF16 *u = malloc ((n + 1) * sizeof (UTF16));
+  size_t i;
+  for (i = 0; i < n; i++)
+    {
+    u[i] = big_endian ? (s[2 * i] << 8) | s[2 * i + 1]
+                      : (s[2 * i + 1] << 8) | s[2 * i];
+    if (u[i] == 0) break;
+    }
+  UTF8 *out = malloc (4 * i + 1);
+  const UTF16 *src = u;
+  UTF8 *dst = out;
+  ConvertUTF16toUTF8 (&src, u + i, &dst, out + 4 * i, lenientConversion);
+  tagreader_set (field, (char *)out, dst - out);
+  free (out);
+  free (u);
+  }
+
+
+/*==========================================================================
+
+  tagreader_set_gain
+
+  Record a ReplayGain value, if 'key' names one. Values look like
+  "-6.54 dB" for gains and "0.988" for peaks. Opus files carry
+  R128_TRACK_GAIN and R128_ALBUM_GAIN instead, which are integers in
+  1/256 dB relative to -23 LUFS; ReplayGain's reference is 5 dB louder
+
+==========================================================================*/
+static void tagreader_set_gain (TagInfo *info, const char *key,
+      size_t klen, const char *v, size_t vlen)
+  {
+  char value[32];
+  if (vlen == 0 || vlen >= sizeof (value)) return;
+  memcpy (value, v, vlen);
+  value[vlen] = 0;
+  char *end;
+  double d = strtod (value, &end);
+  if (end == value) return;
+
+  TagGain *g = &info->gain;
+  if (klen == 21 && strncasecmp (key, "REPLAYGAIN_TRACK_GAIN", 21) == 0)
+    { g->track_gain = d; g->have_track = TRUE; }
+  else if (klen == 21 && strncasecmp (key, "REPLAYGAIN_TRACK_PEAK", 21) == 0)
+    g->track_peak = d;
+  else if (klen == 21 && strncasecmp (key, "REPLAYGAIN_ALBUM_GAIN", 21) == 0)
+    { g->album_gain = d; g->have_album = TRUE; }
+  else if (klen == 21 && strncasecmp (key, "REPLAYGAIN_ALBUM_PEAK", 21) == 0)
+    g->album_peak = d;
+  else if (klen == 15 && strncasecmp (key, "R128_TRACK_GAIN", 15) == 0
+        && !g->have_track)
+    { g->track_gain = d / 256 + 5; g->have_track = TRUE; }
+  else if (klen == 15 && strncasecmp (key, "R128_ALBUM_GAIN", 15) == 0
+        && !g->have_album)
+    { g->album_gain = d / 256 + 5; g->have_album = TRUE; }
+  }
+
+
+/*==========================================================================
+
+  tagreader_set_id3_text
+
+  Set a tag from the content of an ID3v2 text frame, which starts
+  with an encoding byte
+
+==========================================================================*/
+static void tagreader_set_id3_text (char **field, const BYTE *s,
+      size_t len)
+  {
+  if (len < 2) return;
+  switch (s[0])
+    {
+    case 0: tagreader_set_latin1 (field, s + 1, len - 1); break;
+    case 1: tagreader_set_utf16 (field, s + 1, len - 1, FALSE); break;
+    case 2: tagreader_set_utf16 (field, s + 1, len - 1, TRUE); break;
+    case 3: tagreader_set (field, (const char *)s + 1,
+              strnlen ((const char *)s + 1, len - 1)); break;
+    }
+  }
+
+
+/*==========================================================================
+
+  tagreader_read_id3_txxx
+
+  A TXXX frame holds a description and a value, each terminated in the
+  frame's encoding. ReplayGain values are stored this way
+
+==========================================================================*/
+static void tagreader_read_id3_txxx (const BYTE *s, size_t len,
+      TagInfo *info)
+  {
+  if (len < 2) return;
+  int unit = (s[0] == 1 || s[0] == 2) ? 2 : 1;
+  size_t i;
+  for (i = 1; i + unit <= len; i += unit)
+    if (s[i] == 0 && (unit == 1 || s[i + 1] == 0)) break;
+  if (i + unit > len) return;
+
+  // Decode each part as a text frame of its own
+  BYTE *part = malloc (len);
+  char *desc = NULL, *value = NULL;
+  part[0] = s[0];
+  memcpy (part + 1, s + 1, i - 1);
+  tagreader_set_id3_text (&desc, part, i);
+  memcpy (part + 1, s + i + unit, len - i - unit);
+  tagreader_set_id3_text (&value, part, len - i - unit + 1);
+  if (desc && value)
+    tagreader_set_gain (info, desc, strlen (desc), value, strlen (value));
+  if (desc) free (desc);
+  if (value) free (value);
+  free (part);
+  }
+
+
+/*==========================================================================
+
+  tagreader_read_id3v2
+
+  Returns the total size of the tag, so the caller can look for
+  another format after it, or zero if there is no ID3v2 tag
+
+==========================================================================*/
+static long tagreader_read_id3v2 (FILE *f, TagInfo *info)
+  {
+  BYTE h[10];
+  if (!tagreader_read_at (f, 0, h, 10) || memcmp (h, "ID3", 3) != 0)
+    return 0;
+  int version = h[3];
+  int flags = h[5];
+  long size = tagreader_syncsafe (h + 6);
+  long total = size + 10 + ((flags & 0x10) ? 10 : 0);
+  if (version < 2 || version > 4) return total;
+
+  long len = size < TAGREADER_MAX_ID3 ? size : TAGREADER_MAX_ID3;
+  BYTE *buf = tagreader_read_alloc (f, 10, len);
+  if (!buf) return total;
+
+  if ((flags & 0x80) && version < 4)
+    {
+    // Whole-tag unsynchronisation: remove the 0x00 after each 0xFF
+    long j = 0;
+    for (long i = 0; i < len; i++)
+      {
+      buf[j++] = buf[i];
+      if (buf[i] == 0xFF && i + 1 < len && buf[i + 1] == 0) i++;
+      }
+    len = j;
+    }
+
+  long pos = 0;
+  if ((flags & 0x40) && version >= 3 && len >= 4)
+    {
+    // Extended header
+    pos = (version == 4) ? tagreader_syncsafe (buf) : 4 + tagreader_be32 (buf);
+    }
+
+  int id_len = (version == 2) ? 3 : 4;
+  int header_len = (version == 2) ? 6 : 10;
+  while (pos + header_len <= len && buf[pos] != 0)
+    {
+    const char *id = (const char *)buf + pos;
+    long fsize;
+    if (version == 2)
+      fsize = (buf[pos + 3] << 16) | (buf[pos + 4] << 8) | buf[pos + 5];
+    else if (version == 3)
+      fsize = tagreader_be32 (buf + pos + 4);
+    else
+      fsize = tagreader_syncsafe (buf + pos + 4);
+    pos += header_len;
+    if (fsize < 0 || pos + fsize > len) break;
+    const BYTE *data = buf + pos;
+
+    if (strncmp (id, "TIT2", id_len) == 0 || strncmp (id, "TT2", id_len) == 0)
+      tagreader_set_id3_text (&info->title, data, fsize);
+    else if (strncmp (id, "TPE1", id_len) == 0
+          || strncmp (id, "TP1", id_len) == 0)
+      tagreader_set_id3_text (&info->artist, data, fsize);
+    else if (strncmp (id, "TALB", id_len) == 0
+          || strncmp (id, "TAL", id_len) == 0)
+      tagreader_set_id3_text (&info->album, data, fsize);
+    else if (strncmp (id, "TCON", id_len) == 0
+          || strncmp (id, "TCO", id_len) == 0)
+      tagreader_set_id3_text (&info->genre, data, fsize);
+    else if (strncmp (id, "TXXX", id_len) == 0
+          || strncmp (id, "TXX", id_len) == 0)
+      tagreader_read_id3_txxx (data, fsize, info);
+    pos += fsize;
+    }
+  free (buf);
+  return total;
+  }
+
+
+/*==========================================================================
+
+  tagreader_read_id3v1
+
+==========================================================================*/
+static void tagreader_read_id3v1 (FILE *f, TagInfo *info)
+  {
+  BYTE t[128];
+  if (fseek (f, -128, SEEK_END) == 0 && fread (t, 1, 128, f) == 128
+       && memcmp (t, "TAG", 3) == 0)
+    {
+    tagreader_set_latin1 (&info->title, t + 3, 30);
+    tagreader_set_latin1 (&info->artist, t + 33, 30);
+    tagreader_set_latin1 (&info->album, t + 63, 30);
+    }
+  }
+
+
+/*==========================================================================
+
+  tagreader_parse_vorbis_comment
+
+  Parse a Vorbis comment block, as used by FLAC, Ogg Vorbis and Opus
+
+==========================================================================*/
+static void tagreader_parse_vorbis_comment (const BYTE *buf, size_t len,
+      TagInfo *info)
+  {
+  if (len < 8) return;
+  size_t pos = 4 + tagreader_le32 (buf); // Skip vendor string
+  if (pos + 4 > len) return;
+  uint32_t count = tagreader_le32 (buf + pos);
+  pos += 4;
+  for (uint32_t i = 0; i < count && pos + 4 <= len; i++)
+    {
+    uint32_t clen = tagreader_le32 (buf + pos);
+    pos += 4;
+    if (clen > len - pos) break;
+    const char *c = (const char *)buf + pos;
+    const char *eq = memchr (c, '=', clen);
+    if (eq)
+      {
+      size_t klen = eq - c;
+      const char *v = eq + 1;
+      size_t vlen = clen - klen - 1;
+      if (klen == 5 && strncasecmp (c, "TITLE", 5) == 0)
+        tagreader_set (&info->title, v, vlen);
+      else if (klen == 6 && strncasecmp (c, "ARTIST", 6) == 0)
+        tagreader_set (&info->artist, v, vlen);
+      else if (klen == 5 && strncasecmp (c, "ALBUM", 5) == 0)
+        tagreader_set (&info->album, v, vlen);
+      else if (klen == 5 && strncasecmp (c, "GENRE", 5) == 0)
+        tagreader_set (&info->genre, v, vlen);
+      else
+        tagreader_set_gain (info, c, klen, v, vlen);
+      }
+    pos += clen;
+    }
+  }
+
+
+/*==========================================================================
+
+  tagreader_read_flac
+
+  'offset' is the position of the "fLaC" marker
+
+==========================================================================*/
+static void tagreader_read_flac (FILE *f, long offset, TagInfo *info)
+  {
+  long pos = offset + 4;
+  BYTE h[4];
+  BOOL last = FALSE;
+  while (!last && tagreader_read_at (f, pos, h, 4))
+    {
+    last = (h[0] & 0x80) != 0;
+    int type = h[0] & 0x7F;
+    long blen = (h[1] << 16) | (h[2] << 8) | h[3];
+    pos += 4;
+    if (type == 4 && blen < TAGREADER_MAX_BLOCK)
+      {
+      BYTE *buf = tagreader_read_alloc (f, pos, blen);
+      if (buf)
+        {
+        tagreader_parse_vorbis_comment (buf, blen, info);
+        free (buf);
+        }
+      break;
+      }
+    pos += blen;
+    }
+  }
+
+
+/*==========================================================================
+
+  tagreader_read_ogg
+
+  Reassemble the second packet of the first logical stream, which is
+  the comment header for both Vorbis and Opus
+
+==========================================================================*/
+static void tagreader_read_ogg (FILE *f, TagInfo *info)
+  {
+  long pos = 0;
+  int packet = 0;
+  BYTE *data = NULL;
+  size_t data_len = 0;
+  BOOL done = FALSE;
+  for (int page = 0; page < TAGREADER_MAX_PAGES && !done; page++)
+    {
+    BYTE h[27 + 255];
+    if (!tagreader_read_at (f, pos, h, 27) || memcmp (h, "OggS", 4) != 0)
+      break;
+    int nsegs = h[26];
+    if (!tagreader_read_at (f, pos + 27, h + 27, nsegs)) break;
+    long body = pos + 27 + nsegs;
+    long seg_pos = body;
+    for (int s = 0; s < nsegs && !done; s++)
+      {
+      int slen = h[27 + s];
+      if (packet == 1)
+        {
+        if (data_len + slen > TAGREADER_MAX_BLOCK) { done = TRUE; break; }
+        data = realloc (data, data_len + slen + 1);
+        if (!tagreader_read_at (f, seg_pos, data + data_len, slen))
+          { done = TRUE; break; }
+        data_len += slen;
+        }
+      seg_pos += slen;
+      if (slen < 255)
+        {
+        if (packet == 1) done = TRUE;
+        packet++;
+        }
+      }
+    pos = seg_pos;
+    }
+
+  if (data)
+    {
+    if (data_len > 7 && memcmp (data, "\x03vorbis", 7) == 0)
+      tagreader_parse_vorbis_comment (data + 7, data_len - 7, info);
+    else if (data_len > 8 && memcmp (data, "OpusTags", 8) == 0)
+      tagreader_parse_vorbis_comment (data + 8, data_len - 8, info);
+    free (data);
+    }
+  }
+
+
+/*==========================================================================
+
+  tagreader_find_atom
+
+  Find a child atom of the given type within a buffer of atoms. Returns
+  a pointer to its content, and sets its length
+
+==========================================================================*/
+static const BYTE *tagreader_find_atom (const BYTE *buf, size_t len,
+      const char *type, size_t *content_len)
+  {
+  size_t pos = 0;
+  while (pos + 8 <= len)
+    {
+    size_t size = tagreader_be32 (buf + pos);
+    if (size < 8 || size > len - pos) break;
+    if (memcmp (buf + pos + 4, type, 4) == 0)
+      {
+      *content_len = size - 8;
+      return buf + pos + 8;
+      }
+    pos += size;
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  tagreader_read_mp4_item
+
+==========================================================================*/
+static void tagreader_read_mp4_item (const BYTE *ilst, size_t ilst_len,
+      const char *type, char **field)
+  {
+  size_t item_len;
+  const BYTE *item = tagreader_find_atom (ilst, ilst_len, type, &item_len);
+  if (item)
+    {
+    size_t data_len;
+    const BYTE *data = tagreader_find_atom (item, item_len, "data",
+      &data_len);
+    // 'data' content is type (4 bytes), locale (4 bytes), value
+    if (data && data_len > 8)
+      tagreader_set (field, (const char *)data + 8, data_len - 8);
+    }
+  }
+
+
+/*==========================================================================
+
+  tagreader_read_mp4_freeform
+
+  iTunes-style '----' items have a 'name' child, after four bytes of
+  version and flags, and a 'data' child. ReplayGain values are stored
+  this way
+
+==========================================================================*/
+static void tagreader_read_mp4_freeform (const BYTE *ilst, size_t ilst_len,
+      TagInfo *info)
+  {
+  size_t pos = 0;
+  while (pos + 8 <= ilst_len)
+    {
+    size_t size = tagreader_be32 (ilst + pos);
+    if (size < 8 || size > ilst_len - pos) break;
+    if (memcmp (ilst + pos + 4, "----", 4) == 0)
+      {
+      size_t name_len, data_len;
+      const BYTE *item = ilst + pos + 8;
+      const BYTE *name = tagreader_find_atom (item, size - 8, "name",
+        &name_len);
+      const BYTE *data = tagreader_find_atom (item, size - 8, "data",
+        &data_len);
+      if (name && name_len > 4 && data && data_len > 8)
+        tagreader_set_gain (info, (const char *)name + 4, name_len - 4,
+          (const char *)data + 8, data_len - 8);
+      }
+    pos += size;
+    }
+  }
+
+
+/*==========================================================================
+
+  tagreader_read_mp4
+
+  Tags are in moov/udta/meta/ilst. 'meta' has four bytes of version
+  and flags before its children
+
+==========================================================================*/
+static void tagreader_read_mp4 (FILE *f, TagInfo *info)
+  {
+  long pos = 0;
+  BYTE h[8];
+  while (tagreader_read_at (f, pos, h, 8))
+    {
+    uint64_t size = tagreader_be32 (h);
+    long header = 8;
+    if (size == 1)
+      {
+      BYTE ext[8];
+      if (!tagreader_read_at (f, pos + 8, ext, 8)) break;
+      size = ((uint64_t)tagreader_be32 (ext) << 32) | tagreader_be32 (ext + 4);
+      header = 16;
+      }
+    if (size < (uint64_t)header) break;
+    if (memcmp (h + 4, "moov", 4) == 0)
+      {
+      if (size - header < TAGREADER_MAX_MOOV)
+        {
+        size_t len = size - header;
+        BYTE *moov = tagreader_read_alloc (f, pos + header, len);
+        if (moov)
+          {
+          size_t udta_len, meta_len, ilst_len;
+          const BYTE *udta = tagreader_find_atom (moov, len, "udta",
+            &udta_len);
+          const BYTE *meta = udta ? tagreader_find_atom (udta, udta_len,
+            "meta", &meta_len) : NULL;
+          const BYTE *ilst = (meta && meta_len > 4) ? tagreader_find_atom
+            (meta + 4, meta_len - 4, "ilst", &ilst_len) : NULL;
+          if (ilst)
+            {
+            tagreader_read_mp4_item (ilst, ilst_len, "\xA9nam", &info->title);
+            tagreader_read_mp4_item (ilst, ilst_len, "\xA9" "ART",
+              &info->artist);
+            tagreader_read_mp4_item (ilst, ilst_len, "aART", &info->artist);
+            tagreader_read_mp4_item (ilst, ilst_len, "\xA9" "alb",
+              &info->album);
+            tagreader_read_mp4_item (ilst, ilst_len, "\xA9gen", &info->genre);
+            tagreader_read_mp4_freeform (ilst, ilst_len, info);
+            }
+          free (moov);
+          }
+        }
+      break;
+      }
+    pos += size;
+    }
+  }
+
+
+/*==========================================================================
+
+  tagreader_read
+
+==========================================================================*/
+BOOL tagreader_read (const char *path, TagInfo *info)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  memset (info, 0, sizeof (TagInfo));
+  FILE *f = fopen (path, "rb");
+  if (f)
+    {
+    BYTE magic[12];
+    long offset = tagreader_read_id3v2 (f, info);
+    if (tagreader_read_at (f, offset, magic, sizeof (magic)))
+      {
+      if (memcmp (magic, "fLaC", 4) == 0)
+        tagreader_read_flac (f, offset, info);
+      else if (offset == 0 && memcmp (magic, "OggS", 4) == 0)
+        tagreader_read_ogg (f, info);
+      else if (offset == 0 && memcmp (magic + 4, "ftyp", 4) == 0)
+        tagreader_read_mp4 (f, info);
+      }
+    if (!info->title || !info->artist || !info->album)
+      tagreader_read_id3v1 (f, info);
+    fclose (f);
+    ret = TRUE;
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  tagreader_free
+
+==========================================================================*/
+void tagreader_free (TagInfo *info)
+  {
+  if (info->title) free (info->title);
+  if (info->artist) free (info->artist);
+  if (info->album) free (info->album);
+  if (info->genre) free (info->genre);
+  memset (info, 0, sizeof (TagInfo));
+  }
+
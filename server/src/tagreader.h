@@ -0,0 +1,49 @@
+/*============================================================================
+
+  xine-server
+  tagreader.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+// ReplayGain values, from REPLAYGAIN_* tags or, for Opus, R128_*
+//  tags converted to the ReplayGain reference level. Gains are in dB;
+//  peaks are linear, with 1.0 as full scale, and are zero if not known
+typedef struct _TagGain
+  {
+  BOOL have_track;
+  double track_gain;
+  double track_peak;
+  BOOL have_album;
+  double album_gain;
+  double album_peak;
+  } TagGain;
+
+// Tags read from a file. All strings are UTF-8, and any that were not
+//  found are NULL
+typedef struct _TagInfo
+  {
+  char *title;
+  char *artist;
+  char *album;
+  char *genre;
+  TagGain gain;
+  } TagInfo;
+
+BEGIN_DECLS
+
+// Read tags from an audio file, without Xine. Understands ID3v2 and
+//  ID3v1 (MP3, and anything else that has them), FLAC and Ogg
+//  (Vorbis and Opus) comments, and MP4/M4A metadata, including
+//  ReplayGain values in each of these. Returns FALSE
+//  if the file can't be read; otherwise TRUE, even if no tags were
+//  found. The caller must call tagreader_free() in either case
+BOOL  tagreader_read (const char *path, TagInfo *info);
+void  tagreader_free (TagInfo *info);
+
+END_DECLS
+
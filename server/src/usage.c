@@ -23,14 +23,41 @@ void usage_show (FILE *fout, const char *argv0)
   {
   fprintf (fout, "Usage: %s [options]\n", argv0);
   fprintf (fout, "  -?,--help               show this message\n");
+  fprintf (fout, "     --auth-file=file     client roles and tokens (none)\n");
+  fprintf (fout, "     --bench-speed=N      --decode-bench speed (32)\n");
+  fprintf (fout, "     --broadcast=[IP:]N   serve audio over HTTP (none)\n");
   fprintf (fout, "  -c,--config=file        configuration file (none)\n");
+  fprintf (fout, "     --cache-dir=dir      Xine plugin cache location\n");
   fprintf (fout, "     --debug              debug mode\n");
+  fprintf (fout, "     --decode-bench files measure decoding speed\n");
+  fprintf (fout, "     --fade=msec          volume ramp and fade time (150)\n");
   fprintf (fout, "  -h,--host=IP            host IP to bind to (127.0.0.1)\n");
+  fprintf (fout, "     --levels-rate=N      level meter updates/sec (20)\n");
+  fprintf (fout, "     --library=dir,...    media library folders (none)\n");
+  fprintf (fout, "     --library-index=file library index location\n");
+  fprintf (fout, "     --listen=addr,...    listen addresses (host:port)\n");
+  fprintf (fout, "     --listen-backlog=N   connections waiting (128)\n");
   fprintf (fout, "  -l,--log-level=N        log level, 0-5 (default 2)\n");
+  fprintf (fout, "     --meta-cache=N       playlist tags to cache (5000)\n");
   fprintf (fout, "  --list-drivers          list audio drivers\n");
   fprintf (fout, "  -v,--version            show version\n");
   fprintf (fout, "  -p,--port=N             listen port (default 30001)\n");
+  fprintf (fout, "     --rate-limit=N[:B]   commands/sec per client (none)\n");
+  fprintf (fout, "     --rate-limit-policy=P  delay or reject (delay)\n");
+  fprintf (fout, "     --replaygain=M       off, track or album (off)\n");
+  fprintf (fout, "     --replaygain-preamp=dB  added to tagged gains (0)\n");
+  fprintf (fout, "     --resume             resume playback from state file\n");
+  fprintf (fout, "     --server-threads=N   threads accepting clients (1)\n");
+  fprintf (fout, "     --server-workers=N   threads running commands (2)\n");
+  fprintf (fout, "     --shm=name           status in shared memory (none)\n");
+  fprintf (fout, "     --state-file=file    save playlist and state (none)\n");
   fprintf (fout, "  -d,-=driver=D           audio driver (default auto)\n");
+  fprintf (fout, "     --sync=M             master, follower or off (off)\n");
+  fprintf (fout, "                          (a follower varies speed, and pitch, "
+    "by up to 2%%)\n");
+  fprintf (fout, "     --sync-group=IP      multicast group (239.255.30.1)\n");
+  fprintf (fout, "     --sync-port=N        sync UDP port (default 30002)\n");
+  fprintf (fout, "  -z,--zones=Z1[:D],...   extra named zones (none)\n");
   }
 
  
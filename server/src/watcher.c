@@ -0,0 +1,403 @@
+/*==========================================================================
+
+  xine-server
+  watcher.c
+  Copyright (c)2020 Kevin Boone
+  Distributed under the terms of the GPL v3.0
+
+  Watches directory trees for changes, using inotify.
+
+  inotify watches single directories, so every subdirectory gets its own
+  watch, and new subdirectories are watched as they appear. A thread
+  reads the kernel's events, and turns them into WatcherEvents with
+  full pathnames, which it puts on a queue of limited size. If the
+  client falls so far behind that the queue fills up, events are
+  discarded and the client is told to rescan; the same happens if the
+  kernel's own queue overflows.
+
+  Files are reported as added when they are closed after writing, not
+  when they are created, so a file being copied into the tree is not
+  reported until it is complete. Hidden files and directories, and
+  symbolic links to directories, are ignored, as they are by the
+  scanner.
+
+==========================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "feature.h"
+#include "defs.h"
+#include "log.h"
+#include "watcher.h"
+
+#define WATCHER_QUEUE_SIZE 4096
+
+#define WATCHER_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE \
+    | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+struct _Watcher
+  {
+  char *roots;
+  int fd;
+  pthread_t thread;
+  BOOL thread_running;
+  BOOL stop;
+  // Directory for each watch descriptor, or NULL. Only used by the
+  //  watcher thread
+  char **dirs;
+  int dirs_size;
+  int watch_count;
+  BOOL warned;
+  // Ring buffer of events, protected by the mutex
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  WatcherEvent queue[WATCHER_QUEUE_SIZE];
+  int head;
+  int count;
+  BOOL overflow;
+  };
+
+
+/*==========================================================================
+
+  watcher_create
+
+==========================================================================*/
+Watcher *watcher_create (const char *roots)
+  {
+  LOG_IN
+  Watcher *self = malloc (sizeof (Watcher));
+  memset (self, 0, sizeof (Watcher));
+  self->roots = strdup (roots);
+  self->fd = -1;
+  pthread_mutex_init (&self->mutex, NULL);
+  pthread_cond_init (&self->cond, NULL);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  watcher_destroy
+
+==========================================================================*/
+void watcher_destroy (Watcher *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    self->stop = TRUE;
+    if (self->thread_running)
+      pthread_join (self->thread, NULL);
+    if (self->fd >= 0) close (self->fd);
+    for (int i = 0; i < self->dirs_size; i++)
+      if (self->dirs[i]) free (self->dirs[i]);
+    if (self->dirs) free (self->dirs);
+    for (int i = 0; i < self->count; i++)
+      {
+      WatcherEvent *e = &self->queue[(self->head + i) % WATCHER_QUEUE_SIZE];
+      if (e->path) free (e->path);
+      }
+    pthread_mutex_destroy (&self->mutex);
+    pthread_cond_destroy (&self->cond);
+    free (self->roots);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  watcher_push
+
+  Add an event to the queue, taking ownership of the path
+
+==========================================================================*/
+static void watcher_push (Watcher *self, WatcherEventType type,
+      BOOL is_dir, char *path)
+  {
+  pthread_mutex_lock (&self->mutex);
+  if (type == WATCHER_OVERFLOW || self->count == WATCHER_QUEUE_SIZE)
+    {
+    if (!self->overflow)
+      log_warning ("Library changes are arriving too quickly to track");
+    self->overflow = TRUE;
+    if (path) free (path);
+    }
+  else
+    {
+    WatcherEvent *e =
+      &self->queue[(self->head + self->count) % WATCHER_QUEUE_SIZE];
+    e->type = type;
+    e->is_dir = is_dir;
+    e->path = path;
+    self->count++;
+    }
+  pthread_cond_signal (&self->cond);
+  pthread_mutex_unlock (&self->mutex);
+  }
+
+
+/*==========================================================================
+
+  watcher_get_events
+
+==========================================================================*/
+int watcher_get_events (Watcher *self, WatcherEvent *events, int max,
+      int msec)
+  {
+  int n = 0;
+  pthread_mutex_lock (&self->mutex);
+  if (self->count == 0 && !self->overflow)
+    {
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_sec += msec / 1000;
+    ts.tv_nsec += (msec % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+      {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+      }
+    pthread_cond_timedwait (&self->cond, &self->mutex, &ts);
+    }
+  if (self->overflow && max > 0)
+    {
+    // Everything queued is superseded by the rescan
+    for (int i = 0; i < self->count; i++)
+      {
+      WatcherEvent *e = &self->queue[(self->head + i) % WATCHER_QUEUE_SIZE];
+      if (e->path) free (e->path);
+      }
+    self->head = 0;
+    self->count = 0;
+    self->overflow = FALSE;
+    events[n].type = WATCHER_OVERFLOW;
+    events[n].is_dir = FALSE;
+    events[n].path = NULL;
+    n++;
+    }
+  while (n < max && self->count > 0)
+    {
+    events[n++] = self->queue[self->head];
+    self->head = (self->head + 1) % WATCHER_QUEUE_SIZE;
+    self->count--;
+    }
+  pthread_mutex_unlock (&self->mutex);
+  return n;
+  }
+
+
+/*==========================================================================
+
+  watcher_add_tree
+
+  Watch a directory and all its subdirectories
+
+==========================================================================*/
+static void watcher_add_tree (Watcher *self, const char *dir)
+  {
+  int wd = inotify_add_watch (self->fd, dir, WATCHER_MASK);
+  if (wd < 0)
+    {
+    if (!self->warned)
+      log_warning ("Can't watch %s for changes: %s", dir, strerror (errno));
+    self->warned = TRUE;
+    return;
+    }
+  if (wd >= self->dirs_size)
+    {
+    int old = self->dirs_size;
+    self->dirs_size = wd + 256;
+    self->dirs = realloc (self->dirs, self->dirs_size * sizeof (char *));
+    memset (self->dirs + old, 0, (self->dirs_size - old) * sizeof (char *));
+    }
+  if (self->dirs[wd])
+    free (self->dirs[wd]);
+  else
+    self->watch_count++;
+  self->dirs[wd] = strdup (dir);
+
+  DIR *d = opendir (dir);
+  if (d)
+    {
+    struct dirent *de;
+    while ((de = readdir (d)) && !self->stop)
+      {
+      if (de->d_name[0] == '.') continue;
+      unsigned char type = de->d_type;
+      if (type != DT_DIR && type != DT_UNKNOWN) continue;
+      char *path;
+      asprintf (&path, "%s/%s", dir, de->d_name);
+      struct stat sb;
+      if (type == DT_DIR || (lstat (path, &sb) == 0 && S_ISDIR (sb.st_mode)))
+        watcher_add_tree (self, path);
+      free (path);
+      }
+    closedir (d);
+    }
+  }
+
+
+/*==========================================================================
+
+  watcher_remove_tree
+
+  Stop watching a directory that has been moved away, and its
+  subdirectories
+
+==========================================================================*/
+static void watcher_remove_tree (Watcher *self, const char *dir)
+  {
+  size_t len = strlen (dir);
+  for (int wd = 0; wd < self->dirs_size; wd++)
+    {
+    const char *d = self->dirs[wd];
+    if (d && strncmp (d, dir, len) == 0 && (d[len] == 0 || d[len] == '/'))
+      {
+      inotify_rm_watch (self->fd, wd);
+      free (self->dirs[wd]);
+      self->dirs[wd] = NULL;
+      self->watch_count--;
+      }
+    }
+  }
+
+
+/*==========================================================================
+
+  watcher_handle_event
+
+==========================================================================*/
+static void watcher_handle_event (Watcher *self,
+      const struct inotify_event *ev)
+  {
+  if (ev->mask & IN_Q_OVERFLOW)
+    {
+    watcher_push (self, WATCHER_OVERFLOW, FALSE, NULL);
+    return;
+    }
+  if (ev->wd < 0 || ev->wd >= self->dirs_size || !self->dirs[ev->wd])
+    return;
+  if (ev->mask & IN_IGNORED)
+    {
+    // The directory has gone
+    free (self->dirs[ev->wd]);
+    self->dirs[ev->wd] = NULL;
+    self->watch_count--;
+    return;
+    }
+  if (ev->len == 0 || ev->name[0] == '.') return;
+
+  char *path;
+  asprintf (&path, "%s/%s", self->dirs[ev->wd], ev->name);
+  if (ev->mask & IN_ISDIR)
+    {
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+      {
+      watcher_add_tree (self, path);
+      watcher_push (self, WATCHER_ADDED, TRUE, path);
+      }
+    else if (ev->mask & IN_MOVED_FROM)
+      {
+      watcher_remove_tree (self, path);
+      watcher_push (self, WATCHER_REMOVED, TRUE, path);
+      }
+    else if (ev->mask & IN_DELETE)
+      watcher_push (self, WATCHER_REMOVED, TRUE, path);
+    else
+      free (path);
+    }
+  else
+    {
+    if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+      watcher_push (self, WATCHER_ADDED, FALSE, path);
+    else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+      watcher_push (self, WATCHER_REMOVED, FALSE, path);
+    else
+      free (path); // Created but not yet written
+    }
+  }
+
+
+/*==========================================================================
+
+  watcher_thread
+
+==========================================================================*/
+static void *watcher_thread (void *arg)
+  {
+  LOG_IN
+  Watcher *self = (Watcher *)arg;
+  char *roots = strdup (self->roots);
+  char *save;
+  for (char *root = strtok_r (roots, ",", &save); root && !self->stop;
+        root = strtok_r (NULL, ",", &save))
+    watcher_add_tree (self, root);
+  free (roots);
+  log_debug ("%s: watching %d directories", __PRETTY_FUNCTION__,
+    self->watch_count);
+
+  char buff[65536] 
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  while (!self->stop)
+    {
+    struct pollfd pfd = {self->fd, POLLIN, 0};
+    if (poll (&pfd, 1, 500) <= 0) continue;
+    ssize_t n = read (self->fd, buff, sizeof (buff));
+    for (char *p = buff; n > 0 && p < buff + n; )
+      {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      watcher_handle_event (self, ev);
+      p += sizeof (struct inotify_event) + ev->len;
+      }
+    }
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  watcher_start
+
+==========================================================================*/
+BOOL watcher_start (Watcher *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  self->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (self->fd >= 0)
+    {
+    self->thread_running = TRUE;
+    pthread_create (&self->thread, NULL, watcher_thread, self);
+    ret = TRUE;
+    }
+  else
+    asprintf (error, "Can't start inotify: %s", strerror (errno));
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  watcher_get_watch_count
+
+==========================================================================*/
+int watcher_get_watch_count (Watcher *self)
+  {
+  return self->watch_count;
+  }
+
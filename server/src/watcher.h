@@ -0,0 +1,54 @@
+/*============================================================================
+
+  xine-server
+  watcher.h
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+struct _Watcher;
+typedef struct _Watcher Watcher;
+
+typedef enum
+  {
+  // A file was written, or a file or directory was created or moved
+  //  into a watched directory
+  WATCHER_ADDED = 0,
+  // A file or directory was deleted, or moved out of a watched directory
+  WATCHER_REMOVED,
+  // Events were lost, because the queue was full or the kernel's queue
+  //  overflowed. The watcher's client should rescan everything
+  WATCHER_OVERFLOW
+  } WatcherEventType;
+
+typedef struct _WatcherEvent
+  {
+  WatcherEventType type;
+  BOOL is_dir;
+  char *path; // NULL for WATCHER_OVERFLOW
+  } WatcherEvent;
+
+BEGIN_DECLS
+
+// 'roots' is a comma-separated list of directories, all of whose
+//  subdirectories are watched
+Watcher  *watcher_create (const char *roots);
+void      watcher_destroy (Watcher *self);
+
+// Start the watcher thread. Returns FALSE if inotify is not available
+BOOL      watcher_start (Watcher *self, char **error);
+
+// Wait up to 'msec' for events, and take up to 'max' of them from the
+//  queue. Returns the number taken. The caller must free each event's
+//  path
+int       watcher_get_events (Watcher *self, WatcherEvent *events,
+              int max, int msec);
+
+int       watcher_get_watch_count (Watcher *self);
+
+END_DECLS
+
@@ -18,6 +18,7 @@
 #include <netdb.h>
 #include <errno.h>
 #include <pthread.h>
+#include <math.h>
 #include <xine.h> 
 #include "feature.h" 
 #include "defs.h" 
@@ -25,17 +26,58 @@
 #include "string.h" 
 #include "../../api/xine-server-api.h" 
 #include "xine_interface.h" 
+#include "audiotap.h" 
+#include "broadcast.h" 
+
+// How often the ramp thread steps the volume and fade while either is
+//  changing
+#define XINE_INTERFACE_RAMP_TICK_MSEC 10
+
+// Amp level at which Xine neither cuts nor boosts the signal, and the
+//  greatest level it allows, which is a gain of about 6 dB
+#define XINE_INTERFACE_AMP_UNITY 100
+#define XINE_INTERFACE_AMP_MAX 200
+
+// How long the level meter keeps measuring after a client last asked
+//  for levels
+#define XINE_INTERFACE_LEVELS_LEASE_MSEC 3000
 
 struct _XineInterface
   {
   // Xine stuff
   xine_t *xine;
+  // NULL until Xine has been initialized. Each use of the stream holds
+  //   stream_lock for reading (see xine_interface_lock_stream), and it
+  //   is only set, or replaced, by a thread holding it for writing
   xine_stream_t *stream;
+  pthread_rwlock_t stream_lock;
   xine_audio_port_t *ao_port;
-  xine_video_port_t *vo_port;
   xine_event_queue_t *event_queue;
-  // inited == true when Xine has been initialized
+  // inited == true when Xine has been initialized. Protected by 
+  //   init_mutex
   BOOL inited;
+  // Initialization may run in the background. init_started is set 
+  //   when it begins, and init_done (with init_ok) when it ends. 
+  //   init_cond is signalled at that point
+  pthread_mutex_t init_mutex;
+  pthread_cond_t init_cond;
+  BOOL init_started;
+  BOOL init_done;
+  BOOL init_ok;
+  pthread_t init_thread;
+  BOOL init_thread_running;
+  // Time taken by each startup phase, in usec
+  int64_t usec_new;
+  int64_t usec_config;
+  int64_t usec_init;
+  int64_t usec_audio;
+  int64_t usec_stream;
+  int64_t usec_total;
+  // Volume and EQ set before initialization has finished, to be
+  //   applied when it does. pending_volume is -1 if none was set
+  int pending_volume;
+  int pending_eq[10];
+  BOOL have_pending_eq;
   XineInterfacePlaybackFinishedFn playbackFinishedFn;
   void *playbackFinishedData;
   XineInterfaceProgressFn progressFn;
@@ -48,6 +90,58 @@ struct _XineInterface
   char *config_file; // May be NULL, if none needed
   char *driver; // May be NULL, to use default 
   BOOL buffering; // Set when receive a buffering event
+  // For a zone, the interface whose xine_t we share. NULL if this
+  //   interface owns (and must eventually exit) its own engine
+  XineInterface *engine;
+  // The MRL most recently passed to play_stream(), or NULL. Protected
+  //   by mrl_mutex, because it is read by the clock sync thread
+  char *mrl;
+  pthread_mutex_t mrl_mutex;
+  // A second stream, with no audio output, for reading metadata from
+  //   items that are not playing. Created when first needed
+  xine_stream_t *probe_stream;
+  pthread_mutex_t probe_mutex;
+  // Ramps, run by ramp_thread so that changes of volume, and starting 
+  //   and stopping, do not click. Each 'current' value moves towards
+  //   its 'target' at a rate at which a change from 0 to 100 takes 
+  //   ramp_msec. The volume is Xine's mixer volume; the fade is the 
+  //   amp level, which is gain_level except while fading.
+  //   A new target simply replaces the old one, so changes that arrive
+  //   during a ramp make it change direction, rather than queue. 
+  //   Protected by ramp_mutex. ramp_cond is signalled when a target
+  //   changes, and broadcast at each step. If ramp_msec is zero, there
+  //   is no thread, and changes are applied immediately
+  int ramp_msec;
+  pthread_mutex_t ramp_mutex;
+  pthread_cond_t ramp_cond;
+  pthread_t ramp_thread;
+  BOOL ramp_thread_running;
+  BOOL ramp_stop;
+  double volume_current;
+  int volume_target;
+  double fade_current;
+  int fade_target;
+  // The amp level at which items play, which is XINE_INTERFACE_AMP_UNITY
+  //   unless loudness normalization has set a gain for the item. 
+  //   Protected by ramp_mutex
+  int gain_level;
+  // Level meter. It is wired in between the stream and the audio port
+  //   when a client first asks for levels, and taken out again when 
+  //   an item starts, or playback stops, if no client has asked for
+  //   levels within the lease. NULL when not wired. levels_rate is the
+  //   number of measurements a second, or zero if the meter is 
+  //   disabled. Protected by tap_mutex
+  AudioTap *tap;
+  int levels_rate;
+  pthread_mutex_t tap_mutex;
+  // Network broadcast, if enabled. Not owned. It is wired in between the
+  //  stream (or the level meter) and the audio port when Xine is 
+  //  initialized, and stays there; 'broadcasting' is set when it is
+  Broadcast *broadcast;
+  BOOL broadcasting;
+  // Whether Xine should keep playing audio when the fine speed is 
+  //  not normal, rather than muting it. Set before initialization
+  BOOL fine_speed_audio;
   }; 
 
 
@@ -64,10 +158,24 @@ XineInterface *xine_interface_create (const char *driver,
   XineInterface *self = malloc (sizeof (XineInterface));
   self->xine = NULL;
   self->stream = NULL;
+  pthread_rwlock_init (&self->stream_lock, NULL);
   self->ao_port = NULL;
-  self->vo_port = NULL;
   self->event_queue = NULL;
   self->inited = FALSE;
+  pthread_mutex_init (&self->init_mutex, NULL);
+  pthread_cond_init (&self->init_cond, NULL);
+  self->init_started = FALSE;
+  self->init_done = FALSE;
+  self->init_ok = FALSE;
+  self->init_thread_running = FALSE;
+  self->usec_new = 0;
+  self->usec_config = 0;
+  self->usec_init = 0;
+  self->usec_audio = 0;
+  self->usec_stream = 0;
+  self->usec_total = 0;
+  self->pending_volume = -1;
+  self->have_pending_eq = FALSE;
   self->playbackFinishedFn = NULL;
   self->playbackFinishedData = NULL;
   self->progressFn = NULL;
@@ -82,11 +190,125 @@ XineInterface *xine_interface_create (const char *driver,
   else
     self->driver = NULL; 
   self->buffering = FALSE;
+  self->engine = NULL;
+  self->mrl = NULL;
+  pthread_mutex_init (&self->mrl_mutex, NULL);
+  self->probe_stream = NULL;
+  pthread_mutex_init (&self->probe_mutex, NULL);
+  self->ramp_msec = XINE_INTERFACE_DEF_RAMP_MSEC;
+  pthread_mutex_init (&self->ramp_mutex, NULL);
+  pthread_cond_init (&self->ramp_cond, NULL);
+  self->ramp_thread_running = FALSE;
+  self->ramp_stop = FALSE;
+  self->volume_current = 0;
+  self->volume_target = 0;
+  self->fade_current = XINE_INTERFACE_AMP_UNITY;
+  self->fade_target = XINE_INTERFACE_AMP_UNITY;
+  self->gain_level = XINE_INTERFACE_AMP_UNITY;
+  self->tap = NULL;
+  self->levels_rate = AUDIOTAP_DEF_RATE;
+  pthread_mutex_init (&self->tap_mutex, NULL);
+  self->broadcast = NULL;
+  self->broadcasting = FALSE;
+  self->fine_speed_audio = FALSE;
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_create_zone
+
+  Create an interface that shares the Xine engine of an existing one,
+  but has its own audio port and stream. This avoids a second plugin
+  scan when several zones are served by one process. The engine
+  interface must outlive the zone, and must have been initialized
+  before xine_interface_init() is called on the zone.
+
+==========================================================================*/
+XineInterface *xine_interface_create_zone (XineInterface *engine,
+        const char *driver)
+  {
+  LOG_IN
+  XineInterface *self = xine_interface_create (driver, NULL);
+  self->engine = engine;
+  self->ramp_msec = engine->ramp_msec;
+  self->levels_rate = engine->levels_rate;
   LOG_OUT
   return self;
   }
 
 
+/*==========================================================================
+
+  xine_interface_get_output_port
+
+  The port that the stream, or the level meter, should output to
+
+==========================================================================*/
+static xine_audio_port_t *xine_interface_get_output_port 
+       (const XineInterface *self)
+  {
+  if (self->broadcasting)
+    return broadcast_get_input (self->broadcast);
+  return self->ao_port;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_lock_stream
+
+  Returns the stream, or NULL if Xine is not initialized, locked so 
+  that it can't be replaced until xine_interface_unlock_stream(). The
+  lock is taken before ramp_mutex and tap_mutex, and not taken again
+  by the thread that holds it
+
+==========================================================================*/
+static xine_stream_t *xine_interface_lock_stream (const XineInterface *self)
+  {
+  pthread_rwlock_rdlock ((pthread_rwlock_t *)&self->stream_lock);
+  return self->stream;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_unlock_stream
+
+==========================================================================*/
+static void xine_interface_unlock_stream (const XineInterface *self)
+  {
+  pthread_rwlock_unlock ((pthread_rwlock_t *)&self->stream_lock);
+  }
+
+
+/*==========================================================================
+
+  xine_interface_release_tap
+
+  Take the level meter out of the stream, if it is in, and either 
+  'force' is set or its lease has run out. The caller holds the 
+  stream lock
+
+==========================================================================*/
+static void xine_interface_release_tap (XineInterface *self, 
+       xine_stream_t *stream, BOOL force)
+  {
+  pthread_mutex_lock (&self->tap_mutex);
+  if (self->tap && (force || !audiotap_is_leased (self->tap)))
+    {
+    log_debug ("%s: removing level meter", __PRETTY_FUNCTION__);
+    xine_post_wire_audio_port (xine_get_audio_source (stream), 
+      xine_interface_get_output_port (self));
+    audiotap_destroy (self->tap);
+    self->tap = NULL;
+    }
+  pthread_mutex_unlock (&self->tap_mutex);
+  }
+
+
 /*==========================================================================
 
   xine_interface_destroy
@@ -98,6 +320,29 @@ void xine_interface_destroy (XineInterface *self)
   log_debug ("%s: Destroying Xine interface", __PRETTY_FUNCTION__); 
   if (self)
     {
+    if (self->init_thread_running)
+      pthread_join (self->init_thread, NULL);
+    if (self->ramp_thread_running)
+      {
+      pthread_mutex_lock (&self->ramp_mutex);
+      self->ramp_stop = TRUE;
+      pthread_cond_broadcast (&self->ramp_cond);
+      pthread_mutex_unlock (&self->ramp_mutex);
+      pthread_join (self->ramp_thread, NULL);
+      }
+    pthread_mutex_destroy (&self->ramp_mutex);
+    pthread_cond_destroy (&self->ramp_cond);
+    xine_interface_release_tap (self, self->stream, TRUE);
+    pthread_mutex_destroy (&self->tap_mutex);
+    if (self->broadcasting)
+      {
+      xine_post_wire_audio_port (xine_get_audio_source (self->stream), 
+        self->ao_port);
+      broadcast_detach (self->broadcast);
+      }
+    if (self->probe_stream)
+      xine_dispose (self->probe_stream);
+    pthread_mutex_destroy (&self->probe_mutex);
     if (self->stream)
       {
       log_debug ("%s: Closing Xine stream", __PRETTY_FUNCTION__); 
@@ -119,12 +364,7 @@ void xine_interface_destroy (XineInterface *self)
       xine_close_audio_driver (self->xine, self->ao_port);
       }
     self->ao_port = NULL;
-    if (self->vo_port) 
-      {
-      log_debug ("%s: Closing video driver", __PRETTY_FUNCTION__); 
-      xine_close_video_driver (self->xine, self->vo_port);
-      }
-    if (self->xine)
+    if (self->xine && !self->engine)
       {
       log_debug ("%s: Closing Xine", __PRETTY_FUNCTION__); 
       xine_exit (self->xine); 
@@ -133,6 +373,12 @@ void xine_interface_destroy (XineInterface *self)
       free (self->config_file);
     if (self->driver)
       free (self->driver);
+    if (self->mrl)
+      free (self->mrl);
+    pthread_mutex_destroy (&self->mrl_mutex);
+    pthread_mutex_destroy (&self->init_mutex);
+    pthread_cond_destroy (&self->init_cond);
+    pthread_rwlock_destroy (&self->stream_lock);
     free (self);
     }
   LOG_OUT
@@ -212,10 +458,348 @@ static void xine_interface_event_listener (void *user_data,
   }
 
 
+/*==========================================================================
+
+  xine_interface_usec
+
+  Monotonic time in microseconds, for timing the startup phases
+
+==========================================================================*/
+static int64_t xine_interface_usec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_ramp_towards
+
+  Move a ramp's current value at most 'step' towards its target
+
+==========================================================================*/
+static double xine_interface_ramp_towards (double current, int target, 
+      double step)
+  {
+  if (current < target)
+    return current + step < target ? current + step : target;
+  return current - step > target ? current - step : target;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_ramp_thread
+
+==========================================================================*/
+static void *xine_interface_ramp_thread (void *arg)
+  {
+  LOG_IN
+  XineInterface *self = (XineInterface *)arg;
+  pthread_mutex_lock (&self->ramp_mutex);
+  int64_t last = xine_interface_usec ();
+  while (!self->ramp_stop)
+    {
+    if (self->volume_current == self->volume_target 
+         && self->fade_current == self->fade_target)
+      {
+      pthread_cond_wait (&self->ramp_cond, &self->ramp_mutex);
+      last = xine_interface_usec ();
+      continue;
+      }
+    pthread_mutex_unlock (&self->ramp_mutex);
+    usleep (XINE_INTERFACE_RAMP_TICK_MSEC * 1000);
+    // Hold the stream for the step, so it can't be replaced under us 
+    //  by a change of driver
+    xine_stream_t *stream = xine_interface_lock_stream (self);
+    pthread_mutex_lock (&self->ramp_mutex);
+
+    int64_t now = xine_interface_usec ();
+    double step = 100.0 * (now - last) / (self->ramp_msec * 1000.0);
+    last = now;
+    int old_volume = (int)(self->volume_current + 0.5);
+    int old_fade = (int)(self->fade_current + 0.5);
+    self->volume_current = xine_interface_ramp_towards 
+      (self->volume_current, self->volume_target, step);
+    self->fade_current = xine_interface_ramp_towards 
+      (self->fade_current, self->fade_target, step);
+    int volume = (int)(self->volume_current + 0.5);
+    int fade = (int)(self->fade_current + 0.5);
+    if (stream && volume != old_volume)
+      xine_set_param (stream, XINE_PARAM_AUDIO_VOLUME, volume);
+    if (stream && fade != old_fade)
+      xine_set_param (stream, XINE_PARAM_AUDIO_AMP_LEVEL, fade);
+    pthread_cond_broadcast (&self->ramp_cond);
+    xine_interface_unlock_stream (self);
+    }
+  pthread_mutex_unlock (&self->ramp_mutex);
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_set_fade
+
+  Set the amp level. If 'ramp' is set, and ramps are enabled, the 
+  level changes gradually; if 'wait' is also set, this waits until
+  it has reached the new level. Otherwise it changes at once 
+
+==========================================================================*/
+static void xine_interface_set_fade (XineInterface *self, int level,
+      BOOL ramp, BOOL wait)
+  {
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  pthread_mutex_lock (&self->ramp_mutex);
+  self->fade_target = level;
+  if (ramp && self->ramp_thread_running)
+    {
+    // The ramp thread needs the stream lock to make progress
+    xine_interface_unlock_stream (self);
+    pthread_cond_broadcast (&self->ramp_cond);
+    if (wait)
+      {
+      // Don't wait for ever if the thread can't keep up
+      struct timespec ts;
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_sec += 1 + self->ramp_msec / 1000;
+      while (self->fade_current != level && !self->ramp_stop)
+        {
+        if (pthread_cond_timedwait (&self->ramp_cond, &self->ramp_mutex, 
+             &ts) != 0) break;
+        }
+      }
+    }
+  else
+    {
+    self->fade_current = level;
+    if (stream)
+      xine_set_param (stream, XINE_PARAM_AUDIO_AMP_LEVEL, level);
+    xine_interface_unlock_stream (self);
+    }
+  pthread_mutex_unlock (&self->ramp_mutex);
+  }
+
+
+/*==========================================================================
+
+  xine_interface_is_audible
+
+  TRUE if a stream is playing, and not paused -- that is, if stopping
+  it now would be heard. The caller holds the stream lock
+
+==========================================================================*/
+static BOOL xine_interface_is_audible (XineInterface *self, 
+       xine_stream_t *stream)
+  {
+  return stream && self->playback_started
+    && xine_get_param (stream, XINE_PARAM_SPEED) != XINE_SPEED_PAUSE;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_get_gain_level
+
+==========================================================================*/
+static int xine_interface_get_gain_level (XineInterface *self)
+  {
+  pthread_mutex_lock (&self->ramp_mutex);
+  int ret = self->gain_level;
+  pthread_mutex_unlock (&self->ramp_mutex);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_set_gain
+
+  Xine's amp level is a linear scale, so a gain in dB becomes 
+  100 * 10^(dB/20), limited to the range Xine accepts
+
+==========================================================================*/
+void xine_interface_set_gain (XineInterface *self, double db)
+  {
+  int level = (int)(XINE_INTERFACE_AMP_UNITY * pow (10, db / 20) + 0.5);
+  if (level < 0) level = 0;
+  if (level > XINE_INTERFACE_AMP_MAX) level = XINE_INTERFACE_AMP_MAX;
+  log_debug ("%s: gain %.2f dB, amp level %d", __PRETTY_FUNCTION__, 
+    db, level);
+  pthread_mutex_lock (&self->ramp_mutex);
+  self->gain_level = level;
+  pthread_mutex_unlock (&self->ramp_mutex);
+  }
+
+
+/*==========================================================================
+
+  xine_interface_set_levels_rate
+
+==========================================================================*/
+void xine_interface_set_levels_rate (XineInterface *self, int rate)
+  {
+  self->levels_rate = rate > 0 ? rate : 0;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_set_fine_speed_audio
+
+==========================================================================*/
+void xine_interface_set_fine_speed_audio (XineInterface *self, BOOL enable)
+  {
+  self->fine_speed_audio = enable;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_enable_fine_speed_audio
+
+  Xine only plays audio at other than normal speed if 
+  audio.synchronization.slow_fast_audio is set, and the audio output
+  reads the setting when it is opened. So this has to be done between
+  initializing the engine and opening the audio driver. The setting
+  belongs to the engine, so zones sharing it follow suit
+
+==========================================================================*/
+static void xine_interface_enable_fine_speed_audio (XineInterface *self)
+  {
+  static const char *key = "audio.synchronization.slow_fast_audio";
+  xine_cfg_entry_t entry;
+  xine_config_register_bool (self->xine, key, 0, 
+    "play audio even on slow/fast speeds", NULL, 10, NULL, NULL);
+  if (xine_config_lookup_entry (self->xine, key, &entry))
+    {
+    if (!entry.num_value)
+      {
+      log_info ("Enabling %s, for speed adjustment", key);
+      entry.num_value = 1;
+      xine_config_update_entry (self->xine, &entry);
+      }
+    }
+  else
+    log_warning ("Can't enable %s; audio will be muted while the "
+      "speed is adjusted", key);
+  }
+
+
+/*==========================================================================
+
+  xine_interface_set_broadcast
+
+==========================================================================*/
+void xine_interface_set_broadcast (XineInterface *self, Broadcast *broadcast)
+  {
+  self->broadcast = broadcast;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_start_broadcast
+
+  Wire the broadcast in between a new stream and the audio port. If 
+  that fails, audio still plays, but is not broadcast
+
+==========================================================================*/
+static void xine_interface_start_broadcast (XineInterface *self,
+       xine_stream_t *stream)
+  {
+  LOG_IN
+  if (broadcast_attach (self->broadcast, self->xine, self->ao_port))
+    {
+    if (xine_post_wire_audio_port (xine_get_audio_source (stream), 
+          broadcast_get_input (self->broadcast)))
+      {
+      log_debug ("%s: inserted broadcast", __PRETTY_FUNCTION__);
+      self->broadcasting = TRUE;
+      }
+    else
+      broadcast_detach (self->broadcast);
+    }
+  if (!self->broadcasting)
+    log_error ("Can't capture audio for broadcast");
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  xine_interface_get_levels
+
+==========================================================================*/
+BOOL xine_interface_get_levels (XineInterface *self, XSLevels *levels,
+       char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  if (self->levels_rate <= 0)
+    {
+    if (error) asprintf (error, "Level meter is disabled");
+    }
+  else if (xine_interface_wait_ready (self, error))
+    {
+    xine_stream_t *stream = xine_interface_lock_stream (self);
+    pthread_mutex_lock (&self->tap_mutex);
+    if (!self->tap)
+      {
+      AudioTap *tap = audiotap_create (self->xine, 
+        xine_interface_get_output_port (self), self->levels_rate);
+      if (tap && xine_post_wire_audio_port 
+            (xine_get_audio_source (stream), audiotap_get_input (tap)))
+        {
+        log_debug ("%s: inserted level meter", __PRETTY_FUNCTION__);
+        self->tap = tap;
+        }
+      else
+        {
+        if (tap) audiotap_destroy (tap);
+        if (error) asprintf (error, "Can't start level meter");
+        }
+      }
+    if (self->tap)
+      {
+      audiotap_set_lease (self->tap, XINE_INTERFACE_LEVELS_LEASE_MSEC);
+      audiotap_get_levels (self->tap, levels);
+      ret = TRUE;
+      }
+    pthread_mutex_unlock (&self->tap_mutex);
+    xine_interface_unlock_stream (self);
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_set_ramp_msec
+
+==========================================================================*/
+void xine_interface_set_ramp_msec (XineInterface *self, int msec)
+  {
+  self->ramp_msec = msec > 0 ? msec : 0;
+  }
+
+
 /*==========================================================================
 
   xine_interface_init
 
+  Initialize the Xine engine (unless this interface is a zone sharing
+  another's engine), open the audio driver, and create the stream. 
+  No video driver is opened -- this is an audio server, and opening
+  even the 'none' video driver costs time at startup. 
+
+  For a zone, this waits for the engine interface to finish its own
+  initialization, which may be running in the background.
+
 ==========================================================================*/
 BOOL xine_interface_init (XineInterface *self, 
          char **error) 
@@ -224,43 +808,106 @@ BOOL xine_interface_init (XineInterface *self,
   BOOL ret = TRUE; 
   // Note -- driver arg may be NULL
 
-  if (!self->inited)
+  pthread_mutex_lock (&self->init_mutex);
+  self->init_started = TRUE;
+  BOOL inited = self->inited;
+  pthread_mutex_unlock (&self->init_mutex);
+
+  if (self->engine && !xine_interface_wait_ready (self->engine, NULL))
+    {
+    log_error ("%s: Shared Xine engine is not initialized", 
+      __PRETTY_FUNCTION__);
+    if (error) asprintf (error, "Shared Xine engine is not initialized");
+    ret = FALSE;
+    }
+  else if (!inited)
     {
     log_debug ("%s: Initializing Xine interface", __PRETTY_FUNCTION__);
-    self->xine = xine_new();
-
-    if (self->config_file)
+    int64_t t0 = xine_interface_usec ();
+    int64_t t = t0;
+    if (self->engine)
       {
-      log_debug ("%s: loading config file %s", __PRETTY_FUNCTION__, 
-        self->config_file);
-      xine_config_load (self->xine, self->config_file);
+      log_debug ("%s: Sharing existing Xine engine", __PRETTY_FUNCTION__);
+      self->xine = self->engine->xine;
       }
-    xine_init (self->xine);
-
-    log_debug ("%s: Opening audio driver", __PRETTY_FUNCTION__);
-    self->ao_port = xine_open_audio_driver 
-	(self->xine, self->driver, NULL);
-    if (self->ao_port) 
-      log_debug ("%s: Opened audio port", __PRETTY_FUNCTION__);
     else
       {
-      log_error ("%s: Can't open audio port", __PRETTY_FUNCTION__);
-      asprintf (error, "Can't open audio port");
+      self->xine = xine_new();
+      self->usec_new = xine_interface_usec () - t;
+      t += self->usec_new;
+      if (!self->xine)
+        {
+        log_error ("%s: Can't create Xine engine", __PRETTY_FUNCTION__);
+        if (error) asprintf (error, "Can't create Xine engine");
+        ret = FALSE;
+        }
       }
 
-    log_debug ("%s: Opening video driver", __PRETTY_FUNCTION__);
-    self->vo_port = xine_open_video_driver 
-	(self->xine, NULL, XINE_VISUAL_TYPE_NONE, NULL);
+    if (ret && !self->engine)
+      {
+      if (self->config_file)
+        {
+        log_debug ("%s: loading config file %s", __PRETTY_FUNCTION__, 
+          self->config_file);
+        xine_config_load (self->xine, self->config_file);
+        }
+      self->usec_config = xine_interface_usec () - t;
+      t += self->usec_config;
+
+      // This is the slow part, if Xine has to scan its plugins 
+      //  because it can't use its plugin cache
+      xine_init (self->xine);
+      self->usec_init = xine_interface_usec () - t;
+      t += self->usec_init;
+      if (self->fine_speed_audio)
+        xine_interface_enable_fine_speed_audio (self);
+      }
 
-    log_debug ("%s: Creating Xine stream", __PRETTY_FUNCTION__);
-    self->stream = xine_stream_new (self->xine, self->ao_port, 
-      self->vo_port);
+    xine_stream_t *stream = NULL;
+    if (ret)
+      {
+      log_debug ("%s: Opening audio driver", __PRETTY_FUNCTION__);
+      self->ao_port = xine_open_audio_driver 
+	  (self->xine, self->driver, NULL);
+      if (self->ao_port) 
+        log_debug ("%s: Opened audio port", __PRETTY_FUNCTION__);
+      else
+        log_error ("%s: Can't open audio port", __PRETTY_FUNCTION__);
+      self->usec_audio = xine_interface_usec () - t;
+      t += self->usec_audio;
 
-    self->event_queue = xine_event_new_queue (self->stream);
-    xine_event_create_listener_thread (self->event_queue, 
-	xine_interface_event_listener, self);
+      log_debug ("%s: Creating Xine stream", __PRETTY_FUNCTION__);
+      stream = xine_stream_new (self->xine, self->ao_port, NULL);
+      if (!stream)
+        {
+        log_error ("%s: Can't create Xine stream", __PRETTY_FUNCTION__);
+        if (error) asprintf (error, "Can't create Xine stream");
+        ret = FALSE;
+        }
+      }
 
-    self->inited = TRUE;
+    if (stream)
+      {
+      xine_set_param (stream, XINE_PARAM_IGNORE_VIDEO, 1);
+      self->event_queue = xine_event_new_queue (stream);
+      xine_event_create_listener_thread (self->event_queue, 
+	  xine_interface_event_listener, self);
+      self->usec_stream = xine_interface_usec () - t;
+      self->usec_total = xine_interface_usec () - t0;
+
+      log_info ("Xine started in %d msec (new %d, config %d, init %d, "
+        "audio %d, stream %d)", (int)(self->usec_total / 1000), 
+        (int)(self->usec_new / 1000), (int)(self->usec_config / 1000), 
+        (int)(self->usec_init / 1000), (int)(self->usec_audio / 1000), 
+        (int)(self->usec_stream / 1000));
+
+      if (self->broadcast && self->ao_port)
+        xine_interface_start_broadcast (self, stream);
+      pthread_rwlock_wrlock (&self->stream_lock);
+      self->stream = stream;
+      pthread_rwlock_unlock (&self->stream_lock);
+      inited = TRUE;
+      }
     }
   else
     {
@@ -268,6 +915,38 @@ BOOL xine_interface_init (XineInterface *self,
           __PRETTY_FUNCTION__);
     }
 
+  pthread_mutex_lock (&self->init_mutex);
+  self->inited = inited;
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  if (ret && stream)
+    {
+    if (self->pending_volume >= 0)
+      xine_set_param (stream, XINE_PARAM_AUDIO_VOLUME, 
+        self->pending_volume);
+    pthread_mutex_lock (&self->ramp_mutex);
+    self->volume_target = xine_get_param (stream, 
+      XINE_PARAM_AUDIO_VOLUME);
+    self->volume_current = self->volume_target;
+    if (self->ramp_msec > 0 && !self->ramp_thread_running)
+      {
+      self->ramp_thread_running = TRUE;
+      pthread_create (&self->ramp_thread, NULL, 
+        xine_interface_ramp_thread, self);
+      }
+    pthread_mutex_unlock (&self->ramp_mutex);
+    if (self->have_pending_eq)
+      {
+      for (int i = 0; i < 10; i++) 
+        xine_set_param (stream, XINE_PARAM_EQ_30HZ + i, 
+          self->pending_eq[i]);
+      }
+    }
+  xine_interface_unlock_stream (self);
+  self->init_done = TRUE;
+  self->init_ok = ret;
+  pthread_cond_broadcast (&self->init_cond);
+  pthread_mutex_unlock (&self->init_mutex);
+
   LOG_OUT
   return ret;
   }
@@ -275,36 +954,144 @@ BOOL xine_interface_init (XineInterface *self,
 
 /*==========================================================================
 
-  xine_interface_get_metadata
+  xine_interface_init_thread
 
-  This is a thin wrapper on xine_get_meta_info. It takes care
-  of returning a "-" when nothing is playing, or if the data 
-  returned by Xine is null.
+==========================================================================*/
+static void *xine_interface_init_thread (void *arg)
+  {
+  LOG_IN
+  XineInterface *self = (XineInterface *)arg;
+  char *error = NULL;
+  if (!xine_interface_init (self, &error))
+    {
+    log_error ("Can't initialize Xine: %s", error);
+    }
+  if (error) free (error);
+  LOG_OUT
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_init_async
+
+  Start xine_interface_init() on a background thread, so that the 
+  server can accept commands while Xine is starting. Operations that
+  need Xine wait for the initialization to finish; those that only 
+  report on it behave as if nothing is playing.
 
 ==========================================================================*/
-const char *xine_interface_get_meta_info
-                 (const XineInterface *self, int key)
+void xine_interface_init_async (XineInterface *self)
   {
   LOG_IN
-  const char *ret = "-";
-  if (self->stream)
+  pthread_mutex_lock (&self->init_mutex);
+  self->init_started = TRUE;
+  self->init_thread_running = TRUE;
+  pthread_mutex_unlock (&self->init_mutex);
+  pthread_create (&self->init_thread, NULL, 
+    xine_interface_init_thread, self);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  xine_interface_wait_ready
+
+  Wait for initialization to finish, if it is in progress. Returns FALSE
+  if initialization was never started, or failed.
+
+==========================================================================*/
+BOOL xine_interface_wait_ready (XineInterface *self, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  BOOL failed = FALSE;
+  pthread_mutex_lock (&self->init_mutex);
+  if (self->init_started)
     {
-    if (self->playback_started)
-      {
-      const char *value = xine_get_meta_info (self->stream, key); 
-      if (value) 
-        {
-        if (strlen (value) > 0)
-          ret = value;
-        else
-          value = "-";
-        }
-      else
-        ret = "-";
-      }
+    while (!self->init_done)
+      pthread_cond_wait (&self->init_cond, &self->init_mutex);
+    ret = self->init_ok;
+    failed = !ret;
     }
-  return ret; 
+  pthread_mutex_unlock (&self->init_mutex);
+  if (!ret && error)
+    asprintf (error, failed ? "Xine could not be initialized" 
+      : "Xine is not initialized");
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_has_failed
+
+  TRUE if initialization has finished, and failed. Unlike 
+  xine_interface_wait_ready(), this does not wait
+
+==========================================================================*/
+BOOL xine_interface_has_failed (XineInterface *self)
+  {
+  pthread_mutex_lock (&self->init_mutex);
+  BOOL ret = self->init_done && !self->init_ok;
+  pthread_mutex_unlock (&self->init_mutex);
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_get_startup_stats
+
+  Append the time taken by each startup phase, in msec, to the string
+  in the name=value form used by the 'stats' command
+
+==========================================================================*/
+void xine_interface_get_startup_stats (XineInterface *self, String *s)
+  {
+  LOG_IN
+  pthread_mutex_lock (&self->init_mutex);
+  BOOL done = self->init_done;
+  pthread_mutex_unlock (&self->init_mutex);
+  string_append_printf (s, " xine-ready=%d", done);
+  if (done)
+    {
+    string_append_printf (s, " startup-new-ms=%d startup-config-ms=%d"
+      " startup-init-ms=%d startup-audio-ms=%d startup-stream-ms=%d"
+      " startup-total-ms=%d", 
+      (int)(self->usec_new / 1000), (int)(self->usec_config / 1000), 
+      (int)(self->usec_init / 1000), (int)(self->usec_audio / 1000), 
+      (int)(self->usec_stream / 1000), (int)(self->usec_total / 1000));
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+
+  xine_interface_get_meta_info
+
+  This is a thin wrapper on xine_get_meta_info. It takes care
+  of returning a "-" when nothing is playing, or if the data 
+  returned by Xine is null. The string belongs to the stream, and
+  may be replaced once the stream lock is released, so a copy is
+  returned, which the caller must free.
+
+==========================================================================*/
+char *xine_interface_get_meta_info (const XineInterface *self, int key)
+  {
+  LOG_IN
+  const char *value = NULL;
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  if (stream && self->playback_started)
+    value = xine_get_meta_info (stream, key); 
+  char *ret = strdup (value && value[0] ? value : "-");
+  xine_interface_unlock_stream (self);
   LOG_OUT
+  return ret; 
   }
 
 
@@ -317,9 +1104,12 @@ BOOL xine_interface_seek (XineInterface *self, int msec)
   {
   LOG_IN
   BOOL ret = TRUE;
-  if (self->stream)
+  if (xine_interface_wait_ready (self, NULL))
     {
-    xine_play (self->stream, 0, msec);
+    xine_stream_t *stream = xine_interface_lock_stream (self);
+    if (stream)
+      xine_play (stream, 0, msec);
+    xine_interface_unlock_stream (self);
     }
   return ret; 
   LOG_OUT
@@ -339,13 +1129,15 @@ uint32_t  xine_interface_get_stream_info
   {
   LOG_IN
   uint32_t ret = 0;
-  if (self->stream)
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  if (stream)
     {
     if (self->playback_started)
       {
-      ret = xine_get_stream_info (self->stream, key); 
+      ret = xine_get_stream_info (stream, key); 
       }
     }
+  xine_interface_unlock_stream (self);
   return ret; 
   LOG_OUT
   }
@@ -363,13 +1155,15 @@ uint32_t  xine_interface_is_seekable
   {
   LOG_IN
   BOOL ret = FALSE;
-  if (self->stream)
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  if (stream)
     {
     if (self->playback_started)
       {
-      ret = xine_get_stream_info (self->stream, XINE_STREAM_INFO_SEEKABLE); 
+      ret = xine_get_stream_info (stream, XINE_STREAM_INFO_SEEKABLE); 
       }
     }
+  xine_interface_unlock_stream (self);
   return ret; 
   LOG_OUT
   }
@@ -384,7 +1178,8 @@ XSTransportStatus  xine_interface_get_transport_status (XineInterface *self)
   {
   LOG_IN
   BOOL ret = FALSE;
-  if (self->stream)
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  if (stream)
     {
     if (self->playback_started)
       {
@@ -392,7 +1187,7 @@ XSTransportStatus  xine_interface_get_transport_status (XineInterface *self)
         ret = XINESERVER_TRANSPORT_BUFFERING;
       else
         {
-        int speed = xine_get_param (self->stream, XINE_PARAM_SPEED);
+        int speed = xine_get_param (stream, XINE_PARAM_SPEED);
         log_debug ("XINE_PARAM_SPEED is %d", speed);
         if (speed == 0)
           ret = XINESERVER_TRANSPORT_PAUSED; 
@@ -405,6 +1200,7 @@ XSTransportStatus  xine_interface_get_transport_status (XineInterface *self)
     }
   else
     ret = XINESERVER_TRANSPORT_STOPPED;
+  xine_interface_unlock_stream (self);
   return ret; 
   LOG_OUT
   }
@@ -418,10 +1214,15 @@ XSTransportStatus  xine_interface_get_transport_status (XineInterface *self)
 void xine_interface_pause (XineInterface *self)
   {
   LOG_IN
-  if (self->stream)
-    {
-    xine_set_param (self->stream, XINE_PARAM_SPEED, 0);
-    }
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  BOOL audible = xine_interface_is_audible (self, stream);
+  xine_interface_unlock_stream (self);
+  if (audible)
+    xine_interface_set_fade (self, 0, TRUE, TRUE);
+  stream = xine_interface_lock_stream (self);
+  if (stream)
+    xine_set_param (stream, XINE_PARAM_SPEED, 0);
+  xine_interface_unlock_stream (self);
 
   LOG_OUT
   }
@@ -435,9 +1236,15 @@ void xine_interface_pause (XineInterface *self)
 void xine_interface_resume (XineInterface *self)
   {
   LOG_IN
-  if (self->stream)
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  if (stream)
+    xine_set_param (stream, XINE_PARAM_SPEED, XINE_SPEED_NORMAL);
+  xine_interface_unlock_stream (self);
+  if (stream)
     {
-    xine_set_param (self->stream, XINE_PARAM_SPEED, XINE_SPEED_NORMAL);
+    // Fade in if paused, or if play_stream() faded out what it replaced
+    xine_interface_set_fade (self, xine_interface_get_gain_level (self), 
+      TRUE, FALSE);
     }
 
   LOG_OUT
@@ -454,11 +1261,13 @@ void xine_interface_get_pos_len (const XineInterface *self,
   {
   *pos = 0;
   *len = 0;
-  if (self->stream)
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  if (stream)
     {
     int dummy;
-    xine_get_pos_length (self->stream, &dummy, pos, len);
+    xine_get_pos_length (stream, &dummy, pos, len);
     }
+  xine_interface_unlock_stream (self);
   }
 
 
@@ -471,8 +1280,21 @@ void xine_interface_get_pos_len (const XineInterface *self,
 void xine_interface_stop (XineInterface *self)
   {
   LOG_IN
-  if (self->stream)
-    xine_stop (self->stream);
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  BOOL audible = xine_interface_is_audible (self, stream);
+  xine_interface_unlock_stream (self);
+  if (audible)
+    xine_interface_set_fade (self, 0, TRUE, TRUE);
+  stream = xine_interface_lock_stream (self);
+  if (stream)
+    {
+    xine_stop (stream);
+    xine_interface_release_tap (self, stream, FALSE);
+    }
+  xine_interface_unlock_stream (self);
+  if (stream)
+    xine_interface_set_fade (self, xine_interface_get_gain_level (self), 
+      FALSE, FALSE);
   self->playback_started = FALSE;
   self->buffering = FALSE;
   LOG_OUT
@@ -484,14 +1306,23 @@ void xine_interface_stop (XineInterface *self)
   xine_interface_get_volume
 
 ==========================================================================*/
-int xine_interface_get_volume (const XineInterface *self)
+int xine_interface_get_volume (XineInterface *self)
   {
   LOG_IN
   int ret;
-  if (self->stream)
-    ret = xine_get_param (self->stream, XINE_PARAM_AUDIO_VOLUME);
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  pthread_mutex_lock (&self->ramp_mutex);
+  if (self->ramp_thread_running)
+    {
+    // The volume that was asked for, even if it has not been reached
+    ret = self->volume_target;
+    }
+  else if (stream)
+    ret = xine_get_param (stream, XINE_PARAM_AUDIO_VOLUME);
   else 
     ret = -1;
+  pthread_mutex_unlock (&self->ramp_mutex);
+  xine_interface_unlock_stream (self);
   return ret;
   LOG_OUT
   }
@@ -505,15 +1336,17 @@ int xine_interface_get_volume (const XineInterface *self)
 void xine_interface_get_eq (const XineInterface *self, int eq[10])
   {
   LOG_IN
-  if (self->stream)
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  if (stream)
     {
     for (int i = 0; i < 10; i++) 
-      eq[i] = xine_get_param (self->stream, XINE_PARAM_EQ_30HZ + i);
+      eq[i] = xine_get_param (stream, XINE_PARAM_EQ_30HZ + i);
     }
   else
     {
     for (int i = 0; i < 10; i++) eq[i] = 0;
     }
+  xine_interface_unlock_stream (self);
   LOG_OUT
   }
 
@@ -522,15 +1355,27 @@ void xine_interface_get_eq (const XineInterface *self, int eq[10])
   xine_interface_set_eq
 
 ==========================================================================*/
-void xine_interface_set_eq (const XineInterface *self, int eq[10])
+void xine_interface_set_eq (XineInterface *self, int eq[10])
   {
   LOG_IN
-  if (self->stream)
+  pthread_mutex_lock (&self->init_mutex);
+  BOOL pending = self->init_started && !self->init_done;
+  if (pending)
     {
-    for (int i = 0; i < 10; i++) 
+    // Applied when initialization finishes
+    memcpy (self->pending_eq, eq, sizeof (self->pending_eq));
+    self->have_pending_eq = TRUE;
+    }
+  pthread_mutex_unlock (&self->init_mutex);
+
+  if (!pending && xine_interface_wait_ready (self, NULL))
+    {
+    xine_stream_t *stream = xine_interface_lock_stream (self);
+    for (int i = 0; i < 10 && stream; i++) 
       {
-      xine_set_param (self->stream, XINE_PARAM_EQ_30HZ + i, eq[i]);
+      xine_set_param (stream, XINE_PARAM_EQ_30HZ + i, eq[i]);
       }
+    xine_interface_unlock_stream (self);
     }
   LOG_OUT
   }
@@ -542,9 +1387,29 @@ void xine_interface_set_eq (const XineInterface *self, int eq[10])
 ==========================================================================*/
 void xine_interface_set_volume (XineInterface *self, int volume)
   {
-  if (self->stream)
+  pthread_mutex_lock (&self->init_mutex);
+  BOOL pending = self->init_started && !self->init_done;
+  if (pending)
+    self->pending_volume = volume; // Applied when initialization finishes
+  pthread_mutex_unlock (&self->init_mutex);
+
+  xine_stream_t *stream;
+  if (!pending && xine_interface_wait_ready (self, NULL)
+      && (stream = xine_interface_lock_stream (self)))
     {
-    xine_set_param (self->stream, XINE_PARAM_AUDIO_VOLUME, volume);
+    pthread_mutex_lock (&self->ramp_mutex);
+    self->volume_target = volume;
+    if (self->ramp_thread_running 
+        && xine_interface_is_audible (self, stream))
+      pthread_cond_broadcast (&self->ramp_cond);
+    else
+      {
+      // Nobody will hear the change
+      self->volume_current = volume;
+      xine_set_param (stream, XINE_PARAM_AUDIO_VOLUME, volume);
+      }
+    pthread_mutex_unlock (&self->ramp_mutex);
+    xine_interface_unlock_stream (self);
     }
   }
 
@@ -559,12 +1424,30 @@ BOOL xine_interface_play_stream (XineInterface *self,
   LOG_IN
   int ret = TRUE;
 
-  if (self->stream)
+  if (!xine_interface_wait_ready (self, error))
     {
-    xine_close (self->stream);
+    LOG_OUT
+    return FALSE;
     }
 
-  if (xine_open (self->stream, stream))
+  // Fade out what is playing, if anything. If it is replaced, resume()
+  //  fades the replacement in; an item that follows one that has
+  //  finished, or a stop, starts at full level. Full level includes 
+  //  any gain set for the new item by xine_interface_set_gain()
+  xine_stream_t *xs = xine_interface_lock_stream (self);
+  BOOL audible = xine_interface_is_audible (self, xs);
+  xine_interface_unlock_stream (self);
+  if (audible)
+    xine_interface_set_fade (self, 0, TRUE, TRUE);
+  else
+    xine_interface_set_fade (self, xine_interface_get_gain_level (self), 
+      FALSE, FALSE);
+
+  xs = xine_interface_lock_stream (self);
+  xine_close (xs);
+  xine_interface_release_tap (self, xs, FALSE);
+
+  if (xine_open (xs, stream))
       log_debug ("%s: Xine stream opened for %s", __PRETTY_FUNCTION__,
          stream);
   else
@@ -575,7 +1458,7 @@ BOOL xine_interface_play_stream (XineInterface *self,
     ret = FALSE;
     }
 
-  if (xine_play (self->stream, 0, 0))
+  if (xine_play (xs, 0, 0))
     log_debug ("%s: Playing: %s", __PRETTY_FUNCTION__, stream);
   else
     {
@@ -584,11 +1467,16 @@ BOOL xine_interface_play_stream (XineInterface *self,
     asprintf (error, "xine_play() failed for %s", stream);
     ret = FALSE;
     }
+  xine_interface_unlock_stream (self);
   if (ret) 
     {
     xine_interface_resume (self); // Cancel a previous pause
     log_debug ("Setting status to show playback started");
     self->playback_started = TRUE;
+    pthread_mutex_lock (&self->mrl_mutex);
+    if (self->mrl) free (self->mrl);
+    self->mrl = strdup (stream);
+    pthread_mutex_unlock (&self->mrl_mutex);
     } 
 
   LOG_OUT
@@ -608,4 +1496,301 @@ const char *const *xine_interface_list_audio_drivers
   }
 
 
+/*==========================================================================
+
+  xine_interface_get_driver
+
+  Returns the name of the audio driver in use, or NULL if Xine chose
+  the driver itself
+
+==========================================================================*/
+const char *xine_interface_get_driver (const XineInterface *self)
+  {
+  return self->driver;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_reopen_stream
+
+  Replace the stream with one that outputs to the specified port, and
+  resume whatever was playing at the same position. This is the 
+  fallback when the existing stream can't simply be rewired. The 
+  stream is swapped under the write lock, so nothing is using the old
+  one when it is closed. Its event queue is disposed of after the lock
+  is released, because the event thread may be waiting for the stream
+  to play the next item. Returns FALSE, leaving the old stream, if a 
+  new one can't be created. Otherwise 'resumed' is set FALSE, with an
+  error message, if what was playing could not be resumed
+
+==========================================================================*/
+static BOOL xine_interface_reopen_stream (XineInterface *self, 
+       xine_audio_port_t *ao_port, BOOL *resumed, char **error)
+  {
+  LOG_IN
+  *resumed = TRUE;
+  xine_stream_t *stream = xine_stream_new (self->xine, ao_port, NULL);
+  if (!stream)
+    {
+    log_error ("%s: Can't create Xine stream", __PRETTY_FUNCTION__);
+    if (error) asprintf (error, "Can't create Xine stream");
+    LOG_OUT
+    return FALSE;
+    }
+  xine_set_param (stream, XINE_PARAM_IGNORE_VIDEO, 1);
+
+  pthread_rwlock_wrlock (&self->stream_lock);
+  xine_stream_t *old_stream = self->stream;
+  xine_event_queue_t *old_queue = self->event_queue;
+  int pos_stream, pos_time = 0, length;
+  BOOL paused = FALSE;
+  char *mrl = xine_interface_get_mrl (self);
+  if (mrl)
+    {
+    xine_get_pos_length (old_stream, &pos_stream, &pos_time, &length);
+    paused = (xine_get_param (old_stream, XINE_PARAM_SPEED) 
+      == XINE_SPEED_PAUSE);
+    }
+  xine_set_param (stream, XINE_PARAM_AUDIO_VOLUME, 
+    xine_get_param (old_stream, XINE_PARAM_AUDIO_VOLUME));
+  xine_set_param (stream, XINE_PARAM_AUDIO_AMP_LEVEL, 
+    xine_get_param (old_stream, XINE_PARAM_AUDIO_AMP_LEVEL));
+  for (int i = 0; i < 10; i++) 
+    xine_set_param (stream, XINE_PARAM_EQ_30HZ + i, 
+      xine_get_param (old_stream, XINE_PARAM_EQ_30HZ + i));
+  xine_close (old_stream);
+  self->event_queue = xine_event_new_queue (stream);
+  xine_event_create_listener_thread (self->event_queue, 
+	xine_interface_event_listener, self);
+
+  if (mrl)
+    {
+    log_debug ("%s: resuming %s at %d msec", __PRETTY_FUNCTION__, 
+      mrl, pos_time);
+    if (xine_open (stream, mrl) && xine_play (stream, 0, pos_time))
+      {
+      if (paused)
+        xine_set_param (stream, XINE_PARAM_SPEED, XINE_SPEED_PAUSE);
+      }
+    else
+      {
+      log_warning ("Can't resume %s on new audio driver", mrl);
+      if (error) asprintf (error, "Can't resume %s on new audio driver", 
+        mrl);
+      self->playback_started = FALSE;
+      *resumed = FALSE;
+      }
+    free (mrl);
+    }
+  self->stream = stream;
+  pthread_rwlock_unlock (&self->stream_lock);
+
+  xine_event_dispose_queue (old_queue);
+  xine_dispose (old_stream);
+  LOG_OUT
+  return TRUE;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_set_driver
+
+  Switch to a different audio driver without stopping playback. The
+  new port is opened first, so a failure leaves the old one in place. 
+  The stream's audio output is then rewired to the new port; if that 
+  is not possible, the stream is reopened at the current position. 
+  'usec' is set to the time between starting to switch and the new 
+  port being in use, and 'reopened' to TRUE if the fallback was used.
+  If 'reopened' is set, but the return is FALSE, the new driver is in
+  use, but what was playing could not be resumed
+
+==========================================================================*/
+BOOL xine_interface_set_driver (XineInterface *self, const char *driver,
+       int *usec, BOOL *reopened, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  *usec = 0;
+  *reopened = FALSE;
+  if (xine_interface_wait_ready (self, error))
+    {
+    int64_t t0 = xine_interface_usec ();
+    xine_audio_port_t *ao_port = xine_open_audio_driver 
+	(self->xine, driver, NULL);
+    if (ao_port && self->broadcasting 
+          && !broadcast_set_output (self->broadcast, ao_port))
+      {
+      // The stream stays wired to the broadcast, so reopening the
+      //  stream would not help
+      log_error ("%s: Can't rewire broadcast to %s", __PRETTY_FUNCTION__, 
+        driver);
+      if (error) asprintf (error, "Can't rewire broadcast to %s", driver);
+      xine_close_audio_driver (self->xine, ao_port);
+      }
+    else if (ao_port)
+      {
+      // The level meter outputs to the old port; a client that still
+      //  wants levels will put it back
+      xine_stream_t *stream = xine_interface_lock_stream (self);
+      xine_interface_release_tap (self, stream, TRUE);
+      BOOL rewired = self->broadcasting || xine_post_wire_audio_port 
+            (xine_get_audio_source (stream), ao_port);
+      xine_interface_unlock_stream (self);
+      xine_audio_port_t *old_port = self->ao_port;
+      BOOL resumed = TRUE;
+      if (self->broadcasting)
+        {
+        log_debug ("%s: rewired broadcast to %s", __PRETTY_FUNCTION__, 
+          driver);
+        }
+      else if (rewired)
+        {
+        log_debug ("%s: rewired stream to %s", __PRETTY_FUNCTION__, 
+          driver);
+        }
+      else
+        {
+        log_debug ("%s: can't rewire stream; reopening", 
+          __PRETTY_FUNCTION__);
+        *reopened = xine_interface_reopen_stream (self, ao_port, 
+          &resumed, error);
+        }
+      if (self->broadcasting || rewired || *reopened)
+        {
+        self->ao_port = ao_port;
+        *usec = (int)(xine_interface_usec () - t0);
+        if (old_port)
+          xine_close_audio_driver (self->xine, old_port);
+        if (self->driver) free (self->driver);
+        self->driver = strdup (driver);
+        log_info ("Switched audio driver to %s in %d usec", driver, *usec);
+        ret = resumed;
+        }
+      else
+        xine_close_audio_driver (self->xine, ao_port);
+      }
+    else
+      {
+      log_error ("%s: Can't open audio driver %s", __PRETTY_FUNCTION__, 
+        driver);
+      if (error) asprintf (error, "Can't open audio driver %s", driver);
+      }
+    }
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_get_mrl
+
+  Returns a copy of the MRL of the stream currently playing, or NULL
+  if nothing is. The caller must free the result.
+
+==========================================================================*/
+char *xine_interface_get_mrl (XineInterface *self)
+  {
+  LOG_IN
+  char *ret = NULL;
+  pthread_mutex_lock (&self->mrl_mutex);
+  if (self->playback_started && self->mrl)
+    ret = strdup (self->mrl);
+  pthread_mutex_unlock (&self->mrl_mutex);
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_set_speed_ppm
+
+  Nudge the playback rate away from normal speed by the specified number
+  of parts per million, using Xine's fine speed control. Zero restores
+  normal speed. This has no effect when paused, because a paused
+  stream must stay paused.
+
+==========================================================================*/
+void xine_interface_set_speed_ppm (XineInterface *self, int ppm)
+  {
+  LOG_IN
+  xine_stream_t *stream = xine_interface_lock_stream (self);
+  if (stream && self->playback_started)
+    {
+    if (xine_get_param (stream, XINE_PARAM_SPEED) != XINE_SPEED_PAUSE)
+      {
+      xine_set_param (stream, XINE_PARAM_FINE_SPEED, 
+        XINE_FINE_SPEED_NORMAL + 
+          (int)((int64_t)XINE_FINE_SPEED_NORMAL * ppm / 1000000));
+      }
+    }
+  xine_interface_unlock_stream (self);
+  LOG_OUT
+  }
+
+
+
+/*==========================================================================
+
+  xine_interface_probe_meta
+
+==========================================================================*/
+static char *xine_interface_probe_meta (xine_stream_t *stream, int key)
+  {
+  const char *value = xine_get_meta_info (stream, key);
+  if (value && value[0])
+    return strdup (value);
+  return NULL;
+  }
+
+
+/*==========================================================================
+
+  xine_interface_probe
+
+  Read the tags and length of an item, by opening it on a stream that
+  is never played. Any of the tags may be returned as NULL, if the item
+  does not have them; the caller must free the others. Waits for Xine 
+  to be initialized, if it is not
+
+==========================================================================*/
+BOOL xine_interface_probe (XineInterface *self, const char *mrl, 
+      char **title, char **artist, char **album, int *msec)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  *title = NULL;
+  *artist = NULL;
+  *album = NULL;
+  *msec = -1;
+  if (xine_interface_wait_ready (self, NULL))
+    {
+    pthread_mutex_lock (&self->probe_mutex);
+    if (!self->probe_stream)
+      self->probe_stream = xine_stream_new (self->xine, NULL, NULL);
+    if (self->probe_stream && xine_open (self->probe_stream, mrl))
+      {
+      *title = xine_interface_probe_meta (self->probe_stream, 
+        XINE_META_INFO_TITLE);
+      *artist = xine_interface_probe_meta (self->probe_stream, 
+        XINE_META_INFO_ARTIST);
+      *album = xine_interface_probe_meta (self->probe_stream, 
+        XINE_META_INFO_ALBUM);
+      int pos_stream, pos_time, length;
+      if (xine_get_pos_length (self->probe_stream, &pos_stream, &pos_time, 
+            &length))
+        *msec = length;
+      xine_close (self->probe_stream);
+      ret = TRUE;
+      }
+    else
+      log_debug ("%s: can't open %s", __PRETTY_FUNCTION__, mrl);
+    pthread_mutex_unlock (&self->probe_mutex);
+    }
+  LOG_OUT
+  return ret;
+  }
 
@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include "defs.h"
 #include "cmdproc.h"
+#include "string.h"
+#include "broadcast.h"
 #include "../../api/xine-server-api.h"
 
 struct _XineInterface;
@@ -20,11 +22,22 @@ typedef void (*XineInterfacePlaybackFinishedFn)(void *data);
 typedef void (*XineInterfaceProgressFn)(const char *message, 
          int percent, void *data);
 
+// Time for the volume to change from 0 to 100, or to fade in or out
+//  fully, in msec. Zero makes changes immediate
+#define XINE_INTERFACE_DEF_RAMP_MSEC 150
+
 BEGIN_DECLS
 
 XineInterface *xine_interface_create (const char *driver,
                    const char *config_file);
+XineInterface *xine_interface_create_zone (XineInterface *engine,
+                   const char *driver);
 BOOL           xine_interface_init (XineInterface *self,  char **error);
+void           xine_interface_init_async (XineInterface *self);
+BOOL           xine_interface_wait_ready (XineInterface *self, char **error);
+BOOL           xine_interface_has_failed (XineInterface *self);
+void           xine_interface_get_startup_stats (XineInterface *self, 
+                   String *s);
 void           xine_interface_destroy (XineInterface *self);
 void           xine_interface_set_playback_finished_fn (XineInterface *self,
                    XineInterfacePlaybackFinishedFn fn, void *data);
@@ -38,8 +51,36 @@ XSTransportStatus  xine_interface_get_transport_status
 void           xine_interface_resume (XineInterface *self);
 void           xine_interface_pause (XineInterface *self);
 void           xine_interface_set_volume (XineInterface *self, int volume);
-int            xine_interface_get_volume (const XineInterface *self);
-const char    *xine_interface_get_meta_info
+// Set before initialization. Zones take the setting of the engine
+//  interface they are created from
+void           xine_interface_set_ramp_msec (XineInterface *self, 
+                   int msec);
+int            xine_interface_get_volume (XineInterface *self);
+// Measurements a second made by the level meter, or zero to disable 
+//  it. Set before initialization. Zones take the setting of the engine
+//  interface they are created from
+void           xine_interface_set_levels_rate (XineInterface *self, 
+                   int rate);
+// Keep playing audio, rather than muting it, while the fine speed
+//  is away from normal. Set before initialization; it applies to the
+//  whole engine
+void           xine_interface_set_fine_speed_audio (XineInterface *self,
+                   BOOL enable);
+// Broadcast the audio to the network. Set before initialization, and
+//  only on the default zone. The broadcast must outlive the interface
+void           xine_interface_set_broadcast (XineInterface *self, 
+                   Broadcast *broadcast);
+// Get the latest audio levels. The level meter runs only while clients
+//  keep asking for levels, so the first call starts it, and returns 
+//  zero levels with seq zero
+BOOL           xine_interface_get_levels (XineInterface *self, 
+                   XSLevels *levels, char **error);
+// Set the gain, in dB, for loudness normalization of the next item 
+//  to play. It is applied by the amp, within its limits of silence and
+//  about +6 dB, when the item starts, and stays until it is changed
+void           xine_interface_set_gain (XineInterface *self, double db);
+// Returns a copy, which the caller must free
+char          *xine_interface_get_meta_info
                    (const XineInterface *self, int key);
 uint32_t       xine_interface_get_stream_info
                    (const XineInterface *self, int key);
@@ -49,7 +90,17 @@ BOOL           xine_interface_seek (XineInterface *self, int msec);
 const char *const *xine_interface_list_audio_drivers 
                    (const XineInterface *self);
 void           xine_interface_get_eq (const XineInterface *self, int eq[10]);
-void           xine_interface_set_eq (const XineInterface *self, int eq[10]);
+void           xine_interface_set_eq (XineInterface *self, int eq[10]);
+char          *xine_interface_get_mrl (XineInterface *self);
+const char    *xine_interface_get_driver (const XineInterface *self);
+// Returns FALSE, with 'reopened' set, if the driver was switched but
+//  what was playing could not be resumed
+BOOL           xine_interface_set_driver (XineInterface *self, 
+                   const char *driver, int *usec, BOOL *reopened,
+                   char **error);
+void           xine_interface_set_speed_ppm (XineInterface *self, int ppm);
+BOOL           xine_interface_probe (XineInterface *self, const char *mrl,
+                  char **title, char **artist, char **album, int *msec);
 
 // Position and length are in msec. If the stream is inbounded,
 // e.g., a radio stream, length is reported as zero. If nothing
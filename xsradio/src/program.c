@@ -37,6 +37,11 @@
 //   mouse click has landed
 #define SELECT_WINDOW_TOP 5
 
+// The shared memory segment of a server on this machine, if --shm was
+//   given. The status window is redrawn often, and reading the status
+//   from shared memory saves a connection each time
+static XSShm *program_shm = NULL;
+
 /*==========================================================================
 
   program_update_select_window 
@@ -114,7 +119,8 @@ static void program_update_status_window (const char *host, int port,
   XSMetaInfo *mi = NULL;
   if (ok)
     {
-    ok = xineserver_status (host, port, &status, &error_code, &error);
+    if (!(program_shm && xsshm_get_status (program_shm, &status)))
+      ok = xineserver_status (host, port, &status, &error_code, &error);
     }
   if (ok)
     {
@@ -756,6 +762,17 @@ int program_run (ProgramContext *context)
   if (!stream_file) stream_file = SHARE "/news_and_drama.gxsradio";
   const char *colour = program_context_get (context, "colour");
   if (!colour) colour = "green"; 
+  const char *shm = program_context_get (context, "shm");
+  if (shm)
+    {
+    char *error = NULL;
+    program_shm = xineserver_attach_shm (shm, &error);
+    if (!program_shm)
+      {
+      log_warning ("%s; using the network", error);
+      free (error);
+      }
+    }
 
   int error_code = 0;
   char *error = NULL;
@@ -793,6 +810,7 @@ int program_run (ProgramContext *context)
     free (error);
     }
 
+  xineserver_detach_shm (program_shm);
 
   LOG_OUT
   return 0;
@@ -115,6 +115,7 @@ BOOL program_context_parse_command_line (ProgramContext *self,
       {"streams", required_argument, NULL, 's'},
       {"port", required_argument, NULL, 'p'},
       {"colour", required_argument, NULL, 'c'},
+      {"shm", required_argument, NULL, 0},
       {0, 0, 0, 0}
     };
 
@@ -144,6 +145,8 @@ BOOL program_context_parse_command_line (ProgramContext *self,
            program_context_put (self, "streams", optarg); 
          else if (strcmp (long_options[option_index].name, "colour") == 0)
            program_context_put (self, "colour", optarg); 
+         else if (strcmp (long_options[option_index].name, "shm") == 0)
+           program_context_put (self, "shm", optarg); 
          else
            exit (-1);
          break;
@@ -29,6 +29,7 @@ void usage_show (FILE *fout, const char *argv0)
   fprintf (fout, "  -l,--log-level=N        log level, 0-5 (default 2)\n");
   fprintf (fout, "  -p,--port=N             server port (default %d)\n",
      XINESERVER_DEF_PORT);
+  fprintf (fout, "     --shm=name           server's shared memory status\n");
   fprintf (fout, "  -s,--streams=S          stream list file\n");
   }
 